@@ -0,0 +1,190 @@
+/*!
+ * \file app_groups.cpp
+ * \brief Applications defined on the server as groups of web modules for mooWApp
+ * \author Xavier ETCHEBER
+ */
+
+#include <iostream>
+#include <string>
+#include <map> // Applications
+#include <set> // Modules
+#include <vector> // Splited applications
+
+// Boost
+#include <boost/algorithm/string.hpp> // Split
+#include <boost/thread/locks.hpp> // Locks of mutex
+
+// mooWApp
+#include "global.h"
+#include "configuration.h"
+#include "db_access.h"
+#include "app_groups.h"
+
+using namespace std;
+
+/*!
+ * \fn bool AppGroups::load()
+ * \brief Load the applications stored in DB, or the ones of the configuration if the admin API never changed them.
+ *
+ * \return false if no application is defined.
+ */
+bool AppGroups::load() {
+  string strApps;
+  bool stored = (DBAccess::get().dbw_read(KEY_APPS, strApps) == DBW_FOUND);
+
+  boost::unique_lock<boost::shared_mutex> lock(mutex);
+  apps.clear();
+  moduleApps.clear();
+  if (stored) {
+    parse(strApps);
+  } else {
+    map<string, set<string> > &configApps = Config::get().APP_GROUPS;
+    for (map<string, set<string> >::iterator it = configApps.begin(); it != configApps.end(); it++) {
+      apps[it->first] = it->second;
+      for (set<string>::iterator itMod = (it->second).begin(); itMod != (it->second).end(); itMod++) {
+        moduleApps[*itMod] = it->first;
+      }
+    }
+  }
+  cout << "Applications loaded: " << apps.size() << (stored ? " (from DB)" : " (from configuration)") << endl;
+  return !apps.empty();
+}
+
+/*!
+ * \fn bool AppGroups::save()
+ * \brief Store the applications in DB, they replace the ones of the configuration at the next start.
+ *
+ * \return false on DB error.
+ */
+bool AppGroups::save() {
+  DBBatch batch;
+  {
+    boost::shared_lock<boost::shared_mutex> lock(mutex);
+    batch.remove(KEY_APPS);
+    batch.put(KEY_APPS, toString());
+  }
+  return DBAccess::get().dbw_write(batch);
+}
+
+/*!
+ * \fn string AppGroups::seriesOf(const string &module)
+ * \brief Give the series name of the application of a module.
+ *
+ * \param[in] module Web module. Ex: cal_web
+ * \return The application with APP_SERIES_PREFIX, empty if no application is defined or the module is excluded. Ex: @Calendar or @Others
+ */
+string AppGroups::seriesOf(const string &module) {
+  boost::shared_lock<boost::shared_mutex> lock(mutex);
+  if (apps.empty()) {
+    return "";
+  }
+  map<string, string>::const_iterator it = moduleApps.find(module);
+  if (it != moduleApps.end()) {
+    return APP_SERIES_PREFIX + it->second;
+  }
+  /// Excluded modules are not in the "Others" of the requests either
+  const string &excludeMod = Config::get().EXCLUDE_MOD;
+  if (!excludeMod.empty() && module.find(excludeMod) != string::npos) {
+    return "";
+  }
+  return string(1, APP_SERIES_PREFIX) + APP_OTHERS;
+}
+
+/*!
+ * \fn void AppGroups::list(map<string, set<string> > &apps)
+ * \brief Get the applications and their modules.
+ */
+void AppGroups::list(map<string, set<string> > &apps) {
+  boost::shared_lock<boost::shared_mutex> lock(mutex);
+  apps = this->apps;
+}
+
+/*!
+ * \fn bool AppGroups::setApp(const string &app, const set<string> &modules)
+ * \brief Create an application or replace its modules (a module leaves its previous application).
+ *
+ * \param[in] app Application. Ex: Calendar
+ * \param[in] modules Web modules of the application.
+ * \return false if the name of the application is not valid.
+ */
+bool AppGroups::setApp(const string &app, const set<string> &modules) {
+  if (app.empty() || app == APP_OTHERS || app.find_first_of("/:,") != string::npos) {
+    return false;
+  }
+  boost::unique_lock<boost::shared_mutex> lock(mutex);
+  set<string> &appModules = apps[app];
+  for (set<string>::iterator it = appModules.begin(); it != appModules.end(); it++) {
+    moduleApps.erase(*it);
+  }
+  appModules.clear();
+  for (set<string>::const_iterator it = modules.begin(); it != modules.end(); it++) {
+    if (it->empty()) continue;
+    map<string, string>::iterator itApp = moduleApps.find(*it);
+    if (itApp != moduleApps.end()) {
+      apps[itApp->second].erase(*it);
+    }
+    moduleApps[*it] = app;
+    appModules.insert(*it);
+  }
+  return true;
+}
+
+/*!
+ * \fn bool AppGroups::removeApp(const string &app)
+ * \brief Remove an application, its modules go to "Others".
+ *
+ * \return false if the application does not exist.
+ */
+bool AppGroups::removeApp(const string &app) {
+  boost::unique_lock<boost::shared_mutex> lock(mutex);
+  map<string, set<string> >::iterator it = apps.find(app);
+  if (it == apps.end()) {
+    return false;
+  }
+  for (set<string>::iterator itMod = (it->second).begin(); itMod != (it->second).end(); itMod++) {
+    moduleApps.erase(*itMod);
+  }
+  apps.erase(it);
+  return true;
+}
+
+/*!
+ * \fn void AppGroups::parse(const string &strApps)
+ * \brief Read the applications stored in DB. Ex: Calendar:cal_web,cal_ws/Mail:mail_web/
+ */
+void AppGroups::parse(const string &strApps) {
+  vector<string> vectApps;
+  boost::split(vectApps, strApps, boost::is_any_of("/"));
+  for (vector<string>::iterator it = vectApps.begin(); it != vectApps.end(); it++) {
+    size_t found = it->find(':');
+    if (found == string::npos || found == 0) continue;
+    string app = it->substr(0, found);
+    set<string> &appModules = apps[app];
+    string strModules = it->substr(found + 1);
+    vector<string> vectModules;
+    boost::split(vectModules, strModules, boost::is_any_of(","));
+    for (vector<string>::iterator itMod = vectModules.begin(); itMod != vectModules.end(); itMod++) {
+      if (itMod->empty()) continue;
+      appModules.insert(*itMod);
+      moduleApps[*itMod] = app;
+    }
+  }
+}
+
+/*!
+ * \fn string AppGroups::toString() const
+ * \brief Give the applications as stored in DB.
+ */
+string AppGroups::toString() const {
+  string strApps = "";
+  for (map<string, set<string> >::const_iterator it = apps.begin(); it != apps.end(); it++) {
+    strApps += it->first + ':';
+    for (set<string>::const_iterator itMod = (it->second).begin(); itMod != (it->second).end(); itMod++) {
+      strApps += (itMod == (it->second).begin() ? "" : ",") + *itMod;
+    }
+    strApps += '/';
+  }
+  return strApps;
+}
+
+AppGroups AppGroups::singleton;
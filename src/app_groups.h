@@ -0,0 +1,66 @@
+/*!
+ * \file app_groups.h
+ * \brief Applications defined on the server as groups of web modules for mooWApp
+ * \author Xavier ETCHEBER
+ */
+
+#ifndef MOOWAPP_STATS_APP_GROUPS_H_
+#define MOOWAPP_STATS_APP_GROUPS_H_
+
+#include <string>
+#include <map> // Applications
+#include <set> // Modules
+
+// Boost
+#include <boost/thread/shared_mutex.hpp> // Shared mutex
+
+#define APP_SERIES_PREFIX '@' //!< First char of the series of an application. Ex: @Calendar/w/1/2011-04-24
+#define APP_OTHERS "Others"   //!< Application of the modules in no application
+
+/*!
+ * \class AppGroups
+ * \brief Applications made of web modules, from the configuration (APP_GROUPS) or changed by the admin API
+ * and then stored in DB (KEY_APPS).
+ *
+ * The log readers count each visit of a module in the series of its application as well, "@Others" for the modules
+ * in no application, so that the "All" dashboard reads one series by application instead of every module.
+ * A change of the modules of an application applies to the visits read after it, the days already stored are summed up
+ * again from the modules by a background job of the server.
+ * Stored as "App:module,module/App:module/". Ex: Calendar:cal_web,cal_ws/Mail:mail_web/
+ */
+class AppGroups
+{
+public:
+  bool load();
+  bool save();
+  std::string seriesOf(const std::string &module);
+  void list(std::map<std::string, std::set<std::string> > &apps);
+  bool setApp(const std::string &app, const std::set<std::string> &modules);
+  bool removeApp(const std::string &app);
+
+  // Getter of singleton
+  static AppGroups &get() throw() {
+    return singleton;
+  }
+
+private:
+  static AppGroups singleton;
+  std::map<std::string, std::set<std::string> > apps; //!< Modules of each application
+  std::map<std::string, std::string> moduleApps;      //!< Application of each module
+  boost::shared_mutex mutex;  //!< Shared to find the application of a module, exclusive to change the applications
+
+  void parse(const std::string &strApps);
+  std::string toString() const;
+
+  /*!
+   * \fn AppGroups()
+   * \brief Constructor
+   */
+  AppGroups() {}
+
+  // Protection against copy -> Do not define these
+  AppGroups(const AppGroups&);
+  void operator=(const AppGroups&);
+};
+
+#endif // MOOWAPP_STATS_APP_GROUPS_H_
@@ -7,11 +7,13 @@
 #include <iostream>
 #include <string>
 #include <map> // Conf info
+#include <algorithm> // max
 #include <stdio.h> // fopen, fgets, fclose, sscanf
 
 // Boost
 #include <boost/algorithm/string.hpp> // Split
 #include <boost/lexical_cast.hpp> // lexical_cast
+#include <boost/thread/thread.hpp> // hardware_concurrency
 
 #include "global.h"
 #include "configuration.h"
@@ -24,18 +26,22 @@ void Config::trimInfo(string& s) {
   s.erase( s.find_last_not_of(whitespace) + 1U );
 }
 
-Config::Config(string cfgFile) {
+int Config::getIntInfo(map<string, string> &mapConf, const string &key, const int defaultValue) {
+  int val = defaultValue;
+  if (mapConf.find(key) != mapConf.end()) {
+    sscanf(mapConf[key].c_str(), "%d", &val);
+  }
+  return val;
+}
+
+bool Config::readFile(const string &cfgFile, map<string, string> &mapConf) {
   typedef string::size_type pos;
-  const string delimiter = "=", comment = "#", separator = "|";
+  const string delimiter = "=", comment = "#";
   const pos skip = delimiter.length();
   
-  map<string, string> mapConf;
-  
   FILE * pFile = fopen(cfgFile.c_str(), "rb");
   if (pFile == NULL) {
-    cerr << "Error opening configuration file: " << cfgFile << endl;
-    cerr << "Make sure there's one in the current directory." << endl;
-    throw;
+    return false;
   }
   
   char line[2048];
@@ -56,9 +62,120 @@ Config::Config(string cfgFile) {
     }
   }
   fclose (pFile);
+  return true;
+}
+
+RetentionDays Config::getRetentionInfo(map<string, string> &mapConf, const string &suffix, const RetentionDays &defaultValue) {
+  RetentionDays retention;
+  retention.minutes = max(0, getIntInfo(mapConf, "RETENTION_MINUTES"+suffix, defaultValue.minutes));
+  retention.details = max(0, getIntInfo(mapConf, "RETENTION_10MINUTES"+suffix, defaultValue.details));
+  retention.hours = max(0, getIntInfo(mapConf, "RETENTION_HOURS"+suffix, defaultValue.hours));
+  retention.days = max(0, getIntInfo(mapConf, "RETENTION_DAYS"+suffix, defaultValue.days));
+  /// A tier is summed up from the finer one : the finer one can not be kept longer
+  if (retention.days > 0 && (retention.hours == 0 || retention.hours > retention.days)) retention.hours = retention.days;
+  if (retention.hours > 0 && (retention.details == 0 || retention.details > retention.hours)) retention.details = retention.hours;
+  if (retention.details > 0 && (retention.minutes == 0 || retention.minutes > retention.details)) retention.minutes = retention.details;
+  return retention;
+}
+
+void Config::setRetention(map<string, string> &mapConf) {
+  /// DAYS_FOR_DETAILS is the former key of the 10 minutes retention
+  RetentionDays defaultRetention;
+  defaultRetention.details = getIntInfo(mapConf, "DAYS_FOR_DETAILS", defaultRetention.details);
+  defaultRetention = getRetentionInfo(mapConf, "", defaultRetention);
+  
+  map<string, RetentionDays> groupsRetention;
+  for(map<string, set<string> >::iterator it=FILTER_EXTENSION.begin(); it!=FILTER_EXTENSION.end(); it++) {
+    groupsRetention[it->first] = getRetentionInfo(mapConf, '.'+it->first, defaultRetention);
+  }
+  
+  boost::mutex::scoped_lock lock(retentionMutex);
+  RETENTION = defaultRetention;
+  RETENTION_GROUPS.swap(groupsRetention);
+}
+
+/*!
+ * \fn RetentionDays Config::retentionOf(const string &group)
+ * \brief Get the retention of a group of pages.
+ *
+ * \param[in] group Group of pages. Ex: w
+ */
+RetentionDays Config::retentionOf(const string &group) {
+  boost::mutex::scoped_lock lock(retentionMutex);
+  map<string, RetentionDays>::const_iterator it = RETENTION_GROUPS.find(group);
+  return (it != RETENTION_GROUPS.end()) ? it->second : RETENTION;
+}
+
+/*!
+ * \fn int Config::maxMinutesRetention()
+ * \brief Get the longest retention of the minutes stats among the groups of pages, kept forever excepted.
+ *
+ * \return Days, at least 1.
+ */
+int Config::maxMinutesRetention() {
+  boost::mutex::scoped_lock lock(retentionMutex);
+  int days = RETENTION.minutes;
+  for(map<string, RetentionDays>::const_iterator it=RETENTION_GROUPS.begin(); it!=RETENTION_GROUPS.end(); it++) {
+    days = max(days, (it->second).minutes);
+  }
+  return max(days, 1);
+}
+
+/*!
+ * \fn bool Config::minutesKeptForever()
+ * \brief Tell if the minutes stats of a group of pages are kept forever (no hot tier then).
+ */
+bool Config::minutesKeptForever() {
+  boost::mutex::scoped_lock lock(retentionMutex);
+  bool forever = (RETENTION.minutes == 0);
+  for(map<string, RetentionDays>::const_iterator it=RETENTION_GROUPS.begin(); it!=RETENTION_GROUPS.end(); it++) {
+    forever = forever || (it->second).minutes == 0;
+  }
+  return forever;
+}
+
+/*!
+ * \fn bool Config::reloadRetention()
+ * \brief Read the retention again from the configuration file, so that it is changed without restart.
+ *
+ * \return false if the file can not be opened, the retention is not changed.
+ */
+bool Config::reloadRetention() {
+  map<string, string> mapConf;
+  if (!readFile(cfgFile, mapConf)) {
+    cerr << "Error opening configuration file: " << cfgFile << ", retention not changed." << endl;
+    return false;
+  }
+  setRetention(mapConf);
+  return true;
+}
+
+Config::Config(string cfgFile) : cfgFile(cfgFile) {
+  const string separator = "|";
+  
+  map<string, string> mapConf;
+  
+  if (!readFile(cfgFile, mapConf)) {
+    cerr << "Error opening configuration file: " << cfgFile << endl;
+    cerr << "Make sure there's one in the current directory." << endl;
+    throw;
+  }
   
   DB_PATH   = (mapConf.find("DB_PATH") != mapConf.end()) ? mapConf["DB_PATH"] : "/data/";
   DB_NAME   = (mapConf.find("DB_NAME") != mapConf.end()) ? mapConf["DB_NAME"] : "storage.db";
+  DB_ENGINE = (mapConf.find("DB_ENGINE") != mapConf.end()) ? mapConf["DB_ENGINE"] : "berkeleydb";
+  DB_CACHE_SIZE = getIntInfo(mapConf, "DB_CACHE_SIZE", 0);
+  DB_CACHE_NB = getIntInfo(mapConf, "DB_CACHE_NB", 1);
+  if (DB_CACHE_NB < 1) DB_CACHE_NB = 1;
+  DB_PAGE_SIZE = getIntInfo(mapConf, "DB_PAGE_SIZE", 0);
+  DB_MMAP_SIZE = getIntInfo(mapConf, "DB_MMAP_SIZE", 0);
+  DB_LOG_BUFFER_SIZE = getIntInfo(mapConf, "DB_LOG_BUFFER_SIZE", 0);
+  DB_PARTITIONS = (mapConf.find("DB_PARTITIONS") != mapConf.end()) ? (mapConf["DB_PARTITIONS"] == "on") ? true : false : false;
+  DB_SNAPSHOT_READS = (mapConf.find("DB_SNAPSHOT_READS") != mapConf.end()) ? (mapConf["DB_SNAPSHOT_READS"] == "on") ? true : false : true;
+  DB_WARMUP_DAYS = getIntInfo(mapConf, "DB_WARMUP_DAYS", 0);
+  HOT_TIER = (mapConf.find("HOT_TIER") != mapConf.end()) ? (mapConf["HOT_TIER"] == "on") ? true : false : false;
+  HOT_TIER_CHECKPOINT_INTERVAL = getIntInfo(mapConf, "HOT_TIER_CHECKPOINT_INTERVAL", 60);
+  if (HOT_TIER_CHECKPOINT_INTERVAL < 1) HOT_TIER_CHECKPOINT_INTERVAL = 1;
   FILTER_PATH = (mapConf.find("FILTER_PATH") != mapConf.end()) ? mapConf["FILTER_PATH"] : ".";
   FILTER_SSL = (mapConf.find("FILTER_SSL") != mapConf.end()) ? mapConf["FILTER_SSL"] : "access.log";
   
@@ -80,9 +197,42 @@ Config::Config(string cfgFile) {
   FILTER_URL1 = (mapConf.find("FILTER_URL1") != mapConf.end()) ? mapConf["FILTER_URL1"] : " 200 ";
   FILTER_URL2 = (mapConf.find("FILTER_URL2") != mapConf.end()) ? mapConf["FILTER_URL2"] : " 302 ";
   FILTER_URL3 = (mapConf.find("FILTER_URL3") != mapConf.end()) ? mapConf["FILTER_URL3"] : " 404 ";
+  setRetention(mapConf);
   EXCLUDE_MOD = (mapConf.find("EXCLUDE_MOD") != mapConf.end()) ? mapConf["EXCLUDE_MOD"] : "_v0";
   
+  if (mapConf.find("APP_GROUPS") != mapConf.end() && !mapConf["APP_GROUPS"].empty()) {
+    set<string> setApps, setAppModules;
+    boost::split(setApps, mapConf["APP_GROUPS"], boost::is_any_of(separator));
+    for(it=setApps.begin(); it!=setApps.end(); it++) {
+      if (mapConf.find("APP_GROUP."+*it) != mapConf.end()) {
+        setAppModules.clear();
+        boost::split(setAppModules, mapConf["APP_GROUP."+*it], boost::is_any_of(separator));
+        APP_GROUPS.insert( pair<string, set<string> >(*it, setAppModules));
+      } else {
+        cerr << "Missing configuration for key=APP_GROUP." << *it << endl;
+      }
+    }
+  }
+  
   COMPRESSION = (mapConf.find("COMPRESSION") != mapConf.end()) ? (mapConf["COMPRESSION"] == "on") ? true : false : false;
+  COMPACTION = (mapConf.find("COMPACTION") != mapConf.end()) ? (mapConf["COMPACTION"] == "on") ? true : false : false;
+  COMPACTION_PAGES = getIntInfo(mapConf, "COMPACTION_PAGES", 100);
+  if (COMPACTION_PAGES < 1) COMPACTION_PAGES = 1;
+  COMPACTION_SLICE_INTERVAL = getIntInfo(mapConf, "COMPACTION_SLICE_INTERVAL", 5);
+  COMPACTION_PASS_INTERVAL = getIntInfo(mapConf, "COMPACTION_PASS_INTERVAL", 60);
+  WORKER_THREADS = getIntInfo(mapConf, "WORKER_THREADS", 0);
+  if (WORKER_THREADS < 1) WORKER_THREADS = boost::thread::hardware_concurrency();
+  if (WORKER_THREADS < 1) WORKER_THREADS = 1;
+  QUERY_THREADS = getIntInfo(mapConf, "QUERY_THREADS", 0);
+  if (QUERY_THREADS < 1) QUERY_THREADS = boost::thread::hardware_concurrency();
+  if (QUERY_THREADS < 1) QUERY_THREADS = 1;
+  QUERY_PARALLEL_THRESHOLD = getIntInfo(mapConf, "QUERY_PARALLEL_THRESHOLD", 2000);
+  if (QUERY_PARALLEL_THRESHOLD < 0) QUERY_PARALLEL_THRESHOLD = 0;
+  HTTP_GZIP = (mapConf.find("HTTP_GZIP") != mapConf.end()) ? (mapConf["HTTP_GZIP"] == "on") ? true : false : false;
+  HTTP_GZIP_MIN_SIZE = getIntInfo(mapConf, "HTTP_GZIP_MIN_SIZE", 2048);
+  if (HTTP_GZIP_MIN_SIZE < 0) HTTP_GZIP_MIN_SIZE = 0;
+  RESPONSE_CACHE_ENTRIES = getIntInfo(mapConf, "RESPONSE_CACHE_ENTRIES", 1000);
+  if (RESPONSE_CACHE_ENTRIES < 0) RESPONSE_CACHE_ENTRIES = 0;
   LISTENING_PORT = (mapConf.find("LISTENING_PORT") != mapConf.end()) ? mapConf["LISTENING_PORT"] : "9999";
   
   unsigned short logFileNb = 1;
@@ -106,6 +256,8 @@ Config::Config(string cfgFile) {
     sscanf(mapConf["LOGS_READ_INTERVAL"].c_str(), "%d", &val);
   }
   LOGS_READ_INTERVAL = val;
+  LOGS_BATCH_LINES = getIntInfo(mapConf, "LOGS_BATCH_LINES", 10000);
+  if (LOGS_BATCH_LINES < 1) LOGS_BATCH_LINES = 1;
 }
 
 Config Config::singleton;
\ No newline at end of file
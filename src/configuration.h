@@ -11,6 +11,22 @@
 #include <map> // Map of pages extensions
 #include <set> // Set of extensions
 
+// Boost
+#include <boost/thread/mutex.hpp> // Mutex of the retention
+
+/*!
+ * \struct RetentionDays
+ * \brief Days each tier of the stats of a group of pages is kept, 0 to keep it forever.
+ */
+struct RetentionDays {
+  int minutes; //!< Days of stats stored in 1 minute format
+  int details; //!< Days of stats stored in 10 minutes format
+  int hours;   //!< Days of stats stored in hour format
+  int days;    //!< Days of day totals (weeks and months totals are kept forever)
+
+  RetentionDays() : minutes(3), details(7), hours(31), days(0) {}
+};
+
 /*!
  * \class Config
  * \brief Configuration variables for the server.
@@ -21,6 +37,17 @@ class Config
 public:
   std::string DB_PATH; //!< PATH to db's folder
   std::string DB_NAME; //!< Name of db file
+  std::string DB_ENGINE; //!< Storage engine : berkeleydb or segments
+  int DB_CACHE_SIZE; //!< Size of the DB cache in MB (0 for BerkeleyDB default)
+  int DB_CACHE_NB; //!< Number of regions the DB cache is split into
+  int DB_PAGE_SIZE; //!< Page size in bytes of a newly created db file (0 for BerkeleyDB default)
+  int DB_MMAP_SIZE; //!< Max size in MB of a read-only db file to be mapped in memory instead of using the cache (0 for BerkeleyDB default)
+  int DB_LOG_BUFFER_SIZE; //!< Size of the DB log buffer in KB (0 for BerkeleyDB default)
+  bool DB_PARTITIONS; //!< Minutes and 10 minutes stats are stored in one db file per day and per tier
+  bool DB_SNAPSHOT_READS; //!< Requests read a snapshot of the DB (transactions and multi-version pages)
+  int DB_WARMUP_DAYS; //!< Days of stats loaded in the DB cache at startup (0 to disable)
+  bool HOT_TIER; //!< Minute stats of the last days of minutes retention are kept in memory instead of DB
+  int HOT_TIER_CHECKPOINT_INTERVAL; //!< in seconds
   
   std::string FILTER_PATH; //!< %PATH% of the log files to analyse for insertion
   std::string FILTER_SSL; //!< %NAME% of the log files to analyse for insertion
@@ -30,17 +57,31 @@ public:
   std::string FILTER_URL2; //!< Second string to search in (ssl_)access_log files
   std::string FILTER_URL3; //!< Third string to search in (ssl_)access_log files
   std::string EXCLUDE_MOD; //!< Substring of module to exclude from stats
+  std::map<std::string, std::set<std::string> > APP_GROUPS; //!< Modules of each application (until changed by the admin API)
   
   bool COMPRESSION;
+  bool COMPACTION; //!< Background compaction of the DB file
+  int COMPACTION_PAGES; //!< Max pages freed by a compaction slice
+  int COMPACTION_SLICE_INTERVAL; //!< in seconds, pause between two compaction slices
+  int COMPACTION_PASS_INTERVAL; //!< in minutes, pause between two full compaction passes
+  int WORKER_THREADS; //!< Threads of the pool shared by the background jobs (one by module at a time)
   int LOGS_READ_INTERVAL; //!< in seconds
+  int LOGS_BATCH_LINES; //!< Max log lines counted in memory before their visits are written in DB
   static const int LOGS_COMPRESSION_INTERVAL = 5; //!< in minutes
-  static const int DAYS_FOR_MINUTES_DETAILS = 3; //!< Days of non compressed stats stored in 1 minute format
-  static const int DAYS_FOR_DETAILS = 7; //!< Days of non compressed stats stored in 10 minutes format
-  static const int DAYS_FOR_HOURS_DETAILS = 31; //!< Days of non compressed stats stored in hour format
+  int QUERY_THREADS; //!< Threads of the pool sharing the lookups of the large stats requests
+  int QUERY_PARALLEL_THRESHOLD; //!< Lookups of a stats request from which they are shared by the query threads (0 to disable)
+  bool HTTP_GZIP; //!< Responses compressed for the clients accepting gzip
+  int HTTP_GZIP_MIN_SIZE; //!< in bytes, size of the responses from which they are compressed
+  int RESPONSE_CACHE_ENTRIES; //!< Max responses of the stats requests kept in memory (0 to disable)
   std::string LISTENING_PORT; //!< Server listening port
   unsigned short LOGS_FILE_NB; //!< Number of logs files
   std::map<unsigned short, std::pair<std::string, std::string> > LOGS_FILES_CONFIG; //!< Formats and paths of logs files
  
+  RetentionDays retentionOf(const std::string &group);
+  int maxMinutesRetention();
+  bool minutesKeptForever();
+  bool reloadRetention();
+ 
   // Getter of singleton
   static Config &get() throw() {
     return singleton;
@@ -48,6 +89,10 @@ public:
 
 private:
   static Config singleton;
+  std::string cfgFile; //!< Configuration file, read again for the retention
+  RetentionDays RETENTION; //!< Retention of the groups of pages without their own (RETENTION_MINUTES, ...)
+  std::map<std::string, RetentionDays> RETENTION_GROUPS; //!< Retention of each group of pages with its own (RETENTION_MINUTES.w, ...)
+  boost::mutex retentionMutex; //!< Mutex for the retention, changed at runtime
   
   /*!
    * \fn Config(std::string cfgFile = "configuration.ini")
@@ -64,6 +109,44 @@ private:
    * \param s The string to clean from whitespaces.
    */
   void trimInfo(std::string& s);
+
+  /*!
+   * \fn bool readFile(const std::string &cfgFile, std::map<std::string, std::string> &mapConf)
+   * \brief Read the keys and values of a configuration file.
+   *
+   * \param cfgFile The file to be used as configuration file.
+   * \param mapConf Map of the configuration keys and values.
+   * \return false if the file can not be opened.
+   */
+  bool readFile(const std::string &cfgFile, std::map<std::string, std::string> &mapConf);
+
+  /*!
+   * \fn void setRetention(std::map<std::string, std::string> &mapConf)
+   * \brief Set the retention of the tiers, by default and for each group of pages.
+   *
+   * \param mapConf Map of the configuration keys and values.
+   */
+  void setRetention(std::map<std::string, std::string> &mapConf);
+
+  /*!
+   * \fn RetentionDays getRetentionInfo(std::map<std::string, std::string> &mapConf, const std::string &suffix, const RetentionDays &defaultValue)
+   * \brief Return the retention of the keys with a suffix, a finer tier is never kept longer than a coarser one.
+   *
+   * \param mapConf Map of the configuration keys and values.
+   * \param suffix Suffix of the keys. Ex: ".w" for RETENTION_MINUTES.w
+   * \param defaultValue Retention of the keys not set.
+   */
+  RetentionDays getRetentionInfo(std::map<std::string, std::string> &mapConf, const std::string &suffix, const RetentionDays &defaultValue);
+  
+  /*!
+   * \fn int getIntInfo(std::map<std::string, std::string> &mapConf, const std::string &key, const int defaultValue)
+   * \brief Return the integer value of a configuration key or a default value if not set.
+   *
+   * \param mapConf Map of the configuration keys and values.
+   * \param key The configuration key.
+   * \param defaultValue Value returned if key is not set.
+   */
+  int getIntInfo(std::map<std::string, std::string> &mapConf, const std::string &key, const int defaultValue);
   
   // Protection against copy -> Do not define these
   Config(const Config&);
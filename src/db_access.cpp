@@ -0,0 +1,184 @@
+/*!
+ * \file db_access.cpp
+ * \brief Storage interface used to access DB functions
+ * \author Xavier ETCHEBER
+ */
+
+#include <string>
+#include <map> // Configuration, merge functions
+#include <set> // Configuration
+#include <stdio.h> // snprintf
+
+// Boost
+#include <boost/date_time/gregorian/gregorian.hpp> // ISO week
+
+// mooWApp
+#include "global.h"
+#include "configuration.h"
+#include "db_access.h"
+#include "db_access_berkeleydb.h"
+#include "db_access_segments.h"
+
+using namespace std;
+
+/*!
+ * \fn bool parseStatKey(const string &strKey, StatKey &statKey)
+ * \brief Split a stats key into its parts.
+ *
+ * \param[in] strKey Key to parse. Ex: module/w/1/2011-04-24/1503/sz/values
+ * \param[out] statKey Parts of the key.
+ * \return false if the key is not a stats key (Ex: modules).
+ */
+bool parseStatKey(const string &strKey, StatKey &statKey) {
+  /// Series is made of the 3 first parts : module/group/type
+  size_t pos = strKey.find('/');
+  if (pos == string::npos || pos == 0) return false;
+  pos = strKey.find('/', pos + 1);
+  if (pos == string::npos) return false;
+  pos = strKey.find('/', pos + 1);
+  if (pos == string::npos) return false;
+
+  /// Then a day as YYYY-MM-DD
+  size_t posDate = pos + 1;
+  if (strKey.size() < posDate + 10 || strKey[posDate + 4] != '-' || strKey[posDate + 7] != '-') return false;
+  for (size_t i = posDate; i < posDate + 10; i++) {
+    if (i == posDate + 4 || i == posDate + 7) continue;
+    if (strKey[i] < '0' || strKey[i] > '9') return false;
+  }
+  statKey.series = strKey.substr(0, pos);
+  statKey.date = strKey.substr(posDate, 10);
+  statKey.slot = "";
+  statKey.suffix = "";
+  statKey.tier = TIER_DAYS;
+
+  size_t posSlot = posDate + 10;
+  if (posSlot == strKey.size()) return true;
+  if (strKey[posSlot] != '/') return false;
+  posSlot++;
+
+  /// Then the time slot which size gives the tier : HH, HHm or HHMM
+  size_t posEnd = strKey.find('/', posSlot);
+  if (posEnd == string::npos) posEnd = strKey.size();
+  for (size_t i = posSlot; i < posEnd; i++) {
+    if (strKey[i] < '0' || strKey[i] > '9') return false;
+  }
+  switch (posEnd - posSlot) {
+    case 4: statKey.tier = TIER_MINUTES; break;
+    case 3: statKey.tier = TIER_10MINUTES; break;
+    case 2: statKey.tier = TIER_HOURS; break;
+    default: return false;
+  }
+  statKey.slot = strKey.substr(posSlot, posEnd - posSlot);
+  if (posEnd < strKey.size()) {
+    statKey.suffix = strKey.substr(posEnd + 1);
+  }
+  return true;
+}
+
+/*!
+ * \fn string isoWeek(const unsigned int year, const unsigned int month, const unsigned int day)
+ * \brief Give the ISO week of a day as written in the week totals keys.
+ *
+ * \param[in] year Year. Ex: 2011
+ * \param[in] month Month, from 1 to 12.
+ * \param[in] day Day of the month.
+ * \return The week, empty for an invalid day. Ex: 2011-W16
+ */
+string isoWeek(const unsigned int year, const unsigned int month, const unsigned int day) {
+  try {
+    boost::gregorian::date date(year, month, day);
+    /// The week belongs to the year of its Thursday. Ex: 2011-01-01 is in 2010-W52
+    boost::gregorian::date thursday = date + boost::gregorian::days(3 - (date.day_of_week().as_number() + 6) % 7);
+    char week[16];
+    snprintf(week, sizeof(week), "%04d-W%02d", (int) thursday.year(), date.week_number());
+    return week;
+  } catch(exception &e) {
+    return "";
+  }
+}
+
+/*!
+ * \fn size_t tierSlots(const DBTier tier, size_t &slotSize)
+ * \brief Give the number of counters of a tier read by dbw_read_counters and the size of its slot in the keys.
+ */
+size_t tierSlots(const DBTier tier, size_t &slotSize) {
+  switch (tier) {
+    case TIER_MINUTES:
+      slotSize = 4;
+      return DB_TIMES_MINUTES_SIZE;
+    case TIER_10MINUTES:
+      slotSize = 3;
+      return DB_TIMES_SIZE;
+    case TIER_HOURS:
+      slotSize = 2;
+      return DB_TIMES_HOURS_SIZE;
+    case TIER_DAYS:
+      slotSize = 2;
+      return 31;
+  }
+  slotSize = 0;
+  return 0;
+}
+
+/*!
+ * \fn int tierSlotIndex(const DBTier tier, const char *slot)
+ * \brief Give the index of a slot of a key in the counters of dbw_read_counters.
+ */
+int tierSlotIndex(const DBTier tier, const char *slot) {
+  size_t slotSize;
+  tierSlots(tier, slotSize);
+  for (size_t i = 0; i < slotSize; i++) {
+    if (slot[i] < '0' || slot[i] > '9') return -1;
+  }
+  int hour = (slot[0]-'0')*10 + (slot[1]-'0');
+  switch (tier) {
+    case TIER_MINUTES: {
+      int minute = (slot[2]-'0')*10 + (slot[3]-'0');
+      return (hour < 24 && minute < 60) ? hour*60 + minute : -1;
+    }
+    case TIER_10MINUTES: {
+      int minutes = slot[2]-'0';
+      return (hour < 24 && minutes < 6) ? hour*6 + minutes : -1;
+    }
+    case TIER_HOURS:
+      return (hour < 24) ? hour : -1;
+    case TIER_DAYS:
+      return (hour >= 1 && hour <= 31) ? hour - 1 : -1; // Day of the month
+  }
+  return -1;
+}
+
+/*!
+ * \fn static map<string, DBMergeFunc> &mergeFuncs()
+ * \brief Merge functions by name (built at the first use, the functions are registered during the static initialisation).
+ */
+static map<string, DBMergeFunc> &mergeFuncs() {
+  static map<string, DBMergeFunc> funcs;
+  return funcs;
+}
+
+bool registerMergeFunc(const string &name, DBMergeFunc merge) {
+  mergeFuncs()[name] = merge;
+  return true;
+}
+
+DBMergeFunc findMergeFunc(const string &name) {
+  map<string, DBMergeFunc>::iterator it = mergeFuncs().find(name);
+  return (it != mergeFuncs().end()) ? it->second : NULL;
+}
+
+string mergeFuncName(DBMergeFunc merge) {
+  for (map<string, DBMergeFunc>::iterator it = mergeFuncs().begin(); it != mergeFuncs().end(); it++) {
+    if (it->second == merge) {
+      return it->first;
+    }
+  }
+  return "";
+}
+
+DBAccess &DBAccess::get() throw() {
+  if (Config::get().DB_ENGINE == "segments") {
+    return DBAccessSegments::get();
+  }
+  return DBAccessBerkeley::get();
+}
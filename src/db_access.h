@@ -0,0 +1,267 @@
+/*!
+ * \file db_access.h
+ * \brief Storage interface used to access DB functions
+ * \author Xavier ETCHEBER
+ */
+
+#ifndef MOOWAPP_STATS_DB_ACCESS_H_
+#define MOOWAPP_STATS_DB_ACCESS_H_
+
+#include <string>
+#include <vector> // Vector of strings
+#include <utility> // Pair of key and value
+
+/*!
+ * \enum DBTier
+ * \brief Resolution of the stats stored in a key.
+ */
+enum DBTier {
+  TIER_MINUTES,   //!< Ex: module/w/1/2011-04-24/1503
+  TIER_10MINUTES, //!< Ex: module/w/1/2011-04-24/150
+  TIER_HOURS,     //!< Ex: module/w/1/2011-04-24/15
+  TIER_DAYS       //!< Ex: module/w/1/2011-04-24
+};
+
+/*!
+ * \struct StatKey
+ * \brief Parts of a stats key. Ex: module/w/1/2011-04-24/1503/sz/values
+ */
+struct StatKey {
+  std::string series; //!< module/group/type. Ex: module/w/1
+  std::string date;   //!< Day. Ex: 2011-04-24
+  std::string slot;   //!< Time slot in the day, empty for a day key. Ex: 1503
+  std::string suffix; //!< Anything after the time slot, empty for a counter. Ex: sz/values
+  DBTier tier;        //!< Resolution given by the size of the slot
+};
+
+/*!
+ * \fn bool parseStatKey(const std::string &strKey, StatKey &statKey)
+ * \brief Split a stats key into its parts.
+ *
+ * \param[in] strKey Key to parse.
+ * \param[out] statKey Parts of the key.
+ * \return false if the key is not a stats key (Ex: modules).
+ */
+bool parseStatKey(const std::string &strKey, StatKey &statKey);
+
+/*!
+ * \fn std::string isoWeek(const unsigned int year, const unsigned int month, const unsigned int day)
+ * \brief Give the ISO week of a day as written in the week totals keys (the year is the one of the Thursday of the week).
+ *
+ * \return The week, empty for an invalid day. Ex: 2011-W16
+ */
+std::string isoWeek(const unsigned int year, const unsigned int month, const unsigned int day);
+
+/*!
+ * \fn size_t tierSlots(const DBTier tier, size_t &slotSize)
+ * \brief Give the number of counters of a tier read by dbw_read_counters and the size of its slot in the keys.
+ *
+ * \param[in] tier Tier.
+ * \param[out] slotSize Size of the slot. Ex: 4 for 1503, 2 for the day of a month
+ * \return Number of counters by day (by month for the days tier).
+ */
+size_t tierSlots(const DBTier tier, size_t &slotSize);
+
+/*!
+ * \fn int tierSlotIndex(const DBTier tier, const char *slot)
+ * \brief Give the index of a slot of a key in the counters of dbw_read_counters.
+ *
+ * \param[in] tier Tier of the slot.
+ * \param[in] slot Slot of tierSlots() size. Ex: 1503 for a minute, 24 for the 24th day of a month
+ * \return Index, -1 if the slot is not valid.
+ */
+int tierSlotIndex(const DBTier tier, const char *slot);
+
+/*!
+ * \enum DBReadStatus
+ * \brief Result of a read in DB.
+ */
+enum DBReadStatus {
+  DBW_FOUND = 0,    //!< Key found, the value may be empty
+  DBW_NOTFOUND = 1, //!< Key does not exist
+  DBW_ERROR = -1    //!< DB error (already logged)
+};
+
+/*!
+ * \struct DBCompactProgress
+ * \brief Progress of the incremental compaction of the DB, kept by the caller between slices.
+ */
+struct DBCompactProgress {
+  std::string resumeKey;        //!< Key the next slice starts from (empty : beginning of the DB)
+  unsigned long passes;         //!< Full passes over the DB done
+  unsigned long slices;         //!< Slices done
+  unsigned long pagesExamined;  //!< Pages examined
+  unsigned long pagesFreed;     //!< Pages emptied by merging their keys into other pages
+  unsigned long pagesTruncated; //!< Pages given back to the file system
+  double fillFactor;            //!< Used space in the pages at the end of the last pass (-1 if unknown)
+
+  DBCompactProgress() : passes(0), slices(0), pagesExamined(0), pagesFreed(0), pagesTruncated(0), fillFactor(-1) {}
+};
+
+/*!
+ * \typedef DBMergeFunc
+ * \brief Function merging a value to add into the value stored in DB (empty if the key does not exist). Ex: RtSketch::mergeValue
+ */
+typedef void (*DBMergeFunc)(std::string &value, const std::string &delta);
+
+/*!
+ * \fn bool registerMergeFunc(const std::string &name, DBMergeFunc merge)
+ * \brief Name a merge function, so that an engine logging the deltas merged can replay them at open.
+ *
+ * \param[in] name Name stored with the deltas. Ex: rt_sketch
+ * \param[in] merge Function.
+ * \return true, to register the function in a static initialisation.
+ */
+bool registerMergeFunc(const std::string &name, DBMergeFunc merge);
+
+/*!
+ * \fn DBMergeFunc findMergeFunc(const std::string &name)
+ * \brief Give a merge function by its name, NULL if it is not registered.
+ */
+DBMergeFunc findMergeFunc(const std::string &name);
+
+/*!
+ * \fn std::string mergeFuncName(DBMergeFunc merge)
+ * \brief Give the name of a merge function, empty if it is not registered.
+ */
+std::string mergeFuncName(DBMergeFunc merge);
+
+/*!
+ * \struct DBBatch
+ * \brief Removes and puts written in DB at once by dbw_write.
+ */
+struct DBBatch {
+  std::vector<std::string> removes;                           //!< Keys to remove
+  std::vector<std::pair<std::string, std::string> > puts;     //!< Keys and values to put
+
+  void remove(const std::string &strKey) { removes.push_back(strKey); }
+  void put(const std::string &strKey, const std::string &strValue) { puts.push_back(std::make_pair(strKey, strValue)); }
+  bool empty() const { return removes.empty() && puts.empty(); }
+  void clear() { removes.clear(); puts.clear(); }
+};
+
+/*!
+ * \class DBAccess
+ * \brief Interface of the storage engines.
+ *
+ */
+class DBAccess
+{
+public:
+  virtual ~DBAccess() {}
+
+  virtual bool dbw_open(const std::string baseDir, const std::string dbFileName) = 0;
+  virtual std::string dbw_get(const std::string strKey, const int flags = 0) = 0;
+
+  /*!
+   * \fn int dbw_read(const std::string &strKey, std::string &value)
+   * \brief Read a value into a buffer owned by the caller : its memory is reused from one call to another.
+   *
+   * \param[in] strKey Key to read.
+   * \param[out] value Value of the key, cleared if the key is not found.
+   * \return A DBReadStatus.
+   */
+  virtual int dbw_read(const std::string &strKey, std::string &value) = 0;
+  /*!
+   * \fn int dbw_read_counters(const std::string &series, const std::string &strPeriod, const DBTier tier, std::vector<unsigned int> &counters)
+   * \brief Read every counter of a series for a day (minutes, 10 minutes or hours) or a month (days) in one range scan.
+   *
+   * \param[in] series Series. Ex: module/w/1
+   * \param[in] strPeriod Day for the time slots tiers (Ex: 2011-04-24), month for the days tier (Ex: 2011-04).
+   * \param[in] tier Tier to read.
+   * \param[out] counters One counter by slot : DB_TIMES_MINUTES_SIZE, DB_TIMES_SIZE, DB_TIMES_HOURS_SIZE or 31 days, 0 if not stored.
+   * \return A DBReadStatus, DBW_NOTFOUND if no counter of the range is stored.
+   */
+  virtual int dbw_read_counters(const std::string &series, const std::string &strPeriod, const DBTier tier, std::vector<unsigned int> &counters) = 0;
+  virtual int dbw_add(const std::string strKey, const std::string strValue) = 0;
+  virtual unsigned int dbw_increment(const std::string strKey, const unsigned int delta = 1) = 0;
+  virtual bool dbw_append(const std::string strKey, const std::string strValue, const char separator = ',') = 0;
+  /*!
+   * \fn bool dbw_merge(const std::string strKey, const std::string strValue, DBMergeFunc merge)
+   * \brief Atomically merge a value into the value stored in DB (the key is created if it does not exist).
+   *
+   * \param[in] strKey Key to update.
+   * \param[in] strValue Value to merge.
+   * \param[in] merge Function merging both values.
+   * \return false on error.
+   */
+  virtual bool dbw_merge(const std::string strKey, const std::string strValue, DBMergeFunc merge) = 0;
+  virtual void dbw_remove(const std::string strKey) = 0;
+
+  /*!
+   * \fn bool dbw_write(const DBBatch &batch)
+   * \brief Write a batch : removes first, then puts, in one transaction if the engine has them.
+   *
+   * \param[in] batch Removes and puts to write.
+   * \return false on error.
+   */
+  virtual bool dbw_write(const DBBatch &batch) = 0;
+  /*!
+   * \fn bool dbw_remove_day(const std::string strDay, const DBTier tier)
+   * \brief Remove at once all the stats of a day for one tier.
+   *
+   * \param[in] strDay Day to remove. Ex: 2011-04-24
+   * \param[in] tier Tier to remove.
+   * \return false if the engine can not do it, the keys have to be removed one by one.
+   */
+  virtual bool dbw_remove_day(const std::string strDay, const DBTier tier) = 0;
+
+  /*!
+   * \fn void dbw_begin_snapshot()
+   * \brief Make the next reads of the current thread see the DB at this point in time, without blocking writers.
+   * Calls can be nested, the snapshot is released by the last dbw_end_snapshot().
+   */
+  virtual void dbw_begin_snapshot() = 0;
+  virtual void dbw_end_snapshot() = 0;
+  /*!
+   * \fn bool dbw_in_snapshot()
+   * \brief Tell if the reads of the current thread are in a snapshot that the other threads can not share.
+   */
+  virtual bool dbw_in_snapshot() = 0;
+  virtual void dbw_flush() = 0;
+  virtual void dbw_compact() = 0;
+
+  /*!
+   * \fn bool dbw_compact_slice(DBCompactProgress &progress, const unsigned int maxPages)
+   * \brief Compact a slice of the DB, starting at the key where the previous slice stopped.
+   *
+   * \param[in, out] progress Progress of the compaction, updated with the slice.
+   * \param[in] maxPages Max number of pages to free in the slice.
+   * \return false on error.
+   */
+  virtual bool dbw_compact_slice(DBCompactProgress &progress, const unsigned int maxPages) = 0;
+  virtual unsigned long dbw_warmup(const std::vector<std::string> &prefixes) = 0;
+  virtual void dbw_close() = 0;
+  virtual void dbw_drop(const char *basedir) = 0;
+
+  /*!
+   * \fn static DBAccess &get()
+   * \brief Getter of the storage engine selected in configuration (DB_ENGINE).
+   */
+  static DBAccess &get() throw();
+};
+
+/*!
+ * \class DBSnapshot
+ * \brief Snapshot of the DB held by the current thread for the lifetime of the object.
+ *
+ */
+class DBSnapshot
+{
+public:
+  DBSnapshot(DBAccess &dbA) : dbA(dbA) {
+    dbA.dbw_begin_snapshot();
+  }
+  ~DBSnapshot() {
+    dbA.dbw_end_snapshot();
+  }
+
+private:
+  DBAccess &dbA;
+
+  // Protection against copy -> Do not define these
+  DBSnapshot(const DBSnapshot&);
+  void operator=(const DBSnapshot&);
+};
+
+#endif // MOOWAPP_STATS_DB_ACCESS_H_
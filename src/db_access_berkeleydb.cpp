@@ -7,17 +7,70 @@
 #include <string>
 #include <vector> // Vector of strings
 #include <stdint.h> // uint64_t
-#include <string.h> // memset
+#include <string.h> // memset, memcpy, memcmp
+#include <stdio.h> // sscanf
 #include <stdlib.h> // free
+#include <errno.h> // ENOENT
+#include <map> // Partitions
+
+// Boost
+#include <boost/thread/locks.hpp> // Locks of mutex
+#include <boost/thread/thread.hpp> // Sleep
+#include <boost/date_time/posix_time/posix_time.hpp> // Sleep duration
  
 // database
 #include <db_cxx.h>
 
+#include "global.h"
+#include "configuration.h"
 #include "db_access_berkeleydb.h"
 
 using namespace std;
 
+static thread_local DbTxn *snapshotTxn = NULL; //!< Snapshot transaction of the current thread
+static thread_local int snapshotDepth = 0;     //!< Number of nested snapshots of the current thread
+static const string PARTITIONS_MIGRATED_KEY = "bin/mwa.partitions"; //!< Key of the main db set once its minutes stats are moved to the partitions
+static const unsigned int PARTITIONS_MIGRATION_CHUNK = 1000;       //!< Keys moved between two scans of the main db
+
+/*!
+ * \fn static void commitTxn(DbTxn *&txn)
+ * \brief Commit a transaction (if any). The handle is reset first as it can not be aborted after a commit, even a failed one.
+ *
+ * \param[in,out] txn Transaction to commit, set to NULL.
+ */
+static void commitTxn(DbTxn *&txn) {
+  DbTxn *toCommit = txn;
+  txn = NULL;
+  if (toCommit != NULL) {
+    toCommit->commit(0);
+  }
+}
+
+/*!
+ * \fn static void keepDb(Db *db)
+ * \brief Deleter of the shared pointer on the main db : it is closed by dbw_close.
+ */
+static void keepDb(Db *db) {
+}
+
+/*!
+ * \fn static void closeDb(Db *db)
+ * \brief Deleter of the shared pointers on partitions : the db file is closed when the last user releases it.
+ */
+static void closeDb(Db *db) {
+  try {
+    db->close(0);
+  } catch(DbException &e) {
+    cerr << "Error closing database partition." << endl;
+    cerr << e.what() << endl;
+  }
+  delete db;
+}
+
 bool DBAccessBerkeley::dbw_open(const string baseDir, const string bdbFileName) {
+  /// Get config object for the environment tuning
+  Config &c = Config::get();
+  
   /// Setup the database environment
   u_int32_t env_flags =
     DB_CREATE     |   // If the environment does not exist, create it.
@@ -27,18 +80,53 @@ bool DBAccessBerkeley::dbw_open(const string baseDir, const string bdbFileName)
     DB_PRIVATE    |   // single process
     DB_THREAD;        // free-threaded (thread-safe)
   
+  /// Snapshot reads need transactions (and so logging) and multi-version pages
+  transactional = c.DB_SNAPSHOT_READS;
+  if (transactional) {
+    env_flags |=
+      DB_INIT_LOG   |   // Initialize logging
+      DB_INIT_TXN   |   // Initialize transactions
+      DB_RECOVER;       // Run recovery before opening
+  }
+  
   try {
-    DbEnv *env = new DbEnv(0);
+    env = new DbEnv(0);
+    
+    /// Tune the environment before opening it
+    if (c.DB_CACHE_SIZE > 0) {
+      env->set_cachesize(c.DB_CACHE_SIZE / 1024, (c.DB_CACHE_SIZE % 1024) * 1024 * 1024, c.DB_CACHE_NB);
+    }
+    if (c.DB_MMAP_SIZE > 0) {
+      env->set_mp_mmapsize((size_t) c.DB_MMAP_SIZE * 1024 * 1024);
+    }
+    if (c.DB_LOG_BUFFER_SIZE > 0) {
+      env->set_lg_bsize(c.DB_LOG_BUFFER_SIZE * 1024);
+    }
+    if (transactional) {
+      env->set_flags(DB_TXN_WRITE_NOSYNC, 1); // Commits are not synced to disk, dbw_flush does it
+      env->set_lk_detect(DB_LOCK_DEFAULT);    // Run deadlock detection on lock conflicts
+    }
+    
     env->open(baseDir.c_str(), env_flags, 0);
+    if (transactional) {
+      env->log_set_config(DB_LOG_AUTO_REMOVE, 1); // Remove log files no longer needed
+    }
     env->set_error_stream(&cerr); // Redirect debugging information to std::cerr
     
     /// Open the database
-    bdb = new Db(env, 0);
-    u_int32_t bdb_flags =
-      DB_CREATE     |   // If the bdb does not exist, create it.
-      DB_THREAD;        // free-threaded (thread-safe)
-    bdb->open(NULL, bdbFileName.c_str(), NULL, DB_BTREE, bdb_flags, 0);
+    bdb = openDb(bdbFileName, true);
+    mainDb = boost::shared_ptr<Db>(bdb, keepDb);
     cout << "DB " << baseDir << bdbFileName << " connected" << endl;
+    
+    /// Minutes and 10 minutes stats are stored in one db file per day and per tier
+    dbFileName = bdbFileName;
+    partitioned = c.DB_PARTITIONS;
+    if (partitioned) {
+      return migratePartitions();
+    }
+    /// Stats written without partitions will have to be moved if they are enabled again
+    Dbt key(const_cast<char*>(PARTITIONS_MIGRATED_KEY.data()), PARTITIONS_MIGRATED_KEY.size());
+    bdb->del(NULL, &key, 0);
     return true;
   }
   // DbException is not a subclass of std::exception, so we
@@ -54,59 +142,343 @@ bool DBAccessBerkeley::dbw_open(const string baseDir, const string bdbFileName)
   return false;
 }
 
-string DBAccessBerkeley::dbw_get(const string strKey, const int flags/* = 0 */) {
-  Dbt key(const_cast<char*>(strKey.data()), strKey.size());
+/*!
+ * \fn Db *DBAccessBerkeley::openDb(const string &fileName, const bool create)
+ * \brief Open a db file of the environment.
+ *
+ * \param[in] fileName Name of the db file.
+ * \param[in] create Create the db file if it does not exist.
+ * \return The db handle. DbException is thrown on error (ex: file not found and create false).
+ */
+Db *DBAccessBerkeley::openDb(const string &fileName, const bool create) {
+  Config &c = Config::get();
+  Db *db = new Db(env, 0);
+  if (c.DB_PAGE_SIZE > 0) {
+    db->set_pagesize(c.DB_PAGE_SIZE); // Only used if the db file is created
+  }
+  u_int32_t bdb_flags =
+    DB_THREAD;        // free-threaded (thread-safe)
+  if (create) {
+    bdb_flags |= DB_CREATE; // If the bdb does not exist, create it.
+  }
+  if (transactional) {
+    bdb_flags |=
+      DB_AUTO_COMMIT  | // Writes without explicit transaction are committed at once
+      DB_MULTIVERSION;  // Keep copies of pages for snapshot readers, writers do not wait for them
+  }
+  try {
+    db->open(NULL, fileName.c_str(), NULL, DB_BTREE, bdb_flags, 0);
+  } catch(DbException &e) {
+    db->close(0);
+    delete db;
+    throw;
+  }
+  return db;
+}
+
+/*!
+ * \fn string DBAccessBerkeley::partitionName(const string &strDay, const DBTier tier)
+ * \brief Give the db file holding a tier of a day. Ex: storage.db.2011-04-24.m
+ */
+string DBAccessBerkeley::partitionName(const string &strDay, const DBTier tier) {
+  return dbFileName + '.' + strDay + (tier == TIER_MINUTES ? ".m" : ".t");
+}
+
+/*!
+ * \fn boost::shared_ptr<Db> DBAccessBerkeley::getDb(const string &strKey, const bool create)
+ * \brief Give the db file where a key is stored : the partition of its day for minutes and 10 minutes stats, the main db otherwise.
+ *
+ * \param[in] strKey Key to be read or written.
+ * \param[in] create Open (and create) the partition if needed, else a missing partition gives a NULL pointer.
+ * \return The db handle, hold it for the duration of the operation.
+ */
+boost::shared_ptr<Db> DBAccessBerkeley::getDb(const string &strKey, const bool create) {
+  StatKey statKey;
+  if (!partitioned || !parseStatKey(strKey, statKey)
+      || (statKey.tier != TIER_MINUTES && statKey.tier != TIER_10MINUTES)) {
+    return mainDb;
+  }
+  string fileName = partitionName(statKey.date, statKey.tier);
+  map<string, boost::shared_ptr<Db> >::iterator it;
+  {
+    boost::shared_lock<boost::shared_mutex> lock(partitionsMutex);
+    it = partitions.find(fileName);
+    if (it != partitions.end() && (it->second || !create)) {
+      return it->second;
+    }
+  }
   
-  Dbt data;
-  if (flags == 0) {
-    data.set_flags(DB_DBT_USERMEM);
-    char value[VAL_MAX_VALUE_SIZE + 1];
-    data.set_data(value);
-    data.set_ulen(VAL_MAX_VALUE_SIZE + 1);
-  } else {  
-    memset(&data, 0, sizeof(data));
-    data.set_flags(DB_DBT_MALLOC);
+  /// First access to the partition : open it (a missing partition is remembered as a NULL pointer until it is created)
+  boost::unique_lock<boost::shared_mutex> lock(partitionsMutex);
+  it = partitions.find(fileName);
+  if (it != partitions.end() && (it->second || !create)) {
+    return it->second;
+  }
+  boost::shared_ptr<Db> db;
+  try {
+    db = boost::shared_ptr<Db>(openDb(fileName, create), closeDb);
+  } catch(DbException &e) {
+    if (create) {
+      cerr << "Error opening database partition: " << fileName << endl;
+      cerr << e.what() << endl;
+    }
   }
+  partitions[fileName] = db;
+  return db;
+}
 
+/*!
+ * \fn bool DBAccessBerkeley::migratePartitions()
+ * \brief Move the minutes and 10 minutes stats of the main db to the partitions of their day.
+ * Done once, when the partitions are enabled on a db written without them : else getDb would
+ * never read these stats again and the compression would never remove them.
+ * The keys are moved by chunks (written to the partition, then removed from the main db),
+ * an interrupted migration resumes at the next open.
+ *
+ * \return true if all the stats are in the partitions.
+ */
+bool DBAccessBerkeley::migratePartitions() {
+  string value;
+  if (dbw_read(PARTITIONS_MIGRATED_KEY, value) == DBW_FOUND) {
+    return true;
+  }
+  cout << "DB Moving the minutes stats to the partitions..." << endl;
+  unsigned long moved = 0;
+  string start;
+  Dbc *cursor = NULL;
+  Dbt key, data;
+  key.set_flags(DB_DBT_REALLOC);
+  data.set_flags(DB_DBT_REALLOC);
+  bool migrated = true;
   try {
-    /// Get value from DB
-    if (bdb->get(NULL, &key, &data, 0) != DB_NOTFOUND) {
-      string strRes((const char *)data.get_data(), data.get_size()-1);
-      if (flags != 0) {
-        free(data.get_data());
+    bool done = false;
+    while (!done && migrated) {
+      /// Read a chunk of keys to move, the cursor is closed before the writes
+      vector<pair<string, string> > chunk;
+      bdb->cursor(NULL, &cursor, 0);
+      int ret;
+      if (start.empty()) {
+        ret = cursor->get(&key, &data, DB_FIRST);
+      } else {
+        /// The smallest key after the last one scanned
+        key.set_data(realloc(key.get_data(), start.size()));
+        memcpy(key.get_data(), start.data(), start.size());
+        key.set_size(start.size());
+        ret = cursor->get(&key, &data, DB_SET_RANGE);
+      }
+      while (ret == 0 && chunk.size() < PARTITIONS_MIGRATION_CHUNK) {
+        string strKey((char *)key.get_data(), key.get_size());
+        StatKey statKey;
+        if (parseStatKey(strKey, statKey) && (statKey.tier == TIER_MINUTES || statKey.tier == TIER_10MINUTES)) {
+          chunk.push_back(make_pair(strKey, string((char *)data.get_data(), data.get_size())));
+        }
+        start = strKey + '\0';
+        ret = cursor->get(&key, &data, DB_NEXT);
       }
-      return strRes;
+      done = (ret != 0);
+      cursor->close();
+      cursor = NULL;
+      
+      /// Move the chunk
+      for (vector<pair<string, string> >::iterator it = chunk.begin(); it != chunk.end(); it++) {
+        boost::shared_ptr<Db> db = getDb(it->first, true);
+        if (!db) {
+          migrated = false;
+          break;
+        }
+        Dbt moveKey(const_cast<char*>(it->first.data()), it->first.size());
+        Dbt moveData(const_cast<char*>(it->second.data()), it->second.size());
+        db->put(NULL, &moveKey, &moveData, 0);
+        bdb->del(NULL, &moveKey, 0);
+      }
+      moved += chunk.size();
     }
-  } catch(DbMemoryException &e) {
-    /// DbMemoryException: If value is longer than DEFAULT length, re-try with flag for DB_DBT_MALLOC
-    if (flags == 0) {
-      return dbw_get(strKey, 1);
+    
+    if (!migrated) {
+      cerr << "DB Error opening a partition to move the minutes stats (" << moved << " keys moved)." << endl;
     } else {
-      cerr << "DB Error DbMemoryException on bdb->get(key=" << strKey << ") with DB_DBT_MALLOC set." << endl;
-      cerr << e.what() << endl;
+      Dbt markerKey(const_cast<char*>(PARTITIONS_MIGRATED_KEY.data()), PARTITIONS_MIGRATED_KEY.size());
+      Dbt markerData(const_cast<char*>("1"), 2);
+      bdb->put(NULL, &markerKey, &markerData, 0);
     }
-  } catch(DbDeadlockException &e) {
-    cerr << "DB Error DbDeadlockException on bdb->get(key=" << strKey << ")." << endl;
-    cerr << e.what() << endl;
-  } catch(DbLockNotGrantedException &e) {
-    cerr << "DB Error DbLockNotGrantedException on bdb->get(key=" << strKey << ")." << endl;
-    cerr << e.what() << endl;
-  } catch(DbRepHandleDeadException &e) {
-    cerr << "DB Error DbRepHandleDeadException on bdb->get(key=" << strKey << ")." << endl;
+  } catch(DbException &e) {
+    cerr << "DB Error DbException moving the minutes stats to the partitions (" << moved << " keys moved)." << endl;
     cerr << e.what() << endl;
+    if (cursor != NULL) {
+      cursor->close();
+    }
+    migrated = false;
+  }
+  free(key.get_data());
+  free(data.get_data());
+  if (migrated) {
+    cout << "DB " << moved << " minutes stats moved to the partitions" << endl;
+  }
+  return migrated;
+}
+
+string DBAccessBerkeley::dbw_get(const string strKey, const int flags/* = 0 */) {
+  string strRes;
+  dbw_read(strKey, strRes);
+  return strRes;
+}
+
+/*!
+ * \fn int DBAccessBerkeley::dbw_read(const string &strKey, string &value)
+ * \brief Read a value into a buffer owned by the caller.
+ * The C handle is used so that a value larger than the buffer is reported by DB_BUFFER_SMALL
+ * (with the size needed) instead of an exception : the buffer grows and the read is done again.
+ *
+ * \param[in] strKey Key to read.
+ * \param[out] value Value of the key, cleared if the key is not found.
+ * \return A DBReadStatus.
+ */
+int DBAccessBerkeley::dbw_read(const string &strKey, string &value) {
+  Dbt key(const_cast<char*>(strKey.data()), strKey.size());
+  boost::shared_ptr<Db> dbHandle = getDb(strKey, false);
+  if (!dbHandle) {
+    value.clear();
+    return DBW_NOTFOUND;
+  }
+  DB *db = dbHandle->get_DB();
+  DB_TXN *txn = (snapshotTxn != NULL) ? snapshotTxn->get_DB_TXN() : NULL;
+  
+  /// Values are stored with their ending '\0', use all the memory the buffer already has
+  if (value.capacity() < VAL_MAX_VALUE_SIZE + 1) {
+    value.reserve(VAL_MAX_VALUE_SIZE + 1);
+  }
+  value.resize(value.capacity());
+  
+  for (int retry = 0; retry < DBW_MAX_RETRY; retry++) {
+    Dbt data;
+    data.set_flags(DB_DBT_USERMEM);
+    data.set_data(&value[0]);
+    data.set_ulen(value.size());
+    
+    int ret = db->get(db, txn, key.get_DBT(), data.get_DBT(), 0);
+    switch (ret) {
+      case 0:
+        value.resize(data.get_size() > 0 ? data.get_size() - 1 : 0);
+        return DBW_FOUND;
+      case DB_NOTFOUND:
+      case DB_KEYEMPTY:
+        value.clear();
+        return DBW_NOTFOUND;
+      case DB_BUFFER_SMALL:
+        /// Size needed is given back in the Dbt
+        value.resize(data.get_size());
+        break;
+      case DB_LOCK_DEADLOCK:
+      case DB_LOCK_NOTGRANTED:
+        DEBUG_LOGS_FUNC("DB deadlock on get(key=" << strKey << "), retry #" << retry);
+        break;
+      default:
+        cerr << "DB Error on bdb->get(key=" << strKey << "): " << db_strerror(ret) << endl;
+        value.clear();
+        return DBW_ERROR;
+    }
+  }
+  cerr << "DB Error on bdb->get(key=" << strKey << "): too many retries." << endl;
+  value.clear();
+  return DBW_ERROR;
+}
+
+/*!
+ * \fn int DBAccessBerkeley::dbw_read_counters(const string &series, const string &strPeriod, const DBTier tier, vector<unsigned int> &counters)
+ * \brief Read every counter of a series for a day or a month with one cursor.
+ * The keys of the range are read without their value, the value is only read for the keys of the tier.
+ * A key of a finer tier or with a suffix makes the cursor jump to the next slot, so that the minutes
+ * stored between two hours are not walked through.
+ *
+ * \param[in] series Series. Ex: module/w/1
+ * \param[in] strPeriod Day for the time slots tiers (Ex: 2011-04-24), month for the days tier (Ex: 2011-04).
+ * \param[in] tier Tier to read.
+ * \param[out] counters One counter by slot, 0 if not stored.
+ * \return A DBReadStatus.
+ */
+int DBAccessBerkeley::dbw_read_counters(const string &series, const string &strPeriod, const DBTier tier, vector<unsigned int> &counters) {
+  size_t slotSize;
+  counters.assign(tierSlots(tier, slotSize), 0);
+  string prefix = series + '/' + strPeriod + (tier == TIER_DAYS ? '-' : '/');
+  if (prefix.size() + slotSize > KEY_MAX_SIZE) {
+    return DBW_NOTFOUND;
+  }
+  boost::shared_ptr<Db> dbHandle = getDb(prefix + string(slotSize, '0'), false);
+  if (!dbHandle) {
+    return DBW_NOTFOUND;
+  }
+  
+  int status = DBW_NOTFOUND;
+  Dbc *cursor = NULL;
+  try {
+    dbHandle->cursor(snapshotTxn, &cursor, 0);
+    
+    char keyBuffer[KEY_MAX_SIZE];
+    char valueBuffer[VAL_MAX_VALUE_SIZE + 1];
+    Dbt key, data, skip;
+    key.set_flags(DB_DBT_USERMEM);
+    key.set_data(keyBuffer);
+    key.set_ulen(KEY_MAX_SIZE);
+    data.set_flags(DB_DBT_USERMEM);
+    data.set_data(valueBuffer);
+    data.set_ulen(VAL_MAX_VALUE_SIZE);
+    /// Values of the keys walked through are not read (DB_THREAD needs a memory flag on every DBT returned)
+    skip.set_flags(DB_DBT_USERMEM | DB_DBT_PARTIAL);
+    skip.set_data(valueBuffer);
+    skip.set_ulen(0);
+    skip.set_doff(0);
+    skip.set_dlen(0);
+    
+    memcpy(keyBuffer, prefix.data(), prefix.size());
+    key.set_size(prefix.size());
+    int ret = cursor->get(&key, &skip, DB_SET_RANGE);
+    while (ret == 0 && key.get_size() >= prefix.size() && memcmp(keyBuffer, prefix.data(), prefix.size()) == 0) {
+      size_t remain = key.get_size() - prefix.size();
+      if (remain == slotSize) {
+        int slot = tierSlotIndex(tier, keyBuffer + prefix.size());
+        int retValue = DB_NOTFOUND;
+        try {
+          if (slot >= 0) retValue = cursor->get(&key, &data, DB_CURRENT);
+        } catch(DbMemoryException &e) {
+          /// Value too large for a counter : this key is skipped, not the whole range
+          cerr << "DB Error value too large for a counter: " << string(keyBuffer, key.get_size()) << endl;
+        }
+        if (retValue == 0) {
+          valueBuffer[data.get_size() < VAL_MAX_VALUE_SIZE ? data.get_size() : VAL_MAX_VALUE_SIZE] = '\0';
+          sscanf(valueBuffer, "%u", &counters[slot]);
+          status = DBW_FOUND;
+        }
+        ret = cursor->get(&key, &skip, DB_NEXT);
+      } else if (remain > slotSize) {
+        /// Jump over the keys starting with this slot
+        keyBuffer[prefix.size() + slotSize - 1]++;
+        key.set_size(prefix.size() + slotSize);
+        ret = cursor->get(&key, &skip, DB_SET_RANGE);
+      } else {
+        ret = cursor->get(&key, &skip, DB_NEXT);
+      }
+    }
+    cursor->close();
   } catch(DbException &e) {
-    cerr << "DB Error DbException on bdb->get(key=" << strKey << ")." << endl;
+    if (cursor != NULL) cursor->close();
+    cerr << "DB Error DbException on read of counters " << prefix << endl;
     cerr << e.what() << endl;
+    return DBW_ERROR;
   }
-  return "";
+  return status;
 }
 
 int DBAccessBerkeley::dbw_add(const string strKey, const string strValue) { 
   Dbt key(const_cast<char*>(strKey.data()), strKey.size());
   Dbt data(const_cast<char*>(strValue.data()), strValue.size()+1);
   
+  boost::shared_ptr<Db> db = getDb(strKey, true);
+  if (!db) {
+    return false;
+  }
+  
   try {
-    if (bdb->put(NULL, &key, &data, 0) == 0) {
+    if (db->put(NULL, &key, &data, 0) == 0) {
       return true;
     }
   } catch(DbDeadlockException &e) {
@@ -125,10 +497,284 @@ int DBAccessBerkeley::dbw_add(const string strKey, const string strValue) {
   return false;
 }
 
+/*!
+ * \fn unsigned int DBAccessBerkeley::dbw_increment(const string strKey, const unsigned int delta)
+ * \brief Atomically add delta to a counter stored in DB (the key is created if it does not exist).
+ *
+ * The read and the write are done with the same cursor opened with DB_RMW, so the write lock
+ * is taken at read time and no concurrent increment can be lost between both.
+ *
+ * \param[in] strKey Key of the counter.
+ * \param[in] delta Value to add to the counter.
+ * \return The new value of the counter, 0 on error.
+ */
+unsigned int DBAccessBerkeley::dbw_increment(const string strKey, const unsigned int delta/* = 1 */) {
+  Dbt key(const_cast<char*>(strKey.data()), strKey.size());
+  char value[VAL_MAX_VALUE_SIZE + 1];
+  string newVal;
+  boost::shared_ptr<Db> db = getDb(strKey, true);
+  if (!db) {
+    return 0;
+  }
+  
+  for (int retry = 0; retry < DBW_MAX_RETRY; retry++) {
+    Dbc *cursor = NULL;
+    DbTxn *txn = NULL;
+    try {
+      Dbt data;
+      data.set_flags(DB_DBT_USERMEM);
+      data.set_data(value);
+      data.set_ulen(VAL_MAX_VALUE_SIZE + 1);
+      
+      unsigned int iVal = delta;
+      txn = beginTxn();
+      db->cursor(txn, &cursor, 0);
+      if (cursor->get(&key, &data, DB_SET | DB_RMW) == 0) {
+        /// Key already exists : update it in place while holding the write lock
+        iVal += stringToInt(string((const char *)data.get_data(), data.get_size()-1));
+        newVal.clear();
+        intToString(newVal, iVal);
+        Dbt newData(const_cast<char*>(newVal.data()), newVal.size()+1);
+        cursor->put(&key, &newData, DB_CURRENT);
+        cursor->close();
+        cursor = NULL;
+        commitTxn(txn);
+        return iVal;
+      }
+      cursor->close();
+      cursor = NULL;
+      
+      /// Key not found : insert it, unless an other thread did it in between (then retry)
+      newVal.clear();
+      intToString(newVal, iVal);
+      Dbt newData(const_cast<char*>(newVal.data()), newVal.size()+1);
+      int ret = db->put(txn, &key, &newData, DB_NOOVERWRITE);
+      commitTxn(txn);
+      if (ret == 0) {
+        return iVal;
+      }
+    } catch(DbDeadlockException &e) {
+      if (cursor != NULL) cursor->close();
+      if (txn != NULL) txn->abort();
+      DEBUG_LOGS_FUNC("DB DbDeadlockException on increment(key=" << strKey << "), retry #" << retry);
+    } catch(DbLockNotGrantedException &e) {
+      if (cursor != NULL) cursor->close();
+      if (txn != NULL) txn->abort();
+      DEBUG_LOGS_FUNC("DB DbLockNotGrantedException on increment(key=" << strKey << "), retry #" << retry);
+    } catch(DbException &e) {
+      if (cursor != NULL) cursor->close();
+      if (txn != NULL) txn->abort();
+      cerr << "DB Error DbException on increment(key=" << strKey << ")." << endl;
+      cerr << e.what() << endl;
+      return 0;
+    }
+  }
+  cerr << "DB Error on increment(key=" << strKey << "): too many retries." << endl;
+  return 0;
+}
+
+/*!
+ * \fn bool DBAccessBerkeley::dbw_append(const string strKey, const string strValue, const char separator)
+ * \brief Atomically append a value to a list of values stored in DB (the key is created if it does not exist).
+ *
+ * \param[in] strKey Key of the list.
+ * \param[in] strValue Value to append.
+ * \param[in] separator Separator between values of the list.
+ * \return true if the value was appended, false otherwise.
+ */
+bool DBAccessBerkeley::dbw_append(const string strKey, const string strValue, const char separator/* = ',' */) {
+  Dbt key(const_cast<char*>(strKey.data()), strKey.size());
+  string newVal;
+  boost::shared_ptr<Db> db = getDb(strKey, true);
+  if (!db) {
+    return false;
+  }
+  
+  for (int retry = 0; retry < DBW_MAX_RETRY; retry++) {
+    Dbc *cursor = NULL;
+    DbTxn *txn = NULL;
+    try {
+      /// Lists can be long, let BerkeleyDB allocate the value
+      Dbt data;
+      data.set_flags(DB_DBT_MALLOC);
+      
+      txn = beginTxn();
+      db->cursor(txn, &cursor, 0);
+      if (cursor->get(&key, &data, DB_SET | DB_RMW) == 0) {
+        newVal.assign((const char *)data.get_data(), data.get_size()-1);
+        free(data.get_data());
+        newVal += separator;
+        newVal += strValue;
+        Dbt newData(const_cast<char*>(newVal.data()), newVal.size()+1);
+        cursor->put(&key, &newData, DB_CURRENT);
+        cursor->close();
+        cursor = NULL;
+        commitTxn(txn);
+        return true;
+      }
+      cursor->close();
+      cursor = NULL;
+      
+      Dbt newData(const_cast<char*>(strValue.data()), strValue.size()+1);
+      int ret = db->put(txn, &key, &newData, DB_NOOVERWRITE);
+      commitTxn(txn);
+      if (ret == 0) {
+        return true;
+      }
+    } catch(DbDeadlockException &e) {
+      if (cursor != NULL) cursor->close();
+      if (txn != NULL) txn->abort();
+      DEBUG_LOGS_FUNC("DB DbDeadlockException on append(key=" << strKey << "), retry #" << retry);
+    } catch(DbLockNotGrantedException &e) {
+      if (cursor != NULL) cursor->close();
+      if (txn != NULL) txn->abort();
+      DEBUG_LOGS_FUNC("DB DbLockNotGrantedException on append(key=" << strKey << "), retry #" << retry);
+    } catch(DbException &e) {
+      if (cursor != NULL) cursor->close();
+      if (txn != NULL) txn->abort();
+      cerr << "DB Error DbException on append(key=" << strKey << ", value=" << strValue << ")." << endl;
+      cerr << e.what() << endl;
+      return false;
+    }
+  }
+  cerr << "DB Error on append(key=" << strKey << "): too many retries." << endl;
+  return false;
+}
+
+/*!
+ * \fn bool DBAccessBerkeley::dbw_merge(const string strKey, const string strValue, DBMergeFunc merge)
+ * \brief Atomically merge a value into the value stored in DB (the key is created if it does not exist).
+ * The read and the write are done with the same cursor opened with DB_RMW, as for dbw_append.
+ *
+ * \param[in] strKey Key to update.
+ * \param[in] strValue Value to merge.
+ * \param[in] merge Function merging both values.
+ * \return true if the value was merged, false otherwise.
+ */
+bool DBAccessBerkeley::dbw_merge(const string strKey, const string strValue, DBMergeFunc merge) {
+  Dbt key(const_cast<char*>(strKey.data()), strKey.size());
+  string newVal;
+  boost::shared_ptr<Db> db = getDb(strKey, true);
+  if (!db) {
+    return false;
+  }
+  
+  for (int retry = 0; retry < DBW_MAX_RETRY; retry++) {
+    Dbc *cursor = NULL;
+    DbTxn *txn = NULL;
+    try {
+      Dbt data;
+      data.set_flags(DB_DBT_MALLOC);
+      
+      txn = beginTxn();
+      db->cursor(txn, &cursor, 0);
+      if (cursor->get(&key, &data, DB_SET | DB_RMW) == 0) {
+        newVal.assign((const char *)data.get_data(), data.get_size()-1);
+        free(data.get_data());
+        merge(newVal, strValue);
+        Dbt newData(const_cast<char*>(newVal.data()), newVal.size()+1);
+        cursor->put(&key, &newData, DB_CURRENT);
+        cursor->close();
+        cursor = NULL;
+        commitTxn(txn);
+        return true;
+      }
+      cursor->close();
+      cursor = NULL;
+      
+      newVal.clear();
+      merge(newVal, strValue);
+      Dbt newData(const_cast<char*>(newVal.data()), newVal.size()+1);
+      int ret = db->put(txn, &key, &newData, DB_NOOVERWRITE);
+      commitTxn(txn);
+      if (ret == 0) {
+        return true;
+      }
+    } catch(DbDeadlockException &e) {
+      if (cursor != NULL) cursor->close();
+      if (txn != NULL) txn->abort();
+      DEBUG_LOGS_FUNC("DB DbDeadlockException on merge(key=" << strKey << "), retry #" << retry);
+    } catch(DbLockNotGrantedException &e) {
+      if (cursor != NULL) cursor->close();
+      if (txn != NULL) txn->abort();
+      DEBUG_LOGS_FUNC("DB DbLockNotGrantedException on merge(key=" << strKey << "), retry #" << retry);
+    } catch(DbException &e) {
+      if (cursor != NULL) cursor->close();
+      if (txn != NULL) txn->abort();
+      cerr << "DB Error DbException on merge(key=" << strKey << ")." << endl;
+      cerr << e.what() << endl;
+      return false;
+    }
+  }
+  cerr << "DB Error on merge(key=" << strKey << "): too many retries." << endl;
+  return false;
+}
+
+/*!
+ * \fn DbTxn *DBAccessBerkeley::beginTxn(const u_int32_t flags)
+ * \brief Begin a transaction if the environment is transactional.
+ *
+ * \param[in] flags Flags of the transaction.
+ * \return The transaction, or NULL if the environment is not transactional.
+ */
+DbTxn *DBAccessBerkeley::beginTxn(const u_int32_t flags/* = 0 */) {
+  DbTxn *txn = NULL;
+  if (transactional) {
+    env->txn_begin(NULL, &txn, flags);
+  }
+  return txn;
+}
+
+/*!
+ * \fn void DBAccessBerkeley::dbw_begin_snapshot()
+ * \brief Make the next reads of the current thread see the DB as it is now, without locking pages.
+ */
+void DBAccessBerkeley::dbw_begin_snapshot() {
+  if (snapshotDepth++ > 0 || !transactional) {
+    return;
+  }
+  try {
+    snapshotTxn = beginTxn(DB_TXN_SNAPSHOT);
+  } catch(DbException &e) {
+    cerr << "DB Error DbException on txn_begin(DB_TXN_SNAPSHOT)." << endl;
+    cerr << e.what() << endl;
+    snapshotTxn = NULL;
+  }
+}
+
+/*!
+ * \fn void DBAccessBerkeley::dbw_end_snapshot()
+ * \brief Release the snapshot of the current thread.
+ */
+void DBAccessBerkeley::dbw_end_snapshot() {
+  if (snapshotDepth == 0 || --snapshotDepth > 0 || snapshotTxn == NULL) {
+    return;
+  }
+  try {
+    snapshotTxn->commit(0);
+  } catch(DbException &e) {
+    cerr << "DB Error DbException on snapshot commit." << endl;
+    cerr << e.what() << endl;
+  }
+  snapshotTxn = NULL;
+}
+
+/*!
+ * \fn bool DBAccessBerkeley::dbw_in_snapshot()
+ * \brief Tell if the current thread holds a snapshot transaction : it can only be used by one thread at a time.
+ */
+bool DBAccessBerkeley::dbw_in_snapshot() {
+  return snapshotTxn != NULL;
+}
+
 void DBAccessBerkeley::dbw_remove(const string strKey) {
   Dbt key(const_cast<char*>(strKey.data()), strKey.size());
+  boost::shared_ptr<Db> db = getDb(strKey, false);
+  if (!db) {
+    return;
+  }
   try {
-    bdb->del(NULL, &key, 0);
+    db->del(NULL, &key, 0);
   } catch(DbDeadlockException &e) {
     cerr << "DB Error DbDeadlockException on bdb->del(key=" << strKey << ")." << endl;
     cerr << e.what() << endl;
@@ -145,11 +791,111 @@ void DBAccessBerkeley::dbw_remove(const string strKey) {
   return;
 }
 
+/*!
+ * \fn bool DBAccessBerkeley::dbw_write(const DBBatch &batch)
+ * \brief Write a batch in one transaction (if the environment is transactional), retried as a whole on deadlock.
+ *
+ * \param[in] batch Removes and puts to write.
+ * \return false on error.
+ */
+bool DBAccessBerkeley::dbw_write(const DBBatch &batch) {
+  if (batch.empty()) {
+    return true;
+  }
+  for (int retry = 0; retry < DBW_MAX_RETRY; retry++) {
+    DbTxn *txn = NULL;
+    try {
+      txn = beginTxn();
+      vector<string>::const_iterator itRemove;
+      for(itRemove=batch.removes.begin(); itRemove!=batch.removes.end(); itRemove++) {
+        boost::shared_ptr<Db> db = getDb(*itRemove, false);
+        if (db) {
+          Dbt key(const_cast<char*>(itRemove->data()), itRemove->size());
+          db->del(txn, &key, 0);
+        }
+      }
+      vector<pair<string, string> >::const_iterator itPut;
+      for(itPut=batch.puts.begin(); itPut!=batch.puts.end(); itPut++) {
+        boost::shared_ptr<Db> db = getDb(itPut->first, true);
+        if (!db) {
+          if (txn != NULL) txn->abort();
+          return false;
+        }
+        Dbt key(const_cast<char*>((itPut->first).data()), (itPut->first).size());
+        Dbt data(const_cast<char*>((itPut->second).data()), (itPut->second).size()+1);
+        db->put(txn, &key, &data, 0);
+      }
+      commitTxn(txn);
+      return true;
+    } catch(DbDeadlockException &e) {
+      if (txn != NULL) txn->abort();
+      DEBUG_LOGS_FUNC("DB DbDeadlockException on write(" << batch.removes.size() << " removes, " << batch.puts.size() << " puts), retry #" << retry);
+    } catch(DbLockNotGrantedException &e) {
+      if (txn != NULL) txn->abort();
+      DEBUG_LOGS_FUNC("DB DbLockNotGrantedException on write(" << batch.removes.size() << " removes, " << batch.puts.size() << " puts), retry #" << retry);
+    } catch(DbException &e) {
+      if (txn != NULL) txn->abort();
+      cerr << "DB Error DbException on write(" << batch.removes.size() << " removes, " << batch.puts.size() << " puts)." << endl;
+      cerr << e.what() << endl;
+      return false;
+    }
+  }
+  cerr << "DB Error on write(" << batch.removes.size() << " removes, " << batch.puts.size() << " puts): too many retries." << endl;
+  return false;
+}
+
+bool DBAccessBerkeley::dbw_remove_day(const string strDay, const DBTier tier) {
+  if (!partitioned || (tier != TIER_MINUTES && tier != TIER_10MINUTES)) {
+    /// Stored in the main db file, keys have to be removed one by one
+    return false;
+  }
+  string fileName = partitionName(strDay, tier);
+  
+  /// Forget the partition, then wait for the threads still using it : the last one closes it
+  boost::shared_ptr<Db> db;
+  {
+    boost::unique_lock<boost::shared_mutex> lock(partitionsMutex);
+    map<string, boost::shared_ptr<Db> >::iterator it = partitions.find(fileName);
+    if (it != partitions.end()) {
+      db = it->second;
+      partitions.erase(it);
+    }
+  }
+  while (db && !db.unique()) {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+  db.reset();
+  
+  /// Remove the whole db file
+  try {
+    env->dbremove(NULL, fileName.c_str(), NULL, transactional ? DB_AUTO_COMMIT : 0);
+    DEBUG_LOGS_FUNC("DB partition removed: " << fileName);
+  } catch(DbException &e) {
+    if (e.get_errno() != ENOENT) {
+      cerr << "DB Error DbException on dbremove(" << fileName << ")." << endl;
+      cerr << e.what() << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
 void DBAccessBerkeley::dbw_flush() {
   // Flush data
   try {
     if (bdb->sync(0) != 0)
       cout << "DB Flush failed" << endl;
+    {
+      boost::shared_lock<boost::shared_mutex> lock(partitionsMutex);
+      map<string, boost::shared_ptr<Db> >::iterator it;
+      for(it=partitions.begin(); it!=partitions.end(); it++) {
+        if (it->second) (it->second)->sync(0);
+      }
+    }
+    if (transactional) {
+      /// Commits are not synced, a checkpoint writes them and lets the old log files be removed
+      env->txn_checkpoint(0, 0, 0);
+    }
   } catch(DbDeadlockException &e) {
     cerr << "DB Error DbDeadlockException on bdb->sync()." << endl;
     cerr << e.what() << endl;
@@ -184,11 +930,181 @@ void DBAccessBerkeley::dbw_compact() {
   }
 }
 
+/*!
+ * \fn bool DBAccessBerkeley::dbw_compact_slice(DBCompactProgress &progress, const unsigned int maxPages)
+ * \brief Compact the main db file from the key where the previous slice stopped until maxPages pages are freed.
+ * Partitions are not compacted, they are removed as a whole by the retention.
+ *
+ * \param[in, out] progress Progress of the compaction, updated with the slice.
+ * \param[in] maxPages Max number of pages to free in the slice.
+ * \return false on error.
+ */
+bool DBAccessBerkeley::dbw_compact_slice(DBCompactProgress &progress, const unsigned int maxPages) {
+  DB_COMPACT cData;
+  memset(&cData, 0, sizeof(cData));
+  cData.compact_pages = maxPages;
+  
+  string startKey = progress.resumeKey;
+  Dbt start(const_cast<char*>(startKey.data()), startKey.size());
+  Dbt end;
+  end.set_flags(DB_DBT_MALLOC);
+  
+  try {
+    /// Without transaction, a transactional db is compacted in several short transactions
+    bdb->compact(NULL, startKey.empty() ? NULL : &start, NULL, &cData, DB_FREE_SPACE, &end);
+  } catch(DbDeadlockException &e) {
+    DEBUG_LOGS_FUNC("DB DbDeadlockException on compact slice, retry later");
+    return true;
+  } catch(DbException &e) {
+    cerr << "DB Error DbException on bdb->compact()." << endl;
+    cerr << e.what() << endl;
+    return false;
+  }
+  
+  progress.slices++;
+  progress.pagesExamined += cData.compact_pages_examine;
+  progress.pagesFreed += cData.compact_pages_free;
+  progress.pagesTruncated += cData.compact_pages_truncated;
+  
+  /// The end key is where the slice stopped, none at the end of the db (or if the slice did not move)
+  progress.resumeKey.clear();
+  if (end.get_data() != NULL) {
+    progress.resumeKey.assign((const char *)end.get_data(), end.get_size());
+    free(end.get_data());
+  }
+  if (progress.resumeKey.empty() || progress.resumeKey == startKey) {
+    progress.resumeKey.clear();
+    progress.passes++;
+    progress.fillFactor = fillFactor();
+  }
+  return true;
+}
+
+/*!
+ * \fn double DBAccessBerkeley::fillFactor()
+ * \brief Give the used space in the pages of the main db file (the whole btree is read).
+ *
+ * \return Ratio between 0 and 1, -1 on error.
+ */
+double DBAccessBerkeley::fillFactor() {
+  DB_BTREE_STAT *stat = NULL;
+  double ratio = -1;
+  try {
+    bdb->stat(NULL, &stat, 0);
+    double total = (double) (stat->bt_leaf_pg + stat->bt_int_pg) * stat->bt_pagesize;
+    if (total > 0) {
+      ratio = 1.0 - (double) (stat->bt_leaf_pgfree + stat->bt_int_pgfree) / total;
+    }
+  } catch(DbException &e) {
+    cerr << "DB Error DbException on bdb->stat()." << endl;
+    cerr << e.what() << endl;
+  }
+  free(stat);
+  return ratio;
+}
+
+/*!
+ * \fn unsigned long DBAccessBerkeley::warmupDb(Db *db, const vector<string> &prefixes)
+ * \brief Load in the DB cache the pages of all the keys of a db file starting with one of the given prefixes.
+ *
+ * \param[in] db Db file to read.
+ * \param[in] prefixes Prefixes of the keys to load. Ex: module/w/1/2013-11-04
+ * \return Number of keys read.
+ */
+unsigned long DBAccessBerkeley::warmupDb(Db *db, const vector<string> &prefixes) {
+  unsigned long nbKeys = 0;
+  Dbc *cursor = NULL;
+  
+  try {
+    db->cursor(NULL, &cursor, 0);
+    
+    char keyBuffer[KEY_MAX_SIZE];
+    char valueBuffer[1];
+    Dbt key, data;
+    key.set_flags(DB_DBT_USERMEM);
+    key.set_data(keyBuffer);
+    key.set_ulen(KEY_MAX_SIZE);
+    /// Values are not needed : read no byte of them, the leaf pages are loaded anyway
+    /// (DB_THREAD needs a memory flag on every DBT returned)
+    data.set_flags(DB_DBT_USERMEM | DB_DBT_PARTIAL);
+    data.set_data(valueBuffer);
+    data.set_ulen(0);
+    data.set_doff(0);
+    data.set_dlen(0);
+    
+    vector<string>::const_iterator it;
+    for(it=prefixes.begin(); it!=prefixes.end(); it++) {
+      if ((*it).size() > KEY_MAX_SIZE) continue;
+      /// Position the cursor on the first key >= prefix, then read while keys match prefix
+      memcpy(keyBuffer, (*it).data(), (*it).size());
+      key.set_size((*it).size());
+      int ret = cursor->get(&key, &data, DB_SET_RANGE);
+      while (ret == 0 && key.get_size() >= (*it).size() && memcmp(keyBuffer, (*it).data(), (*it).size()) == 0) {
+        nbKeys++;
+        ret = cursor->get(&key, &data, DB_NEXT);
+      }
+    }
+    cursor->close();
+  } catch(DbException &e) {
+    if (cursor != NULL) cursor->close();
+    cerr << "DB Error DbException on warm-up." << endl;
+    cerr << e.what() << endl;
+  }
+  return nbKeys;
+}
+
+/*!
+ * \fn unsigned long DBAccessBerkeley::dbw_warmup(const vector<string> &prefixes)
+ * \brief Load in the DB cache the pages of all the keys starting with one of the given prefixes.
+ *
+ * \param[in] prefixes Prefixes of the keys to load. Ex: module/w/1/2013-11-04
+ * \return Number of keys read.
+ */
+unsigned long DBAccessBerkeley::dbw_warmup(const vector<string> &prefixes) {
+  unsigned long nbKeys = warmupDb(bdb, prefixes);
+  if (!partitioned) {
+    return nbKeys;
+  }
+  
+  /// Minutes and 10 minutes stats are in the partitions of their day
+  map<string, vector<string> > prefixesByDay;
+  vector<string>::const_iterator it;
+  StatKey statKey;
+  for(it=prefixes.begin(); it!=prefixes.end(); it++) {
+    if (parseStatKey(*it, statKey)) {
+      prefixesByDay[statKey.date].push_back(*it);
+    }
+  }
+  map<string, vector<string> >::iterator itDay;
+  for(itDay=prefixesByDay.begin(); itDay!=prefixesByDay.end(); itDay++) {
+    const string &prefix = (itDay->second).front();
+    boost::shared_ptr<Db> db = getDb(prefix + "/0000", false);
+    if (db) nbKeys += warmupDb(db.get(), itDay->second);
+    db = getDb(prefix + "/000", false);
+    if (db) nbKeys += warmupDb(db.get(), itDay->second);
+  }
+  return nbKeys;
+}
+
 void DBAccessBerkeley::dbw_close() {
+  {
+    /// Partitions are closed when released
+    boost::unique_lock<boost::shared_mutex> lock(partitionsMutex);
+    partitions.clear();
+  }
+  mainDb.reset();
   try {
     if (bdb != NULL) {
       // Close the bdb
       bdb->close(0);
+      delete bdb;
+      bdb = NULL;
+    }
+    if (env != NULL) {
+      // Close the environment, the db can be opened again
+      env->close(0);
+      delete env;
+      env = NULL;
     }
   } catch(DbException &e) {
     cerr << "Error closing database." << endl;
@@ -204,6 +1120,9 @@ void DBAccessBerkeley::dbw_drop(const char *basedir) {
 }
 
 DBAccessBerkeley::DBAccessBerkeley() {
+  transactional = false;
+  partitioned = false;
+  env = NULL;
   bdb = NULL;
 }
 
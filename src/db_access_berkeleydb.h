@@ -1,34 +1,58 @@
 /*!
- * \file db_access.h
+ * \file db_access_berkeleydb.h
  * \brief Wrapper to access DB functions
  * \author Xavier ETCHEBER
  */
 
-#ifndef MOOWAPP_STATS_DB_ACCESS_H_
-#define MOOWAPP_STATS_DB_ACCESS_H_
+#ifndef MOOWAPP_STATS_DB_ACCESS_BERKELEYDB_H_
+#define MOOWAPP_STATS_DB_ACCESS_BERKELEYDB_H_
 
 #include <string>
 #include <vector> // Vector of strings
+#include <map> // Partitions
+
+// Boost
+#include <boost/shared_ptr.hpp> // Partitions shared with the threads using them
+#include <boost/thread/shared_mutex.hpp> // Shared mutex
 
 // database
 #include <db_cxx.h>
 
+// mooWApp
+#include "db_access.h"
+
 #define VAL_MAX_VALUE_SIZE 100
+#define KEY_MAX_SIZE 1024 //!< Max size of a key read back from DB by a cursor
+#define DBW_MAX_RETRY 10 //!< Max retries of an atomic update on deadlock / concurrent insert
 
 /*!
  * \class DBAccessBerkeley
- * \brief Class to access DB functions.
+ * \brief Class to access DB functions, storage engine on top of BerkeleyDB.
  *
+ * With DB_PARTITIONS, minutes and 10 minutes stats are stored in one db file per day and per tier
+ * (Ex: storage.db.2011-04-24.m) so that their retention removes whole files.
  */
-class DBAccessBerkeley
+class DBAccessBerkeley : public DBAccess
 {
 public:
   bool dbw_open(const std::string baseDir, const std::string dbFileName);
   std::string dbw_get(const std::string strKey, const int flags = 0);
+  int dbw_read(const std::string &strKey, std::string &value);
+  int dbw_read_counters(const std::string &series, const std::string &strPeriod, const DBTier tier, std::vector<unsigned int> &counters);
   int dbw_add(const std::string strKey, const std::string strValue);
+  unsigned int dbw_increment(const std::string strKey, const unsigned int delta = 1);
+  bool dbw_append(const std::string strKey, const std::string strValue, const char separator = ',');
+  bool dbw_merge(const std::string strKey, const std::string strValue, DBMergeFunc merge);
   void dbw_remove(const std::string strKey);
+  bool dbw_write(const DBBatch &batch);
+  bool dbw_remove_day(const std::string strDay, const DBTier tier);
+  void dbw_begin_snapshot();
+  void dbw_end_snapshot();
+  bool dbw_in_snapshot();
   void dbw_flush();
   void dbw_compact();
+  bool dbw_compact_slice(DBCompactProgress &progress, const unsigned int maxPages);
+  unsigned long dbw_warmup(const std::vector<std::string> &prefixes);
   void dbw_close();
   void dbw_drop(const char *basedir);
  
@@ -39,7 +63,22 @@ public:
 
 private:
   static DBAccessBerkeley singleton;
+  bool transactional; //!< Environment opened with transactions (for snapshot reads)
+  DbEnv *env; //!< DB environment pointer
   Db *bdb; //!< DB pointer
+  boost::shared_ptr<Db> mainDb; //!< DB pointer shared like partitions (never closed by release)
+  std::string dbFileName; //!< Name of the main db file, prefix of the partitions
+  bool partitioned; //!< Minutes and 10 minutes stats are stored in one db file per day and per tier
+  std::map<std::string, boost::shared_ptr<Db> > partitions; //!< Opened partitions by file name (NULL if the file does not exist)
+  boost::shared_mutex partitionsMutex; //!< Shared to find a partition, exclusive to open or remove one
+  
+  DbTxn *beginTxn(const u_int32_t flags = 0);
+  Db *openDb(const std::string &fileName, const bool create);
+  std::string partitionName(const std::string &strDay, const DBTier tier);
+  boost::shared_ptr<Db> getDb(const std::string &strKey, const bool create);
+  bool migratePartitions();
+  unsigned long warmupDb(Db *db, const std::vector<std::string> &prefixes);
+  double fillFactor();
   
   /*!
    * \fn DBAccessBerkeley()
@@ -52,4 +91,4 @@ private:
   void operator=(const DBAccessBerkeley&);
 };
 
-#endif // MOOWAPP_STATS_DB_ACCESS_H_
\ No newline at end of file
+#endif // MOOWAPP_STATS_DB_ACCESS_BERKELEYDB_H_
\ No newline at end of file
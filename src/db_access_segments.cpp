@@ -0,0 +1,891 @@
+/*!
+ * \file db_access_segments.cpp
+ * \brief Append-only storage engine of day-partitioned segment files
+ * \author Xavier ETCHEBER
+ */
+
+#include <iostream>
+#include <string>
+#include <vector> // Vector of strings
+#include <map> // Index of series and segments
+#include <set> // Days to warm-up
+#include <stdio.h> // fopen, fread, fwrite, fclose, rename
+#include <string.h> // memcpy, memset, strncmp, strcmp
+#include <stdlib.h> // atoi
+#include <errno.h> // errno
+#include <fcntl.h> // open
+#include <unistd.h> // close, ftruncate, unlink, fsync, rmdir
+#include <dirent.h> // opendir, readdir
+#include <sys/mman.h> // mmap, munmap, msync, madvise
+#include <sys/stat.h> // fstat, mkdir
+
+// Boost
+#include <boost/thread/locks.hpp> // Locks of mutex
+
+// mooWApp
+#include "global.h"
+#include "db_access_segments.h"
+
+using namespace std;
+
+static const char SEG_MAGIC[8] = "MWSEG01";
+static const uint32_t MISC_TOMBSTONE = 0xFFFFFFFF; //!< Value size of a removed key in the misc log
+static const uint32_t MISC_APPEND = 0x80000000;    //!< Flag of the key size : the value is appended to the stored value
+static const uint32_t MISC_MERGE = 0x40000000;     //!< Flag of the key size : the value (merge function name, '\0', delta) is merged
+static const uint32_t MISC_FLAGS = MISC_APPEND | MISC_MERGE;
+
+/*!
+ * \fn static bool counterLocation(const StatKey &statKey, string &fileName, uint32_t &nbSlots, uint32_t &slot)
+ * \brief Give the segment file and the counter used to store a stats key.
+ *
+ * \param[in] statKey Parsed key.
+ * \param[out] fileName Segment file name. Ex: 2011-04-24.m.seg or 2011-04.d.seg
+ * \param[out] nbSlots Number of counters in each record of the segment.
+ * \param[out] slot Counter of the key in its record.
+ * \return false if the key is not a counter.
+ */
+static bool counterLocation(const StatKey &statKey, string &fileName, uint32_t &nbSlots, uint32_t &slot) {
+  if (!statKey.suffix.empty() || statKey.series.size() >= SEG_SERIES_SIZE) {
+    return false;
+  }
+  const string &s = statKey.slot;
+  unsigned int hour = 0, minute = 0;
+  switch (statKey.tier) {
+    case TIER_MINUTES:
+      hour = (s[0]-'0')*10 + (s[1]-'0');
+      minute = (s[2]-'0')*10 + (s[3]-'0');
+      if (hour > 23 || minute > 59) return false;
+      fileName = statKey.date + ".m.seg";
+      nbSlots = DB_TIMES_MINUTES_SIZE;
+      slot = hour*60 + minute;
+      return true;
+    case TIER_10MINUTES:
+      hour = (s[0]-'0')*10 + (s[1]-'0');
+      minute = s[2]-'0';
+      if (hour > 23 || minute > 5) return false;
+      fileName = statKey.date + ".t.seg";
+      nbSlots = DB_TIMES_SIZE;
+      slot = hour*6 + minute;
+      return true;
+    case TIER_HOURS:
+      hour = (s[0]-'0')*10 + (s[1]-'0');
+      if (hour > 23) return false;
+      fileName = statKey.date + ".h.seg";
+      nbSlots = DB_TIMES_HOURS_SIZE;
+      slot = hour;
+      return true;
+    case TIER_DAYS:
+      fileName = statKey.date.substr(0, 7) + ".d.seg";
+      nbSlots = 31;
+      slot = atoi(statKey.date.substr(8, 2).c_str()) - 1;
+      return slot < 31;
+  }
+  return false;
+}
+
+/*!
+ * \fn static bool readMiscRecord(FILE *pFile, uint32_t &keyFlags, string &key, string &value, bool &removed)
+ * \brief Read the next record of a misc log.
+ *
+ * \param[in] pFile Log.
+ * \param[out] keyFlags MISC_APPEND, MISC_MERGE or 0 for a value put.
+ * \param[out] key Key.
+ * \param[out] value Value, or delta of an append or a merge.
+ * \param[out] removed The record is a tombstone.
+ * \return false at the end of the log or on an incomplete record.
+ */
+static bool readMiscRecord(FILE *pFile, uint32_t &keyFlags, string &key, string &value, bool &removed) {
+  uint32_t sizes[2];
+  if (fread(sizes, sizeof(uint32_t), 2, pFile) != 2) return false;
+  keyFlags = sizes[0] & MISC_FLAGS;
+  uint32_t keySize = sizes[0] & ~MISC_FLAGS;
+  key.resize(keySize);
+  if (keySize > 0 && fread(&key[0], 1, keySize, pFile) != keySize) return false;
+  removed = (sizes[1] == MISC_TOMBSTONE);
+  if (!removed) {
+    value.resize(sizes[1]);
+    if (sizes[1] > 0 && fread(&value[0], 1, sizes[1], pFile) != sizes[1]) return false;
+  }
+  return true;
+}
+
+/*!
+ * \fn static void writeMiscRecord(FILE *pFile, const uint32_t keyFlags, const string &strKey, const string *strValue)
+ * \brief Append a record to a misc log.
+ *
+ * \param[in] pFile Log.
+ * \param[in] keyFlags MISC_APPEND, MISC_MERGE or 0 for a value put.
+ * \param[in] strKey Key.
+ * \param[in] strValue Value, NULL if the key is removed.
+ */
+static void writeMiscRecord(FILE *pFile, const uint32_t keyFlags, const string &strKey, const string *strValue) {
+  uint32_t sizes[2] = { (uint32_t) strKey.size() | keyFlags, strValue == NULL ? MISC_TOMBSTONE : (uint32_t) strValue->size() };
+  fwrite(sizes, sizeof(uint32_t), 2, pFile);
+  fwrite(strKey.data(), 1, strKey.size(), pFile);
+  if (strValue != NULL) {
+    fwrite(strValue->data(), 1, strValue->size(), pFile);
+  }
+}
+
+/*!
+ * \fn static long fileSize(FILE *pFile)
+ * \brief Give the size of an opened file, -1 on error.
+ */
+static long fileSize(FILE *pFile) {
+  struct stat st;
+  if (fflush(pFile) != 0 || fstat(fileno(pFile), &st) != 0) {
+    return -1;
+  }
+  return st.st_size;
+}
+
+/*!
+ * \fn static string tierExtension(const DBTier tier)
+ * \brief Return the extension of the segment files of a tier.
+ */
+static string tierExtension(const DBTier tier) {
+  switch (tier) {
+    case TIER_MINUTES: return ".m.seg";
+    case TIER_10MINUTES: return ".t.seg";
+    case TIER_HOURS: return ".h.seg";
+    default: return ".d.seg";
+  }
+}
+
+Segment::Segment(const string &path, const uint32_t nbSlots) : path(path), nbSlots(nbSlots), fd(-1), data(NULL), mappedSize(0) {
+}
+
+Segment::~Segment() {
+  close();
+}
+
+/*!
+ * \fn bool Segment::open(const bool create)
+ * \brief Open and map the segment file, then rebuild the index of its records.
+ *
+ * \param[in] create Create the file if it does not exist.
+ */
+bool Segment::open(const bool create) {
+  fd = ::open(path.c_str(), O_RDWR | (create ? O_CREAT : 0), 0644);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close();
+    return false;
+  }
+
+  if (st.st_size == 0) {
+    /// New file : write the header and allocate the first records
+    size_t size = sizeof(SegmentHeader) + SEG_INITIAL_RECORDS * recordSize();
+    if (ftruncate(fd, size) != 0 || !remap(size)) {
+      close();
+      return false;
+    }
+    SegmentHeader *header = (SegmentHeader *) data;
+    memcpy(header->magic, SEG_MAGIC, sizeof(SEG_MAGIC));
+    header->nbSlots = nbSlots;
+    header->nbRecords = 0;
+    return true;
+  }
+
+  if ((size_t) st.st_size < sizeof(SegmentHeader) || !remap(st.st_size)) {
+    cerr << "Segment Error: " << path << " can not be mapped." << endl;
+    close();
+    return false;
+  }
+  SegmentHeader *header = (SegmentHeader *) data;
+  if (memcmp(header->magic, SEG_MAGIC, sizeof(SEG_MAGIC)) != 0 || header->nbSlots != nbSlots
+      || sizeof(SegmentHeader) + header->nbRecords * recordSize() > mappedSize) {
+    cerr << "Segment Error: " << path << " is not a valid segment file." << endl;
+    close();
+    return false;
+  }
+
+  /// Rebuild the index of the series
+  for (uint32_t i = 0; i < header->nbRecords; i++) {
+    const char *series = data + sizeof(SegmentHeader) + i * recordSize();
+    index[string(series, strnlen(series, SEG_SERIES_SIZE))] = i;
+  }
+  return true;
+}
+
+void Segment::close() {
+  if (data != NULL) {
+    munmap(data, mappedSize);
+    data = NULL;
+    mappedSize = 0;
+  }
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+/*!
+ * \fn bool Segment::remap(const size_t size)
+ * \brief (Re)map the segment file in memory. Must be called with the exclusive lock.
+ */
+bool Segment::remap(const size_t size) {
+  if (data != NULL) {
+    munmap(data, mappedSize);
+    data = NULL;
+  }
+  void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    mappedSize = 0;
+    return false;
+  }
+  data = (char *) addr;
+  mappedSize = size;
+  return true;
+}
+
+/*!
+ * \fn uint32_t Segment::appendRecord(const string &series)
+ * \brief Add a record for a new series at the end of the file. Must be called with the exclusive lock.
+ *
+ * \return The record number of the series.
+ */
+uint32_t Segment::appendRecord(const string &series) {
+  SegmentHeader *header = (SegmentHeader *) data;
+  uint32_t record = header->nbRecords;
+  size_t needed = sizeof(SegmentHeader) + (record + 1) * recordSize();
+  if (needed > mappedSize) {
+    /// Grow the file by doubling it (new bytes are zeros : counters are initialized)
+    size_t size = mappedSize * 2 > needed ? mappedSize * 2 : needed;
+    if (ftruncate(fd, size) != 0 || !remap(size)) {
+      cerr << "Segment Error: " << path << " can not grow." << endl;
+      throw bad_alloc();
+    }
+    header = (SegmentHeader *) data;
+  }
+  char *rec = data + sizeof(SegmentHeader) + record * recordSize();
+  memset(rec, 0, SEG_SERIES_SIZE);
+  memcpy(rec, series.data(), series.size());
+  header->nbRecords = record + 1; // Record is valid from now
+  index[series] = record;
+  return record;
+}
+
+/*!
+ * \fn bool Segment::read(const string &series, const uint32_t slot, uint32_t &value)
+ * \brief Read a counter.
+ *
+ * \return false if the series has no record in this segment.
+ */
+bool Segment::read(const string &series, const uint32_t slot, uint32_t &value) {
+  boost::shared_lock<boost::shared_mutex> lock(mutex);
+  map<string, uint32_t>::iterator it = index.find(series);
+  if (it == index.end()) {
+    return false;
+  }
+  value = counters(it->second)[slot];
+  return true;
+}
+
+/*!
+ * \fn bool Segment::readAll(const string &series, uint32_t *values)
+ * \brief Copy all the counters of a series.
+ *
+ * \param[out] values Array of nbSlots counters.
+ * \return false if the series has no record in this segment.
+ */
+bool Segment::readAll(const string &series, uint32_t *values) {
+  boost::shared_lock<boost::shared_mutex> lock(mutex);
+  map<string, uint32_t>::iterator it = index.find(series);
+  if (it == index.end()) {
+    return false;
+  }
+  memcpy(values, counters(it->second), nbSlots * sizeof(uint32_t));
+  return true;
+}
+
+/*!
+ * \fn uint32_t Segment::add(const string &series, const uint32_t slot, const uint32_t delta)
+ * \brief Atomically add delta to a counter, the record of the series is appended if needed.
+ *
+ * \return The new value of the counter.
+ */
+uint32_t Segment::add(const string &series, const uint32_t slot, const uint32_t delta) {
+  {
+    boost::shared_lock<boost::shared_mutex> lock(mutex);
+    map<string, uint32_t>::iterator it = index.find(series);
+    if (it != index.end()) {
+      return __sync_add_and_fetch(&counters(it->second)[slot], delta);
+    }
+  }
+  boost::unique_lock<boost::shared_mutex> lock(mutex);
+  map<string, uint32_t>::iterator it = index.find(series);
+  uint32_t record = (it != index.end()) ? it->second : appendRecord(series);
+  return __sync_add_and_fetch(&counters(record)[slot], delta);
+}
+
+/*!
+ * \fn void Segment::set(const string &series, const uint32_t slot, const uint32_t value)
+ * \brief Set a counter, the record of the series is appended if needed.
+ */
+void Segment::set(const string &series, const uint32_t slot, const uint32_t value) {
+  {
+    boost::shared_lock<boost::shared_mutex> lock(mutex);
+    map<string, uint32_t>::iterator it = index.find(series);
+    if (it != index.end()) {
+      counters(it->second)[slot] = value;
+      return;
+    }
+  }
+  if (value == 0) return; // Nothing to store
+  boost::unique_lock<boost::shared_mutex> lock(mutex);
+  map<string, uint32_t>::iterator it = index.find(series);
+  uint32_t record = (it != index.end()) ? it->second : appendRecord(series);
+  counters(record)[slot] = value;
+}
+
+void Segment::sync() {
+  boost::shared_lock<boost::shared_mutex> lock(mutex);
+  if (data != NULL) {
+    msync(data, mappedSize, MS_SYNC);
+  }
+}
+
+void Segment::willNeed() {
+  boost::shared_lock<boost::shared_mutex> lock(mutex);
+  if (data != NULL) {
+    madvise(data, mappedSize, MADV_WILLNEED);
+  }
+}
+
+bool DBAccessSegments::dbw_open(const string baseDir, const string dbFileName) {
+  dir = baseDir;
+  if (!dir.empty() && dir[dir.size()-1] != '/') dir += '/';
+  dir += dbFileName + ".segments/";
+
+  if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+    cerr << "Error opening database: " << dir << endl;
+    return false;
+  }
+  if (!loadMisc()) {
+    cerr << "Error opening database: " << dir << "misc.log" << endl;
+    return false;
+  }
+  cout << "DB " << dir << " connected" << endl;
+  return true;
+}
+
+/*!
+ * \fn bool DBAccessSegments::loadMisc()
+ * \brief Replay the log of the keys which are not counters, then open it for appending.
+ */
+bool DBAccessSegments::loadMisc() {
+  string path = dir + "misc.log";
+  long validSize = 0;
+  FILE *pFile = fopen(path.c_str(), "rb");
+  if (pFile != NULL) {
+    uint32_t keyFlags;
+    string key, value;
+    bool removed;
+    while (readMiscRecord(pFile, keyFlags, key, value, removed)) {
+      replayMisc(keyFlags, key, removed ? NULL : &value);
+      validSize = ftell(pFile);
+    }
+    fclose(pFile);
+    /// Drop an incomplete record written during a crash
+    if (truncate(path.c_str(), validSize) != 0) {
+      return false;
+    }
+  }
+  miscLog = fopen(path.c_str(), "ab");
+  return miscLog != NULL;
+}
+
+/*!
+ * \fn void DBAccessSegments::replayMisc(const uint32_t keyFlags, const string &strKey, const string *strValue)
+ * \brief Apply a record of the misc log to the keys in memory.
+ *
+ * \param[in] keyFlags MISC_APPEND, MISC_MERGE or 0 for a value put.
+ * \param[in] strKey Key.
+ * \param[in] strValue Value, or delta of an append or a merge. NULL if the key is removed.
+ */
+void DBAccessSegments::replayMisc(const uint32_t keyFlags, const string &strKey, const string *strValue) {
+  if (strValue == NULL) {
+    misc.erase(strKey);
+  } else if (keyFlags & MISC_APPEND) {
+    misc[strKey] += *strValue;
+  } else if (keyFlags & MISC_MERGE) {
+    size_t end = strValue->find('\0');
+    DBMergeFunc merge = (end != string::npos) ? findMergeFunc(strValue->substr(0, end)) : NULL;
+    if (merge == NULL) {
+      cerr << "DB Error no merge function to replay the key: " << strKey << endl;
+      return;
+    }
+    merge(misc[strKey], strValue->substr(end + 1));
+  } else {
+    misc[strKey] = *strValue;
+  }
+}
+
+/*!
+ * \fn void DBAccessSegments::writeMisc(const string &strKey, const string *strValue, const uint32_t keyFlags)
+ * \brief Append a key to the misc log. Must be called with miscMutex.
+ *
+ * \param[in] strKey Key.
+ * \param[in] strValue Value, or delta of an append or a merge. NULL if the key is removed.
+ * \param[in] keyFlags MISC_APPEND, MISC_MERGE or 0 for a value put.
+ */
+void DBAccessSegments::writeMisc(const string &strKey, const string *strValue, const uint32_t keyFlags/* = 0 */) {
+  writeMiscRecord(miscLog, keyFlags, strKey, strValue);
+}
+
+/*!
+ * \fn boost::shared_ptr<Segment> DBAccessSegments::getSegment(const string &fileName, const uint32_t nbSlots, const bool create)
+ * \brief Give an opened segment file.
+ *
+ * \param[in] fileName Segment file name. Ex: 2011-04-24.m.seg
+ * \param[in] nbSlots Number of counters in each record of the segment.
+ * \param[in] create Create the file if needed, else a missing file gives a NULL pointer (remembered until it is created).
+ */
+boost::shared_ptr<Segment> DBAccessSegments::getSegment(const string &fileName, const uint32_t nbSlots, const bool create) {
+  boost::mutex::scoped_lock lock(segmentsMutex);
+  map<string, boost::shared_ptr<Segment> >::iterator it = segments.find(fileName);
+  if (it != segments.end() && (it->second || !create)) {
+    return it->second;
+  }
+  boost::shared_ptr<Segment> segment(new Segment(dir + fileName, nbSlots));
+  if (!segment->open(create)) {
+    segment.reset();
+  }
+  segments[fileName] = segment;
+  return segment;
+}
+
+boost::shared_ptr<Segment> DBAccessSegments::getSegment(const StatKey &statKey, const bool create, uint32_t &slot) {
+  string fileName;
+  uint32_t nbSlots;
+  if (!counterLocation(statKey, fileName, nbSlots, slot)) {
+    return boost::shared_ptr<Segment>();
+  }
+  return getSegment(fileName, nbSlots, create);
+}
+
+string DBAccessSegments::dbw_get(const string strKey, const int flags/* = 0 */) {
+  string strRes;
+  dbw_read(strKey, strRes);
+  return strRes;
+}
+
+int DBAccessSegments::dbw_read(const string &strKey, string &value) {
+  value.clear();
+  StatKey statKey;
+  string fileName;
+  uint32_t nbSlots, slot;
+  if (parseStatKey(strKey, statKey) && counterLocation(statKey, fileName, nbSlots, slot)) {
+    /// Counter : a straight read in the mapped segment
+    boost::shared_ptr<Segment> segment = getSegment(fileName, nbSlots, false);
+    uint32_t counter = 0;
+    if (segment && segment->read(statKey.series, slot, counter) && counter != 0) {
+      intToString(value, counter);
+      return DBW_FOUND;
+    }
+    return DBW_NOTFOUND;
+  }
+
+  boost::mutex::scoped_lock lock(miscMutex);
+  map<string, string>::iterator it = misc.find(strKey);
+  if (it == misc.end()) {
+    return DBW_NOTFOUND;
+  }
+  value = it->second;
+  return DBW_FOUND;
+}
+
+/*!
+ * \fn int DBAccessSegments::dbw_read_counters(const string &series, const string &strPeriod, const DBTier tier, vector<unsigned int> &counters)
+ * \brief Read every counter of a series for a day or a month : the record of the series in one segment.
+ */
+int DBAccessSegments::dbw_read_counters(const string &series, const string &strPeriod, const DBTier tier, vector<unsigned int> &counters) {
+  size_t slotSize;
+  size_t nbCounters = tierSlots(tier, slotSize);
+  counters.assign(nbCounters, 0);
+  
+  /// Location of the first slot of the range
+  StatKey statKey;
+  string fileName;
+  uint32_t nbSlots, slot;
+  statKey.series = series;
+  statKey.tier = tier;
+  if (tier == TIER_DAYS) {
+    statKey.date = strPeriod + "-01";
+  } else {
+    statKey.date = strPeriod;
+    statKey.slot = string(slotSize, '0');
+  }
+  if (!counterLocation(statKey, fileName, nbSlots, slot) || nbSlots != nbCounters) {
+    return DBW_NOTFOUND;
+  }
+  boost::shared_ptr<Segment> segment = getSegment(fileName, nbSlots, false);
+  vector<uint32_t> values(nbSlots);
+  if (!segment || !segment->readAll(series, &values[0])) {
+    return DBW_NOTFOUND;
+  }
+  counters.assign(values.begin(), values.end());
+  return DBW_FOUND;
+}
+
+int DBAccessSegments::dbw_add(const string strKey, const string strValue) {
+  StatKey statKey;
+  string fileName;
+  uint32_t nbSlots, slot;
+  if (parseStatKey(strKey, statKey) && counterLocation(statKey, fileName, nbSlots, slot)) {
+    boost::shared_ptr<Segment> segment = getSegment(fileName, nbSlots, true);
+    if (!segment) return false;
+    segment->set(statKey.series, slot, stringToInt(strValue));
+    return true;
+  }
+
+  boost::mutex::scoped_lock lock(miscMutex);
+  misc[strKey] = strValue;
+  writeMisc(strKey, &strValue);
+  return true;
+}
+
+unsigned int DBAccessSegments::dbw_increment(const string strKey, const unsigned int delta/* = 1 */) {
+  StatKey statKey;
+  string fileName;
+  uint32_t nbSlots, slot;
+  if (parseStatKey(strKey, statKey) && counterLocation(statKey, fileName, nbSlots, slot)) {
+    boost::shared_ptr<Segment> segment = getSegment(fileName, nbSlots, true);
+    if (!segment) return 0;
+    return segment->add(statKey.series, slot, delta);
+  }
+
+  boost::mutex::scoped_lock lock(miscMutex);
+  string &value = misc[strKey];
+  unsigned int iVal = stringToInt(value) + delta;
+  value.clear();
+  intToString(value, iVal);
+  writeMisc(strKey, &value);
+  return iVal;
+}
+
+bool DBAccessSegments::dbw_append(const string strKey, const string strValue, const char separator/* = ',' */) {
+  boost::mutex::scoped_lock lock(miscMutex);
+  string &value = misc[strKey];
+  /// Only the data appended is logged
+  string delta;
+  if (!value.empty()) {
+    delta += separator;
+  }
+  delta += strValue;
+  value += delta;
+  writeMisc(strKey, &delta, MISC_APPEND);
+  return true;
+}
+
+bool DBAccessSegments::dbw_merge(const string strKey, const string strValue, DBMergeFunc merge) {
+  boost::mutex::scoped_lock lock(miscMutex);
+  string &value = misc[strKey];
+  merge(value, strValue);
+  /// Only the delta is logged when the function can be found by its name at replay, the value otherwise
+  string name = mergeFuncName(merge);
+  if (name.empty()) {
+    writeMisc(strKey, &value);
+  } else {
+    string delta = name + '\0' + strValue;
+    writeMisc(strKey, &delta, MISC_MERGE);
+  }
+  return true;
+}
+
+void DBAccessSegments::dbw_remove(const string strKey) {
+  StatKey statKey;
+  string fileName;
+  uint32_t nbSlots, slot;
+  if (parseStatKey(strKey, statKey) && counterLocation(statKey, fileName, nbSlots, slot)) {
+    boost::shared_ptr<Segment> segment = getSegment(fileName, nbSlots, false);
+    if (segment) {
+      segment->set(statKey.series, slot, 0);
+    }
+    return;
+  }
+
+  boost::mutex::scoped_lock lock(miscMutex);
+  if (misc.erase(strKey) > 0) {
+    writeMisc(strKey, NULL);
+  }
+}
+
+/*!
+ * \fn bool DBAccessSegments::dbw_write(const DBBatch &batch)
+ * \brief Write a batch key by key : the segments have no transaction, counters are updated in place.
+ */
+bool DBAccessSegments::dbw_write(const DBBatch &batch) {
+  bool ok = true;
+  vector<string>::const_iterator itRemove;
+  for(itRemove=batch.removes.begin(); itRemove!=batch.removes.end(); itRemove++) {
+    dbw_remove(*itRemove);
+  }
+  vector<pair<string, string> >::const_iterator itPut;
+  for(itPut=batch.puts.begin(); itPut!=batch.puts.end(); itPut++) {
+    ok = dbw_add(itPut->first, itPut->second) && ok;
+  }
+  return ok;
+}
+
+bool DBAccessSegments::dbw_remove_day(const string strDay, const DBTier tier) {
+  if (tier == TIER_DAYS) {
+    /// Days are stored by month
+    return false;
+  }
+
+  /// Unlink the segment file : readers still using it keep a valid mapping until they release it
+  string fileName = strDay + tierExtension(tier);
+  {
+    boost::mutex::scoped_lock lock(segmentsMutex);
+    segments[fileName].reset(); // Missing from now
+    unlink((dir + fileName).c_str());
+  }
+
+  /// Remove the keys of the same day and tier which are not counters (Ex: response times)
+  boost::mutex::scoped_lock lock(miscMutex);
+  StatKey statKey;
+  map<string, string>::iterator it = misc.begin();
+  while (it != misc.end()) {
+    if (parseStatKey(it->first, statKey) && statKey.date == strDay && statKey.tier == tier) {
+      writeMisc(it->first, NULL);
+      misc.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+  return true;
+}
+
+void DBAccessSegments::dbw_flush() {
+  vector<boost::shared_ptr<Segment> > toSync;
+  {
+    boost::mutex::scoped_lock lock(segmentsMutex);
+    map<string, boost::shared_ptr<Segment> >::iterator it;
+    for (it = segments.begin(); it != segments.end(); it++) {
+      if (it->second) toSync.push_back(it->second);
+    }
+  }
+  for (size_t i = 0; i < toSync.size(); i++) {
+    toSync[i]->sync();
+  }
+
+  boost::mutex::scoped_lock lock(miscMutex);
+  if (miscLog != NULL && (fflush(miscLog) != 0 || fsync(fileno(miscLog)) != 0)) {
+    cout << "DB Flush failed" << endl;
+  }
+}
+
+/*!
+ * \fn void DBAccessSegments::dbw_compact()
+ * \brief Rewrite the misc log with only the keys still alive.
+ */
+void DBAccessSegments::dbw_compact() {
+  boost::mutex::scoped_lock lock(miscMutex);
+  abortCompaction();
+  string path = dir + "misc.log", pathTmp = dir + "misc.log.tmp";
+  FILE *pFile = miscLog;
+  miscLog = fopen(pathTmp.c_str(), "wb");
+  if (miscLog == NULL) {
+    miscLog = pFile;
+    cout << "DB Compaction failed" << endl;
+    return;
+  }
+  map<string, string>::iterator it;
+  for (it = misc.begin(); it != misc.end(); it++) {
+    writeMisc(it->first, &it->second);
+  }
+  if (fflush(miscLog) != 0 || fsync(fileno(miscLog)) != 0 || rename(pathTmp.c_str(), path.c_str()) != 0) {
+    fclose(miscLog);
+    unlink(pathTmp.c_str());
+    miscLog = pFile;
+    cout << "DB Compaction failed" << endl;
+    return;
+  }
+  fclose(pFile);
+}
+
+/*!
+ * \fn void DBAccessSegments::abortCompaction()
+ * \brief Drop the log being rewritten by the compaction slices. Must be called with miscMutex.
+ */
+void DBAccessSegments::abortCompaction() {
+  if (compactLog != NULL) {
+    fclose(compactLog);
+    compactLog = NULL;
+    unlink((dir + "misc.log.tmp").c_str());
+  }
+}
+
+/*!
+ * \fn bool DBAccessSegments::copyMiscTail()
+ * \brief Copy to the log being rewritten the records logged since the previous slice for the keys it already has.
+ * Must be called with miscMutex.
+ */
+bool DBAccessSegments::copyMiscTail() {
+  if (fflush(miscLog) != 0) {
+    return false;
+  }
+  FILE *pFile = fopen((dir + "misc.log").c_str(), "rb");
+  if (pFile == NULL) {
+    return false;
+  }
+  if (fseek(pFile, compactOffset, SEEK_SET) != 0) {
+    fclose(pFile);
+    return false;
+  }
+  uint32_t keyFlags;
+  string key, value;
+  bool removed;
+  while (readMiscRecord(pFile, keyFlags, key, value, removed)) {
+    if (key < compactLastKey) {
+      writeMiscRecord(compactLog, keyFlags, key, removed ? NULL : &value);
+    }
+  }
+  fclose(pFile);
+  return true;
+}
+
+/*!
+ * \fn bool DBAccessSegments::dbw_compact_slice(DBCompactProgress &progress, const unsigned int maxPages)
+ * \brief Segments are never fragmented (retention unlinks files) : the misc log is rewritten with the values, by slices.
+ *
+ * Each slice copies the next keys, in order, with their value to a new log, after the records logged since the
+ * previous slice for the keys already copied. The new log replaces the misc log once every key is copied.
+ * \param[in, out] progress Progress of the compaction (resumeKey is the next key to copy).
+ * \param[in] maxPages SEG_COMPACT_KEYS_BY_PAGE keys are copied by page.
+ * \return false on error, the pass starts again at the next slice.
+ */
+bool DBAccessSegments::dbw_compact_slice(DBCompactProgress &progress, const unsigned int maxPages) {
+  boost::mutex::scoped_lock lock(miscMutex);
+  string path = dir + "misc.log", pathTmp = dir + "misc.log.tmp";
+  if (compactLog == NULL) {
+    /// New pass
+    compactLog = fopen(pathTmp.c_str(), "wb");
+    if (compactLog == NULL) {
+      cout << "DB Compaction failed" << endl;
+      return false;
+    }
+    compactLastKey.clear();
+  } else if (!copyMiscTail()) {
+    abortCompaction();
+    cout << "DB Compaction failed" << endl;
+    return false;
+  }
+  
+  /// Next keys, compactLastKey is the smallest key after the last one copied
+  unsigned long maxKeys = (unsigned long) maxPages * SEG_COMPACT_KEYS_BY_PAGE;
+  map<string, string>::iterator it = misc.lower_bound(compactLastKey);
+  for (unsigned long nbKeys = 0; it != misc.end() && nbKeys < maxKeys; it++, nbKeys++) {
+    writeMiscRecord(compactLog, 0, it->first, &it->second);
+    compactLastKey = it->first + '\0';
+  }
+  compactOffset = fileSize(miscLog);
+  progress.slices++;
+  if (compactOffset < 0) {
+    abortCompaction();
+    cout << "DB Compaction failed" << endl;
+    return false;
+  }
+  if (it != misc.end()) {
+    progress.resumeKey = it->first;
+    return true;
+  }
+  
+  /// Every key copied : the new log replaces the misc log
+  if (fflush(compactLog) != 0 || fsync(fileno(compactLog)) != 0 || rename(pathTmp.c_str(), path.c_str()) != 0) {
+    abortCompaction();
+    cout << "DB Compaction failed" << endl;
+    return false;
+  }
+  fclose(miscLog);
+  miscLog = compactLog;
+  compactLog = NULL;
+  progress.resumeKey.clear();
+  progress.passes++;
+  return true;
+}
+
+/*!
+ * \fn unsigned long DBAccessSegments::dbw_warmup(const vector<string> &prefixes)
+ * \brief Ask the system to load the segments of the days found in the prefixes.
+ *
+ * \param[in] prefixes Prefixes of the keys to load. Ex: module/w/1/2013-11-04
+ * \return Number of records of the segments loaded.
+ */
+unsigned long DBAccessSegments::dbw_warmup(const vector<string> &prefixes) {
+  unsigned long nbRecords = 0;
+  set<string> setDays;
+  StatKey statKey;
+  vector<string>::const_iterator it;
+  for (it = prefixes.begin(); it != prefixes.end(); it++) {
+    if (parseStatKey(*it, statKey)) {
+      setDays.insert(statKey.date);
+    }
+  }
+  const DBTier tiers[3] = { TIER_MINUTES, TIER_10MINUTES, TIER_HOURS };
+  const uint32_t tiersSlots[3] = { DB_TIMES_MINUTES_SIZE, DB_TIMES_SIZE, DB_TIMES_HOURS_SIZE };
+  set<string>::iterator itDay;
+  for (itDay = setDays.begin(); itDay != setDays.end(); itDay++) {
+    for (int i = 0; i < 3; i++) {
+      boost::shared_ptr<Segment> segment = getSegment(*itDay + tierExtension(tiers[i]), tiersSlots[i], false);
+      if (segment) {
+        segment->willNeed();
+        nbRecords += segment->nbRecords();
+      }
+    }
+  }
+  return nbRecords;
+}
+
+void DBAccessSegments::dbw_close() {
+  {
+    boost::mutex::scoped_lock lock(segmentsMutex);
+    segments.clear();
+  }
+  boost::mutex::scoped_lock lock(miscMutex);
+  abortCompaction();
+  misc.clear();
+  if (miscLog != NULL) {
+    fclose(miscLog);
+    miscLog = NULL;
+  }
+}
+
+/*!
+ * \fn void DBAccessSegments::dbw_drop(const char *basedir)
+ * \brief Close the DB and remove its folder : the segment files and the misc log.
+ *
+ * \param[in] basedir Not used, the folder is the one of the last dbw_open.
+ */
+void DBAccessSegments::dbw_drop(const char *basedir) {
+  dbw_close();
+  if (dir.empty()) {
+    return;
+  }
+  DIR *pDir = opendir(dir.c_str());
+  if (pDir != NULL) {
+    struct dirent *entry;
+    while ((entry = readdir(pDir)) != NULL) {
+      if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+        unlink((dir + entry->d_name).c_str());
+      }
+    }
+    closedir(pDir);
+  }
+  if (rmdir(dir.c_str()) != 0 && errno != ENOENT) {
+    cerr << "Error dropping database: " << dir << endl;
+  }
+}
+
+DBAccessSegments::DBAccessSegments() {
+  miscLog = NULL;
+  compactLog = NULL;
+  compactOffset = 0;
+}
+
+DBAccessSegments DBAccessSegments::singleton;
@@ -0,0 +1,143 @@
+/*!
+ * \file db_access_segments.h
+ * \brief Append-only storage engine of day-partitioned segment files
+ * \author Xavier ETCHEBER
+ */
+
+#ifndef MOOWAPP_STATS_DB_ACCESS_SEGMENTS_H_
+#define MOOWAPP_STATS_DB_ACCESS_SEGMENTS_H_
+
+#include <string>
+#include <vector> // Vector of strings
+#include <map> // Index of series and segments
+#include <stdio.h> // FILE
+#include <stdint.h> // uint32_t
+
+// Boost
+#include <boost/thread/mutex.hpp> // Mutex
+#include <boost/thread/shared_mutex.hpp> // Shared mutex
+#include <boost/shared_ptr.hpp> // Segments shared with readers
+
+// mooWApp
+#include "db_access.h"
+
+#define SEG_SERIES_SIZE 128 //!< Max size of a series name (module/group/type) in a segment record
+#define SEG_INITIAL_RECORDS 64 //!< Number of records allocated at the creation of a segment file
+#define SEG_COMPACT_KEYS_BY_PAGE 16 //!< Keys of the misc log rewritten by a compaction slice for each page asked
+
+/*!
+ * \struct SegmentHeader
+ * \brief Header at the beginning of each segment file.
+ */
+struct SegmentHeader {
+  char magic[8];       //!< "MWSEG01"
+  uint32_t nbSlots;    //!< Number of counters in each record
+  uint32_t nbRecords;  //!< Number of records written (the file may be larger)
+};
+
+/*!
+ * \class Segment
+ * \brief A segment file mapped in memory : one record per series, each record is a fixed array of counters.
+ *
+ * Record layout : series name (SEG_SERIES_SIZE bytes) followed by nbSlots counters of 32 bits.
+ */
+class Segment {
+public:
+  Segment(const std::string &path, const uint32_t nbSlots);
+  ~Segment();
+
+  bool open(const bool create);
+  void close();
+  bool read(const std::string &series, const uint32_t slot, uint32_t &value);
+  bool readAll(const std::string &series, uint32_t *values);
+  uint32_t add(const std::string &series, const uint32_t slot, const uint32_t delta);
+  void set(const std::string &series, const uint32_t slot, const uint32_t value);
+  void sync();
+  void willNeed();
+  uint32_t nbRecords() const { return index.size(); }
+
+private:
+  std::string path;     //!< Path of the segment file
+  uint32_t nbSlots;     //!< Number of counters in each record
+  int fd;               //!< File descriptor
+  char *data;           //!< Mapping of the file
+  size_t mappedSize;    //!< Size of the mapping
+  std::map<std::string, uint32_t> index; //!< Record number of each series
+  boost::shared_mutex mutex; //!< Shared for counters access, exclusive to append a record or remap the file
+
+  size_t recordSize() const { return SEG_SERIES_SIZE + nbSlots * sizeof(uint32_t); }
+  uint32_t *counters(const uint32_t record) { return (uint32_t *) (data + sizeof(SegmentHeader) + record * recordSize() + SEG_SERIES_SIZE); }
+  bool remap(const size_t size);
+  uint32_t appendRecord(const std::string &series);
+};
+
+/*!
+ * \class DBAccessSegments
+ * \brief Storage engine designed for the stats : append-only, memory mapped, day-partitioned segment files.
+ *
+ * Counters (minutes, 10 minutes and hours) are stored in one segment file per day and per tier and the days
+ * counters in one segment file per month, so that the retention of a tier is a file unlink.
+ * Any other key (modules list, response times and sizes...) is stored in an append-only log replayed in memory at open :
+ * appends and merges log their delta only, the compaction rewrites the log with the values by slices.
+ */
+class DBAccessSegments : public DBAccess
+{
+public:
+  bool dbw_open(const std::string baseDir, const std::string dbFileName);
+  std::string dbw_get(const std::string strKey, const int flags = 0);
+  int dbw_read(const std::string &strKey, std::string &value);
+  int dbw_read_counters(const std::string &series, const std::string &strPeriod, const DBTier tier, std::vector<unsigned int> &counters);
+  int dbw_add(const std::string strKey, const std::string strValue);
+  unsigned int dbw_increment(const std::string strKey, const unsigned int delta = 1);
+  bool dbw_append(const std::string strKey, const std::string strValue, const char separator = ',');
+  bool dbw_merge(const std::string strKey, const std::string strValue, DBMergeFunc merge);
+  void dbw_remove(const std::string strKey);
+  bool dbw_write(const DBBatch &batch);
+  bool dbw_remove_day(const std::string strDay, const DBTier tier);
+  void dbw_begin_snapshot() {} //!< Counters are read without lock, nothing to do
+  void dbw_end_snapshot() {}
+  bool dbw_in_snapshot() { return false; }
+  void dbw_flush();
+  void dbw_compact();
+  bool dbw_compact_slice(DBCompactProgress &progress, const unsigned int maxPages);
+  unsigned long dbw_warmup(const std::vector<std::string> &prefixes);
+  void dbw_close();
+  void dbw_drop(const char *basedir);
+
+  // Getter of singleton
+  static DBAccessSegments &get() throw() {
+    return singleton;
+  }
+
+private:
+  static DBAccessSegments singleton;
+  std::string dir; //!< Folder of the segment files
+  std::map<std::string, boost::shared_ptr<Segment> > segments; //!< Opened segments by file name
+  boost::mutex segmentsMutex; //!< Mutex for the map of segments
+  std::map<std::string, std::string> misc; //!< Keys which are not counters
+  FILE *miscLog; //!< Append-only log of the keys which are not counters
+  boost::mutex miscMutex; //!< Mutex for the keys which are not counters
+  FILE *compactLog; //!< Log being rewritten by the compaction slices, NULL between passes
+  long compactOffset; //!< Position in the misc log of the records not yet copied to the log being rewritten
+  std::string compactLastKey; //!< Last key copied to the log being rewritten
+
+  boost::shared_ptr<Segment> getSegment(const StatKey &statKey, const bool create, uint32_t &slot);
+  boost::shared_ptr<Segment> getSegment(const std::string &fileName, const uint32_t nbSlots, const bool create);
+  bool loadMisc();
+  void replayMisc(const uint32_t keyFlags, const std::string &strKey, const std::string *strValue);
+  void writeMisc(const std::string &strKey, const std::string *strValue, const uint32_t keyFlags = 0);
+  bool copyMiscTail();
+  void abortCompaction();
+
+  /*!
+   * \fn DBAccessSegments()
+   * \brief Constructor
+   */
+  DBAccessSegments();
+
+  // Protection against copy -> Do not define these
+  DBAccessSegments(const DBAccessSegments&);
+  void operator=(const DBAccessSegments&);
+};
+
+#endif // MOOWAPP_STATS_DB_ACCESS_SEGMENTS_H_
@@ -0,0 +1,239 @@
+/*!
+ * \file dirty_index.cpp
+ * \brief Index of the days and modules changed by the log readers for mooWApp
+ * \author Xavier ETCHEBER
+ */
+
+#include <iostream>
+#include <string>
+#include <map> // Days
+#include <set> // Modules
+#include <vector> // Splited minutes
+#include <fstream> // ifstream
+#include <sstream> // istringstream
+#include <algorithm> // min
+#include <stdio.h> // fopen, fprintf, fclose, rename, sscanf
+
+// Boost
+#include <boost/algorithm/string.hpp> // Split
+
+// mooWApp
+#include "global.h"
+#include "dirty_index.h"
+
+using namespace std;
+
+DirtyIndex::DirtyIndex() {
+  opened = false;
+  changed = false;
+}
+
+/*!
+ * \fn bool DirtyIndex::open(const string &indexFile)
+ * \brief Enable the index and load its last save.
+ *
+ * \param[in] indexFile File the index is saved to and loaded from.
+ * \return false if there was no index yet (the days stored before are not known).
+ */
+bool DirtyIndex::open(const string &indexFile) {
+  boost::mutex::scoped_lock lock(mutex);
+  this->indexFile = indexFile;
+  opened = true;
+  rtSz.clear();
+  retention.clear();
+
+  ifstream indexIn(indexFile.c_str());
+  if (!indexIn.is_open()) {
+    return false;
+  }
+  string line, kind, day, module, minutes; // module is the group of pages on "g" lines
+  int stage;
+  while (getline(indexIn, line)) {
+    istringstream iss(line);
+    iss >> kind >> day;
+    if (kind == "r" && iss >> module) {
+      set<unsigned short> &dirtyMinutes = rtSz[day][module];
+      if (iss >> minutes) {
+        vector<string> strMinutes;
+        boost::split(strMinutes, minutes, boost::is_any_of(","));
+        for (vector<string>::iterator it = strMinutes.begin(); it != strMinutes.end(); it++) {
+          unsigned short minute;
+          if (sscanf(it->c_str(), "%hu", &minute) == 1 && minute < DB_TIMES_MINUTES_SIZE) {
+            dirtyMinutes.insert(minute);
+          }
+        }
+      } else {
+        /// No list of minutes : every minute of the day
+        for (unsigned short minute = 0; minute < DB_TIMES_MINUTES_SIZE; minute++) {
+          dirtyMinutes.insert(minute);
+        }
+      }
+    } else if (kind == "d" && iss >> stage >> module) {
+      DirtyDay &dirtyDay = retention[day];
+      dirtyDay.stage = stage;
+      dirtyDay.modules.insert(module);
+    } else if (kind == "g" && iss >> stage >> module) {
+      retention[day].groupStages[module] = stage;
+    }
+  }
+  indexIn.close();
+  cout << "Dirty index loaded: " << retention.size() << " days to retain, " << rtSz.size() << " days to calculate." << endl;
+  return true;
+}
+
+/*!
+ * \fn void DirtyIndex::mark(const map<string, DirtyModules> &dayModules)
+ * \brief Mark days, modules and minutes written by a log reader.
+ *
+ * \param[in] dayModules Modules of each day written, with the minutes of their response sizes and times.
+ */
+void DirtyIndex::mark(const map<string, DirtyModules> &dayModules) {
+  if (!opened || dayModules.empty()) {
+    return;
+  }
+  boost::mutex::scoped_lock lock(mutex);
+  for (map<string, DirtyModules>::const_iterator itDay = dayModules.begin(); itDay != dayModules.end(); itDay++) {
+    DirtyModules &dirtyModules = rtSz[itDay->first];
+    DirtyDay &dirtyDay = retention[itDay->first];
+    /// Late lines of an old day : its tiers are written again, the retention has to start over
+    dirtyDay.stage = STAGE_NEW;
+    dirtyDay.groupStages.clear();
+    for (DirtyModules::const_iterator it = (itDay->second).begin(); it != (itDay->second).end(); it++) {
+      if (!(it->second).empty()) {
+        dirtyModules[it->first].insert((it->second).begin(), (it->second).end());
+      }
+      dirtyDay.modules.insert(it->first);
+    }
+  }
+  changed = true;
+}
+
+/*!
+ * \fn void DirtyIndex::markRtSz(const string &day, const DirtyModules &modules)
+ * \brief Put back minutes not calculated by the RtSz job.
+ *
+ * \param[in] day Day. Ex: 2011-04-24
+ * \param[in] modules Minutes of each module of the day.
+ */
+void DirtyIndex::markRtSz(const string &day, const DirtyModules &modules) {
+  if (!opened || modules.empty()) {
+    return;
+  }
+  boost::mutex::scoped_lock lock(mutex);
+  DirtyModules &dirtyModules = rtSz[day];
+  for (DirtyModules::const_iterator it = modules.begin(); it != modules.end(); it++) {
+    dirtyModules[it->first].insert((it->second).begin(), (it->second).end());
+  }
+  changed = true;
+}
+
+/*!
+ * \fn void DirtyIndex::takeRtSz(map<string, DirtyModules> &dayModules)
+ * \brief Get and empty the minutes with response sizes and times to calculate.
+ *
+ * \param[out] dayModules Minutes of each module of each day.
+ */
+void DirtyIndex::takeRtSz(map<string, DirtyModules> &dayModules) {
+  boost::mutex::scoped_lock lock(mutex);
+  dayModules.clear();
+  dayModules.swap(rtSz);
+  changed = changed || !dayModules.empty();
+}
+
+/*!
+ * \fn void DirtyIndex::retentionDays(map<string, DirtyDay> &days)
+ * \brief Get the days with stats not fully removed by the retention.
+ *
+ * \param[out] days Modules and retention stage of each day.
+ */
+void DirtyIndex::retentionDays(map<string, DirtyDay> &days) {
+  boost::mutex::scoped_lock lock(mutex);
+  days = retention;
+}
+
+/*!
+ * \fn void DirtyIndex::setStages(const string &day, const map<string, int> &groupStages, const bool done)
+ * \brief Record the retention applied to each group of pages of a day, the day leaves the index once its retention is done.
+ *
+ * \param[in] day Day. Ex: 2011-04-24
+ * \param[in] groupStages RetentionStage reached by each group of pages.
+ * \param[in] done Every tier to remove with the current retention is removed.
+ */
+void DirtyIndex::setStages(const string &day, const map<string, int> &groupStages, const bool done) {
+  boost::mutex::scoped_lock lock(mutex);
+  map<string, DirtyDay>::iterator it = retention.find(day);
+  if (it == retention.end()) {
+    return;
+  }
+  changed = true;
+  if (done) {
+    retention.erase(it);
+    return;
+  }
+  /// Stage of the day is the one of the group the less retained, the others are kept aside
+  DirtyDay &dirtyDay = it->second;
+  map<string, int>::const_iterator itGroup;
+  dirtyDay.stage = STAGE_DAYS_REMOVED;
+  for (itGroup = groupStages.begin(); itGroup != groupStages.end(); itGroup++) {
+    dirtyDay.stage = min(dirtyDay.stage, itGroup->second);
+  }
+  if (groupStages.empty()) {
+    dirtyDay.stage = STAGE_NEW;
+  }
+  dirtyDay.groupStages.clear();
+  for (itGroup = groupStages.begin(); itGroup != groupStages.end(); itGroup++) {
+    if (itGroup->second > dirtyDay.stage) {
+      dirtyDay.groupStages.insert(*itGroup);
+    }
+  }
+}
+
+/*!
+ * \fn bool DirtyIndex::save()
+ * \brief Save the index if it changed (written aside then renamed, so that a crash keeps the previous one).
+ *
+ * \return false on error.
+ */
+bool DirtyIndex::save() {
+  if (!opened) {
+    return false;
+  }
+  boost::mutex::scoped_lock lock(mutex);
+  if (!changed) {
+    return true;
+  }
+  string tmpFile = indexFile + ".tmp";
+  FILE *pFile = fopen(tmpFile.c_str(), "wb");
+  if (pFile == NULL) {
+    cerr << "Error opening dirty index: " << tmpFile << endl;
+    return false;
+  }
+  bool ok = true;
+  for (map<string, DirtyModules>::iterator itDay = rtSz.begin(); ok && itDay != rtSz.end(); itDay++) {
+    for (DirtyModules::iterator it = (itDay->second).begin(); ok && it != (itDay->second).end(); it++) {
+      if ((it->second).empty()) continue;
+      ok = fprintf(pFile, "r %s %s ", (itDay->first).c_str(), (it->first).c_str()) > 0;
+      for (set<unsigned short>::iterator itMinute = (it->second).begin(); ok && itMinute != (it->second).end(); itMinute++) {
+        ok = fprintf(pFile, itMinute == (it->second).begin() ? "%hu" : ",%hu", *itMinute) > 0;
+      }
+      ok = ok && fprintf(pFile, "\n") > 0;
+    }
+  }
+  for (map<string, DirtyDay>::iterator itDay = retention.begin(); ok && itDay != retention.end(); itDay++) {
+    for (set<string>::iterator it = (itDay->second).modules.begin(); ok && it != (itDay->second).modules.end(); it++) {
+      ok = fprintf(pFile, "d %s %d %s\n", (itDay->first).c_str(), (itDay->second).stage, it->c_str()) > 0;
+    }
+    for (map<string, int>::iterator it = (itDay->second).groupStages.begin(); ok && it != (itDay->second).groupStages.end(); it++) {
+      ok = fprintf(pFile, "g %s %d %s\n", (itDay->first).c_str(), it->second, (it->first).c_str()) > 0;
+    }
+  }
+  if (fclose(pFile) != 0 || !ok || rename(tmpFile.c_str(), indexFile.c_str()) != 0) {
+    cerr << "Error writing dirty index: " << indexFile << endl;
+    remove(tmpFile.c_str());
+    return false;
+  }
+  changed = false;
+  return true;
+}
+
+DirtyIndex DirtyIndex::singleton;
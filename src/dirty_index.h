@@ -0,0 +1,100 @@
+/*!
+ * \file dirty_index.h
+ * \brief Index of the days and modules changed by the log readers for mooWApp
+ * \author Xavier ETCHEBER
+ */
+
+#ifndef MOOWAPP_STATS_DIRTY_INDEX_H_
+#define MOOWAPP_STATS_DIRTY_INDEX_H_
+
+#include <string>
+#include <map> // Days
+#include <set> // Modules
+
+// Boost
+#include <boost/thread/mutex.hpp> // Mutex
+
+/*!
+ * \enum RetentionStage
+ * \brief Tiers of a day already removed by the retention.
+ */
+enum RetentionStage {
+  STAGE_NEW = 0,             //!< Every tier of the day is stored
+  STAGE_MINUTES_REMOVED = 1, //!< Minutes stats removed
+  STAGE_DETAILS_REMOVED = 2, //!< Minutes and 10 minutes stats removed
+  STAGE_HOURS_REMOVED = 3,   //!< Only days, weeks and months totals left
+  STAGE_DAYS_REMOVED = 4     //!< Only weeks and months totals left
+};
+
+/*!
+ * \struct DirtyDay
+ * \brief Modules with stats in a day and the retention already applied to them.
+ */
+struct DirtyDay {
+  int stage;                       //!< RetentionStage reached by every group of pages of the day
+  std::map<std::string, int> groupStages; //!< RetentionStage of the groups of pages ahead of stage (retention of their own)
+  std::set<std::string> modules;   //!< Modules with stats in the day
+
+  DirtyDay() : stage(STAGE_NEW) {}
+
+  /*!
+   * \fn int stageOf(const std::string &group) const
+   * \brief RetentionStage of a group of pages. Ex: w
+   */
+  int stageOf(const std::string &group) const {
+    std::map<std::string, int>::const_iterator it = groupStages.find(group);
+    return (it != groupStages.end()) ? it->second : stage;
+  }
+};
+
+typedef std::map<std::string, std::set<unsigned short> > DirtyModules; //!< Minutes with response sizes and times of each module
+
+/*!
+ * \class DirtyIndex
+ * \brief Days and modules written by the log readers, consumed by the background jobs so that they only
+ * go through what changed instead of every day of the calendar.
+ *
+ * Two lists are kept :
+ * - the minutes of the days and modules with response sizes and times not calculated yet (RtSz job),
+ * - the days and modules with stats not fully removed by the retention yet (compression job).
+ * The index is saved to a text file, one line per day and module, and per day and group of pages ahead of its day.
+ * Ex: "r 2011-04-24 module 903,904", "d 2011-04-24 1 module" or "g 2011-04-24 2 w"
+ */
+class DirtyIndex
+{
+public:
+  bool open(const std::string &indexFile);
+  bool isOpened() const { return opened; }
+  void mark(const std::map<std::string, DirtyModules> &dayModules);
+  void markRtSz(const std::string &day, const DirtyModules &modules);
+  void takeRtSz(std::map<std::string, DirtyModules> &dayModules);
+  void retentionDays(std::map<std::string, DirtyDay> &days);
+  void setStages(const std::string &day, const std::map<std::string, int> &groupStages, const bool done);
+  bool save();
+
+  // Getter of singleton
+  static DirtyIndex &get() throw() {
+    return singleton;
+  }
+
+private:
+  static DirtyIndex singleton;
+  bool opened;               //!< Opened by the server and the insertion tool
+  bool changed;              //!< Changed since the last save
+  std::string indexFile;     //!< File the index is saved to and loaded from
+  std::map<std::string, DirtyModules> rtSz;          //!< Minutes of each day and module with response sizes and times to calculate
+  std::map<std::string, DirtyDay> retention;         //!< Modules of each day with stats to remove by the retention
+  boost::mutex mutex;        //!< Mutex for the lists
+
+  /*!
+   * \fn DirtyIndex()
+   * \brief Constructor
+   */
+  DirtyIndex();
+
+  // Protection against copy -> Do not define these
+  DirtyIndex(const DirtyIndex&);
+  void operator=(const DirtyIndex&);
+};
+
+#endif // MOOWAPP_STATS_DIRTY_INDEX_H_
@@ -23,7 +23,20 @@ static const std::string format("%d/%b/%Y");
 
 static const char *standard_json_reply = "HTTP/1.1 200 OK\r\n"
   "Content-Type: application/json; charset=utf-8\r\n"
-  "Cache: no-cache\r\n"
+  "Cache-Control: no-cache\r\n"
+  "Access-Control-Allow-Origin: *\r\n"
+  "X-Powered-By: IHM-Stat-Server\r\n"
+  "Connection: close\r\n\r\n";
+
+static const char *standard_not_modified_reply = "HTTP/1.1 304 Not Modified\r\n"
+  "Cache-Control: no-cache\r\n"
+  "Access-Control-Allow-Origin: *\r\n"
+  "X-Powered-By: IHM-Stat-Server\r\n"
+  "Connection: close\r\n\r\n";
+
+static const char *standard_msgpack_reply = "HTTP/1.1 200 OK\r\n"
+  "Content-Type: application/x-msgpack\r\n"
+  "Cache-Control: no-cache\r\n"
   "Access-Control-Allow-Origin: *\r\n"
   "X-Powered-By: IHM-Stat-Server\r\n"
   "Connection: close\r\n\r\n";
@@ -139,6 +152,7 @@ static const std::string dbTimesHours [DB_TIMES_HOURS_SIZE] = {
 
 static const std::string KEY_MODULES("modules");
 static const std::string KEY_DELETED_MODULES("modules-deleted");
+static const std::string KEY_APPS("apps");
 
 /*!
  * \fn int getMonth(const string &month)
@@ -0,0 +1,588 @@
+/*!
+ * \file hot_tier.cpp
+ * \brief In-memory tier of the most recent minute stats for mooWApp
+ * \author Xavier ETCHEBER
+ */
+
+#include <iostream>
+#include <string>
+#include <vector> // Ring of days
+#include <map> // Series
+#include <algorithm> // fill, copy
+#include <stdio.h> // fopen, fread, fwrite, fclose, rename, sscanf
+#include <string.h> // memcmp
+#include <unistd.h> // fsync
+
+// Boost
+#include <boost/thread/locks.hpp> // Locks of mutex
+#include <boost/date_time/posix_time/posix_time.hpp> // Current time
+#include <boost/date_time/gregorian/gregorian.hpp> // Day numbers
+
+// mooWApp
+#include "global.h"
+#include "db_access.h"
+#include "hot_tier.h"
+
+using namespace std;
+
+static const char HOT_MAGIC[8] = "MWHOT01"; //!< First bytes of a checkpoint file
+static const int HOT_MAX_DAYS = 3660;       //!< Size of ring above which a checkpoint is taken as corrupt
+
+/*!
+ * \fn static long dayNumber(const string &date)
+ * \brief Give the day number of a date.
+ *
+ * \param[in] date Day. Ex: 2011-04-24
+ * \return The day number, -1 if the date is not valid.
+ */
+static long dayNumber(const string &date) {
+  unsigned int year = 0, month = 0, day = 0;
+  if (sscanf(date.c_str(), "%4u-%2u-%2u", &year, &month, &day) != 3) {
+    return -1;
+  }
+  try {
+    return boost::gregorian::date(year, month, day).day_number();
+  } catch(exception &e) {
+    return -1;
+  }
+}
+
+/*!
+ * \struct HotCheckpoint
+ * \brief Content of a checkpoint file, with the size of ring it was written with.
+ */
+struct HotCheckpoint {
+  int32_t nbDays;        //!< Number of days in the ring
+  int64_t coveredSince;  //!< First minute fed to the tier
+  vector<long> ringDays; //!< Day number held by each slot of the ring (-1 if empty)
+  map<string, vector<uint32_t> > series; //!< Counters of each series (nbDays * minutes a day)
+};
+
+/*!
+ * \fn static int readCheckpoint(const string &checkpointFile, HotCheckpoint &checkpoint)
+ * \brief Read a checkpoint file, whatever the size of the ring it was written with.
+ *
+ * \param[in] checkpointFile File to read.
+ * \param[out] checkpoint Content of the file.
+ * \return 1 if read, 0 if there is no checkpoint, -1 if the file is not usable.
+ */
+static int readCheckpoint(const string &checkpointFile, HotCheckpoint &checkpoint) {
+  FILE *pFile = fopen(checkpointFile.c_str(), "rb");
+  if (pFile == NULL) {
+    return 0;
+  }
+
+  char magic[sizeof(HOT_MAGIC)];
+  uint32_t nbSeries = 0;
+  checkpoint.series.clear();
+  bool ok = fread(magic, sizeof(magic), 1, pFile) == 1 && memcmp(magic, HOT_MAGIC, sizeof(HOT_MAGIC)) == 0
+         && fread(&checkpoint.nbDays, sizeof(checkpoint.nbDays), 1, pFile) == 1
+         && checkpoint.nbDays >= 1 && checkpoint.nbDays <= HOT_MAX_DAYS
+         && fread(&checkpoint.coveredSince, sizeof(checkpoint.coveredSince), 1, pFile) == 1;
+  if (ok) {
+    checkpoint.ringDays.assign(checkpoint.nbDays, -1);
+  }
+  for (int i = 0; ok && i < checkpoint.nbDays; i++) {
+    int64_t iDay;
+    ok = fread(&iDay, sizeof(iDay), 1, pFile) == 1;
+    checkpoint.ringDays[i] = iDay;
+  }
+  ok = ok && fread(&nbSeries, sizeof(nbSeries), 1, pFile) == 1;
+  for (uint32_t i = 0; ok && i < nbSeries; i++) {
+    uint32_t nameSize = 0;
+    ok = fread(&nameSize, sizeof(nameSize), 1, pFile) == 1 && nameSize < 1024;
+    if (!ok) break;
+    string name(nameSize, '\0');
+    vector<uint32_t> counters(checkpoint.nbDays * DB_TIMES_MINUTES_SIZE);
+    ok = fread(&name[0], 1, nameSize, pFile) == nameSize
+      && fread(&counters[0], sizeof(uint32_t), counters.size(), pFile) == counters.size();
+    if (ok) {
+      checkpoint.series[name].swap(counters);
+    }
+  }
+  fclose(pFile);
+  return ok ? 1 : -1;
+}
+
+/*!
+ * \fn static bool flushDay(const HotCheckpoint &checkpoint, const int slot)
+ * \brief Add the covered minutes of the day held by a slot of a checkpoint to the minute keys in DB.
+ *
+ * \param[in] checkpoint Checkpoint read.
+ * \param[in] slot Slot of the day in the ring of the checkpoint.
+ * \return false on DB error.
+ */
+static bool flushDay(const HotCheckpoint &checkpoint, const int slot) {
+  long day = checkpoint.ringDays[slot];
+  if (day < 0) {
+    return true;
+  }
+  DBAccess &dbA = DBAccess::get();
+  string strDate = boost::gregorian::to_iso_extended_string(
+    boost::gregorian::date(boost::gregorian::gregorian_calendar::from_day_number(day)));
+  for (map<string, vector<uint32_t> >::const_iterator it = checkpoint.series.begin(); it != checkpoint.series.end(); it++) {
+    const uint32_t *minutes = &(it->second)[slot * DB_TIMES_MINUTES_SIZE];
+    for (unsigned int i = 0; i < DB_TIMES_MINUTES_SIZE; i++) {
+      if (minutes[i] == 0 || day * DB_TIMES_MINUTES_SIZE + i < checkpoint.coveredSince) continue;
+      if (dbA.dbw_increment(it->first+'/'+strDate+'/'+dbTimesMinutes[i], minutes[i]) == 0) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/*!
+ * \fn static bool flushCheckpoint(const string &checkpointFile, const HotCheckpoint &checkpoint)
+ * \brief Add every day of a checkpoint to the minute keys in DB, then remove the file so that it is not added twice.
+ *
+ * \return false on DB error, the file is kept.
+ */
+static bool flushCheckpoint(const string &checkpointFile, const HotCheckpoint &checkpoint) {
+  for (int i = 0; i < checkpoint.nbDays; i++) {
+    if (!flushDay(checkpoint, i)) {
+      cerr << "Error writing the hot tier checkpoint " << checkpointFile << " in DB." << endl;
+      return false;
+    }
+  }
+  DBAccess::get().dbw_flush();
+  if (remove(checkpointFile.c_str()) != 0) {
+    cerr << "Error removing the hot tier checkpoint " << checkpointFile << " written in DB." << endl;
+    return false;
+  }
+  cout << "Hot tier checkpoint written in DB: " << checkpoint.series.size() << " series." << endl;
+  return true;
+}
+
+HotTier::HotTier() {
+  enabled = false;
+  nbDays = 0;
+  coveredSince = 0;
+  changes = 0;
+  savedChanges = 0;
+}
+
+/*!
+ * \fn bool HotTier::open(const string &checkpointFile, const int nbDays)
+ * \brief Enable the hot tier and load its last checkpoint.
+ *
+ * \param[in] checkpointFile File the tier is saved to and loaded from.
+ * \param[in] nbDays Number of days kept in memory.
+ * \return false if the tier can not be enabled : the checkpoint can not be read or written in DB.
+ */
+bool HotTier::open(const string &checkpointFile, const int nbDays) {
+  boost::unique_lock<boost::shared_mutex> lock(mutex);
+  if (nbDays < 1 || nbDays > HOT_MAX_DAYS) {
+    return false;
+  }
+  this->checkpointFile = checkpointFile;
+  this->nbDays = nbDays;
+  ringDays.assign(nbDays, -1);
+  series.clear();
+
+  int loaded = load();
+  if (loaded < 0) {
+    return false;
+  }
+  if (loaded == 2) {
+    /// Resized ring saved at once, the days written in DB are not in it anymore
+    changes++;
+    enabled = true;
+    lock.unlock();
+    return checkpoint();
+  }
+  if (loaded == 0) {
+    /// No checkpoint : the minutes before now are in DB (a checkpoint not loaded is written in DB first)
+    boost::posix_time::ptime now(boost::posix_time::second_clock::local_time());
+    coveredSince = now.date().day_number() * DB_TIMES_MINUTES_SIZE
+                 + now.time_of_day().hours() * 60 + now.time_of_day().minutes();
+    ringDays.assign(nbDays, -1);
+    series.clear();
+  }
+  enabled = true;
+  return true;
+}
+
+/*!
+ * \fn bool HotTier::flush(const string &checkpointFile)
+ * \brief Write the last checkpoint in DB when the tier is not enabled, so that its minutes are not lost.
+ *
+ * \param[in] checkpointFile File the tier was saved to.
+ * \return false if the checkpoint can not be read or written in DB.
+ */
+bool HotTier::flush(const string &checkpointFile) {
+  HotCheckpoint checkpoint;
+  int status = readCheckpoint(checkpointFile, checkpoint);
+  if (status < 0) {
+    cerr << "Hot tier checkpoint " << checkpointFile << " is not usable." << endl;
+    return false;
+  }
+  return status == 0 || flushCheckpoint(checkpointFile, checkpoint);
+}
+
+/*!
+ * \fn bool HotTier::covered(const long day, const unsigned short minute) const
+ * \brief Tell if a minute has been fed to the tier since the beginning.
+ */
+bool HotTier::covered(const long day, const unsigned short minute) const {
+  return day * DB_TIMES_MINUTES_SIZE + minute >= coveredSince;
+}
+
+/*!
+ * \fn bool HotTier::add(const string &series, const string &date, const unsigned short minute, const uint32_t delta)
+ * \brief Add visits to a minute counter.
+ *
+ * \param[in] series Series of the counter. Ex: module/w/1
+ * \param[in] date Day of the counter. Ex: 2011-04-24
+ * \param[in] minute Minute in the day (hour*60 + minute).
+ * \param[in] delta Visits to add.
+ * \return false if the minute is not covered by the tier, the counter has to be stored in DB.
+ */
+bool HotTier::add(const string &series, const string &date, const unsigned short minute, const uint32_t delta/* = 1 */) {
+  if (!enabled || minute >= DB_TIMES_MINUTES_SIZE) {
+    return false;
+  }
+  long day = dayNumber(date);
+  if (day < 0) {
+    return false;
+  }
+  unsigned int slot = day % nbDays;
+
+  /// Usual case : day in the ring and series known, counters are updated atomically
+  {
+    boost::shared_lock<boost::shared_mutex> lock(mutex);
+    if (ringDays[slot] > day || !covered(day, minute)) {
+      return false; // Too old
+    }
+    if (ringDays[slot] == day) {
+      map<string, vector<uint32_t> >::iterator it = this->series.find(series);
+      if (it != this->series.end()) {
+        __sync_add_and_fetch(&(it->second)[slot * DB_TIMES_MINUTES_SIZE + minute], delta);
+        __sync_add_and_fetch(&changes, 1);
+        return true;
+      }
+    }
+  }
+
+  /// New day (the oldest day of the ring is recycled) or new series
+  boost::unique_lock<boost::shared_mutex> lock(mutex);
+  if (ringDays[slot] > day) {
+    return false;
+  }
+  if (ringDays[slot] < day) {
+    for (map<string, vector<uint32_t> >::iterator it = this->series.begin(); it != this->series.end(); it++) {
+      fill((it->second).begin() + slot * DB_TIMES_MINUTES_SIZE, (it->second).begin() + (slot + 1) * DB_TIMES_MINUTES_SIZE, 0);
+    }
+    ringDays[slot] = day;
+  }
+  vector<uint32_t> &counters = this->series[series];
+  if (counters.empty()) {
+    counters.assign(nbDays * DB_TIMES_MINUTES_SIZE, 0);
+  }
+  counters[slot * DB_TIMES_MINUTES_SIZE + minute] += delta;
+  __sync_add_and_fetch(&changes, 1);
+  return true;
+}
+
+/*!
+ * \fn bool HotTier::get(const string &series, const string &date, const string &slot, unsigned int &value)
+ * \brief Read the visits of a minute, 10 minutes or hour slot.
+ *
+ * \param[in] series Series of the counter. Ex: module/w/1
+ * \param[in] date Day of the counter. Ex: 2011-04-24
+ * \param[in] slot Time slot as in DB keys. Ex: 1503, 150 or 15
+ * \param[out] value Visits in the slot.
+ * \return false if the slot is not (fully) covered by the tier, the value has to be read in DB.
+ */
+bool HotTier::get(const string &series, const string &date, const string &slot, unsigned int &value) {
+  if (!enabled) {
+    return false;
+  }
+  unsigned int hour = 0, minutes = 0, first, count;
+  switch (slot.size()) {
+    case 4: // Minute. Ex: 1503
+      if (sscanf(slot.c_str(), "%2u%2u", &hour, &minutes) != 2) return false;
+      first = hour * 60 + minutes;
+      count = 1;
+      break;
+    case 3: // 10 minutes. Ex: 150
+      if (sscanf(slot.c_str(), "%2u%1u", &hour, &minutes) != 2) return false;
+      first = hour * 60 + minutes * 10;
+      count = 10;
+      break;
+    case 2: // Hour. Ex: 15
+      if (sscanf(slot.c_str(), "%2u", &hour) != 1) return false;
+      first = hour * 60;
+      count = 60;
+      break;
+    default:
+      return false;
+  }
+  if (first + count > DB_TIMES_MINUTES_SIZE) {
+    return false;
+  }
+  long day = dayNumber(date);
+  if (day < 0) {
+    return false;
+  }
+  unsigned int ringSlot = day % nbDays;
+
+  boost::shared_lock<boost::shared_mutex> lock(mutex);
+  if (ringDays[ringSlot] != day || !covered(day, first)) {
+    return false;
+  }
+  value = 0;
+  map<string, vector<uint32_t> >::iterator it = this->series.find(series);
+  if (it != this->series.end()) {
+    const uint32_t *counters = &(it->second)[ringSlot * DB_TIMES_MINUTES_SIZE + first];
+    for (unsigned int i = 0; i < count; i++) {
+      value += counters[i];
+    }
+  }
+  return true;
+}
+
+/*!
+ * \fn int HotTier::readDay(const string &series, const string &date, const unsigned int width, vector<unsigned int> &counters)
+ * \brief Read every minute, 10 minutes or hour slot of a day at once.
+ *
+ * \param[in] series Series of the counters. Ex: module/w/1
+ * \param[in] date Day of the counters. Ex: 2011-04-24
+ * \param[in] width Minutes by slot : 1, 10 or 60.
+ * \param[out] counters Visits of each slot of the day, the slots before the first one covered are set to 0.
+ * \return The first slot covered by the tier (the ones before have to be read in DB), -1 if none is covered.
+ */
+int HotTier::readDay(const string &series, const string &date, const unsigned int width, vector<unsigned int> &counters) {
+  if (!enabled || width == 0 || DB_TIMES_MINUTES_SIZE % width != 0) {
+    return -1;
+  }
+  unsigned int nbSlots = DB_TIMES_MINUTES_SIZE / width;
+  long day = dayNumber(date);
+  if (day < 0) {
+    return -1;
+  }
+  unsigned int ringSlot = day % nbDays;
+
+  boost::shared_lock<boost::shared_mutex> lock(mutex);
+  if (ringDays[ringSlot] != day) {
+    return -1;
+  }
+  /// First slot starting at a covered minute
+  long uncovered = coveredSince - day * DB_TIMES_MINUTES_SIZE;
+  unsigned int first = (uncovered <= 0) ? 0 : (uncovered + width - 1) / width;
+  if (first >= nbSlots) {
+    return -1;
+  }
+  counters.assign(nbSlots, 0);
+  map<string, vector<uint32_t> >::iterator it = this->series.find(series);
+  if (it != this->series.end()) {
+    const uint32_t *minutes = &(it->second)[ringSlot * DB_TIMES_MINUTES_SIZE];
+    for (unsigned int i = first * width; i < DB_TIMES_MINUTES_SIZE; i++) {
+      counters[i / width] += minutes[i];
+    }
+  }
+  return first;
+}
+
+/*!
+ * \fn bool HotTier::sumDay(const string &series, const vector<string> &members, const string &date)
+ * \brief Replace the covered minutes of a day of a series by the sum of the same minutes of other series.
+ *
+ * \param[in] series Series rebuilt. Ex: @Calendar/w/1
+ * \param[in] members Series summed up. Ex: cal_web/w/1, cal_ws/w/1
+ * \param[in] date Day of the counters. Ex: 2011-04-24
+ * \return false if no minute of the day is covered by the tier, the minutes are in DB.
+ */
+bool HotTier::sumDay(const string &series, const vector<string> &members, const string &date) {
+  if (!enabled) {
+    return false;
+  }
+  long day = dayNumber(date);
+  if (day < 0) {
+    return false;
+  }
+  unsigned int ringSlot = day % nbDays;
+
+  boost::unique_lock<boost::shared_mutex> lock(mutex);
+  if (ringDays[ringSlot] != day) {
+    return false;
+  }
+  long uncovered = coveredSince - day * DB_TIMES_MINUTES_SIZE;
+  unsigned int first = (uncovered <= 0) ? 0 : (unsigned int)min(uncovered, (long)DB_TIMES_MINUTES_SIZE);
+  if (first >= DB_TIMES_MINUTES_SIZE) {
+    return false;
+  }
+  vector<uint32_t> sums(DB_TIMES_MINUTES_SIZE, 0);
+  bool any = false;
+  for (vector<string>::const_iterator itMember = members.begin(); itMember != members.end(); itMember++) {
+    map<string, vector<uint32_t> >::const_iterator it = this->series.find(*itMember);
+    if (it == this->series.end()) continue;
+    const uint32_t *minutes = &(it->second)[ringSlot * DB_TIMES_MINUTES_SIZE];
+    for (unsigned int i = first; i < DB_TIMES_MINUTES_SIZE; i++) {
+      sums[i] += minutes[i];
+      any = any || minutes[i] != 0;
+    }
+  }
+  map<string, vector<uint32_t> >::iterator it = this->series.find(series);
+  if (it == this->series.end()) {
+    if (!any) {
+      return true;
+    }
+    it = this->series.insert(make_pair(series, vector<uint32_t>(nbDays * DB_TIMES_MINUTES_SIZE, 0))).first;
+  }
+  copy(sums.begin() + first, sums.end(), (it->second).begin() + ringSlot * DB_TIMES_MINUTES_SIZE + first);
+  changes++;
+  return true;
+}
+
+/*!
+ * \fn bool HotTier::checkpoint()
+ * \brief Save the tier to its checkpoint file (written aside then renamed, so that a crash keeps the previous one).
+ * Called by the log readers before they save their position, nothing is written if the counters did not change.
+ *
+ * \return false on error.
+ */
+bool HotTier::checkpoint() {
+  if (!enabled) {
+    return false;
+  }
+  boost::mutex::scoped_lock checkpointLock(checkpointMutex);
+  /// Counted before the copy : the updates it covers are in the copy
+  unsigned long currentChanges = __sync_add_and_fetch(&changes, 0);
+  if (currentChanges == savedChanges) {
+    return true;
+  }
+  string tmpFile = checkpointFile + ".tmp";
+  FILE *pFile = fopen(tmpFile.c_str(), "wb");
+  if (pFile == NULL) {
+    cerr << "Error opening hot tier checkpoint: " << tmpFile << endl;
+    return false;
+  }
+
+  bool ok = true;
+  {
+    boost::shared_lock<boost::shared_mutex> lock(mutex);
+    int32_t iNbDays = nbDays;
+    int64_t iCoveredSince = coveredSince;
+    uint32_t nbSeries = series.size();
+    ok = ok && fwrite(HOT_MAGIC, sizeof(HOT_MAGIC), 1, pFile) == 1;
+    ok = ok && fwrite(&iNbDays, sizeof(iNbDays), 1, pFile) == 1;
+    ok = ok && fwrite(&iCoveredSince, sizeof(iCoveredSince), 1, pFile) == 1;
+    for (int i = 0; ok && i < nbDays; i++) {
+      int64_t iDay = ringDays[i];
+      ok = fwrite(&iDay, sizeof(iDay), 1, pFile) == 1;
+    }
+    ok = ok && fwrite(&nbSeries, sizeof(nbSeries), 1, pFile) == 1;
+    for (map<string, vector<uint32_t> >::iterator it = series.begin(); ok && it != series.end(); it++) {
+      uint32_t nameSize = (it->first).size();
+      ok = fwrite(&nameSize, sizeof(nameSize), 1, pFile) == 1
+        && fwrite((it->first).data(), 1, nameSize, pFile) == nameSize
+        && fwrite(&(it->second)[0], sizeof(uint32_t), (it->second).size(), pFile) == (it->second).size();
+    }
+  }
+
+  /// On disk before the rename : the log readers save their position once the checkpoint is done
+  ok = ok && fflush(pFile) == 0 && fsync(fileno(pFile)) == 0;
+  if (fclose(pFile) != 0 || !ok || rename(tmpFile.c_str(), checkpointFile.c_str()) != 0) {
+    cerr << "Error writing hot tier checkpoint: " << checkpointFile << endl;
+    remove(tmpFile.c_str());
+    return false;
+  }
+  savedChanges = currentChanges;
+  return true;
+}
+
+/*!
+ * \fn int HotTier::load()
+ * \brief Load the last checkpoint (the mutex is held by the caller).
+ * The days of a checkpoint written with an other size of ring are moved to their slot in the ring,
+ * the ones that do not fit anymore are written in DB.
+ *
+ * \return 1 if loaded as saved, 2 if the ring was resized, 0 if there is no checkpoint,
+ * -1 if the checkpoint can not be read or written in DB.
+ */
+int HotTier::load() {
+  HotCheckpoint checkpoint;
+  int status = readCheckpoint(checkpointFile, checkpoint);
+  if (status < 0) {
+    cerr << "Hot tier checkpoint " << checkpointFile << " is not usable." << endl;
+    return -1;
+  }
+  if (status == 0) {
+    return 0;
+  }
+  coveredSince = checkpoint.coveredSince;
+  if (checkpoint.nbDays == nbDays) {
+    ringDays.swap(checkpoint.ringDays);
+    series.swap(checkpoint.series);
+    cout << "Hot tier loaded: " << series.size() << " series." << endl;
+    return 1;
+  }
+  
+  /// Most recent days first : they keep their slot, an older day on the same slot is written in DB
+  vector<pair<long, int> > days;
+  for (int i = 0; i < checkpoint.nbDays; i++) {
+    if (checkpoint.ringDays[i] >= 0) {
+      days.push_back(make_pair(checkpoint.ringDays[i], i));
+    }
+  }
+  sort(days.rbegin(), days.rend());
+  vector<int> moved(nbDays, -1); // Slot in the checkpoint of each slot of the ring
+  for (vector<pair<long, int> >::iterator it = days.begin(); it != days.end(); it++) {
+    int slot = it->first % nbDays;
+    if (ringDays[slot] < 0) {
+      ringDays[slot] = it->first;
+      moved[slot] = it->second;
+    } else if (!flushDay(checkpoint, it->second)) {
+      cerr << "Error writing the hot tier checkpoint " << checkpointFile << " in DB." << endl;
+      return -1;
+    }
+  }
+  DBAccess::get().dbw_flush();
+  for (map<string, vector<uint32_t> >::iterator it = checkpoint.series.begin(); it != checkpoint.series.end(); it++) {
+    vector<uint32_t> &counters = series[it->first];
+    counters.assign(nbDays * DB_TIMES_MINUTES_SIZE, 0);
+    for (int i = 0; i < nbDays; i++) {
+      if (moved[i] < 0) continue;
+      copy((it->second).begin() + moved[i] * DB_TIMES_MINUTES_SIZE, (it->second).begin() + (moved[i] + 1) * DB_TIMES_MINUTES_SIZE,
+           counters.begin() + i * DB_TIMES_MINUTES_SIZE);
+    }
+  }
+  cout << "Hot tier loaded: " << series.size() << " series, ring resized from " << checkpoint.nbDays << " to " << nbDays << " days." << endl;
+  return 2;
+}
+
+/*!
+ * \fn bool HotTier::close()
+ * \brief Disable the hot tier : its minutes are written in DB and its checkpoint is removed.
+ * Used when the retention of the minutes does not fit in the ring anymore (longer or kept forever).
+ *
+ * \return false on DB error, the tier is kept.
+ */
+bool HotTier::close() {
+  boost::mutex::scoped_lock checkpointLock(checkpointMutex);
+  boost::unique_lock<boost::shared_mutex> lock(mutex);
+  if (!enabled) {
+    return true;
+  }
+  HotCheckpoint checkpoint;
+  checkpoint.nbDays = nbDays;
+  checkpoint.coveredSince = coveredSince;
+  checkpoint.ringDays = ringDays;
+  checkpoint.series.swap(series);
+  for (int i = 0; i < nbDays; i++) {
+    if (!flushDay(checkpoint, i)) {
+      cerr << "Error writing the hot tier in DB." << endl;
+      series.swap(checkpoint.series);
+      return false;
+    }
+  }
+  DBAccess::get().dbw_flush();
+  remove(checkpointFile.c_str());
+  enabled = false;
+  ringDays.assign(nbDays, -1);
+  cout << "Hot tier closed: " << checkpoint.series.size() << " series written in DB." << endl;
+  return true;
+}
+
+HotTier HotTier::singleton;
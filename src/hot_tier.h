@@ -0,0 +1,74 @@
+/*!
+ * \file hot_tier.h
+ * \brief In-memory tier of the most recent minute stats for mooWApp
+ * \author Xavier ETCHEBER
+ */
+
+#ifndef MOOWAPP_STATS_HOT_TIER_H_
+#define MOOWAPP_STATS_HOT_TIER_H_
+
+#include <string>
+#include <vector> // Ring of days
+#include <map> // Series
+#include <stdint.h> // uint32_t
+
+// Boost
+#include <boost/thread/shared_mutex.hpp> // Shared mutex
+#include <boost/thread/mutex.hpp> // Mutex of the checkpoints
+
+/*!
+ * \class HotTier
+ * \brief Minute counters of the last days kept in memory, fed by the log readers and checkpointed to disk.
+ *
+ * Each series (module/group/type) holds a ring buffer of nbDays days of minute counters,
+ * the slot of a day in the ring is its day number modulo nbDays.
+ * Minutes older than the ring, or older than the time the tier started to be fed, are not covered :
+ * they stay in DB and the callers fall back to it.
+ */
+class HotTier
+{
+public:
+  bool open(const std::string &checkpointFile, const int nbDays);
+  bool flush(const std::string &checkpointFile);
+  bool close();
+  bool add(const std::string &series, const std::string &date, const unsigned short minute, const uint32_t delta = 1);
+  bool get(const std::string &series, const std::string &date, const std::string &slot, unsigned int &value);
+  int readDay(const std::string &series, const std::string &date, const unsigned int width, std::vector<unsigned int> &counters);
+  bool sumDay(const std::string &series, const std::vector<std::string> &members, const std::string &date);
+  bool checkpoint();
+  bool isEnabled() const { return enabled; }
+  int days() const { return nbDays; }
+
+  // Getter of singleton
+  static HotTier &get() throw() {
+    return singleton;
+  }
+
+private:
+  static HotTier singleton;
+  bool enabled;               //!< Opened by the server, the insertion tool writes everything in DB
+  std::string checkpointFile; //!< File the tier is saved to and loaded from
+  int nbDays;                 //!< Number of days in the ring
+  std::vector<long> ringDays; //!< Day number held by each slot of the ring (-1 if empty)
+  long coveredSince;          //!< First minute (day number * minutes a day + minute) fed to the tier
+  std::map<std::string, std::vector<uint32_t> > series; //!< Counters of each series (nbDays * minutes a day)
+  boost::shared_mutex mutex;  //!< Shared to update and read counters, exclusive to add a series or recycle a day
+  unsigned long changes;      //!< Number of updates of the counters, for the checkpoints to skip an unchanged tier
+  unsigned long savedChanges; //!< Updates saved by the last checkpoint
+  boost::mutex checkpointMutex; //!< One checkpoint written at a time
+
+  bool covered(const long day, const unsigned short minute) const;
+  int load();
+
+  /*!
+   * \fn HotTier()
+   * \brief Constructor
+   */
+  HotTier();
+
+  // Protection against copy -> Do not define these
+  HotTier(const HotTier&);
+  void operator=(const HotTier&);
+};
+
+#endif // MOOWAPP_STATS_HOT_TIER_H_
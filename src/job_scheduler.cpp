@@ -0,0 +1,245 @@
+/*!
+ * \file job_scheduler.cpp
+ * \brief Scheduler of the periodic background jobs for mooWApp
+ * \author Xavier ETCHEBER
+ */
+
+#include <iostream>
+#include <string>
+#include <vector> // Jobs due
+#include <map> // Jobs
+#include <algorithm> // sort
+
+// mooWApp
+#include "job_scheduler.h"
+
+using namespace std;
+
+/*!
+ * \fn bool JobContext::stopRequested() const
+ * \brief Tell if the job has to stop : shutdown of the server or runtime budget reached.
+ */
+bool JobContext::stopRequested() const {
+  if (cancelled) {
+    return true;
+  }
+  return !deadline.is_not_a_date_time() && boost::posix_time::microsec_clock::universal_time() > deadline;
+}
+
+/*!
+ * \fn template<class J> static bool dueFirst(const J &a, const J &b)
+ * \brief Order of the jobs due : highest priority, then oldest deadline.
+ */
+template<class J>
+static bool dueFirst(const J &a, const J &b) {
+  if (a->spec.priority != b->spec.priority) {
+    return a->spec.priority > b->spec.priority;
+  }
+  return a->status.next < b->status.next;
+}
+
+/*!
+ * \fn void JobScheduler::add(const JobSpec &spec)
+ * \brief Add a job, before start().
+ */
+void JobScheduler::add(const JobSpec &spec) {
+  boost::mutex::scoped_lock lock(mutex);
+  boost::shared_ptr<Job> job(new Job());
+  job->spec = spec;
+  job->status.name = spec.name;
+  job->status.lock = spec.lock;
+  job->status.priority = spec.priority;
+  job->status.running = false;
+  job->status.waiting = false;
+  job->status.runs = job->status.cancelled = job->status.overBudget = job->status.missed = 0;
+  job->status.lastDuration = boost::posix_time::seconds(0);
+  job->status.next = spec.first;
+  jobs[spec.name] = job;
+}
+
+/*!
+ * \fn void JobScheduler::start()
+ * \brief Start the dispatcher thread.
+ */
+void JobScheduler::start() {
+  stopping = false;
+  dispatcher = boost::thread(&JobScheduler::dispatch, this);
+}
+
+/*!
+ * \fn void JobScheduler::stop()
+ * \brief Cancel the running jobs and wait for them to stop.
+ */
+void JobScheduler::stop() {
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    stopping = true;
+    for (map<string, boost::shared_ptr<Job> >::iterator it = jobs.begin(); it != jobs.end(); it++) {
+      (it->second)->context.cancelled = true;
+    }
+  }
+  changed.notify_all();
+  if (dispatcher.joinable()) {
+    dispatcher.join();
+  }
+  /// The dispatcher is stopped : no job is started any more
+  for (map<string, boost::shared_ptr<Job> >::iterator it = jobs.begin(); it != jobs.end(); it++) {
+    if ((it->second)->thread.joinable()) {
+      cout << "Stoping " << it->first << "... " << flush;
+      (it->second)->thread.join();
+      cout << "done" << endl;
+    }
+  }
+}
+
+/*!
+ * \fn void JobScheduler::status(vector<JobStatus> &jobs)
+ * \brief Get the state of every job.
+ */
+void JobScheduler::status(vector<JobStatus> &jobs) {
+  boost::mutex::scoped_lock lock(mutex);
+  jobs.clear();
+  for (map<string, boost::shared_ptr<Job> >::iterator it = this->jobs.begin(); it != this->jobs.end(); it++) {
+    jobs.push_back((it->second)->status);
+  }
+}
+
+/*!
+ * \fn bool JobScheduler::dependenciesDone(const Job &job)
+ * \brief Tell if every job the job runs after has ended a run since its last start.
+ */
+bool JobScheduler::dependenciesDone(const Job &job) {
+  for (set<string>::const_iterator it = job.spec.after.begin(); it != job.spec.after.end(); it++) {
+    map<string, boost::shared_ptr<Job> >::iterator itDep = jobs.find(*it);
+    if (itDep == jobs.end()) {
+      continue; // Job not configured (Ex: compaction off)
+    }
+    const boost::posix_time::ptime &depEnd = (itDep->second)->lastEnd;
+    if (depEnd.is_not_a_date_time()) {
+      return false;
+    }
+    if (!job.status.lastStart.is_not_a_date_time() && depEnd < job.status.lastStart) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*!
+ * \fn bool JobScheduler::lockFree(const Job &job, const bool exclusiveWaiting)
+ * \brief Tell if the running jobs let the job start.
+ *
+ * \param[in] job Job to start.
+ * \param[in] exclusiveWaiting An exclusive job is due : no new shared job starts.
+ */
+bool JobScheduler::lockFree(const Job &job, const bool exclusiveWaiting) {
+  if (job.spec.lock == JOB_LOCK_NONE) {
+    return true;
+  }
+  if (job.spec.lock == JOB_LOCK_SHARED && exclusiveWaiting) {
+    return false;
+  }
+  for (map<string, boost::shared_ptr<Job> >::iterator it = jobs.begin(); it != jobs.end(); it++) {
+    const Job &running = *(it->second);
+    if (!running.status.running || running.spec.lock == JOB_LOCK_NONE) continue;
+    if (job.spec.lock == JOB_LOCK_EXCLUSIVE || running.spec.lock == JOB_LOCK_EXCLUSIVE) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*!
+ * \fn void JobScheduler::dispatch()
+ * \brief Loop of the dispatcher : start the jobs due, then sleep until the next deadline or the end of a job.
+ */
+void JobScheduler::dispatch() {
+  boost::mutex::scoped_lock lock(mutex);
+  while (!stopping) {
+    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+    /// Jobs due, by priority
+    vector<boost::shared_ptr<Job> > due;
+    boost::posix_time::ptime wakeUp = now + boost::posix_time::minutes(1);
+    for (map<string, boost::shared_ptr<Job> >::iterator it = jobs.begin(); it != jobs.end(); it++) {
+      Job &job = *(it->second);
+      job.status.waiting = false;
+      if (job.status.running) continue;
+      if (job.status.next <= now) {
+        due.push_back(it->second);
+      } else if (job.status.next < wakeUp) {
+        wakeUp = job.status.next;
+      }
+    }
+    sort(due.begin(), due.end(), dueFirst<boost::shared_ptr<Job> >);
+
+    /// An exclusive job due holds back the new shared jobs, so that it is not starved by them
+    bool exclusiveWaiting = false;
+    for (vector<boost::shared_ptr<Job> >::iterator it = due.begin(); it != due.end(); it++) {
+      if ((*it)->spec.lock == JOB_LOCK_EXCLUSIVE && dependenciesDone(**it)) {
+        exclusiveWaiting = true;
+      }
+    }
+
+    /// Start the jobs allowed to run, the others wait for the end of a job
+    for (vector<boost::shared_ptr<Job> >::iterator it = due.begin(); it != due.end(); it++) {
+      Job &job = **it;
+      if (!dependenciesDone(job) || !lockFree(job, exclusiveWaiting && job.spec.lock != JOB_LOCK_EXCLUSIVE)) {
+        job.status.waiting = true;
+        continue;
+      }
+      if (job.thread.joinable()) {
+        job.thread.join(); // Last run already ended
+      }
+      job.status.running = true;
+      job.status.lastStart = now;
+      job.context.cancelled = false;
+      job.context.delayed = false;
+      job.context.deadline = (job.spec.budget.total_seconds() > 0) ? now + job.spec.budget : boost::posix_time::ptime();
+      job.thread = boost::thread(&JobScheduler::runJob, this, *it);
+    }
+
+    changed.timed_wait(lock, wakeUp);
+  }
+}
+
+/*!
+ * \fn void JobScheduler::runJob(boost::shared_ptr<Job> job)
+ * \brief Run a job on its thread, then set its next deadline.
+ */
+void JobScheduler::runJob(boost::shared_ptr<Job> job) {
+  try {
+    job->spec.run(job->context);
+  } catch(exception &e) {
+    cerr << "Job " << job->spec.name << " failed: " << e.what() << endl;
+  }
+
+  boost::mutex::scoped_lock lock(mutex);
+  boost::posix_time::ptime end = boost::posix_time::microsec_clock::universal_time();
+  JobStatus &status = job->status;
+  status.running = false;
+  status.runs++;
+  status.lastDuration = end - status.lastStart;
+  job->lastEnd = end;
+  if (job->context.cancelled) {
+    status.cancelled++;
+  } else if (!job->context.deadline.is_not_a_date_time() && end > job->context.deadline) {
+    status.overBudget++;
+  }
+
+  /// Next deadline
+  if (job->context.delayed) {
+    status.next = end + job->context.delay;
+  } else if (job->spec.fixedRate) {
+    status.next += job->spec.interval;
+    while (status.next <= end) {
+      status.next += job->spec.interval;
+      status.missed++;
+    }
+  } else {
+    status.next = end + job->spec.interval;
+  }
+  changed.notify_all();
+}
+
+JobScheduler JobScheduler::singleton;
@@ -0,0 +1,158 @@
+/*!
+ * \file job_scheduler.h
+ * \brief Scheduler of the periodic background jobs for mooWApp
+ * \author Xavier ETCHEBER
+ */
+
+#ifndef MOOWAPP_STATS_JOB_SCHEDULER_H_
+#define MOOWAPP_STATS_JOB_SCHEDULER_H_
+
+#include <string>
+#include <vector> // Status of the jobs
+#include <map> // Jobs
+#include <set> // Dependencies
+#include <atomic> // Cancellation
+
+// Boost
+#include <boost/function.hpp> // Job functions
+#include <boost/shared_ptr.hpp> // Jobs
+#include <boost/thread/thread.hpp> // Thread system
+#include <boost/thread/mutex.hpp> // Mutex
+#include <boost/thread/condition_variable.hpp> // Wake up of the dispatcher
+#include <boost/date_time/posix_time/posix_time.hpp> // Deadlines
+
+/*!
+ * \enum JobLock
+ * \brief Jobs a job can run with.
+ */
+enum JobLock {
+  JOB_LOCK_NONE = 0,     //!< Runs with any job. Ex: checkpoint of the hot tier
+  JOB_LOCK_SHARED = 1,   //!< Runs with the other shared jobs only. Ex: log readers
+  JOB_LOCK_EXCLUSIVE = 2 //!< Runs alone among the shared and exclusive jobs. Ex: retention
+};
+
+/*!
+ * \class JobContext
+ * \brief Given to a job while it runs : the job checks stopRequested() between two steps and stops there.
+ */
+class JobContext
+{
+public:
+  JobContext() : cancelled(false), delayed(false) {}
+
+  bool stopRequested() const;
+
+  /*!
+   * \fn void runAgainIn(const boost::posix_time::time_duration &delay)
+   * \brief Replace the interval of the job for its next run. Ex: pause after a full compaction pass
+   */
+  void runAgainIn(const boost::posix_time::time_duration &delay) {
+    this->delay = delay;
+    delayed = true;
+  }
+
+private:
+  friend class JobScheduler;
+  std::atomic<bool> cancelled;         //!< Cancelled by the scheduler (shutdown)
+  boost::posix_time::ptime deadline;   //!< End of the runtime budget, not_a_date_time if none
+  bool delayed;                        //!< runAgainIn() called
+  boost::posix_time::time_duration delay; //!< Delay before the next run given by runAgainIn()
+};
+
+typedef boost::function<void (JobContext &)> JobFunc;
+
+/*!
+ * \struct JobSpec
+ * \brief Description of a periodic job.
+ */
+struct JobSpec {
+  std::string name;                          //!< Unique name. Ex: rtsz
+  JobFunc run;                               //!< Function run at each deadline
+  JobLock lock;                              //!< Jobs it can run with
+  int priority;                              //!< Among the jobs due, the highest priority starts first
+  boost::posix_time::ptime first;            //!< Deadline of the first run
+  boost::posix_time::time_duration interval; //!< Time between two runs
+  bool fixedRate;                            //!< Deadlines at first + n * interval (missed ones are skipped), else interval after the end of the last run
+  boost::posix_time::time_duration budget;   //!< Max runtime before stopRequested(), 0 for none
+  std::set<std::string> after;               //!< Jobs that must end a run between two runs of this job. Ex: retention after log readers
+
+  JobSpec() : lock(JOB_LOCK_NONE), priority(0), fixedRate(false), budget(0, 0, 0) {}
+};
+
+/*!
+ * \struct JobStatus
+ * \brief State and history of a job.
+ */
+struct JobStatus {
+  std::string name;
+  JobLock lock;
+  int priority;
+  bool running;                                  //!< Running now
+  bool waiting;                                  //!< Deadline passed but blocked by its lock or dependencies
+  unsigned long runs;                            //!< Runs ended
+  unsigned long cancelled;                       //!< Runs stopped by a shutdown
+  unsigned long overBudget;                      //!< Runs that reached their runtime budget
+  unsigned long missed;                          //!< Deadlines skipped because the job was still running or blocked
+  boost::posix_time::ptime lastStart;            //!< Start of the last run
+  boost::posix_time::time_duration lastDuration; //!< Duration of the last run ended
+  boost::posix_time::ptime next;                 //!< Deadline of the next run
+};
+
+/*!
+ * \class JobScheduler
+ * \brief Owner of every periodic background job : a dispatcher thread starts each job at its deadline
+ * on a thread of its own, by priority, when its lock and its dependencies allow it.
+ *
+ * A job due but blocked is not skipped, it waits : a due exclusive job stops new shared jobs from starting
+ * until the running ones end. A job runs once at a time, the jobs are stopped cooperatively (JobContext).
+ */
+class JobScheduler
+{
+public:
+  void add(const JobSpec &spec);
+  void start();
+  void stop();
+  void status(std::vector<JobStatus> &jobs);
+
+  // Getter of singleton
+  static JobScheduler &get() throw() {
+    return singleton;
+  }
+
+private:
+  /*!
+   * \struct Job
+   * \brief A job with its state.
+   */
+  struct Job {
+    JobSpec spec;
+    JobContext context;
+    JobStatus status;
+    boost::posix_time::ptime lastEnd; //!< End of the last run
+    boost::thread thread;             //!< Thread of the current or last run
+  };
+
+  static JobScheduler singleton;
+  std::map<std::string, boost::shared_ptr<Job> > jobs; //!< Jobs by name
+  boost::mutex mutex;                  //!< Mutex for the jobs
+  boost::condition_variable changed;   //!< Notified when a job ends or the scheduler stops
+  boost::thread dispatcher;            //!< Thread starting the jobs
+  bool stopping;                       //!< Shutdown requested
+
+  void dispatch();
+  void runJob(boost::shared_ptr<Job> job);
+  bool dependenciesDone(const Job &job);
+  bool lockFree(const Job &job, const bool exclusiveWaiting);
+
+  /*!
+   * \fn JobScheduler()
+   * \brief Constructor
+   */
+  JobScheduler() : stopping(false) {}
+
+  // Protection against copy -> Do not define these
+  JobScheduler(const JobScheduler&);
+  void operator=(const JobScheduler&);
+};
+
+#endif // MOOWAPP_STATS_JOB_SCHEDULER_H_
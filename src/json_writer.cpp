@@ -0,0 +1,343 @@
+/*!
+ * \file json_writer.cpp
+ * \brief Writer of the JSON responses of the stats requests for mooWApp
+ * \author Xavier ETCHEBER
+ */
+
+#include <string>
+#include <string.h> // strlen
+#include <stdio.h> // snprintf
+#include <algorithm> // max
+
+// zlib
+#include <zlib.h> // gzip responses
+
+// mooWApp
+#include "global.h"
+#include "configuration.h"
+#include "json_writer.h"
+
+using namespace std;
+
+/*!
+ * \fn string &JsonWriter::threadBuffer()
+ * \brief Give the buffer of the thread, emptied : its memory is kept from one request to the next.
+ */
+string &JsonWriter::threadBuffer() {
+  static thread_local string buffer;
+  buffer.clear();
+  return buffer;
+}
+
+/*!
+ * \fn string &JsonWriter::threadPacked()
+ * \brief Give the buffer of the compressed parts of the thread, emptied.
+ */
+string &JsonWriter::threadPacked() {
+  static thread_local string packed;
+  packed.clear();
+  return packed;
+}
+
+/*!
+ * \struct DeflateStream
+ * \brief gzip stream of a thread, allocated once and reset for each response.
+ */
+struct DeflateStream {
+  z_stream stream;
+  bool ready;
+
+  DeflateStream() : ready(false) {
+    memset(&stream, 0, sizeof(stream));
+  }
+  ~DeflateStream() {
+    if (ready) deflateEnd(&stream);
+  }
+};
+
+/*!
+ * \fn static z_stream *threadDeflate()
+ * \brief Give the gzip stream of the thread, ready for a new response. NULL if zlib failed to allocate it.
+ */
+static z_stream *threadDeflate() {
+  static thread_local DeflateStream deflateStream;
+  if (!deflateStream.ready) {
+    // 15 + 16 : 32 KiB window with a gzip header
+    deflateStream.ready = deflateInit2(&deflateStream.stream, JSON_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+  } else {
+    deflateReset(&deflateStream.stream);
+  }
+  return deflateStream.ready ? &deflateStream.stream : NULL;
+}
+
+/*!
+ * \fn static bool clientAcceptsGzip(struct mg_connection *conn)
+ * \brief Tell if the Accept-Encoding header of a request accepts gzip. Ex: gzip, deflate
+ */
+static bool clientAcceptsGzip(struct mg_connection *conn) {
+  const char *accept = mg_get_header(conn, "Accept-Encoding");
+  if (accept == NULL) {
+    return false;
+  }
+  const char *gzip = strstr(accept, "gzip");
+  if (gzip == NULL) {
+    return false;
+  }
+  /// Refused with a null quality. Ex: gzip;q=0
+  const char *quality = gzip + 4;
+  while (*quality == ' ') quality++;
+  if (*quality == ';') {
+    quality++;
+    while (*quality == ' ') quality++;
+    if (!strncmp(quality, "q=0", 3) && strspn(quality + 3, ".0") == strcspn(quality + 3, ", ")) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*!
+ * \fn JsonWriter::JsonWriter(struct mg_connection *conn, const string &callback, string *copy, string *gzipCopy)
+ * \brief Start the response of a request.
+ *
+ * \param[in] conn Opaque connection handler.
+ * \param[in] callback JSONP callback, empty for a JSON call.
+ * \param[out] copy String receiving the whole response without the JSONP wrapping, NULL if not needed.
+ * \param[out] gzipCopy String receiving the whole compressed response, left empty if it is not compressed
+ * or is wrapped in a JSONP callback. NULL if not needed.
+ */
+JsonWriter::JsonWriter(struct mg_connection *conn, const string &callback, string *copy/* = NULL */, string *gzipCopy/* = NULL */)
+  : conn(conn), buffer(threadBuffer()), packed(threadPacked()), copy(copy), gzipCopy(gzipCopy), firstChunk(JSON_CHUNK_SIZE),
+    gzip(NULL), chunked(false), ended(false) {
+  if (copy != NULL) {
+    copy->clear();
+  }
+  if (gzipCopy != NULL) {
+    gzipCopy->clear();
+  }
+  if (!callback.empty()) {
+    buffer += callback + '(';
+    suffix = ")";
+    this->gzipCopy = NULL; // The compressed response depends on the callback
+  }
+  const Config &c = Config::get();
+  acceptGzip = c.HTTP_GZIP && clientAcceptsGzip(conn);
+  if (acceptGzip) {
+    /// The response is kept until it is known if it is compressed
+    firstChunk = max<size_t>(JSON_CHUNK_SIZE, c.HTTP_GZIP_MIN_SIZE);
+  }
+}
+
+/*!
+ * \fn JsonWriter::~JsonWriter()
+ * \brief Send the end of the response if end() was not called.
+ */
+JsonWriter::~JsonWriter() {
+  end();
+}
+
+/*!
+ * \fn JsonWriter &JsonWriter::raw(const char *data, const size_t size)
+ * \brief Write a JSON part as is.
+ */
+JsonWriter &JsonWriter::raw(const char *data, const size_t size) {
+  buffer.append(data, size);
+  if (copy != NULL) {
+    copy->append(data, size);
+  }
+  if (buffer.size() >= (chunked ? JSON_CHUNK_SIZE : firstChunk)) {
+    sendChunk();
+  }
+  return *this;
+}
+
+/*!
+ * \fn JsonWriter &JsonWriter::number(const int64_t value)
+ * \brief Write an integer, formatted in place.
+ */
+JsonWriter &JsonWriter::number(const int64_t value) {
+  char digits[24];
+  char *end = digits + sizeof(digits), *pos = end;
+  uint64_t remain = (value < 0) ? -static_cast<uint64_t>(value) : value;
+  do {
+    *--pos = '0' + remain % 10;
+    remain /= 10;
+  } while (remain != 0);
+  if (value < 0) {
+    *--pos = '-';
+  }
+  return raw(pos, end - pos);
+}
+
+/*!
+ * \fn JsonWriter &JsonWriter::quoted(const string &value)
+ * \brief Write a JSON string, the quotes, backslashes and control characters are escaped.
+ */
+JsonWriter &JsonWriter::quoted(const string &value) {
+  raw("\"", 1);
+  size_t from = 0;
+  for (size_t i = 0; i < value.size(); i++) {
+    unsigned char c = value[i];
+    if (c != '"' && c != '\\' && c >= 0x20) continue;
+    raw(value.data() + from, i - from);
+    char escaped[8];
+    if (c == '"' || c == '\\') {
+      escaped[0] = '\\';
+      escaped[1] = c;
+      raw(escaped, 2);
+    } else {
+      raw(escaped, snprintf(escaped, sizeof(escaped), "\\u%04x", c));
+    }
+    from = i + 1;
+  }
+  raw(value.data() + from, value.size() - from);
+  return raw("\"", 1);
+}
+
+/*!
+ * \fn void JsonWriter::etag(const string &tag)
+ * \brief Set the ETag of the response, before anything is sent.
+ *
+ * \param[in] tag ETag. Ex: W/"5f3a9c2e10b47d61"
+ */
+void JsonWriter::etag(const string &tag) {
+  extraHeaders += "ETag: " + tag + "\r\n";
+}
+
+/*!
+ * \fn string JsonWriter::headers(const bool compressed, const size_t length) const
+ * \brief Give the headers of the response.
+ *
+ * \param[in] compressed Response compressed with gzip.
+ * \param[in] length Length of the response, string::npos for a chunked stream.
+ */
+string JsonWriter::headers(const bool compressed, const size_t length) const {
+  string strHeaders(standard_json_reply, strlen(standard_json_reply) - 2);
+  strHeaders += extraHeaders;
+  if (Config::get().HTTP_GZIP) {
+    strHeaders += "Vary: Accept-Encoding\r\n";
+  }
+  if (compressed) {
+    strHeaders += "Content-Encoding: gzip\r\n";
+  }
+  if (length == string::npos) {
+    strHeaders += "Transfer-Encoding: chunked\r\n\r\n";
+  } else {
+    char strLength[48];
+    strHeaders.append(strLength, snprintf(strLength, sizeof(strLength), "Content-Length: %lu\r\n\r\n", static_cast<unsigned long>(length)));
+  }
+  return strHeaders;
+}
+
+/*!
+ * \fn void JsonWriter::compress(const int flush)
+ * \brief Compress the buffer at the end of the compressed parts, the buffer is emptied.
+ *
+ * \param[in] flush Z_NO_FLUSH while the response is written, Z_FINISH for its end.
+ */
+void JsonWriter::compress(const int flush) {
+  char out[16 * 1024];
+  gzip->next_in = reinterpret_cast<Bytef*>(buffer.empty() ? NULL : &buffer[0]);
+  gzip->avail_in = buffer.size();
+  do {
+    gzip->next_out = reinterpret_cast<Bytef*>(out);
+    gzip->avail_out = sizeof(out);
+    deflate(gzip, flush);
+    packed.append(out, sizeof(out) - gzip->avail_out);
+  } while (gzip->avail_out == 0);
+  buffer.clear();
+  if (gzipCopy != NULL) {
+    gzipCopy->append(packed);
+  }
+}
+
+/*!
+ * \fn void JsonWriter::writeChunk(string &chunk)
+ * \brief Send a part of the response as a chunk, the part is emptied.
+ */
+void JsonWriter::writeChunk(string &chunk) {
+  if (chunk.empty()) {
+    return; // A zero size chunk would end the response
+  }
+  char size[16];
+  int sizeLength = snprintf(size, sizeof(size), "%lx\r\n", static_cast<unsigned long>(chunk.size()));
+  chunk.insert(0, size, sizeLength);
+  chunk += "\r\n";
+  mg_write(conn, chunk.data(), chunk.size());
+  chunk.clear();
+}
+
+/*!
+ * \fn void JsonWriter::sendChunk()
+ * \brief Send the buffer as a chunk, compressed if the client accepts it, the headers are sent before the first one.
+ */
+void JsonWriter::sendChunk() {
+  if (!chunked) {
+    /// Headers of the standard reply, the response length is not known yet
+    if (acceptGzip) {
+      gzip = threadDeflate();
+    }
+    string strHeaders = headers(gzip != NULL, string::npos);
+    mg_write(conn, strHeaders.data(), strHeaders.size());
+    chunked = true;
+  }
+  if (gzip != NULL) {
+    compress(Z_NO_FLUSH);
+    writeChunk(packed); // Empty while zlib keeps the data for the next chunk
+  } else {
+    writeChunk(buffer);
+  }
+}
+
+/*!
+ * \fn bool JsonWriter::sendGzipped(const string &gzipped)
+ * \brief Send a response already compressed (Ex: response cache), if the client accepts it and it is not wrapped.
+ * To be called before anything is written.
+ *
+ * \param[in] gzipped Compressed response, empty if none.
+ * \return false if the response has to be written.
+ */
+bool JsonWriter::sendGzipped(const string &gzipped) {
+  if (gzipped.empty() || !acceptGzip || !suffix.empty() || chunked || ended) {
+    return false;
+  }
+  ended = true;
+  buffer = headers(true, gzipped.size());
+  buffer += gzipped;
+  mg_write(conn, buffer.data(), buffer.size());
+  buffer.clear();
+  return true;
+}
+
+/*!
+ * \fn void JsonWriter::end()
+ * \brief Send the rest of the response : with its headers in one write, or as the last chunks.
+ */
+void JsonWriter::end() {
+  if (ended) {
+    return;
+  }
+  ended = true;
+  buffer += suffix;
+  if (chunked) {
+    if (gzip != NULL) {
+      compress(Z_FINISH);
+      writeChunk(packed);
+    } else {
+      writeChunk(buffer);
+    }
+    mg_write(conn, "0\r\n\r\n", 5);
+    return;
+  }
+  /// Whole response known : headers with its length, then the response
+  if (acceptGzip && buffer.size() >= static_cast<size_t>(Config::get().HTTP_GZIP_MIN_SIZE)) {
+    gzip = threadDeflate();
+  }
+  if (gzip != NULL) {
+    compress(Z_FINISH);
+    swap(buffer, packed);
+  }
+  buffer.insert(0, headers(gzip != NULL, buffer.size()));
+  mg_write(conn, buffer.data(), buffer.size());
+  buffer.clear();
+}
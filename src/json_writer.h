@@ -0,0 +1,103 @@
+/*!
+ * \file json_writer.h
+ * \brief Writer of the JSON responses of the stats requests for mooWApp
+ * \author Xavier ETCHEBER
+ */
+
+#ifndef MOOWAPP_STATS_JSON_WRITER_H_
+#define MOOWAPP_STATS_JSON_WRITER_H_
+
+#include <string>
+#include <stddef.h> // size_t
+#include <string.h> // strlen
+#include <stdint.h> // int64_t
+
+// mongoose web server
+#include "mongoose.h"
+
+/*!
+ * \def JSON_CHUNK_SIZE
+ * \brief Size of the response from which it is sent as a chunked stream, and size of the chunks.
+ */
+#define JSON_CHUNK_SIZE (64 * 1024)
+
+/*!
+ * \def JSON_GZIP_LEVEL
+ * \brief zlib compression level of the gzip responses, the repetitive JSON gets most of its gain from the fast levels.
+ */
+#define JSON_GZIP_LEVEL 6
+
+typedef struct z_stream_s z_stream;
+
+/*!
+ * \class JsonWriter
+ * \brief Response of a request written in a buffer reused by every request of the thread.
+ *
+ * A response smaller than JSON_CHUNK_SIZE is sent with its headers in a single mg_write at end(),
+ * a larger one is sent as a chunked stream while it is written.
+ * When HTTP_GZIP is on and the client accepts gzip, a response of HTTP_GZIP_MIN_SIZE bytes or more
+ * is compressed while it is written.
+ */
+class JsonWriter
+{
+public:
+  JsonWriter(struct mg_connection *conn, const std::string &callback, std::string *copy = NULL, std::string *gzipCopy = NULL);
+  ~JsonWriter();
+
+  JsonWriter &raw(const char *data, const size_t size);
+  /*!
+   * \fn JsonWriter &raw(const char *data)
+   * \brief Write a JSON part as is. Ex: [{
+   */
+  JsonWriter &raw(const char *data) {
+    return raw(data, strlen(data));
+  }
+  /*!
+   * \fn JsonWriter &raw(const std::string &data)
+   * \brief Write a JSON part as is.
+   */
+  JsonWriter &raw(const std::string &data) {
+    return raw(data.data(), data.size());
+  }
+  JsonWriter &number(const int64_t value);
+  JsonWriter &quoted(const std::string &value);
+  /*!
+   * \fn JsonWriter &key(const int64_t value)
+   * \brief Write a number as the key of an object. Ex: "15":
+   */
+  JsonWriter &key(const int64_t value) {
+    raw("\"", 1);
+    number(value);
+    return raw("\":", 2);
+  }
+  void etag(const std::string &tag);
+  bool sendGzipped(const std::string &gzipped);
+  void end();
+
+private:
+  struct mg_connection *conn; //!< Connection the response is sent to
+  std::string &buffer;        //!< Part of the response not sent yet
+  std::string &packed;        //!< Compressed part of the response not sent yet
+  std::string *copy;          //!< Whole response without the JSONP wrapping, NULL if not needed (Ex: response cache)
+  std::string *gzipCopy;      //!< Whole compressed response if it is compressed and not wrapped, NULL if not needed
+  std::string suffix;         //!< End of the JSONP wrapping
+  std::string extraHeaders;   //!< Headers of the request added to the standard ones. Ex: ETag
+  size_t firstChunk;          //!< Size of the response from which the first chunk is sent
+  z_stream *gzip;             //!< Stream compressing the response, NULL if it is not compressed
+  bool acceptGzip;            //!< Client accepting a gzip response
+  bool chunked;               //!< Headers sent, the rest is sent by chunks
+  bool ended;                 //!< end() called
+
+  static std::string &threadBuffer();
+  static std::string &threadPacked();
+  std::string headers(const bool compressed, const size_t length) const;
+  void compress(const int flush);
+  void writeChunk(std::string &chunk);
+  void sendChunk();
+
+  // Protection against copy -> Do not define these
+  JsonWriter(const JsonWriter&);
+  void operator=(const JsonWriter&);
+};
+
+#endif // MOOWAPP_STATS_JSON_WRITER_H_
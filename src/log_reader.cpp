@@ -22,7 +22,11 @@
 // mooWApp
 #include "global.h"
 #include "configuration.h"
-#include "db_access_berkeleydb.h"
+#include "db_access.h"
+#include "hot_tier.h"
+#include "dirty_index.h"
+#include "app_groups.h"
+#include "response_cache.h"
 #include "log_reader.h"
 
 using namespace std;
@@ -67,76 +71,102 @@ string findExtInLine(map<string, set<string> > &mapExtensions, const string &lin
 }
 
 /*!
- * \fn void insertLogLine(SslLog &logLine, set<string> &setModules)
- * \brief Insert a new row of visit in stat DB (or do a +1 on an existing line).
+ * \fn void flushLogBatch(LogBatch &batch)
+ * \brief Write in DB the visits counted in a batch (one increment or append by key), mark its days in the dirty index
+ * and in the response cache, and empty it.
  *
- * \param[in] strLog String format of log line to insert in DB.
+ * \param[in, out] batch Visits to write.
  */
-bool insertLogLine(const string &strLog, const string &responseSize, const string &responseDuration) {
+void flushLogBatch(LogBatch &batch) {
   // Get DB accessor
-  DBAccessBerkeley &dbA = DBAccessBerkeley::get();
-  
-  unsigned int iVisit = 0;
-  string val = dbA.dbw_get(strLog);
-  string newVal = "";
-  if (val.length() > 0) {
-    /// If Key already exist in db add +1 visit
-    DEBUG_LOGS_FUNC("Read: " << strLog << "=" << val);
-    /*char buffer[10];
-    sscanf(val.c_str(), "%d", &iVisit);
-    memset(buffer, 0, sizeof buffer);
-    sprintf(buffer, "%d", iVisit++);
-    val = buffer;*/
-    iVisit = stringToInt(val) + 1;
-    intToString(newVal, iVisit);
-  } else { /// Else insert new key with 1 visit
-    iVisit = 1;
-    newVal = "1";
+  DBAccess &dbA = DBAccess::get();
+  
+  /// Add the visits of each key (the key is created if it does not exist)
+  map<string, unsigned int>::iterator itCounter;
+  for(itCounter=batch.counters.begin(); itCounter!=batch.counters.end(); itCounter++) {
+    unsigned int iVisit = dbA.dbw_increment(itCounter->first, itCounter->second);
+    DEBUG_LOGS_FUNC("Set: " << itCounter->first << "=" << iVisit);
+    if (iVisit == 0)
+      cerr << "DB error on increment(key=" << itCounter->first << ")" << endl;
   }
-  DEBUG_LOGS_FUNC("Set: " << strLog << "=" << newVal);
   
-  if (!dbA.dbw_add(strLog, newVal))
-    cerr << "db.error().name()" << endl;
-
-  // Insert response size
-  if (responseSize.length() > 0) {
-    val = dbA.dbw_get(strLog+"/sz/values");
-    if (val.length() > 0) {
-      val += "," + responseSize;
-    } else {
-      val = responseSize;
-    }
-    DEBUG_LOGS_FUNC("Set: " << strLog << "/sz/values=" << val);
-    if (!dbA.dbw_add(strLog+"/sz/values", val))
-      cerr << "db.error().name()" << endl;
+  /// Append response sizes and durations
+  map<string, string>::iterator itValues;
+  for(itValues=batch.values.begin(); itValues!=batch.values.end(); itValues++) {
+    DEBUG_LOGS_FUNC("Append: " << itValues->first << "+=" << itValues->second);
+    if (!dbA.dbw_append(itValues->first, itValues->second))
+      cerr << "DB error on append(key=" << itValues->first << ")" << endl;
   }
   
-  // Insert response duration
-  if (responseDuration.length() > 0) {
-    val = dbA.dbw_get(strLog+"/rt/values");
-    if (val.length() > 0) {
-      val += "," + responseDuration;
-    } else {
-      val = responseDuration;
-    }
-    DEBUG_LOGS_FUNC("Set: " << strLog << "/rt/values=" << val);
-    if (!dbA.dbw_add(strLog+"/rt/values", val))
-      cerr << "db.error().name()" << endl;
+  /// Let the background jobs know which days and modules changed
+  DirtyIndex::get().mark(batch.days);
+  
+  /// The cached responses built from these days are not valid any more
+  for(map<string, DirtyModules>::iterator itDay=batch.days.begin(); itDay!=batch.days.end(); itDay++) {
+    ResponseCache::get().bumpDay(itDay->first);
   }
   
-	if (iVisit == 1) return true;
-	return false;
+  /// Merge response times into the minute, hour, day and month sketches
+  map<string, RtSketch>::iterator itSketch;
+  for(itSketch=batch.sketches.begin(); itSketch!=batch.sketches.end(); itSketch++) {
+    if (!dbA.dbw_merge(itSketch->first, (itSketch->second).toString(), RtSketch::mergeValue))
+      cerr << "DB error on merge(key=" << itSketch->first << ")" << endl;
+  }
+  
+  batch.counters.clear();
+  batch.values.clear();
+  batch.sketches.clear();
+  batch.days.clear();
+  batch.lines = 0;
+}
+
+/*!
+ * \fn static void batchVisit(LogBatch &batch, const string &strSeries, const SslLog &logLine, const unsigned short minute, const string &strWeek)
+ * \brief Count a visit in the minute, 10 minutes, hour, day, ISO week and month of a series.
+ *
+ * \param[in, out] batch Batch the visit is counted in.
+ * \param[in] strSeries Series. Ex: module/w/1
+ * \param[in] logLine Line of the visit.
+ * \param[in] minute Minute of the day.
+ * \param[in] strWeek ISO week of the day, empty if not known. Ex: 2011-W16
+ */
+static void batchVisit(LogBatch &batch, const string &strSeries, const SslLog &logLine, const unsigned short minute, const string &strWeek) {
+  string strDayKey = strSeries+'/'+logLine.date_d;
+  batch.counters[strDayKey+'/'+logLine.date_t_hours]++;
+  batch.counters[strDayKey+'/'+logLine.date_t]++;
+  /// Minute visits go to the hot tier when it covers them
+  if (!HotTier::get().add(strSeries, logLine.date_d, minute)) {
+    batch.counters[strDayKey+'/'+logLine.date_t_minutes]++;
+  }
+  /// Day, ISO week and month totals. Ex: module/w/1/2011-04-24, module/w/1/2011-W16, module/w/1/2011-04
+  batch.counters[strDayKey]++;
+  if (!strWeek.empty()) {
+    batch.counters[strSeries+'/'+strWeek]++;
+  }
+  batch.counters[strSeries+'/'+logLine.date_d.substr(0, 7)]++;
+}
+
+/*!
+ * \fn static void batchValue(LogBatch &batch, const string &strKey, const string &value)
+ * \brief Add a value to the list of values to append to a key.
+ */
+static void batchValue(LogBatch &batch, const string &strKey, const string &value) {
+  if (value.length() == 0) return;
+  string &values = batch.values[strKey];
+  if (!values.empty()) values += ',';
+  values += value;
 }
 
 /*!
- * \fn bool analyseLine(const string line, set<string> &setModules)
- * \brief Create a SslLog object from a line of a log file and call insertLogLine.
+ * \fn bool analyseLine(const string line, set<string> &setModules, LogBatch &batch)
+ * \brief Create a SslLog object from a line of a log file and count its visit in a batch.
  *
  * \param[in] logFileNb Log file number in configuration (for debugging purpose).
  * \param[in] line to be analysed.
  * \param[in, out] setModules set of modules to be updated with the visit inserted in DB.
+ * \param[in, out] batch Batch the visit is counted in.
  */
-bool analyseLine(const unsigned short &logFileNb, const string &line, set<string> &setModules) {
+bool analyseLine(const unsigned short &logFileNb, const string &line, set<string> &setModules, LogBatch &batch) {
   if (line.length() < 10) return false; // Line not long enough : error
   SslLog logLine;
   
@@ -230,18 +260,42 @@ bool analyseLine(const unsigned short &logFileNb, const string &line, set<string
   
   DEBUG_LOGS_FUNC(logLine.app << " at " << logLine.date_d << " " << logLine.date_t << " as " << logLine.group << " " << logLine.type << " size:" << logLine.responseSize << " in:" << logLine.responseDuration);
   
-  string str = logLine.logKey+logLine.date_t_hours;
-  const string strEmpty = "";
-  insertLogLine(str, strEmpty, strEmpty);
-  str = logLine.logKey+logLine.date_t;
-  insertLogLine(str, strEmpty, strEmpty);
-  str = logLine.logKey+logLine.date_t_minutes;
-  if (insertLogLine(str, logLine.responseSize, logLine.responseDuration)) {
-    /// Add module in list if not exist
-    setModules.insert(logLine.app);
-    DEBUG_LOGS_FUNC("+1 module for " << logLine.app);
+  /// Count the visit in every tier of the module
+  string strSeries = logLine.app+'/'+logLine.group+'/'+logLine.type;
+  string strMinute = logLine.logKey+logLine.date_t_minutes;
+  string strWeek = isoWeek(year, getMonth((string) month), day);
+  if (strWeek.empty()) {
+    DEBUG_LOGS_FUNC("No week for date " << logLine.date_d);
+  }
+  batchVisit(batch, strSeries, logLine, iHour*60 + iMin, strWeek);
+  batchValue(batch, strMinute+"/sz/values", logLine.responseSize);
+  
+  /// Response time goes to the minute, hour, day and month sketches. Ex: module/w/1/2011-04-24/1503/rt/sketch, module/w/1/2011-04/rt/sketch
+  unsigned int responseTime = 0;
+  if (sscanf(logLine.responseDuration.c_str(), "%u", &responseTime) == 1) {
+    batch.sketches[strMinute+"/rt/sketch"].add(responseTime);
+    batch.sketches[logLine.logKey+logLine.date_t_hours+"/rt/sketch"].add(responseTime);
+    batch.sketches[strSeries+'/'+logLine.date_d+"/rt/sketch"].add(responseTime);
+    batch.sketches[strSeries+'/'+logLine.date_d.substr(0, 7)+"/rt/sketch"].add(responseTime);
   }
   
+  /// Count the visit in the series of its application too, kept by the retention as a module. Ex: @Calendar/w/1/2011-04-24/15
+  string strAppSeries = AppGroups::get().seriesOf(logLine.app);
+  if (!strAppSeries.empty()) {
+    batchVisit(batch, strAppSeries+'/'+logLine.group+'/'+logLine.type, logLine, iHour*60 + iMin, strWeek);
+    batch.days[logLine.date_d][strAppSeries];
+  }
+  
+  /// Minute with response sizes and times to calculate by the RtSz job
+  set<unsigned short> &dirtyMinutes = batch.days[logLine.date_d][logLine.app];
+  if (iHour < 24 && iMin < 60) {
+    dirtyMinutes.insert(iHour*60 + iMin);
+  }
+  batch.lines++;
+  
+  /// Add module in list if not exist
+  setModules.insert(logLine.app);
+  
   return true;
 }
 
@@ -287,6 +341,10 @@ uint64_t readLogFile(const unsigned short &logFileNb, const string &strFile, set
   
   DEBUG_LOGS_FUNC("#" << logFileNb << ". Parsing logs...");
   
+  /// Visits are counted in a batch, written in DB every LOGS_BATCH_LINES lines
+  Config &c = Config::get();
+  LogBatch batch;
+  
   string linedata;
   for (uint64_t i=0, j=0; j<lSize; j++) { // loop thru the buffer
     linedata.push_back(buffer[j]); // push character into string
@@ -294,11 +352,15 @@ uint64_t readLogFile(const unsigned short &logFileNb, const string &strFile, set
       if (i%100 == 0) {
         printProgBar((int) j/(lSize/100));
       }
-      analyseLine(logFileNb, linedata, setModules);
+      analyseLine(logFileNb, linedata, setModules, batch);
+      if (batch.lines >= (unsigned long) c.LOGS_BATCH_LINES) {
+        flushLogBatch(batch);
+      }
       linedata.clear();
       ++i;
     }
   }
+  flushLogBatch(batch);
   free (buffer);
   printProgBar(100);
   cout << endl;
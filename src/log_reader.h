@@ -9,10 +9,15 @@
 
 #include <string>
 #include <set> // Set of modules
+#include <map> // Batch of visits
 
 // database
 #include <db_cxx.h>
 
+// mooWApp
+#include "dirty_index.h"
+#include "rt_sketch.h"
+
 extern Db *db;
 
 /*!
@@ -44,22 +49,37 @@ struct SslLog {
 std::string findExtInLine(std::map<std::string, std::set<std::string> > &mapExtensions, const std::string &line);
 
 /*!
- * \fn void insertLogLine(SslLog &logLine, set<string> &setModules)
- * \brief Insert a new row of visit in stat DB (or do a +1 on an existing line).
+ * \struct LogBatch
+ * \brief Visits counted while reading a chunk of log file, written in DB at once by flushLogBatch.
+ */
+struct LogBatch {
+  std::map<std::string, unsigned int> counters; //!< Visits to add to each key. Ex: module/w/1/2011-04-24/15 => 12
+  std::map<std::string, std::string> values;     //!< Values to append to each key. Ex: module/w/1/2011-04-24/1503/sz/values => 1200,980
+  std::map<std::string, RtSketch> sketches;      //!< Response times to merge into each sketch. Ex: module/w/1/2011-04-24/15/rt/sketch
+  std::map<std::string, DirtyModules> days;      //!< Modules of each day written, with their minutes. Ex: 2011-04-24 => module => 903
+  unsigned long lines;                           //!< Lines counted since the last flush
+
+  LogBatch() : lines(0) {}
+};
+
+/*!
+ * \fn void flushLogBatch(LogBatch &batch)
+ * \brief Write in DB the visits counted in a batch (one increment or append by key), mark its days in the dirty index and empty it.
  *
- * \param[in] strLog String format of log line to insert in DB.
+ * \param[in, out] batch Visits to write.
  */
-bool insertLogLine(const std::string &strLog);
+void flushLogBatch(LogBatch &batch);
 
 /*!
- * \fn void analyseLine(string line, set<string> &setModules)
+ * \fn void analyseLine(string line, set<string> &setModules, LogBatch &batch)
  * \brief Filter the usefull stats from a string that represent a line of log
  *
  * \param logFileNb Log file number in configuration (for debugging purpose).
  * \param line The log line to be parsed.
  * \param setModules The set of web modules already known.
+ * \param batch Batch the visit is counted in.
  */
-bool analyseLine(const unsigned short &logFileNb, const std::string &line, std::set<std::string> &setModules);
+bool analyseLine(const unsigned short &logFileNb, const std::string &line, std::set<std::string> &setModules, LogBatch &batch);
 
 /*!
  * \fn unsigned long readLogFile(const unsigned short &logFileNb, const std::string &strFile, std::set<std::string> &setModules, uint64_t readPos = 0)
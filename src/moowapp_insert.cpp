@@ -16,7 +16,9 @@
 // mooWApp
 #include "global.h"
 #include "configuration.h"
-#include "db_access_berkeleydb.h"
+#include "db_access.h"
+#include "dirty_index.h"
+#include "app_groups.h"
 #include "log_reader.h"
 
 using namespace std;
@@ -26,7 +28,7 @@ int main(int argc, char* argv[]) {
   Config &c = Config::get();
   
   /// Get DB accessor
-  DBAccessBerkeley &dbA = DBAccessBerkeley::get();
+  DBAccess &dbA = DBAccess::get();
   
   /// Open the database
   if (! dbA.dbw_open(c.DB_PATH, c.DB_NAME)) {
@@ -34,6 +36,17 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
+  /// Visits are counted in the series of their application too
+  AppGroups::get().load();
+
+  /// Mark the days inserted for the background jobs of the server (if the server has not created its index yet, it visits every day at its first start)
+  string strDirtyFile = c.DB_PATH;
+  if (!strDirtyFile.empty() && strDirtyFile[strDirtyFile.size()-1] != '/') strDirtyFile += '/';
+  strDirtyFile += c.DB_NAME + ".dirty";
+  if (boost::filesystem::exists(strDirtyFile)) {
+    DirtyIndex::get().open(strDirtyFile);
+  }
+
   size_t founds;
   boost::progress_timer t; // start timing
   
@@ -99,6 +112,8 @@ int main(int argc, char* argv[]) {
   dbA.dbw_add(KEY_MODULES, strModules);
   cout << "Re-added" << endl;
   
+  DirtyIndex::get().save();
+  
   /// Close the database
   cout << "Closing db connection" << endl;
   dbA.dbw_close();
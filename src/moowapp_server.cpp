@@ -13,11 +13,16 @@
 #include <vector> // Line log analyse
 #include <signal.h> // Handler for Ctrl+C
 #include <stdio.h> // sscanf
+#include <string.h> // strstr
+#include <stdlib.h> // strtoul
+#include <ctype.h> // isalnum
 #include <time.h> // localtime, strftime
+#include <algorithm> // min, max
 
 // Boost
 #include <boost/progress.hpp> // Timing system
 #include <boost/thread/thread.hpp> // Thread system
+#include <boost/thread/shared_mutex.hpp> // Shared mutex
 #include <boost/algorithm/string.hpp> // split
 #include <boost/date_time/posix_time/posix_time.hpp> // Conversion date
 #include <boost/date_time/gregorian/parsers.hpp> // Parser date
@@ -26,35 +31,54 @@
 #include <boost/interprocess/sync/scoped_lock.hpp> // Lock for mutex
 #include <boost/interprocess/sync/named_mutex.hpp> // Mutex
 #include <boost/asio.hpp> // Service system
+#include <boost/property_tree/ptree.hpp> // Body of the range requests
+#include <boost/property_tree/json_parser.hpp>
 
 // mooWApp
 #include "global.h"
 #include "configuration.h"
-#include "db_access_berkeleydb.h"
+#include "db_access.h"
+#include "hot_tier.h"
+#include "dirty_index.h"
+#include "app_groups.h"
+#include "rt_sketch.h"
 #include "log_reader.h"
 #include "thread_pool.h"
+#include "response_cache.h"
+#include "query_engine.h"
+#include "json_writer.h"
+#include "msgpack_writer.h"
+#include "request_params.h"
+#include "job_scheduler.h"
 
 // mongoose web server
 #include "mongoose.h"
 
 using namespace std;
-boost::mutex appMutex;     //!< Mutex for thread blocking
+boost::mutex modulesMutex;    //!< Mutex for the update of the list of modules in DB
+DBCompactProgress compactProgress; //!< Progress of the background compaction
+boost::mutex compactMutex;    //!< Mutex for the progress of the background compaction
+ThreadPool *workPool;         //!< Pool of workers shared by the background jobs (one task by module)
+const string COMPACTION_POS_FILE("bin/mwa.compact"); //!< Key where the last compaction pass stopped
 struct mg_context *ctx; //!< Pointer of request's context 
 bool quit;              //!< Boolean used to quit server properly
 
-// add new work item to the pool
-template<class F>
-void ThreadPool::enqueue(F f) {
-  { // acquire lock
-    std::unique_lock<mutex> lock(queue_mutex);
- 
-    // add the task
-    tasks.push_back(function<void()>(f));
-  } // release lock
- 
-  // wake up one thread
-  condition.notify_one();
-}
+/*!
+ * \struct AppsRebuild
+ * \brief Progress of the rebuild of the series of the applications from their modules, going back in time from today.
+ */
+struct AppsRebuild {
+  std::string day;               //!< Next day to rebuild, empty if no rebuild is pending. Ex: 2011-04-24
+  std::set<std::string> removed; //!< Series of the applications removed since the rebuild started. Ex: @Calendar
+  unsigned long requests;        //!< Number of rebuilds requested, a request during a run starts over from today
+
+  AppsRebuild() : requests(0) {}
+};
+AppsRebuild appsRebuild;      //!< Progress of the rebuild of the applications
+boost::mutex appsRebuildMutex; //!< Mutex for the progress of the rebuild of the applications
+const string APPS_REBUILD_FILE("bin/mwa.apps"); //!< Next day to rebuild and removed series of the applications
+#define APPS_REBUILD_BUDGET 30 //!< Seconds of a slice of the rebuild of the applications (log readers paused)
+#define APPS_REBUILD_PAUSE 5   //!< Seconds between two slices of the rebuild of the applications
 
 /*!
  * \fn int getDBModules(set<string> &setModules, const string &modulesLine)
@@ -69,12 +93,11 @@ int getDBModules(set<string> &setModules, const string &modulesLine) {
   Config &c = Config::get();
   
   /// Get DB accessor
-  DBAccessBerkeley &dbA = DBAccessBerkeley::get();
+  DBAccess &dbA = DBAccess::get();
   
   /// Create a set of all known applications in DB
-  string strModules = dbA.dbw_get(modulesLine);
-  
-  if (strModules.length() <= 0) {
+  string strModules;
+  if (dbA.dbw_read(modulesLine, strModules) != DBW_FOUND || strModules.length() <= 0) {
     return 1;
   }
   
@@ -105,12 +128,11 @@ int getDBModules(set<string> &setModules, const string &modulesLine) {
  */
 int removeDBModules(set<string> &setDeleteModules) {
   /// Get DB accessor
-  DBAccessBerkeley &dbA = DBAccessBerkeley::get();
+  DBAccess &dbA = DBAccess::get();
   
   /// Create a set of all known applications in DB
-  string strModules = dbA.dbw_get(KEY_MODULES);
-  
-  if (strModules.length() <= 0)
+  string strModules;
+  if (dbA.dbw_read(KEY_MODULES, strModules) != DBW_FOUND || strModules.length() <= 0)
     return 1;
   
   set<string> setModules;
@@ -141,51 +163,82 @@ int removeDBModules(set<string> &setDeleteModules) {
 }
 
 /*!
- * \fn void statsAddSumRow(vector< pair<string, map<int, int> > > &vRes, int nbResWithOffset, int offset)
- * \brief Insert in front of the vector in param, a SUM of visits by days
+ * \fn void serverAppsParams(RequestParams &params, string &strApps, set<string> &setOtherModules)
+ * \brief Set the applications of a request in mode=all to the ones defined on the server (apps=server) :
+ * each application and "Others" read the series of the application instead of every module.
  *
- * \param[in, out] vRes The vector where the SUM will be added.
- * \param[in] nbResWithOffset A number of days
- * \param[in] offset A number of stating day for the answer
+ * \param[in, out] params Parameters of the request, p_i, m_i and m_i_0 of each application are set.
+ * \param[out] strApps Number of applications. Ex: 4
+ * \param[out] setOtherModules Series of the modules in no application.
  */
-void statsAddSumRow(vector< pair<string, map<int, int> > > &vRes, int nbResWithOffset, int offset) {
-  map<int, int>::iterator itMap;
-  
-  if (vRes.size() > 1) { // If only one module, sum is useless
-    map<int, int> mapSum;
-      
-    for (int i=offset; i < nbResWithOffset; i++) {
-      mapSum.insert( pair<int,int>(i, 0) );
-    }  
-    for (int maxI=vRes.size(), i=0; i<maxI; i++) {
-      for (itMap=(vRes[i].second).begin(); itMap != (vRes[i].second).end(); itMap++) {
-        mapSum[itMap->first] += itMap->second;
-      }
+void serverAppsParams(RequestParams &params, string &strApps, set<string> &setOtherModules) {
+  map<string, set<string> > apps;
+  AppGroups::get().list(apps);
+  ostringstream oss;
+  int i = 0;
+  for (map<string, set<string> >::iterator it = apps.begin(); it != apps.end(); it++, i++) {
+    oss << "p_" << i;
+    params.set(oss.str(), it->first);
+    oss.str("");
+    oss << "m_" << i;
+    params.set(oss.str(), "1");
+    oss.str("");
+    oss << "m_" << i << "_0";
+    params.set(oss.str(), APP_SERIES_PREFIX + it->first);
+    oss.str("");
+  }
+  oss << i;
+  strApps = oss.str();
+  setOtherModules.clear();
+  setOtherModules.insert(string(1, APP_SERIES_PREFIX) + APP_OTHERS);
+}
+
+/*!
+ * \struct StatsTable
+ * \brief Visits of the rows of a stats response, for the same keys (dates or time slots) in each row.
+ */
+struct StatsTable {
+  vector<int> keys;            //!< Key of each column, in the order of the response. Ex: 0 to 23 for the hours of a day
+  vector<string> names;        //!< Name of each row. Ex: Calendar
+  vector<unsigned int> values; //!< Visits, row after row (names.size() * keys.size())
+};
+
+/*!
+ * \fn void statsAddSumRow(StatsTable &table)
+ * \brief Insert in front of the table a SUM of visits by key, named "All".
+ *
+ * \param[in, out] table The table where the SUM will be added.
+ */
+void statsAddSumRow(StatsTable &table) {
+  if (table.names.size() > 1) { // If only one module, sum is useless
+    size_t nbKeys = table.keys.size();
+    vector<unsigned int> sum(nbKeys, 0);
+    for (size_t i = 0; i < table.values.size(); i++) {
+      sum[i % nbKeys] += table.values[i];
     }
-    vRes.insert(vRes.begin(), make_pair("All", mapSum));
+    table.names.insert(table.names.begin(), "All");
+    table.values.insert(table.values.begin(), sum.begin(), sum.end());
   }
 }
 
 /*!
- * \fn void statsConstructResponse(vector< pair<string, map<int, int> > > &vRes, string &response)
- * \brief Return a JSON part string of the content of a vector of stats.
+ * \fn void statsConstructResponse(const StatsTable &table, JsonWriter &json)
+ * \brief Write the JSON part of a table of stats : ["name",{"key":visits,...}] for each row.
  *
- * \param[in, out] vRes The vector of all stats grouped by module and stored by day.
- * \param[in, out] response Response string in JSON format (only part of JSON answer will be returned). Should by empty at call.
+ * \param[in] table The table of all stats grouped by module.
+ * \param[in, out] json Response being written.
  */
-void statsConstructResponse(vector< pair<string, map<int, int> > > &vRes, string &response) {
-  map<int, int>::iterator itMap;
-  for (int maxI=vRes.size(), i=0; i<maxI; i++) {
+void statsConstructResponse(const StatsTable &table, JsonWriter &json) {
+  size_t nbKeys = table.keys.size();
+  for (size_t i = 0; i < table.names.size(); i++) {
+    if (i != 0) json.raw(",", 1);
     // Print web module name or application name for mode "all"
-    response += "[\"" + vRes[i].first + "\",{";
-    itMap = (vRes[i].second).begin();
-    for (int j=0, maxJ=(vRes[i].second).size(); itMap != (vRes[i].second).end(); j++, itMap++) {
-      response += "\"" + boost::lexical_cast<string>(itMap->first)
-               + "\":" + boost::lexical_cast<string>(itMap->second);
-      if (j != (maxJ - 1)) response += ",";
+    json.raw("[", 1).quoted(table.names[i]).raw(",{", 2);
+    for (size_t j = 0; j < nbKeys; j++) {
+      if (j != 0) json.raw(",", 1);
+      json.key(table.keys[j]).number(table.values[i * nbKeys + j]);
     }
-    response += "}]";
-    if (i != (maxI - 1)) response += ",";
+    json.raw("}]", 2);
   }
 }
 
@@ -225,56 +278,7 @@ void get_qsvar(const struct mg_request_info *ri, const char *name, char *dst, si
 }
 
 /*!
- * \fn void get_request_params(struct mg_connection *conn, const struct mg_request_info *ri, map<string, string> &mapParams)
- * \brief Put all request parameters into a map.
- *
- * \param[in] conn Opaque connection handler.
- * \param[in] ri Information about HTTP request.
- * \param[in, out] mapParams Length of the destination buffer.
- */
-void get_request_params(struct mg_connection *conn, const struct mg_request_info *ri, map<string, string> &mapParams) {
-  char *buf;
-  size_t buf_len;
-  const char *cl;
-  buf_len = 0;
-  buf = NULL;
-  cl = mg_get_header(conn, "Content-Length");
-  if ((!strcmp(ri->request_method, "POST") || !strcmp(ri->request_method, "PUT")) && cl != NULL) {
-   buf_len = atoi(cl);
-   buf = (char*) malloc(buf_len);
-   /// Read in two pieces, to test continuation
-   if (buf_len > 2) {
-     mg_read(conn, buf, 2);
-     mg_read(conn, buf + 2, buf_len - 2);
-   } else {
-     mg_read(conn, buf, buf_len);
-   }
-  } else if (ri->query_string != NULL) {
-   buf_len = strlen(ri->query_string);
-   buf = (char*) malloc(buf_len + 1);
-   strcpy(buf, ri->query_string);
-  }
-  
-  string strBuf = string(buf, buf_len);
-  //cout << "Buffer value: " << strBuf << endl;
-  /// Split sequences separated by & ; Ex var1=val1&var2=val2
-  vector<string> vectStrAnd;
-  boost::split(vectStrAnd, strBuf, boost::is_any_of("&"));
-  for(vector<string>::iterator tok_iter = vectStrAnd.begin(); tok_iter != vectStrAnd.end(); ++tok_iter) {
-    size_t found = (*tok_iter).find("=");
-    if (found != string::npos) {
-      /// Split sequences separated by = ; Ex: var1=val1
-      vector<string> vectStrEqual;
-      boost::split(vectStrEqual, *tok_iter, boost::is_any_of("="));
-      //cout << "Value for [" << vectStrEqual[0] << "] is [" << vectStrEqual[1] << "]" << endl;
-      mapParams.insert(pair<string, string>(vectStrEqual[0], vectStrEqual[1]));
-    }
-  }
-  free(buf);
-}
-
-/*!
- * \fn void filteringPeriod(struct mg_connection *conn, const struct mg_request_info *ri, int i, string &strYearMonth, set<string> &setDateToKeep, map<string, string> &mapParams)
+ * \fn void filteringPeriod(struct mg_connection *conn, const struct mg_request_info *ri, int i, string &strYearMonth, set<string> &setDateToKeep, const RequestParams &params)
  * \brief Return a set of web modules stored in DB.
  *
  * \param[in] conn A set to store the web modules names.
@@ -282,21 +286,19 @@ void get_request_params(struct mg_connection *conn, const struct mg_request_info
  * \param[in] i A set to store the web modules names.
  * \param[in, out] strYearMonth A set to store the web modules names.
  * \param[in, out] setDateToKeep A set to store the web modules names.
- * \param[in, out] mapParams A set to store the web modules names.
+ * \param[in] params A set to store the web modules names.
  */
-void filteringPeriod(struct mg_connection *conn, const struct mg_request_info *ri, int i, string &strYearMonth, set<string> &setDateToKeep, map<string, string> &mapParams) {
+void filteringPeriod(struct mg_connection *conn, const struct mg_request_info *ri, int i, string &strYearMonth, set<string> &setDateToKeep, const RequestParams &params) {
   string strAppDays; // Days in the month, starting at 0. Ex: 0-30 or 0-2,4,6-30
   ostringstream oss;
-  map<string, string>::iterator itParam;
+  RequestParams::View value;
   
   /// Get periods for that project (filtering)
-  oss << "p_" << i << "_d";
-  if ((itParam = mapParams.find(oss.str())) != mapParams.end()) {
-    strAppDays = itParam->second;
+  if (params.find("p", i, "d", value)) {
+    strAppDays = value.to_string();
   } else {
     strAppDays = "1-31"; // Default value : complete month
   }
-  oss.str("");
   //if (c.DEBUG_REQUESTS) cout << " days=" << strAppDays;
 
   /// Store only date to be returned
@@ -339,6 +341,98 @@ void filteringPeriod(struct mg_connection *conn, const struct mg_request_info *r
   }
 }
 
+/*!
+ * \fn bool periodOfDay(const string &strDay, const string &strBy, string &strPeriod, boost::gregorian::date &first, boost::gregorian::date &last)
+ * \brief Give the period (day, ISO week or month) of a day, as written in the totals keys, and its first and last days.
+ *
+ * \param[in] strDay Day. Ex: 2011-04-24
+ * \param[in] strBy Period : day, week or month.
+ * \param[out] strPeriod Period in the key. Ex: 2011-04-24, 2011-W16 or 2011-04
+ * \param[out] first First day of the period.
+ * \param[out] last Last day of the period.
+ * \return false if the day is not valid.
+ */
+bool periodOfDay(const string &strDay, const string &strBy, string &strPeriod, boost::gregorian::date &first, boost::gregorian::date &last) {
+  try {
+    boost::gregorian::date day = boost::gregorian::from_simple_string(strDay);
+    if (strBy == "week") {
+      first = day - boost::gregorian::days((day.day_of_week().as_number() + 6) % 7); // Monday
+      last = first + boost::gregorian::days(6);
+      strPeriod = isoWeek(day.year(), day.month(), day.day());
+    } else if (strBy == "month") {
+      first = boost::gregorian::date(day.year(), day.month(), 1);
+      last = day.end_of_month();
+      strPeriod = strDay.substr(0, 7);
+    } else {
+      first = last = day;
+      strPeriod = strDay;
+    }
+  } catch(exception &e) {
+    return false;
+  }
+  return !strPeriod.empty();
+}
+
+/*!
+ * \fn void filteringPeriods(struct mg_connection *conn, const struct mg_request_info *ri, int i, const set<string> &setDate, const string &strBy, set<string> &setDateToKeep, const RequestParams &params)
+ * \brief Fill the days kept by the p_i_d filter in every month covered by the periods of the dates.
+ *
+ * \param[in] conn Opaque connection handler.
+ * \param[in] ri Information about HTTP request.
+ * \param[in] i Index of the application in the request.
+ * \param[in] setDate Days of the requested periods. Ex: 2011-04-24
+ * \param[in] strBy Period : day, week or month.
+ * \param[out] setDateToKeep Days kept by the filter, empty to keep every day.
+ * \param[in] params Parameters of the request.
+ */
+void filteringPeriods(struct mg_connection *conn, const struct mg_request_info *ri, int i, const set<string> &setDate, const string &strBy, set<string> &setDateToKeep, const RequestParams &params) {
+  set<string> setYearMonth; // Ex: 2011-04-
+  for (set<string>::const_iterator it = setDate.begin(); it != setDate.end(); it++) {
+    string strPeriod;
+    boost::gregorian::date first, last;
+    if (periodOfDay(*it, strBy, strPeriod, first, last)) {
+      setYearMonth.insert(boost::gregorian::to_iso_extended_string(first).substr(0, 8));
+      setYearMonth.insert(boost::gregorian::to_iso_extended_string(last).substr(0, 8));
+    }
+  }
+  for (set<string>::iterator it = setYearMonth.begin(); it != setYearMonth.end(); it++) {
+    string strYearMonth = *it;
+    filteringPeriod(conn, ri, i, strYearMonth, setDateToKeep, params);
+  }
+}
+
+/*!
+ * \fn void periodsDays(const set<string> &setDate, const string &strBy, set<string> &setDays)
+ * \brief Give every day of the periods of the dates of a request.
+ *
+ * \param[in] setDate Days of the request. Ex: 2011-04-24
+ * \param[in] strBy Period of each date : day, week or month.
+ * \param[out] setDays Days of the periods.
+ */
+void periodsDays(const set<string> &setDate, const string &strBy, set<string> &setDays) {
+  string strPeriod;
+  boost::gregorian::date first, last;
+  for (set<string>::const_iterator it = setDate.begin(); it != setDate.end(); it++) {
+    if (!periodOfDay(*it, strBy, strPeriod, first, last)) continue;
+    for (boost::gregorian::day_iterator ditr(first); ditr <= last; ++ditr) {
+      setDays.insert(to_iso_extended_string(*ditr));
+    }
+  }
+}
+
+/*!
+ * \fn static void checkCallback(char *cb)
+ * \brief Empty a JSONP callback which is not a JavaScript name, so that no script is given through it. Ex: jQuery1510_1303
+ */
+static void checkCallback(char *cb) {
+  for (char *c = cb; *c != '\0'; c++) {
+    if (!isalnum((unsigned char) *c) && *c != '_' && *c != '$' && *c != '.') {
+      cb[0] = '\0';
+      return;
+    }
+  }
+}
+
 /*!
  * \fn bool handle_jsonp(struct mg_connection *conn, const struct mg_request_info *request_info)
  * \brief Tell if the request is a JSON call
@@ -350,12 +444,205 @@ void filteringPeriod(struct mg_connection *conn, const struct mg_request_info *r
 bool handle_jsonp(struct mg_connection *conn, const struct mg_request_info *request_info) {
   char cb[64];
   get_qsvar(request_info, "callback", cb, sizeof(cb));
+  checkCallback(cb);
   if (cb[0] != '\0') {
     mg_printf(conn, "%s(", cb);
   }
   return cb[0] == '\0' ? false : true;
 }
 
+/*!
+ * \fn string jsonpCallback(const struct mg_request_info *ri)
+ * \brief Give the JSONP callback of a request.
+ *
+ * \param[in] ri Information about HTTP request.
+ * \return Value of the "callback" param, empty for a JSON call.
+ */
+string jsonpCallback(const struct mg_request_info *ri) {
+  char cb[64];
+  get_qsvar(ri, "callback", cb, sizeof(cb));
+  checkCallback(cb);
+  return cb;
+}
+
+/*!
+ * \fn void writeJsonReply(struct mg_connection *conn, const struct mg_request_info *ri, const string &body)
+ * \brief Write the JSON reply of a request, in the JSONP callback if one is requested.
+ *
+ * \param[in] conn Opaque connection handler.
+ * \param[in] ri Information about HTTP request.
+ * \param[in] body JSON response.
+ */
+void writeJsonReply(struct mg_connection *conn, const struct mg_request_info *ri, const string &body) {
+  JsonWriter json(conn, jsonpCallback(ri));
+  json.raw(body);
+  json.end();
+}
+
+/*!
+ * \fn string requestEtag(const struct mg_request_info *ri, const string &key, const set<string> &days)
+ * \brief Give the ETag of the response of a request, from the current epochs of the days it reads.
+ *
+ * \param[in] ri Information about HTTP request.
+ * \param[in] key Key of the request (ResponseCache::key()).
+ * \param[in] days Days read by the request. Ex: 2011-04-24
+ * \return Ex: W/"5f3a9c2e10b47d61"
+ */
+string requestEtag(const struct mg_request_info *ri, const string &key, const set<string> &days) {
+  ResponseCache &cache = ResponseCache::get();
+  CacheEpochs epochs;
+  cache.epochsOf(days, epochs);
+  return cache.etag(key + '#' + jsonpCallback(ri), epochs);
+}
+
+/*!
+ * \fn bool sendNotModified(struct mg_connection *conn, const string &etag)
+ * \brief Answer 304 Not Modified when the client already has the response of an ETag (If-None-Match).
+ *
+ * \param[in] conn Opaque connection handler.
+ * \param[in] etag ETag of the response (weak). Ex: W/"5f3a9c2e10b47d61"
+ * \return true if the 304 is sent, the response does not have to be built.
+ */
+bool sendNotModified(struct mg_connection *conn, const string &etag) {
+  const char *match = mg_get_header(conn, "If-None-Match");
+  if (match == NULL) {
+    return false;
+  }
+  /// Weak comparison : the W/ of the tags is ignored. Ex: W/"5f3a9c2e10b47d61", "0c1e77d2a9b35f04"
+  string strMatch(match);
+  string strOpaque = etag.substr(etag.find('"'));
+  if (strMatch.find(strOpaque) == string::npos && boost::algorithm::trim_copy(strMatch) != "*") {
+    return false;
+  }
+  string reply(standard_not_modified_reply, strlen(standard_not_modified_reply) - 2);
+  reply += "ETag: " + etag + "\r\n\r\n";
+  mg_write(conn, reply.data(), reply.size());
+  DEBUG_REQ_FUNC("Not modified: " << etag);
+  return true;
+}
+
+/*!
+ * \struct StatsRow
+ * \brief Row of a stats response : a module, an application and its modules, or the modules in no application ("Others").
+ */
+struct StatsRow {
+  string name;           //!< Module or application name. Ex: Calendar
+  vector<string> series; //!< Series summed in the row. Ex: module_test_1/w/1
+  int app;               //!< Index of the application in the request (p_i), -1 for a module or "Others"
+};
+
+/*!
+ * \fn bool getRequiredParam(struct mg_connection *conn, const RequestParams &params, const char *name, string &value)
+ * \brief Get a parameter of a request, the error is sent if it is missing.
+ *
+ * \param[in] conn Opaque connection handler.
+ * \param[in] params Parameters of the request.
+ * \param[in] name Name of the parameter. Ex: mode
+ * \param[out] value Value of the parameter.
+ * \return false if the parameter is missing.
+ */
+bool getRequiredParam(struct mg_connection *conn, const RequestParams &params, const char *name, string &value) {
+  if (!params.get(name, value)) {
+    mg_printf(conn, "%s", standard_json_reply);
+    mg_printf(conn, "Missing parameter: %s", name);
+    return false;
+  }
+  return true;
+}
+
+/*!
+ * \fn bool statsRequestRows(struct mg_connection *conn, RequestParams &params, const string &context, vector<StatsRow> &rows)
+ * \brief Read the mode, the modules or applications, the group and the type of a stats request and give the rows of its response.
+ *
+ * In mode=app each module m_i is a row, in mode=all each application p_i sums its modules m_i_j
+ * and the modules in no application are summed in an "Others" row.
+ * \param[in] conn Opaque connection handler.
+ * \param[in, out] params Parameters of the request (applications set for apps=server).
+ * \param[in] context Name of the request for the debug logs. Ex: stats_app_day
+ * \param[out] rows Rows of the response.
+ * \return false if a parameter is missing, the error is sent.
+ */
+bool statsRequestRows(struct mg_connection *conn, RequestParams &params, const string &context, vector<StatsRow> &rows) {
+  string strMode;    // Mode. Ex: app or all
+  string strModules; // Number of modules or applications. Ex: 4
+  string strGroup;   // Type of page requested. Ex: w for web (depends on configuration.ini)
+  string strType;    // Mode. Ex: 1:visits, 2:views, 3:statics
+  set<string> setOtherModules;
+  
+  /// Check parameters values
+  if (!getRequiredParam(conn, params, "mode", strMode)
+      || !getRequiredParam(conn, params, (strMode == "all") ? "apps" : "modules", strModules)) {
+    return false;
+  }
+  if (strMode == "all") {
+    if (strModules == "server") {
+      serverAppsParams(params, strModules, setOtherModules);
+    } else {
+      getDBModules(setOtherModules, KEY_MODULES);
+    }
+  }
+  if (!getRequiredParam(conn, params, "group", strGroup) || !getRequiredParam(conn, params, "type", strType)) {
+    return false;
+  }
+  string strSeriesEnd = '/' + strGroup + '/' + strType;
+  
+  int nbApps = 0;
+  sscanf(strModules.c_str(), "%d", &nbApps);
+  if (strMode == "all") {
+    DEBUG_REQ_FUNC(context << " - with " << nbApps << " apps.");
+  } else {
+    DEBUG_REQ_FUNC(context << " - with " << nbApps << " module(s) in app.");
+  }
+  
+  RequestParams::View value;
+  for (int i = 0; i < nbApps; i++) {
+    StatsRow row;
+    row.app = -1;
+    if (strMode == "all") {
+      if (!params.find("p", i, value)) continue;
+      row.name = value.to_string();
+      row.app = i;
+      
+      /// Get nb module of that app in request
+      int nbModules = 0;
+      if (!params.find("m", i, value)) continue;
+      sscanf(value.to_string().c_str(), "%d", &nbModules);
+      
+      /// Modules of the app, removed from the whole app list
+      set<string> setModules;
+      for (int j = 0; j < nbModules; j++) {
+        if (!params.find("m", i, j, value)) continue;
+        string strModule = value.to_string();
+        setModules.insert(strModule);
+        setOtherModules.erase(strModule);
+      }
+      for (set<string>::iterator it = setModules.begin(); it != setModules.end(); it++) {
+        row.series.push_back(*it + strSeriesEnd);
+      }
+      DEBUG_REQ_FUNC(row.name << " with " << setModules.size() << " modules");
+    } else {
+      if (!params.find("m", i, value)) continue;
+      row.name = value.to_string();
+      row.series.push_back(row.name + strSeriesEnd);
+      DEBUG_REQ_FUNC("- module=" << row.name);
+    }
+    rows.push_back(row);
+  }
+  
+  /// In all mode, add an "Others" application
+  if (strMode == "all" && setOtherModules.size() > 0) {
+    StatsRow row;
+    row.name = "Others";
+    row.app = -1;
+    for (set<string>::iterator it = setOtherModules.begin(); it != setOtherModules.end(); it++) {
+      row.series.push_back(*it + strSeriesEnd);
+    }
+    DEBUG_REQ_FUNC("Others modules (" << setOtherModules.size() << ")");
+    rows.push_back(row);
+  }
+  return true;
+}
+
 /*!
  * \fn void stats_app_intra(struct mg_connection *conn, const struct mg_request_info *ri)
  * \brief Build an HTTP response for the /stats_app_intra context.
@@ -365,128 +652,103 @@ bool handle_jsonp(struct mg_connection *conn, const struct mg_request_info *requ
  * \example http://localhost:9999/stats_app_intra
  */
 void stats_app_intra(struct mg_connection *conn, const struct mg_request_info *ri) {
-  bool is_jsonp;
-  int i, j, max, nbApps, nbModules, offset;
-  unsigned int iVisit, minVisit;
+  int i, max = 0, offset = 0;
   ostringstream oss;
-  string strMode;        // Mode. Ex: app or all
-  string strModules;     // Number of modules. Ex: 4
   string strDates;       // Number of dates. Ex: 60
-  string strGroup;       // Type of page requested. Ex: w for web (depends on configuration.ini)
-  string strType;        // Mode. Ex: 1:visits, 2:views, 3:statics
-  bool detailed;         // Detailed mode ? Ex: yes, no
   string strOffset;      // Date offset. Ex: 60
-  string strApplication; // Application name. Ex: Calendar
+  string strDetailed;    // Detailed mode ? Ex: yes, no
   string strDate;        // Start date. Ex: 1314253853 or Thursday 25 November
-  string strModule;      // Modules name. Ex: gerer_connaissance
-  string visit;
   map<int, string> mapDate;
   map<int, string>::iterator itm;
-  set<string> setModules, setOtherModules;
-  set<string>::iterator its;
   
   /// Get parameters in request.
-  map<string, string> mapParams;
-  map<string, string>::iterator itParam;
-  get_request_params(conn, ri, mapParams);
+  RequestParams params;
+  RequestParams::View value;
+  params.parse(conn, ri);
   
   /// Check parameters values
-  if ((itParam = mapParams.find("mode")) != mapParams.end()) {
-    strMode = itParam->second;
-  } else {
-    mg_printf(conn, "%s", standard_json_reply);
-    mg_printf(conn, "%s", "Missing parameter: mode");
+  if (!getRequiredParam(conn, params, "dates", strDates)
+      || !getRequiredParam(conn, params, "offset", strOffset)
+      || !getRequiredParam(conn, params, "detailed", strDetailed)) {
     return;
   }
-  if (strMode == "all") {
-    if ((itParam = mapParams.find("apps")) != mapParams.end()) {
-      strModules = itParam->second;
-      getDBModules(setOtherModules, KEY_MODULES);
+  sscanf(strDates.c_str(), "%d", &max);
+  sscanf(strOffset.c_str(), "%d", &offset);
+  bool detailed = (strDetailed == "yes");
+  
+  /// Set each date to according offset.
+  vector<pair<int, string> > dateKeys; // Timestamp of each key
+  max += offset;
+  int ii = 0, iii = 0, key = 0;
+  int sub_off = offset-(offset%100); 
+  for(i = offset; i < max; i++, ii++) {
+    if (detailed) {
+	    if (ii!=0 && ii%60 == 0) { ii = 0; iii+=100; }
+	    key = sub_off + ii + iii;
     } else {
-      mg_printf(conn, "%s", standard_json_reply);
-      mg_printf(conn, "%s", "Missing parameter: apps");
-      return;
+	    if (ii!=0 && ii%6 == 0) { ii = 0; iii+=10; }
+	    key = offset + ii + iii;
     }
-  } else {
-    if ((itParam = mapParams.find("modules")) != mapParams.end()) {
-      strModules = itParam->second;
-    } else {
-      mg_printf(conn, "%s", standard_json_reply);
-      mg_printf(conn, "%s", "Missing parameter: modules");
-      return;
+    if (params.find("d", key, value)) {
+      strDate = value.to_string();
+      dateKeys.push_back(pair<int,string>(key, strDate));
+      mapDate.insert( pair<int,string>(key, convertDate(strDate, "%Y-%m-%d") ) ); // Convert timestamp to Y-m-d
     }
   }
-  if ((itParam = mapParams.find("dates")) != mapParams.end()) {
-    strDates = itParam->second;
-    sscanf(strDates.c_str(), "%d", &max);
-  } else {
-    mg_printf(conn, "%s", standard_json_reply);
-    mg_printf(conn, "%s", "Missing parameter: dates");
-    return;
-  }
-  if ((itParam = mapParams.find("offset")) != mapParams.end()) {
-    strOffset = itParam->second;
-    sscanf(strOffset.c_str(), "%d", &offset);
-  } else {
-    mg_printf(conn, "%s", standard_json_reply);
-    mg_printf(conn, "%s", "Missing parameter: offset");
-    return;
+  
+  /// Same days not changed since the response of the client
+  set<string> setDays;
+  for(itm=mapDate.begin(); itm!=mapDate.end(); itm++) {
+    setDays.insert(itm->second);
   }
-  if ((itParam = mapParams.find("group")) != mapParams.end()) {
-    strGroup = itParam->second;
-  } else {
-    mg_printf(conn, "%s", standard_json_reply);
-    mg_printf(conn, "%s", "Missing parameter: group");
+  string etag = requestEtag(ri, ResponseCache::key(ri->uri, params), setDays);
+  if (sendNotModified(conn, etag)) {
     return;
   }
-  if ((itParam = mapParams.find("type")) != mapParams.end()) {
-    strType = itParam->second;
-  } else {
-    mg_printf(conn, "%s", standard_json_reply);
-    mg_printf(conn, "%s", "Missing parameter: type");
+  
+  vector<StatsRow> rows;
+  if (!statsRequestRows(conn, params, "stats_app_intra", rows)) {
     return;
   }
-  if ((itParam = mapParams.find("detailed")) != mapParams.end()) {
-    if ((itParam->second).compare("yes") ==0) {
-	  detailed = true;
-    } else {
-	  detailed = false;
+  
+  /// Query of the minutes or 10 minutes of the days of the dates only, the days in between are not read
+  StatsQuery query;
+  query.resolution = detailed ? RES_MINUTES : RES_10MINUTES;
+  query.daysKept = setDays;
+  map<int, int> mapBucket; // Bucket of each date
+  try {
+    for(itm=mapDate.begin(); itm!=mapDate.end(); itm++) {
+      boost::gregorian::date day = boost::gregorian::from_simple_string(itm->second);
+      if (query.first.is_special() || day < query.first) query.first = day;
+      if (query.last.is_special() || day > query.last) query.last = day;
     }
-  } else {
-    mg_printf(conn, "%s", standard_json_reply);
-    mg_printf(conn, "%s", "Missing parameter: detailed");
-    return;
+    if (queryBuckets(query) > QUERY_MAX_BUCKETS) {
+      mg_printf(conn, "%s", standard_json_reply);
+      mg_printf(conn, "Bad request: dates too far apart for the resolution");
+      return;
+    }
+    for(itm=mapDate.begin(); itm!=mapDate.end(); itm++) {
+      // Slot of the key. Ex: 1503 in detailed mode, 150 otherwise
+      int hour = detailed ? itm->first / 100 : itm->first / 10;
+      int minutes = detailed ? itm->first % 100 : itm->first % 10;
+      if (hour < 24 && minutes < (detailed ? 60 : 6)) {
+        mapBucket[itm->first] = queryBucket(query, boost::gregorian::from_simple_string(itm->second), hour * (detailed ? 60 : 6) + minutes);
+      }
+    }
+  } catch(exception &e) {
+    mapBucket.clear();
   }
   
   /// Get DB accessor
-  DBAccessBerkeley &dbA = DBAccessBerkeley::get();
+  DBAccess &dbA = DBAccess::get();
+  DBSnapshot snapshot(dbA); // All the reads of the request see the same state of the DB
   
   /// Set begining JSON string in response.
-  mg_printf(conn, "%s", standard_json_reply);
-  is_jsonp = handle_jsonp(conn, ri);
-  mg_printf(conn, "%s", "[{");
-  
-  /// Set each date to according offset in response.
-  max += offset;
-  int ii = 0, iii = 0, key = 0;
-  int sub_off = offset-(offset%100); 
-  for(i = offset; i < max; i++, ii++) {
-    if (detailed) {
-	    if (ii!=0 && ii%60 == 0) { ii = 0; iii+=100; }
-	    key = sub_off + ii + iii;
-    } else {
-	    if (ii!=0 && ii%6 == 0) { ii = 0; iii+=10; }
-	    key = offset + ii + iii;
-    }
-    oss << "d_" << key;
-    if ((itParam = mapParams.find(oss.str())) != mapParams.end()) {
-      strDate = itParam->second;
-      //cout << "ici: i=" << i << " ii=" << ii << " iii=" << iii << " => " << key << " strDate=" << strDate << endl;	
-      mg_printf(conn, "\"%d\":\"%s\",", key, strDate.c_str()); // Timestamp returned
-      
-      mapDate.insert( pair<int,string>(key, convertDate(strDate, "%Y-%m-%d") ) ); // Convert timestamp to Y-m-d
-    }  
-    oss.str("");
+  JsonWriter json(conn, jsonpCallback(ri));
+  json.etag(etag);
+  json.raw("[{", 2);
+  for (vector<pair<int, string> >::iterator itKey = dateKeys.begin(); itKey != dateKeys.end(); itKey++) {
+    json.key(itKey->first).quoted(itKey->second).raw(",", 1); // Timestamp returned
   }
   
   /// Set Mode and Date in response.
@@ -497,179 +759,33 @@ void stats_app_intra(struct mg_connection *conn, const struct mg_request_info *r
   } else {
     i = offset + ii + iii;
   }
-  mg_printf(conn, "\"%d\":\"intra\",\"%d\":\"%s\"},", i, i+1, convertDate(strDate, "%A %d %B").c_str());
+  json.key(i).raw("\"intra\",", 8).key(i+1).quoted(convertDate(strDate, "%A %d %B")).raw("},", 2);
   
   /// Build visits stats in response for each modules.
-  vector< pair<string, map<int, int> > > vRes;
-  nbApps = 0;
-  sscanf(strModules.c_str(), "%d", &nbApps);
-  if (strMode == "all") {
-    DEBUG_REQ_FUNC("stats_app_intra - with " << nbApps << " apps.");
-  } else {
-    DEBUG_REQ_FUNC("stats_app_intra - with " << nbApps << " module(s) in app.");
-  }
-  
-  for(i = 0; i < nbApps; i++) {
-    map<int, int> mapResMod;
-    if (strMode == "all") {
-      oss << "p_" << i;
-      if ((itParam = mapParams.find(oss.str())) != mapParams.end()) {
-        strApplication = itParam->second;
-      } else {
-        continue;
-      }
-      oss.str("");
-
-      // Get nb module of that app in request
-      nbModules = 0;
-      oss << "m_" << i;
-      if ((itParam = mapParams.find(oss.str())) != mapParams.end()) {
-        sscanf((itParam->second).c_str(), "%d", &nbModules);
-      } else {
-        continue;
-      }
-      oss.str("");
-      DEBUG_REQ_FUNC(strApplication << " with " << strModules << " modules [");
-
-      // Loop to put modules from request in a set
-      setModules.clear();
-      for(j = 0; j < nbModules; j++) {
-        oss << "m_" << i << "_" << j;
-        if ((itParam = mapParams.find(oss.str())) != mapParams.end()) {
-          strModule = itParam->second;
-        } else {
-          continue;
-        }
-        oss.str("");
-        DEBUG_REQ_FUNC(strModule << ", ");
-        setModules.insert(strModule);
-
-        // Remove this module from the whole app list
-        setOtherModules.erase(strModule);
-      }
-      DEBUG_REQ_FUNC("]");
-      
-      //-- and each module in an app
-      for(itm=mapDate.begin(); itm!=mapDate.end(); itm++) {
-        //-- Get nb visit from DB
-        for(its=setModules.begin(), minVisit=0; its!=setModules.end(); its++) {
-          // Build Key ex: "application/w/1/2011-04-24/1503";
-          oss << *its << '/' << strGroup << '/' << strType << "/" << (*itm).second << '/' << setfill('0');
-		      if (detailed) {
-            oss << setw(4) << (*itm).first;
-          } else {
-            oss << setw(3) << (*itm).first;
-          }
-          // Search Key (oss) in DB
-          visit = dbA.dbw_get(oss.str());
-          if (visit.length() > 0) {
-            // Update nb visit of the app for this day
-            iVisit = 0;
-            sscanf(visit.c_str(), "%d", &iVisit);
-            minVisit += iVisit;
-          }
-          // Return last nb visit
-          //if (strcmp("xxx", strApplication)==0) DEBUG_REQ_FUNC("visits for " << oss.str() << " (" << (*itm).first << ")= " << minVisit);
-          oss.str("");
-        }  
-        mapResMod.insert(pair<int, int>((*itm).first, minVisit));
-      }
-    
-      vRes.push_back(make_pair(strApplication, mapResMod));
-    }
-    else {
-      oss << "m_" << i;
-      if ((itParam = mapParams.find(oss.str())) != mapParams.end()) {
-        strModule = itParam->second;
-      } else {
-        continue;
-      }
-      oss.str("");
-      DEBUG_REQ_FUNC("- module=" << strModule);
-      
-      //-- and each dates.
-      for(itm=mapDate.begin(); itm!=mapDate.end(); itm++) {
-        //-- Get nb visit from DB
-        // Build Key ex: "application/w/1/2011-04-24/150";
-        oss << strModule << '/' << strGroup << '/' << strType << "/" << (*itm).second << '/' << setfill('0');
-        if (detailed) {
-          oss << setw(4) << (*itm).first;
-        } else {
-          oss << setw(3) << (*itm).first;
-        }
-        // Search Key (oss) in DB
-        visit = dbA.dbw_get(oss.str());
-        int iVisit = 0;
-        if (visit.length() > 0) {
-          // Update nb visit of the app for this day
-          sscanf(visit.c_str(), "%d", &iVisit);
-        }
-        // Return nb visit
-        DEBUG_REQ_FUNC(" visits for " << oss.str() << " (" << (*itm).first << ")= " << iVisit);
-        oss.str("");
-        mapResMod.insert(pair<int, int>((*itm).first, iVisit));
-      }
-      vRes.push_back(make_pair(strModule, mapResMod));
-    }
-  }
-  
-  /// In all mode, add an "Others" application
-  if (strMode == "all" && setOtherModules.size() > 0) {
-    map<int, int> mapResMod;
-    DEBUG_REQ_FUNC("Others modules: ");
-    
-    //-- Get nb visit from DB
+  StatsTable table;
+  for(itm=mapDate.begin(); itm!=mapDate.end(); itm++) {
+    table.keys.push_back(itm->first);
+  }
+  vector<unsigned int> values;
+  for (vector<StatsRow>::iterator itRow = rows.begin(); itRow != rows.end(); itRow++) {
+    query.series = itRow->series;
+    runQuery(dbA, query, values);
+    table.names.push_back(itRow->name);
     for(itm=mapDate.begin(); itm!=mapDate.end(); itm++) {
-      //-- Get nb visit from DB
-      for(its=setOtherModules.begin(), minVisit=0; its!=setOtherModules.end(); its++) {
-        if (itm == mapDate.begin()) DEBUG_REQ_FUNC(*its << ", ");
-        // Build Key ex: "application/2011-04-24/150";
-				oss << *its << '/' << strGroup << '/' << strType << "/" << (*itm).second << '/' << setfill('0');
-				if (detailed) {
-          oss << setw(4) << (*itm).first;
-        } else {
-          oss << setw(3) << (*itm).first;
-        }
-        // Search Key (oss) in DB
-        visit = dbA.dbw_get(oss.str());
-        if (visit.length() > 0) {
-          // Update nb visit of the app for this day
-          iVisit = 0;
-          sscanf(visit.c_str(), "%d", &iVisit);
-          minVisit += iVisit;
-        }
-        // Return last nb visit
-        //if (c.DEBUG_REQUESTS && strcmp("xxx", strApplication)==0) cout << " visits for " << oss.str() << " (" << (*itm).first << ")= " << iVisit << endl; 
-        //if (c.DEBUG_REQUESTS && iVisit!=0) cout << " visits for " << oss.str() << " (" << (*itm).first << ")= " << iVisit << endl; 
-				oss.str("");
-      }
-      if (itm == mapDate.begin()) DEBUG_REQ_FUNC(" ");
-      mapResMod.insert(pair<int, int>((*itm).first, minVisit));
+      map<int, int>::iterator itBucket = mapBucket.find(itm->first);
+      table.values.push_back((itBucket != mapBucket.end() && itBucket->second >= 0) ? values[itBucket->second] : 0);
     }
-    vRes.push_back(make_pair("Others", mapResMod));
   }
   
   /// Add a SUM row serie
-  statsAddSumRow(vRes, (max-offset), offset); // 36 a day without offset
+  statsAddSumRow(table);
   
   //-- Construct response
-  string response = "";
-  statsConstructResponse(vRes, response);
+  statsConstructResponse(table, json);
   
   /// Set end JSON string in response.
-  response += "]";
-  if (is_jsonp) {
-    response += ")";
-  }
-  mg_write(conn, response.c_str(), response.length());
-  
-  //In needed, below is a mocked response
-  /*mg_printf(conn, "%s", "[{\"60\":1313726400,\"61\":1313727000,\"62\":1313727600,\"63\":1313728200,\"64\":1313728800,\"65\":1313729400,\"66\":1313730000,\"67\":1313730600,\"68\":1313731200,\"69\":1313731800,\"70\":1313732400,\"71\":1313733000,\"72\":1313733600,\"73\":1313734200,\"74\":1313734800,\"75\":1313735400,\"76\":1313736000,\"77\":1313736600,\"78\":1313737200,\"79\":1313737800,\"80\":1313738400,\"81\":1313739000,\"82\":1313739600,\"83\":1313740200,\"84\":1313740800,\"85\":1313741400,\"86\":1313742000,\"87\":1313742600,\"88\":1313743200,\"89\":1313743800,\"90\":1313744400,\"91\":1313745000,\"92\":1313745600,\"93\":1313746200,\"94\":1313746800,\"95\":1313747400,\"96\":\"intra\",\"97\":\"Vendredi 19 août 2011\"},");
-  mg_printf(conn, "%s", "[\"Connaissance Client\",{\"60\":0,\"61\":0,\"62\":144,\"63\":455,\"64\":234,\"65\":456,\"66\":0,\"67\":0,\"68\":0,\"69\":0,\"70\":0,\"71\":0,\"72\":0,\"73\":0,\"74\":0,\"75\":0,\"76\":0,\"77\":0,\"78\":0,\"79\":0,\"80\":0,\"81\":0,\"82\":0,\"83\":0,\"84\":0,\"85\":0,\"86\":0,\"87\":0,\"88\":0,\"89\":0,\"90\":0,\"91\":0,\"92\":0,\"93\":0,\"94\":0,\"95\":0}],");
-  mg_printf(conn, "%s", "[\"agenda_application\",{\"60\":0,\"61\":0,\"62\":0,\"63\":0,\"64\":0,\"65\":0,\"66\":0,\"67\":0,\"68\":0,\"69\":0,\"70\":0,\"71\":0,\"72\":0,\"73\":0,\"74\":0,\"75\":0,\"76\":0,\"77\":0,\"78\":0,\"79\":0,\"80\":0,\"81\":0,\"82\":0,\"83\":0,\"84\":0,\"85\":0,\"86\":0,\"87\":0,\"88\":0,\"89\":0,\"90\":0,\"91\":0,\"92\":0,\"93\":0,\"94\":0,\"95\":0}],");
-  mg_printf(conn, "%s", "[\"prise_rdv\",{\"60\":0,\"61\":0,\"62\":0,\"63\":0,\"64\":0,\"65\":0,\"66\":0,\"67\":0,\"68\":0,\"69\":0,\"70\":0,\"71\":0,\"72\":0,\"73\":0,\"74\":0,\"75\":0,\"76\":0,\"77\":0,\"78\":0,\"79\":0,\"80\":0,\"81\":0,\"82\":0,\"83\":0,\"84\":0,\"85\":0,\"86\":0,\"87\":0,\"88\":0,\"89\":0,\"90\":0,\"91\":0,\"92\":0,\"93\":0,\"94\":0,\"95\":0}],");
-  mg_printf(conn, "%s", "[\"room_booking\",{\"60\":0,\"61\":0,\"62\":0,\"63\":0,\"64\":0,\"65\":0,\"66\":0,\"67\":0,\"68\":0,\"69\":0,\"70\":0,\"71\":0,\"72\":0,\"73\":0,\"74\":0,\"75\":0,\"76\":0,\"77\":0,\"78\":0,\"79\":0,\"80\":0,\"81\":0,\"82\":0,\"83\":0,\"84\":0,\"85\":0,\"86\":0,\"87\":0,\"88\":0,\"89\":0,\"90\":0,\"91\":0,\"92\":0,\"93\":0,\"94\":0,\"95\":0}]]");  
-  */
+  json.raw("]", 1);
+  json.end();
 }
 
 /*!
@@ -681,533 +797,258 @@ void stats_app_intra(struct mg_connection *conn, const struct mg_request_info *r
  * \example http://localhost:9999/stats_app_day
  */
 void stats_app_day(struct mg_connection *conn, const struct mg_request_info *ri) {
-  bool is_jsonp;
-  int i, j, max, nbApps, nbModules, iVisit;
+  int i, max = 0;
   string strDates;       // Number of dates. Ex: 60
   string strDate;        // Start date. Ex: 1314253853 or Thursday 25 November
-  string strModules;     // Number of modules. Ex: 4m
-  string strApplication; // Application name. Ex: Calendar
-  string strModule;      // Modules name. Ex: module_test_1
-  string strMode;        // Mode. Ex: app or all
-  string strGroup;       // Type of page requested. Ex: w for web (depends on configuration.ini)
-  string strType;        // Mode. Ex: 1:visits, 2:views, 3:statics
   ostringstream oss;
-  string visit;
-  set<string> setModules, setOtherModules;
-  set<string>::iterator it;
-  unsigned int nbVisitForApp;
   
   /// Get parameters in request.
-  map<string, string> mapParams;
-  map<string, string>::iterator itParam;
-  get_request_params(conn, ri, mapParams);
+  RequestParams params;
+  RequestParams::View value;
+  params.parse(conn, ri);
   
   /// Check parameters values
-  if ((itParam = mapParams.find("mode")) != mapParams.end()) {
-    strMode = itParam->second;
-  } else {
-    mg_printf(conn, "%s", standard_json_reply);
-    mg_printf(conn, "%s", "Missing parameter: mode");
+  if (!getRequiredParam(conn, params, "dates", strDates)) {
     return;
   }
-  if (strMode == "all") {
-    if ((itParam = mapParams.find("apps")) != mapParams.end()) {
-      strModules = itParam->second;
-      getDBModules(setOtherModules, KEY_MODULES);
-    } else {
-      mg_printf(conn, "%s", standard_json_reply);
-      mg_printf(conn, "%s", "Missing parameter: apps");
-      return;
-    }
-  } else {
-    if ((itParam = mapParams.find("modules")) != mapParams.end()) {
-      strModules = itParam->second;
-    } else {
-      mg_printf(conn, "%s", standard_json_reply);
-      mg_printf(conn, "%s", "Missing parameter: modules");
-      return;
+  sscanf(strDates.c_str(), "%d", &max);
+  
+  /// The day is the one of the last date
+  for(i = 0; i < max; i++) {
+    if (params.find("d", i, value)) {
+      strDate = value.to_string();
     }
   }
-  if ((itParam = mapParams.find("dates")) != mapParams.end()) {
-    strDates = itParam->second;
-    sscanf(strDates.c_str(), "%d", &max);
-  } else {
-    mg_printf(conn, "%s", standard_json_reply);
-    mg_printf(conn, "%s", "Missing parameter: dates");
-    return;
-  }
-  if ((itParam = mapParams.find("group")) != mapParams.end()) {
-    strGroup = itParam->second;
-  } else {
-    mg_printf(conn, "%s", standard_json_reply);
-    mg_printf(conn, "%s", "Missing parameter: group");
+  
+  /// Same day not changed since the response of the client
+  set<string> setDays;
+  setDays.insert(convertDate(strDate, "%Y-%m-%d"));
+  string etag = requestEtag(ri, ResponseCache::key(ri->uri, params), setDays);
+  if (sendNotModified(conn, etag)) {
     return;
   }
-  if ((itParam = mapParams.find("type")) != mapParams.end()) {
-    strType = itParam->second;
-  } else {
-    mg_printf(conn, "%s", standard_json_reply);
-    mg_printf(conn, "%s", "Missing parameter: type");
+  
+  vector<StatsRow> rows;
+  if (!statsRequestRows(conn, params, "stats_app_day", rows)) {
     return;
   }
 
   /// Get DB accessor
-  DBAccessBerkeley &dbA = DBAccessBerkeley::get();
+  DBAccess &dbA = DBAccess::get();
+  DBSnapshot snapshot(dbA); // All the reads of the request see the same state of the DB
   
   /// Set begining JSON string in response.
-  mg_printf(conn, "%s", standard_json_reply);
-  is_jsonp = handle_jsonp(conn, ri);
-  mg_printf(conn, "%s", "[{");
+  JsonWriter json(conn, jsonpCallback(ri));
+  json.etag(etag);
+  json.raw("[{", 2);
   
   for(i = 0; i < max; i++) {
-    oss << "d_" << i;
-    if ((itParam = mapParams.find(oss.str())) != mapParams.end()) {
-      strDate = itParam->second;
+    if (params.find("d", i, value)) {
 	  //-- Set each date to according offset in response.
-      mg_printf(conn, "\"%d\":\"%s\",", i, strDate.c_str());
+      json.key(i).quoted(value.to_string()).raw(",", 1);
     }
-    oss.str("");
   }
   
   /// Set Mode and Date in response.
   // Extract "Day NDay Month" from timestamp
-  mg_printf(conn, "\"%d\":\"day\",\"%d\":\"%s\"},", i, i+1, convertDate(strDate, "%A %d %B").c_str() );
+  json.key(i).raw("\"day\",", 6).key(i+1).quoted(convertDate(strDate, "%A %d %B")).raw("},", 2);
   
-  /// Convert timestamp to Y-m-d
-  string strDateFormated = convertDate(strDate, "%Y-%m-%d");
+  /// Query of the hours of the day (converted from timestamp to Y-m-d)
+  StatsQuery query;
+  query.resolution = RES_HOURS;
+  try {
+    query.first = query.last = boost::gregorian::from_simple_string(convertDate(strDate, "%Y-%m-%d"));
+  } catch(exception &e) {}
   
   /// Build visits stats in response for each modules or app.
-  vector< pair<string, map<int, int> > > vRes;
-  nbApps = 0;
-  sscanf(strModules.c_str(), "%d", &nbApps);
-  if (strMode == "all") {
-    DEBUG_REQ_FUNC("stats_app_day - with " << nbApps << " apps.");
-  } else {
-    DEBUG_REQ_FUNC("stats_app_day - with " << nbApps << " module(s) in app.");
+  StatsTable table;
+  for(int l = 0; l < DB_TIMES_HOURS_SIZE; l++) {
+    table.keys.push_back(l);
   }
-  for(i = 0; i < nbApps; i++) {
-    map<int, int> mapResMod;
-    if (strMode == "all") {
-      oss << "p_" << i;
-      if ((itParam = mapParams.find(oss.str())) != mapParams.end()) {
-        strApplication = itParam->second;
-      } else {
-        continue;
-      }
-      oss.str("");
-
-      /// Get nb module of that app in request
-      nbModules = 0;
-      oss << "m_" << i;
-      if ((itParam = mapParams.find(oss.str())) != mapParams.end()) {
-        sscanf((itParam->second).c_str(), "%d", &nbModules);
-      } else {
-        continue;
-      }
-      oss.str("");
-      DEBUG_REQ_FUNC(strApplication << " with " << nbModules << " modules [");
-
-      /// Loop to put modules from request in a set
-      setModules.clear();
-      for(j = 0; j < nbModules; j++) {
-        oss << "m_" << i << "_" << j;
-        if ((itParam = mapParams.find(oss.str())) != mapParams.end()) {
-          strModule = itParam->second;
-        } else {
-          continue;
-        }
-        oss.str("");
-        DEBUG_REQ_FUNC(strModule << ", ");
-        setModules.insert(strModule);
-
-        /// Remove this module from the whole app list
-        setOtherModules.erase(strModule);
-      }
-      DEBUG_REQ_FUNC("]");
-
-      /// and each module in an app
-      for(int l=0, max=DB_TIMES_HOURS_SIZE;l<max;l++) {
-        //-- Get nb visit from DB
-        for(it=setModules.begin(); it!=setModules.end(); it++) {
-          // Build Key ex: "application/w/1/2011-04-24/150";
-          oss << *it << '/' << strGroup << '/' << strType << "/" << strDateFormated << '/' << dbTimesHours[l];
-          // Search Key (oss) in DB
-          visit = dbA.dbw_get(oss.str());
-          iVisit = 0;
-          if (visit.length() > 0) {
-            sscanf(visit.c_str(), "%d", &iVisit);
-            //if (*it == "bureau") cout << oss.str() << " = " << iVisit << endl;
-          }
-          if (iVisit != 0) DEBUG_REQ_FUNC(" visits for " << oss.str() << " => " << iVisit << " dbTimesHours[l]=" << dbTimesHours[l]);
-          // Return nb visit
-          mapResMod.insert(pair<int, int>(l, iVisit));
-          oss.str("");
-        }
-      }
-    
-      vRes.push_back(make_pair(strApplication, mapResMod));
-    }
-    else {
-      oss << "m_" << i;
-      if ((itParam = mapParams.find(oss.str())) != mapParams.end()) {
-        strModule = itParam->second;
-      } else {
-        continue;
-      }
-      oss.str("");
-      DEBUG_REQ_FUNC(" - module=" << strModule);
-    
-      /// Get nb visit from DB
-      for(int l=0, max=DB_TIMES_HOURS_SIZE;l<max;l++) {
-        // Build Key ex: "application/w/1/2011-04-24/150";
-        oss << strModule << '/' << strGroup << '/' << strType << "/" << strDateFormated << '/' << dbTimesHours[l];
-        //if (c.DEBUG_REQUESTS && l==0) cout << " visits for " << oss.str() << endl;
-        /// Search Key (oss) in DB
-        visit = dbA.dbw_get(oss.str());
-        iVisit = 0;
-        if (visit.length() > 0) {
-          sscanf(visit.c_str(), "%d", &iVisit);
-          //if (c.DEBUG_REQUESTS) cout << oss.str() << " = " << iVisit << endl;
-        }
-        DEBUG_REQ_FUNC(oss.str() << " at " << l << "h00 => " << iVisit);
-        /// Return nb visit
-        mapResMod.insert(pair<int, int>(l, iVisit));
-        oss.str("");
-      }
-      
-      vRes.push_back(make_pair(strModule, mapResMod));
-    }
-  }
-  
-  /// In all mode, add an "Others" application
-  if (strMode == "all" && setOtherModules.size() > 0) {
-    map<int, int> mapResMod;
-    DEBUG_REQ_FUNC("Others modules (" << setOtherModules.size() << "): ");
-    
-    /// Get nb visit from DB
-    for(int l = 0, max=DB_TIMES_HOURS_SIZE;l<max;l++) {
-      for(it=setOtherModules.begin(), nbVisitForApp = 0; it!=setOtherModules.end(); it++) {
-        if (l == 0) DEBUG_REQ_FUNC(*it << ", ");
-        /// Build Key ex: "application/w/1/2011-04-24/150";
-        oss << *it << '/' << strGroup << '/' << strType << "/" << strDateFormated << '/' << dbTimesHours[l];
-        /// Search Key (oss) in DB
-        visit = dbA.dbw_get(oss.str());
-        if (visit.length() > 0) {
-          iVisit = 0;
-          sscanf(visit.c_str(), "%d", &iVisit);
-          nbVisitForApp += iVisit;
-          //if (c.DEBUG_APP_OTHERS && *it == "bureau") cout << oss.str() << " = " << boost::lexical_cast<int>(visit) << endl;
-        }
-        oss.str("");
-      }
-      if (l == 0) DEBUG_REQ_FUNC(" ");
-      /// Return nb visit
-      mapResMod.insert(pair<int,int>(l, nbVisitForApp));
-    }
-    vRes.push_back(make_pair("Others", mapResMod));
+  vector<unsigned int> values;
+  for (vector<StatsRow>::iterator itRow = rows.begin(); itRow != rows.end(); itRow++) {
+    query.series = itRow->series;
+    runQuery(dbA, query, values);
+    values.resize(DB_TIMES_HOURS_SIZE, 0); // Day not valid
+    table.names.push_back(itRow->name);
+    table.values.insert(table.values.end(), values.begin(), values.end());
   }
   
   /// Add a SUM row serie
-  statsAddSumRow(vRes, 24, 0); // 24hours a day without offset
+  statsAddSumRow(table); // 24hours a day
   
   /// Construct response
-  string response = "";
-  statsConstructResponse(vRes, response);
+  statsConstructResponse(table, json);
   
   /// Set end JSON string in response.
-  response += "]";
-  if (is_jsonp) {
-    response += ")";
-  }
-  mg_write(conn, response.c_str(), response.length());
+  json.raw("]", 1);
+  json.end();
 }
 
 /*!
- * \fn void stats_app_week(struct mg_connection *conn, const struct mg_request_info *ri)
- * \brief Build an HTTP response for the /stats_app_week context.
+ * \fn void statsAppPeriods(struct mg_connection *conn, const struct mg_request_info *ri, const string &context)
+ * \brief Build an HTTP response for the /stats_app_week and /stats_app_month contexts : visits of each date,
+ * by day, ISO week or month (parameter by), the response is kept in the response cache.
  *
  * \param[in] conn Opaque connection handler.
- * \param[in] request_info Information about HTTP request.
- * \example http://localhost:9999/stats_app_week
+ * \param[in] ri Information about HTTP request.
+ * \param[in] context Name of the request. Ex: stats_app_week
  */
-void stats_app_week(struct mg_connection *conn, const struct mg_request_info *ri) {
-  bool is_jsonp;
-  int i, j, max, nbApps, nbModules, offset, iVisit;
+void statsAppPeriods(struct mg_connection *conn, const struct mg_request_info *ri, const string &context) {
+  int i, j, max = 0, offset = 0;
   string strDates;   // Number of dates. Ex: 31
   string strDate;    // Start date. Ex: 1314253853 or Thursday 25 November
   string strOffset;  // Date offset. Ex: 11
-  string strModules; // Number of modules. Ex: 4
-  string strApplication;  // Application name. Ex: Calendar
-  string strModule;  // Modules name. Ex: gerer_connaissance
-  string strMode;     // Mode. Ex: app or all
-  string strGroup;       // Type of page requested. Ex: w for web (depends on configuration.ini)
-  string strType;     // Mode. Ex: 1:visits, 2:views, 3:statics
+  string strBy;      // Period of each date. Ex: day, week (ISO week) or month
   ostringstream oss;
-  string visit, date;
-  set<string> setDate, setModules, setOtherModules;
-  set<string>::iterator it, itt;
-  unsigned int nbVisitForApp;
+  set<string> setDate;
+  set<string>::iterator it;
 
   /// Get parameters in request.
-  map<string, string> mapParams;
-  map<string, string>::iterator itParam;
-  get_request_params(conn, ri, mapParams);
+  RequestParams params;
+  RequestParams::View value;
+  params.parse(conn, ri);
   
   /// Check parameters values
-  if ((itParam = mapParams.find("mode")) != mapParams.end()) {
-    strMode = itParam->second;
-  } else {
-    mg_printf(conn, "%s", standard_json_reply);
-    mg_printf(conn, "%s", "Missing parameter: mode");
+  if (!getRequiredParam(conn, params, "dates", strDates)
+      || !getRequiredParam(conn, params, "offset", strOffset)) {
     return;
   }
-  if (strMode == "all") {
-    if ((itParam = mapParams.find("apps")) != mapParams.end()) {
-      strModules = itParam->second;
-      getDBModules(setOtherModules, KEY_MODULES);
-    } else {
+  sscanf(strDates.c_str(), "%d", &max);
+  sscanf(strOffset.c_str(), "%d", &offset);
+  if (params.get("by", strBy)) {
+    if (strBy != "day" && strBy != "week" && strBy != "month") {
       mg_printf(conn, "%s", standard_json_reply);
-      mg_printf(conn, "%s", "Missing parameter: apps");
+      mg_printf(conn, "%s", "Bad parameter: by");
       return;
     }
   } else {
-    if ((itParam = mapParams.find("modules")) != mapParams.end()) {
-      strModules = itParam->second;
-    } else {
-      mg_printf(conn, "%s", standard_json_reply);
-      mg_printf(conn, "%s", "Missing parameter: modules");
-      return;
-    }
+    strBy = "day"; // Default value : each date is a day
   }
-  if ((itParam = mapParams.find("dates")) != mapParams.end()) {
-    strDates = itParam->second;
-    sscanf(strDates.c_str(), "%d", &max);
-  } else {
-    mg_printf(conn, "%s", standard_json_reply);
-    mg_printf(conn, "%s", "Missing parameter: dates");
-    return;
+  
+  /// Create a set for the Dates to loop easily
+  max += offset;
+  for(i = offset; i < max; i++) {
+    if (params.find("d", i, value)) {
+      strDate = value.to_string();
+      // Convert timestamp to Y-m-d
+      try {
+        boost::posix_time::ptime pt = boost::posix_time::from_time_t(boost::lexical_cast<time_t> (strDate));
+        setDate.insert(boost::gregorian::to_iso_extended_string(pt.date()));
+      } catch(boost::bad_lexical_cast &) {}
+    }
   }
-  if ((itParam = mapParams.find("offset")) != mapParams.end()) {
-    strOffset = itParam->second;
-    sscanf(strOffset.c_str(), "%d", &offset);
-  } else {
-    mg_printf(conn, "%s", standard_json_reply);
-    mg_printf(conn, "%s", "Missing parameter: offset");
+  
+  /// Epochs of the days of the periods, got before reading them
+  ResponseCache &cache = ResponseCache::get();
+  string cacheKey = ResponseCache::key(ri->uri, params);
+  CacheEpochs epochs;
+  set<string> setDaysRead;
+  periodsDays(setDate, strBy, setDaysRead);
+  cache.epochsOf(setDaysRead, epochs);
+  
+  /// Same days not changed since the response of the client
+  string etag = cache.etag(cacheKey + '#' + jsonpCallback(ri), epochs);
+  if (sendNotModified(conn, etag)) {
     return;
   }
-  if ((itParam = mapParams.find("group")) != mapParams.end()) {
-    strGroup = itParam->second;
-  } else {
-    mg_printf(conn, "%s", standard_json_reply);
-    mg_printf(conn, "%s", "Missing parameter: type");
+  
+  /// Same request already answered from days not changed since
+  string body, gzipped;
+  if (cache.find(cacheKey, body, &gzipped)) {
+    bool compressed = !gzipped.empty();
+    JsonWriter json(conn, jsonpCallback(ri), NULL, compressed ? NULL : &gzipped);
+    json.etag(etag);
+    if (!json.sendGzipped(gzipped)) {
+      json.raw(body);
+      json.end();
+      if (!compressed && !gzipped.empty()) cache.storeGzipped(cacheKey, gzipped); // Compressed for the first time
+    }
     return;
   }
-  if ((itParam = mapParams.find("type")) != mapParams.end()) {
-    strType = itParam->second;
-  } else {
-    mg_printf(conn, "%s", standard_json_reply);
-    mg_printf(conn, "%s", "Missing parameter: type");
+  
+  vector<StatsRow> rows;
+  if (!statsRequestRows(conn, params, context, rows)) {
     return;
   }
   
   /// Get DB accessor
-  DBAccessBerkeley &dbA = DBAccessBerkeley::get();
-  
-  /// Set begining JSON string in response.
-  mg_printf(conn, "%s", standard_json_reply);
-  is_jsonp = handle_jsonp(conn, ri);
-  mg_printf(conn, "%s", "[{");
+  DBAccess &dbA = DBAccess::get();
+  DBSnapshot snapshot(dbA); // All the reads of the request see the same state of the DB
   
-  /// Create a set for the Dates to loop easily
-  max += offset;
+  /// Set begining JSON string in response, kept in body for the cache.
+  JsonWriter json(conn, jsonpCallback(ri), &body, &gzipped);
+  json.etag(etag);
+  json.raw("[{", 2);
   for(i = offset; i < max; i++) {
-    oss << "d_" << i;
-    if ((itParam = mapParams.find(oss.str())) != mapParams.end()) {
-      strDate = itParam->second;
+    if (params.find("d", i, value)) {
       //-- Set each date to according offset in response.
-      mg_printf(conn, "\"%d\":\"%s\",", i, strDate.c_str());
-      // Convert timestamp to Y-m-d
-      try {
-        boost::posix_time::ptime pt = boost::posix_time::from_time_t(boost::lexical_cast<time_t> (strDate));
-        boost::gregorian::date d = pt.date();
-        date = boost::gregorian::to_iso_extended_string(d);
-        setDate.insert(date);
-      } catch(boost::bad_lexical_cast &) {}
+      json.key(i).quoted(value.to_string()).raw(",", 1);
     }
-    oss.str("");
   }
   
-  /// Save Year-Month for later
-  size_t found = date.find_last_of("-");
-  string strYearMonth = date.substr(0, found+1);
-  
   /// Set Mode and Date in response.
   // Extract "Day NDay Month" from timestamp // Depend one request intra, day, week, month, year
-  mg_printf(conn, "\"%d\":\"month\",\"%d\":\"%s\"},", i, i+1, convertDate(strDate, "%B %Y").c_str() );
+  json.key(i).raw("\"month\",", 8).key(i+1).quoted(convertDate(strDate, "%B %Y")).raw("},", 2);
   
-  /// Build visits stats in response for each modules.
-  vector< pair<string, map<int, int> > > vRes;
-  nbApps = 0;
-  sscanf(strModules.c_str(), "%d", &nbApps);
-  for(i = 0; i < nbApps; i++) {
-    map<int, int> mapResMod;
-    if (strMode == "all") {
-      oss << "p_" << i;
-      if ((itParam = mapParams.find(oss.str())) != mapParams.end()) {
-        strApplication = itParam->second;
-      } else {
-        continue;
-      }
-      oss.str("");
-      DEBUG_REQ_FUNC("stats_app_week - app=" << strApplication);
-      
-      //-- Filter for days
-      set<string> setDateToKeep;
-      filteringPeriod(conn, ri, i, strYearMonth, setDateToKeep, mapParams);
-      
-      // Get nb module of that app in request
-      nbModules = 0;
-      oss << "m_" << i;
-      if ((itParam = mapParams.find(oss.str())) != mapParams.end()) {
-        sscanf((itParam->second).c_str(), "%d", &nbModules);
-      } else {
-        continue;
-      }
-      oss.str("");
-      DEBUG_REQ_FUNC("with " << nbModules << " modules in app [");
-      
-      // Loop to put modules from request in a set
-      setModules.clear();
-      for(j = 0; j < nbModules; j++) {
-        oss << "m_" << i << "_" << j;
-        if ((itParam = mapParams.find(oss.str())) != mapParams.end()) {
-          strModule = itParam->second;
-        } else {
-          continue;
-        }
-        oss.str("");
-        DEBUG_REQ_FUNC(strModule << ", ");
-        setModules.insert(strModule);
-        
-        // Remove this module from the whole app list
-        setOtherModules.erase(strModule);
-      }
-      DEBUG_REQ_FUNC("]");
-        
-      //-- and loop for each dates.
-      sscanf(strOffset.c_str(), "%d", &j);
-      for(it=setDate.begin(); it!=setDate.end(); j++) {
-        nbVisitForApp = 0;
-        // If *it is not in setDateToKeep, return 0 values
-        set<string>::iterator itSet = setDateToKeep.find(*it);
-        if ((setDateToKeep.size() == 0) || (itSet != setDateToKeep.end())) {
-          //-- and each module in an app
-          for(itt=setModules.begin(); itt!=setModules.end(); itt++) {
-            //-- Get nb visit from DB
-            // Build Key ex: "application/w/1/2011-04-24";
-            oss << *itt << '/' << strGroup << '/' << strType << "/" << *it;
-            // Search Key (oss) in DB
-            visit = dbA.dbw_get(oss.str());
-            oss.str("");
-            if (visit.length() > 0) {
-              // Update nb visit of the app for this day
-              iVisit = 0;
-              sscanf(visit.c_str(), "%d", &iVisit);
-              nbVisitForApp += iVisit;
-            }
-          }
-        }
-        DEBUG_REQ_FUNC(*it << " => " << nbVisitForApp << " visits.");
-        it++;
-        
-        // Return nb visit
-        mapResMod.insert(pair<int, int>(j, nbVisitForApp));
-      }
-      
-      vRes.push_back(make_pair(strApplication, mapResMod));
-    }
-    else {
-      oss << "m_" << i;
-      if ((itParam = mapParams.find(oss.str())) != mapParams.end()) {
-        strModule = itParam->second;
-      } else {
-        continue;
-      }
-      oss.str("");
-      DEBUG_REQ_FUNC("stats_app_week: " << strModule);
-    
-      //-- and each dates.
-      sscanf(strOffset.c_str(), "%d", &j);
-      for(it=setDate.begin(); it!=setDate.end(); j++, it++) {
-        //-- Get nb visit from DB
-        // Build Key ex: "application/w/1/2011-04-24";
-        oss << strModule << '/' << strGroup << '/' << strType << "/" << *it;
-        // Search Key (oss) in DB
-        visit = dbA.dbw_get(oss.str());
-        if (visit.length() == 0) {
-          visit = "0";
-        }
-        //if (c.DEBUG_REQUESTS) cout << "oss:" << oss.str() << " i: " << i << " visit:" << visit << endl;
-        oss.str("");
-      
-        // Return nb visit
-        try {
-          sscanf(visit.c_str(), "%d", &iVisit);
-          mapResMod.insert(pair<int, int>(j, iVisit));
-        } catch(boost::bad_lexical_cast &) {}
-      }
-      vRes.push_back(make_pair(strModule, mapResMod));
-    }
+  /// Query of the periods of the dates
+  StatsQuery query;
+  query.resolution = (strBy == "week") ? RES_WEEKS : (strBy == "month") ? RES_MONTHS : RES_DAYS;
+  if (!setDate.empty()) {
+    string strPeriod;
+    boost::gregorian::date first, last;
+    if (periodOfDay(*setDate.begin(), strBy, strPeriod, first, last)) query.first = first;
+    if (periodOfDay(*setDate.rbegin(), strBy, strPeriod, first, last)) query.last = last;
   }
   
-  /// In all mode, add an "Others" application
-  if (strMode == "all" && setOtherModules.size() > 0) {
-    map<int, int> mapResMod;
-    DEBUG_REQ_FUNC("Others modules: ");
-    
-    sscanf(strOffset.c_str(), "%d", &j);
-    for(it=setDate.begin(); it!=setDate.end(); j++, it++) {
-      for(itt=setOtherModules.begin(), nbVisitForApp = 0; itt!=setOtherModules.end(); itt++) {
-        //-- Get nb visit from DB
-        // Build Key ex: "application/w/1/2011-04-24";
-        oss << *itt << '/' << strGroup << '/' << strType << "/" << *it;
-        // Search Key (oss) in DB
-        visit = dbA.dbw_get(oss.str());
-        oss.str("");
-        if (visit.length() > 0) {
-          // Update nb visit of the app for this day
-          iVisit = 0;
-          sscanf(visit.c_str(), "%d", &iVisit);
-          nbVisitForApp += iVisit;
-        }
-        
-        if (it==setDate.begin()) DEBUG_REQ_FUNC(*itt << ", ");
-      }
-      
-      // Return nb visit if != 0
-      ///if (nbVisitForApp != 0){
-        mapResMod.insert(pair<int,int>(j, nbVisitForApp));
-      ///}
+  /// Build visits stats in response for each modules or app.
+  StatsTable table;
+  for(it=setDate.begin(), j=offset; it!=setDate.end(); j++, it++) {
+    table.keys.push_back(j);
+  }
+  vector<unsigned int> values;
+  for (vector<StatsRow>::iterator itRow = rows.begin(); itRow != rows.end(); itRow++) {
+    //-- Filter for days of an application (days not kept count 0)
+    query.daysKept.clear();
+    if (itRow->app >= 0) {
+      filteringPeriods(conn, ri, itRow->app, setDate, strBy, query.daysKept, params);
     }
+    query.series = itRow->series;
+    runQuery(dbA, query, values);
     
-    vRes.push_back(make_pair("Others", mapResMod));
-    
-    DEBUG_REQ_FUNC(" ");
+    table.names.push_back(itRow->name);
+    for(it=setDate.begin(), j=offset; it!=setDate.end(); j++, it++) {
+      int bucket = -1;
+      try {
+        bucket = queryBucket(query, boost::gregorian::from_simple_string(*it));
+      } catch(exception &e) {}
+      table.values.push_back((bucket >= 0) ? values[bucket] : 0);
+      DEBUG_REQ_FUNC(itRow->name << ' ' << *it << " => j=" << j << " - " << table.values.back() << " visits.");
+    }
   }
   
   /// Add a SUM row serie
-  statsAddSumRow(vRes, max, offset);
+  statsAddSumRow(table);
   
   /// Construct response
-  string response = "";
-  statsConstructResponse(vRes, response);
+  statsConstructResponse(table, json);
   
   /// Set end JSON string in response.
-  response += "]";
-  if (is_jsonp) {
-   response += ")";
-  }
-  mg_write(conn, response.c_str(), response.length());
+  json.raw("]", 1);
+  json.end();
+  cache.store(cacheKey, body, epochs, gzipped);
+}
+
+/*!
+ * \fn void stats_app_week(struct mg_connection *conn, const struct mg_request_info *ri)
+ * \brief Build an HTTP response for the /stats_app_week context.
+ *
+ * \param[in] conn Opaque connection handler.
+ * \param[in] request_info Information about HTTP request.
+ * \example http://localhost:9999/stats_app_week
+ */
+void stats_app_week(struct mg_connection *conn, const struct mg_request_info *ri) {
+  statsAppPeriods(conn, ri, "stats_app_week");
 }
 
 /*!
@@ -1219,281 +1060,299 @@ void stats_app_week(struct mg_connection *conn, const struct mg_request_info *ri
  * \example http://localhost:9999/stats_app_month
  */
 void stats_app_month(struct mg_connection *conn, const struct mg_request_info *ri) {
-  bool is_jsonp;
-  int i, j, max, nbApps, nbModules, offset, iVisit;
-  string strDates;   // Number of dates. Ex: 31
-  string strDate;    // Start date. Ex: 1314253853 or Thursday 25 November
-  string strOffset;  // Date offset. Ex: 11
-  string strModules; // Number of modules. Ex: 4
-  string strApplication;  // Application name. Ex: Calendar
-  string strModule;  // Modules name. Ex: module_test_1
-  string strMode;     // Mode. Ex: app or all
-  string strGroup;       // Type of page requested. Ex: w for web (depends on configuration.ini)
-  string strType;     // Mode. Ex: 1 or 2 or 3
-  ostringstream oss;
-  string mode, visit, date;
-  set<string> setDate, setModules, setOtherModules;
-  set<string>::iterator it, itt;
-  unsigned int nbVisitForApp;
-  
-  /// Get parameters in request.
-  map<string, string> mapParams;
-  map<string, string>::iterator itParam;
-  get_request_params(conn, ri, mapParams);
-  
-  /// Check parameters values
-  if ((itParam = mapParams.find("mode")) != mapParams.end()) {
-    strMode = itParam->second;
-  } else {
-    mg_printf(conn, "%s", standard_json_reply);
-    mg_printf(conn, "%s", "Missing parameter: mode");
-    return;
+  statsAppPeriods(conn, ri, "stats_app_month");
+}
+
+/*!
+ * \fn bool parseRangeRequest(const string &body, StatsQuery &query, vector<StatsRow> &rows, string &format, string &error)
+ * \brief Read the JSON body of a range request.
+ *
+ * \param[in] body Body of the request. Ex: {"series":[{"name":"Calendar","modules":["module_test_1","module_test_2"]}],
+ * "from":"2011-04-01","to":"2011-04-30","resolution":"day","type":1,"group":"w"}
+ * \param[out] query Range and resolution of the query, the series are given by row.
+ * \param[out] rows Rows of the response : a row sums its modules, a row without modules is the module of its name.
+ * \param[out] format Format of the response : json (default) or msgpack.
+ * \param[out] error Reason of the failure.
+ * \return false if the body is not a valid range request.
+ */
+bool parseRangeRequest(const string &body, StatsQuery &query, vector<StatsRow> &rows, string &format, string &error) {
+  boost::property_tree::ptree tree;
+  try {
+    istringstream iss(body);
+    boost::property_tree::read_json(iss, tree);
+  } catch (boost::property_tree::json_parser_error &e) {
+    error = "JSON body not valid";
+    return false;
   }
-  if (strMode == "all") {
-    if ((itParam = mapParams.find("apps")) != mapParams.end()) {
-      strModules = itParam->second;
-      getDBModules(setOtherModules, KEY_MODULES);
-    } else {
-      mg_printf(conn, "%s", standard_json_reply);
-      mg_printf(conn, "%s", "Missing parameter: apps");
-      return;
-    }
+  
+  /// Range and resolution
+  string strFrom = tree.get<string>("from", ""), strTo = tree.get<string>("to", "");
+  try {
+    query.first = boost::gregorian::from_simple_string(strFrom);
+    query.last = boost::gregorian::from_simple_string(strTo);
+  } catch (exception &e) {
+    error = "from and to must be dates. Ex: 2011-04-24";
+    return false;
+  }
+  string strResolution = tree.get<string>("resolution", "day");
+  if (strResolution == "minute") {
+    query.resolution = RES_MINUTES;
+  } else if (strResolution == "10minutes") {
+    query.resolution = RES_10MINUTES;
+  } else if (strResolution == "hour") {
+    query.resolution = RES_HOURS;
+  } else if (strResolution == "day") {
+    query.resolution = RES_DAYS;
+  } else if (strResolution == "week") {
+    query.resolution = RES_WEEKS;
+  } else if (strResolution == "month") {
+    query.resolution = RES_MONTHS;
   } else {
-    if ((itParam = mapParams.find("modules")) != mapParams.end()) {
-      strModules = itParam->second;
-    } else {
-      mg_printf(conn, "%s", standard_json_reply);
-      mg_printf(conn, "%s", "Missing parameter: modules");
-      return;
+    error = "resolution must be minute, 10minutes, hour, day, week or month";
+    return false;
+  }
+  size_t nbBuckets = queryBuckets(query);
+  if (nbBuckets == 0 || nbBuckets > QUERY_MAX_BUCKETS) {
+    error = "Range empty or too large for the resolution";
+    return false;
+  }
+  
+  /// Series of each row
+  string strGroup = tree.get<string>("group", ""), strType = tree.get<string>("type", "");
+  if (strGroup.empty() || strType.empty()) {
+    error = "Missing group or type";
+    return false;
+  }
+  string strSeriesEnd = '/' + strGroup + '/' + strType;
+  boost::optional<boost::property_tree::ptree&> series = tree.get_child_optional("series");
+  if (series) {
+    for (boost::property_tree::ptree::iterator it = series->begin(); it != series->end(); it++) {
+      StatsRow row;
+      row.name = it->second.get<string>("name", "");
+      row.app = -1;
+      if (row.name.empty()) continue;
+      set<string> setModules;
+      boost::optional<boost::property_tree::ptree&> modules = it->second.get_child_optional("modules");
+      if (!modules) {
+        setModules.insert(row.name);
+      } else if (modules->empty()) {
+        if (!modules->data().empty()) setModules.insert(modules->data()); // A single module not in an array
+      } else {
+        for (boost::property_tree::ptree::iterator itModule = modules->begin(); itModule != modules->end(); itModule++) {
+          setModules.insert(itModule->second.get_value<string>());
+        }
+      }
+      for (set<string>::iterator itModule = setModules.begin(); itModule != setModules.end(); itModule++) {
+        row.series.push_back(*itModule + strSeriesEnd);
+      }
+      DEBUG_REQ_FUNC(row.name << " with " << setModules.size() << " modules");
+      rows.push_back(row);
     }
   }
-  if ((itParam = mapParams.find("dates")) != mapParams.end()) {
-    strDates = itParam->second;
-    sscanf(strDates.c_str(), "%d", &max);
-  } else {
-    mg_printf(conn, "%s", standard_json_reply);
-    mg_printf(conn, "%s", "Missing parameter: dates");
-    return;
+  if (rows.empty()) {
+    error = "Missing series";
+    return false;
   }
-  if ((itParam = mapParams.find("offset")) != mapParams.end()) {
-    strOffset = itParam->second;
-    sscanf(strOffset.c_str(), "%d", &offset);
+  format = tree.get<string>("format", "json");
+  return true;
+}
+
+/*!
+ * \fn void stats_app_range(struct mg_connection *conn, const struct mg_request_info *ri)
+ * \brief Build an HTTP response for the /stats_app_range context : visits of each series from a day to another,
+ * by bucket of the resolution, the dates are computed by the server.
+ *
+ * The response is JSON, or MessagePack with "format":"msgpack" or an Accept: application/x-msgpack header.
+ * Ex: {"from":"2011-04-01","to":"2011-04-30","resolution":"day","keys":["2011-04-01",...],
+ * "series":[["All",[12,5,...]],["Calendar",[10,3,...]],...]} (same structure in MessagePack)
+ * \param[in] conn Opaque connection handler.
+ * \param[in] ri Information about HTTP request.
+ * \example curl -d '{"series":[{"name":"module_test_1"}],"from":"2011-04-01","to":"2011-04-30","type":1,"group":"w"}' http://localhost:9999/stats_app_range
+ */
+void stats_app_range(struct mg_connection *conn, const struct mg_request_info *ri) {
+  /// Read the JSON body
+  string body, format, error;
+  StatsQuery query;
+  vector<StatsRow> rows;
+  if (!RequestParams::readBody(conn, ri, body)) {
+    error = "POST a JSON body";
   } else {
-    mg_printf(conn, "%s", standard_json_reply);
-    mg_printf(conn, "%s", "Missing parameter: offset");
-    return;
+    parseRangeRequest(body, query, rows, format, error);
   }
-  if ((itParam = mapParams.find("group")) != mapParams.end()) {
-    strGroup = itParam->second;
-  } else {
+  if (!error.empty()) {
     mg_printf(conn, "%s", standard_json_reply);
-    mg_printf(conn, "%s", "Missing parameter: type");
+    mg_printf(conn, "Bad request: %s", error.c_str());
     return;
   }
-  if ((itParam = mapParams.find("type")) != mapParams.end()) {
-    strType = itParam->second;
-  } else {
-    mg_printf(conn, "%s", standard_json_reply);
-    mg_printf(conn, "%s", "Missing parameter: type");
+  const char *accept = mg_get_header(conn, "Accept");
+  if (accept != NULL && strstr(accept, "application/x-msgpack") != NULL) {
+    format = "msgpack";
+  }
+  DEBUG_REQ_FUNC("stats_app_range - " << rows.size() << " series from " << query.first << " to " << query.last);
+  
+  /// Same days not changed since the response of the client
+  string strFrom = boost::gregorian::to_iso_extended_string(query.first);
+  string strTo = boost::gregorian::to_iso_extended_string(query.last);
+  ResponseCache &cache = ResponseCache::get();
+  CacheEpochs epochs;
+  cache.epochsOfRange(strFrom, strTo, epochs);
+  string etag = cache.etag(string(ri->uri) + '?' + body + '#' + format + '#' + jsonpCallback(ri), epochs);
+  if (sendNotModified(conn, etag)) {
     return;
   }
   
   /// Get DB accessor
-  DBAccessBerkeley &dbA = DBAccessBerkeley::get();
-  
-  /// Set begining JSON string in response.
-  mg_printf(conn, "%s", standard_json_reply);
-  is_jsonp = handle_jsonp(conn, ri);
-  mg_printf(conn, "%s", "[{");
+  DBAccess &dbA = DBAccess::get();
+  DBSnapshot snapshot(dbA); // All the reads of the request see the same state of the DB
   
-  DEBUG_REQ_FUNC("nb=" << strModules);
-  
-  /// Create a set for the Dates to loop easily
-  max += offset;
-  for(i = offset; i < max; i++) {
-    oss << "d_" << i;
-    if ((itParam = mapParams.find(oss.str())) != mapParams.end()) {
-      strDate = itParam->second;
-      //-- Set each date to according offset in response.
-      mg_printf(conn, "\"%d\":\"%s\",", i, strDate.c_str());
-      // Convert timestamp to Y-m-d
-      try {
-        boost::posix_time::ptime pt = boost::posix_time::from_time_t(boost::lexical_cast<time_t> (strDate));
-        boost::gregorian::date d = pt.date();
-        date = boost::gregorian::to_iso_extended_string(d);
-        setDate.insert(date);
-      } catch(boost::bad_lexical_cast &) {}
-    }  
-    oss.str("");
+  /// Build visits stats for each series
+  StatsTable table;
+  size_t nbBuckets = queryBuckets(query);
+  for (size_t k = 0; k < nbBuckets; k++) {
+    table.keys.push_back(k);
   }
-  
-  /// Save Year-Month for later
-  size_t found = date.find_last_of("-");
-  string strYearMonth = date.substr(0, found+1);
-  
-  /// Set Mode and Date in response.
-  // Extract "Day NDay Month" from timestamp // Depend one request intra, day, week, month, year
-  mg_printf(conn, "\"%d\":\"month\",\"%d\":\"%s\"},", i, i+1, convertDate(strDate, "%B %Y").c_str() );
-  
-  /// Build visits stats in response for each modules or app.
-  vector< pair<string, map<int, int> > > vRes;
-  nbApps = 0;
-  sscanf(strModules.c_str(), "%d", &nbApps);
-  for(i = 0; i < nbApps; i++) {
-    map<int, int> mapResMod;
-    if (strMode == "all") {
-      oss << "p_" << i;
-      if ((itParam = mapParams.find(oss.str())) != mapParams.end()) {
-        strApplication = itParam->second;
-      } else {
-        continue;
-      }
-      oss.str("");
-      DEBUG_REQ_FUNC("stats_app_month - app=" << strApplication);
-      
-      //-- Filter for days
-      set<string> setDateToKeep;
-      filteringPeriod(conn, ri, i, strYearMonth, setDateToKeep, mapParams);
-      
-      // Get nb module of that app in request
-      nbModules = 0;
-      oss << "m_" << i;
-      if ((itParam = mapParams.find(oss.str())) != mapParams.end()) {
-        sscanf((itParam->second).c_str(), "%d", &nbModules);
-      } else {
-        continue;
-      }
-      oss.str("");
-      DEBUG_REQ_FUNC("with " << nbModules << " modules in app [");
-      
-      // Loop to put modules from request in a set
-      setModules.clear();
-      for(j = 0; j < nbModules; j++) {
-        oss << "m_" << i << "_" << j;
-        if ((itParam = mapParams.find(oss.str())) != mapParams.end()) {
-          strModule = itParam->second;
-        } else {
-          continue;
-        }
-        oss.str("");
-        DEBUG_REQ_FUNC(strModule << ", ");
-        setModules.insert(strModule);
-        
-        // Remove this module from the whole app list
-        setOtherModules.erase(strModule);
-      }
-      DEBUG_REQ_FUNC("]");
-        
-      //-- and loop for each dates.
-      sscanf(strOffset.c_str(), "%d", &j);
-      for(it=setDate.begin(); it!=setDate.end(); j++) {
-        nbVisitForApp = 0;
-        // If *it is not in setDateToKeep, return 0 values
-        set<string>::iterator itSet = setDateToKeep.find(*it);
-        if ((setDateToKeep.size() == 0) || (itSet != setDateToKeep.end())) {
-          //-- and each module in an app
-          for(itt=setModules.begin(); itt!=setModules.end(); itt++) {
-            //-- Get nb visit from DB
-            // Build Key ex: "application/w/1/2011-04-24";
-            oss << *itt << '/' << strGroup << '/' << strType << "/" << *it;
-            // Search Key (oss) in DB
-            visit = dbA.dbw_get(oss.str());
-            oss.str("");
-            if (visit.length() > 0) {
-              // Update nb visit of the app for this day
-              iVisit = 0;
-              sscanf(visit.c_str(), "%d", &iVisit);
-              nbVisitForApp += iVisit;
-            }
-          }
-        }
-        DEBUG_REQ_FUNC(*it << " => " << nbVisitForApp << " visits.");
-        it++;
-        
-        // Return nb visit
-        mapResMod.insert(pair<int, int>(j, nbVisitForApp));
-      }
-      
-      vRes.push_back(make_pair(strApplication, mapResMod));
-    }
-    else {
-      oss << "m_" << i;
-      if ((itParam = mapParams.find(oss.str())) != mapParams.end()) {
-        strModule = itParam->second;
-      } else {
-        continue;
-      }
-      oss.str("");
-      DEBUG_REQ_FUNC("stats_app_month - module=" << strModule);
-      
-      //-- and each dates.
-      sscanf(strOffset.c_str(), "%d", &j);
-      for(it=setDate.begin(); it!=setDate.end(); j++, it++) {
-        //-- Get nb visit from DB
-        // Build Key ex: "application/w/1/2011-04-24";
-        oss << strModule << '/' << strGroup << '/' << strType << '/' << *it;
-        // Search Key (oss) in DB
-        visit = dbA.dbw_get(oss.str());
-        DEBUG_REQ_FUNC(oss.str() << " => j=" << j << " - "<< visit << " visits.");
-        oss.str("");
-        // Return nb visit if != 0
-        if (visit.length() != 0){
-          sscanf(visit.c_str(), "%d", &iVisit);
-          mapResMod.insert(pair<int,int>(j, iVisit));
-        } else {
-          mapResMod.insert(pair<int,int>(j, 0));
-        }
+  vector<unsigned int> values;
+  for (vector<StatsRow>::iterator itRow = rows.begin(); itRow != rows.end(); itRow++) {
+    query.series = itRow->series;
+    runQuery(dbA, query, values);
+    table.names.push_back(itRow->name);
+    table.values.insert(table.values.end(), values.begin(), values.end());
+  }
+  
+  /// Add a SUM row serie
+  statsAddSumRow(table);
+  
+  /// Construct response
+  string strResolution = (query.resolution == RES_MINUTES) ? "minute" : (query.resolution == RES_10MINUTES) ? "10minutes"
+    : (query.resolution == RES_HOURS) ? "hour" : (query.resolution == RES_DAYS) ? "day"
+    : (query.resolution == RES_WEEKS) ? "week" : "month";
+  if (format == "msgpack") {
+    MsgPackWriter msgpack(conn);
+    msgpack.etag(etag);
+    msgpack.map(5);
+    msgpack.str("from").str(strFrom).str("to").str(strTo).str("resolution").str(strResolution);
+    msgpack.str("keys").array(nbBuckets);
+    for (size_t k = 0; k < nbBuckets; k++) {
+      msgpack.str(queryBucketLabel(query, k));
+    }
+    msgpack.str("series").array(table.names.size());
+    for (size_t i = 0; i < table.names.size(); i++) {
+      msgpack.array(2).str(table.names[i]).array(nbBuckets);
+      for (size_t k = 0; k < nbBuckets; k++) {
+        msgpack.number(table.values[i * nbBuckets + k]);
       }
-      
-      vRes.push_back(make_pair(strModule, mapResMod));
     }
+    msgpack.end();
+    return;
   }
   
-  /// In all mode, add an "Others" application
-  if (strMode == "all" && setOtherModules.size() > 0) {
-    map<int, int> mapResMod;
-    DEBUG_REQ_FUNC("Others modules: ");
-    
-    sscanf(strOffset.c_str(), "%d", &j);
-    for(it=setDate.begin(); it!=setDate.end(); j++, it++) {
-      for(itt=setOtherModules.begin(), nbVisitForApp = 0; itt!=setOtherModules.end(); itt++) {
-        //-- Get nb visit from DB
-        // Build Key ex: "application/w/1/2011-04-24";
-        oss << *itt << '/' << strGroup << '/' << strType << "/" << *it;
-        // Search Key (oss) in DB
-        visit = dbA.dbw_get(oss.str());
-        oss.str("");
-        if (visit.length() > 0) {
-          // Update nb visit of the app for this day
-          sscanf(visit.c_str(), "%d", &iVisit);
-          nbVisitForApp += iVisit;
-        }
-        
-        if (it==setDate.begin()) DEBUG_REQ_FUNC(*itt << ", ");
-      }
-      
-      // Return nb visit
-      mapResMod.insert(pair<int,int>(j, nbVisitForApp));
+  JsonWriter json(conn, jsonpCallback(ri));
+  json.etag(etag);
+  json.raw("{\"from\":", 8).quoted(strFrom).raw(",\"to\":", 6).quoted(strTo);
+  json.raw(",\"resolution\":", 14).quoted(strResolution).raw(",\"keys\":[", 9);
+  for (size_t k = 0; k < nbBuckets; k++) {
+    if (k != 0) json.raw(",", 1);
+    json.quoted(queryBucketLabel(query, k));
+  }
+  json.raw("],\"series\":[", 12);
+  for (size_t i = 0; i < table.names.size(); i++) {
+    if (i != 0) json.raw(",", 1);
+    json.raw("[", 1).quoted(table.names[i]).raw(",[", 2);
+    for (size_t k = 0; k < nbBuckets; k++) {
+      if (k != 0) json.raw(",", 1);
+      json.number(table.values[i * nbBuckets + k]);
     }
-    
-    vRes.push_back(make_pair("Others", mapResMod));
-    
-    DEBUG_REQ_FUNC(" ");
+    json.raw("]]", 2);
   }
+  json.raw("]}", 2);
+  json.end();
+}
+
+/*!
+ * \fn void stats_app_rt(struct mg_connection *conn, const struct mg_request_info *ri)
+ * \brief Build an HTTP response for the /stats_app_rt context : response time percentiles of a module,
+ * for a month, a day, an hour, 10 minutes or a minute (merge of the sketches stored in DB).
+ *
+ * \param[in] conn Opaque connection handler.
+ * \param[in] request_info Information about HTTP request.
+ * \example http://localhost:9999/stats_app_rt?module=module_test_1&group=w&type=1&date=2011-04-24&slot=15
+ */
+void stats_app_rt(struct mg_connection *conn, const struct mg_request_info *ri) {
+  string strModule;  // Modules name. Ex: module_test_1
+  string strGroup;   // Type of page requested, all groups if missing. Ex: w for web (depends on configuration.ini)
+  string strType;    // Mode. Ex: 1 or 2 or 3
+  string strDate;    // Month or day. Ex: 2011-04 or 2011-04-24
+  string strSlot;    // Time slot in the day, whole date if missing. Ex: 15, 150 or 1503
+  string val;
+  ostringstream oss;
+  vector<string> vectKeys;
+  RtSketch sketch, slotSketch;
   
-  /// Add a SUM row serie
-  statsAddSumRow(vRes, setDate.size(), 0);
+  /// Get parameters in request.
+  RequestParams params;
+  params.parse(conn, ri);
   
-  /// Construct response
-  string response = "";
-  statsConstructResponse(vRes, response);
+  /// Check parameters values
+  if (!params.get("module", strModule)) {
+    mg_printf(conn, "%s", standard_json_reply);
+    mg_printf(conn, "%s", "Missing parameter: module");
+    return;
+  }
+  if (!params.get("date", strDate)) {
+    mg_printf(conn, "%s", standard_json_reply);
+    mg_printf(conn, "%s", "Missing parameter: date");
+    return;
+  }
+  params.get("group", strGroup); // Optional
+  if (!params.get("type", strType)) {
+    strType = "1";
+  }
+  params.get("slot", strSlot); // Optional
+  if ((strDate.size() != 7 && strDate.size() != 10) || (!strSlot.empty() && strDate.size() != 10)
+      || (strSlot.size() != 0 && strSlot.size() != 2 && strSlot.size() != 3 && strSlot.size() != 4)) {
+    mg_printf(conn, "%s", standard_json_reply);
+    mg_printf(conn, "%s", "Wrong parameter: date or slot");
+    return;
+  }
   
-  /// Set end JSON string in response.
-  response += "]";
-  if (is_jsonp) {
-    response += ")";
+  /// Keys of the sketches to merge for each group. Ex: module/w/1/2011-04-24/15/rt/sketch
+  map<string, set<string> >::iterator itExtMap;
+  for(itExtMap=Config::get().FILTER_EXTENSION.begin(); itExtMap!=Config::get().FILTER_EXTENSION.end(); itExtMap++) {
+    if (!strGroup.empty() && itExtMap->first != strGroup) continue;
+    oss << strModule << '/' << itExtMap->first << '/' << strType << '/' << strDate << '/';
+    if (strSlot.size() == 3) {
+      /// 10 minutes : minute sketches of the slot
+      for (int i = 0; i < 10; i++) {
+        vectKeys.push_back(oss.str() + strSlot.substr(0, 2) + strSlot[2] + (char) ('0' + i) + "/rt/sketch");
+      }
+    } else if (!strSlot.empty()) {
+      vectKeys.push_back(oss.str() + strSlot + "/rt/sketch");
+    } else {
+      vectKeys.push_back(oss.str() + "rt/sketch");
+    }
+    oss.str("");
   }
-  mg_write(conn, response.c_str(), response.length());
+  DEBUG_REQ_FUNC("stats_app_rt - module=" << strModule << " date=" << strDate << " slot=" << strSlot << " (" << vectKeys.size() << " sketches)");
+  
+  /// Merge the sketches
+  {
+    DBAccess &dbA = DBAccess::get();
+    DBSnapshot snapshot(dbA);
+    for (vector<string>::iterator itKey = vectKeys.begin(); itKey != vectKeys.end(); itKey++) {
+      if (dbA.dbw_read(*itKey, val) == DBW_FOUND && slotSketch.parse(val)) {
+        sketch.merge(slotSketch);
+      }
+    }
+  }
+  
+  /// Construct response, the parameters of the request escaped
+  JsonWriter json(conn, jsonpCallback(ri));
+  json.raw("[{\"module\": ", 12).quoted(strModule).raw(", \"date\": ", 10).quoted(strDate);
+  json.raw(", \"slot\": ", 10).quoted(strSlot).raw(", \"count\": ", 11).number(sketch.count());
+  json.raw(", \"mean\": ", 10).number(sketch.mean()).raw(", \"p50\": ", 9).number(sketch.quantile(0.5));
+  json.raw(", \"p90\": ", 9).number(sketch.quantile(0.9)).raw(", \"p99\": ", 9).number(sketch.quantile(0.99));
+  json.raw("}]", 2);
+  json.end();
 }
 
 /*!
@@ -1514,14 +1373,12 @@ void stats_modules_list(struct mg_connection *conn, const struct mg_request_info
   set<string>::iterator it;
 
   /// Get parameters in request.
-  map<string, string> mapParams;
-  map<string,string>::iterator itParam;
-  get_request_params(conn, ri, mapParams);
+  RequestParams params;
+  RequestParams::View value;
+  params.parse(conn, ri);
   
   /// Check parameters values
-  if ((itParam = mapParams.find("mode")) != mapParams.end()) {
-    strMode = itParam->second;
-  } else {
+  if (!params.get("mode", strMode)) {
     mg_printf(conn, "%s", standard_json_reply);
     mg_printf(conn, "%s", "Missing parameter: mode");
     return;
@@ -1530,8 +1387,8 @@ void stats_modules_list(struct mg_connection *conn, const struct mg_request_info
     getDBModules(setModules, KEY_MODULES);
     DEBUG_REQ_FUNC("stats_modules_list - all");
   } else if (strMode == "grouped") {
-    if ((itParam = mapParams.find("modules")) != mapParams.end()) {
-      sscanf((itParam->second).c_str(), "%d", &nbModules);
+    if (params.find("modules", value)) {
+      sscanf(value.to_string().c_str(), "%d", &nbModules);
     } else {
       mg_printf(conn, "%s", standard_json_reply);
       mg_printf(conn, "%s", "Missing parameter: modules");
@@ -1541,14 +1398,10 @@ void stats_modules_list(struct mg_connection *conn, const struct mg_request_info
     
     /// Loop to remove modules from request of the set
     for(i = 0; i < nbModules; i++) {
-      oss << "m_" << i;
-      if ((itParam = mapParams.find(oss.str())) != mapParams.end()) {
+      if (params.find("m", i, value)) {
         /// Remove this module from the OTHERS list
-        setModules.erase(itParam->second);
-      } else {
-        continue;
+        setModules.erase(value.to_string());
       }
-      oss.str("");
     }
   }
   
@@ -1600,6 +1453,125 @@ void stats_admin_list_mergemodules(struct mg_connection *conn, const struct mg_r
   mg_write(conn, response.c_str(), response.length());
 }
 
+/*!
+ * \fn void stats_admin_compaction(struct mg_connection *conn, const struct mg_request_info *ri)
+ * \brief Build an HTTP response with the progress of the background compaction.
+ *
+ * \param[in] conn Opaque connection handler.
+ * \param[in] request_info Information about HTTP request.
+ * \example http://localhost:9999/stats_admin_compaction
+ */
+void stats_admin_compaction(struct mg_connection *conn, const struct mg_request_info *ri) {
+  bool is_jsonp;
+  ostringstream oss;
+  
+  /// Set begining JSON string in response.
+  mg_printf(conn, "%s", standard_json_reply);
+  is_jsonp = handle_jsonp(conn, ri);
+  
+  /// Construct response
+  {
+    boost::mutex::scoped_lock lock(compactMutex);
+    oss << "[{\"enabled\": " << (Config::get().COMPACTION ? "true" : "false")
+        << ", \"passes\": " << compactProgress.passes
+        << ", \"slices\": " << compactProgress.slices
+        << ", \"pages_examined\": " << compactProgress.pagesExamined
+        << ", \"pages_freed\": " << compactProgress.pagesFreed
+        << ", \"pages_reclaimed\": " << compactProgress.pagesTruncated
+        << ", \"fill_factor\": " << compactProgress.fillFactor
+        << ", \"pass_running\": " << (compactProgress.resumeKey.empty() ? "false" : "true") << "}]";
+  }
+  string response = oss.str();
+  
+  /// Set end JSON string in response.
+  if (is_jsonp) {
+    response += ")";
+  }
+  mg_write(conn, response.c_str(), response.length());
+}
+
+/*!
+ * \fn void stats_admin_jobs(struct mg_connection *conn, const struct mg_request_info *ri)
+ * \brief Build an HTTP response with the state of the background jobs : last run, its duration and next run.
+ *
+ * \param[in] conn Opaque connection handler.
+ * \param[in] request_info Information about HTTP request.
+ * \example http://localhost:9999/stats_admin_jobs
+ */
+void stats_admin_jobs(struct mg_connection *conn, const struct mg_request_info *ri) {
+  bool is_jsonp;
+  ostringstream oss;
+  static const char *lockNames[] = {"none", "shared", "exclusive"};
+  
+  /// Set begining JSON string in response.
+  mg_printf(conn, "%s", standard_json_reply);
+  is_jsonp = handle_jsonp(conn, ri);
+  
+  /// Construct response
+  vector<JobStatus> jobs;
+  JobScheduler::get().status(jobs);
+  oss << "[";
+  for (vector<JobStatus>::iterator it = jobs.begin(); it != jobs.end(); it++) {
+    oss << (it == jobs.begin() ? "" : ", ")
+        << "{\"name\": \"" << it->name << "\""
+        << ", \"lock\": \"" << lockNames[it->lock] << "\""
+        << ", \"priority\": " << it->priority
+        << ", \"state\": \"" << (it->running ? "running" : (it->waiting ? "waiting" : "idle")) << "\""
+        << ", \"runs\": " << it->runs
+        << ", \"cancelled\": " << it->cancelled
+        << ", \"over_budget\": " << it->overBudget
+        << ", \"missed\": " << it->missed
+        << ", \"last_run\": \"" << (it->lastStart.is_not_a_date_time() ? "" : boost::posix_time::to_simple_string(it->lastStart)) << "\""
+        << ", \"last_duration_ms\": " << it->lastDuration.total_milliseconds()
+        << ", \"next_run\": \"" << boost::posix_time::to_simple_string(it->next) << "\"}";
+  }
+  oss << "]";
+  string response = oss.str();
+  
+  /// Set end JSON string in response.
+  if (is_jsonp) {
+    response += ")";
+  }
+  mg_write(conn, response.c_str(), response.length());
+}
+
+/*!
+ * \fn void stats_admin_cache(struct mg_connection *conn, const struct mg_request_info *ri)
+ * \brief Build an HTTP response with the metrics of the response cache : hits, misses, invalidations and size.
+ *
+ * \param[in] conn Opaque connection handler.
+ * \param[in] request_info Information about HTTP request.
+ * \example http://localhost:9999/stats_admin_cache
+ */
+void stats_admin_cache(struct mg_connection *conn, const struct mg_request_info *ri) {
+  bool is_jsonp;
+  ostringstream oss;
+  
+  /// Set begining JSON string in response.
+  mg_printf(conn, "%s", standard_json_reply);
+  is_jsonp = handle_jsonp(conn, ri);
+  
+  /// Construct response
+  CacheMetrics metrics;
+  ResponseCache::get().metrics(metrics);
+  unsigned long lookups = metrics.hits + metrics.misses + metrics.stale;
+  oss << "[{\"hits\": " << metrics.hits
+      << ", \"misses\": " << metrics.misses
+      << ", \"stale\": " << metrics.stale
+      << ", \"hit_ratio\": " << (lookups > 0 ? (double) metrics.hits / lookups : 0.0)
+      << ", \"evictions\": " << metrics.evictions
+      << ", \"entries\": " << metrics.entries
+      << ", \"capacity\": " << metrics.capacity
+      << ", \"bytes\": " << metrics.bytes << "}]";
+  string response = oss.str();
+  
+  /// Set end JSON string in response.
+  if (is_jsonp) {
+    response += ")";
+  }
+  mg_write(conn, response.c_str(), response.length());
+}
+
 /*!
  * \fn void stats_admin_do_mergemodules(struct mg_connection *conn, const struct mg_request_info *ri)
  * \brief Mark two modules to be merged in the stats for each days collected in the next vacation or do a full delete of a module.
@@ -1615,34 +1587,30 @@ void stats_admin_do_mergemodules(struct mg_connection *conn, const struct mg_req
   string moduleMerge;
   
   /// Get parameters in request.
-  map<string, string> mapParams;
-  map<string,string>::iterator itParam;
-  get_request_params(conn, ri, mapParams);
+  RequestParams params;
+  params.parse(conn, ri);
   
   /// Check parameters values
-  if ((itParam = mapParams.find("module")) != mapParams.end()) {
-    strModule = itParam->second;
-  } else {
+  if (!params.get("module", strModule)) {
     mg_printf(conn, "%s", standard_json_reply);
     mg_printf(conn, "%s", "Missing parameter: module");
     return;
   }
-  if ((itParam = mapParams.find("mergein")) != mapParams.end()) {
-    moduleMerge = itParam->second;
-  } else {
+  if (!params.get("mergein", moduleMerge)) {
     mg_printf(conn, "%s", standard_json_reply);
     mg_printf(conn, "%s", "Missing parameter: mergein");
     return;
   }
   
   /// Get DB accessor
-  DBAccessBerkeley &dbA = DBAccessBerkeley::get();
+  DBAccess &dbA = DBAccess::get();
   
   set<string>::iterator it;
   set<string> setToBeDeleted;
   setToBeDeleted.insert(strModule);
   DEBUG_REQ_FUNC("Delete: " << strModule);
   removeDBModules(setToBeDeleted);
+  ResponseCache::get().bumpAll();
   
   /// Construct response
   string response = "[{\"delete\": \"" + strModule + "\"";
@@ -1682,6 +1650,112 @@ void stats_admin_do_mergemodules(struct mg_connection *conn, const struct mg_req
   mg_write(conn, response.c_str(), response.length());
 }
 
+/*!
+ * \fn void saveAppsRebuild(const AppsRebuild &rebuild)
+ * \brief Save the progress of the rebuild of the applications, so that a restart goes on from there.
+ *
+ */
+void saveAppsRebuild(const AppsRebuild &rebuild) {
+  ofstream rebuildFileOut (APPS_REBUILD_FILE.c_str());
+  if (rebuildFileOut.is_open()) {
+    rebuildFileOut << rebuild.day << "\n" << boost::algorithm::join(rebuild.removed, "/") << "\n";
+    rebuildFileOut.close();
+  } else {
+    cerr << "Error saving the rebuild of the applications in " << APPS_REBUILD_FILE << endl;
+  }
+}
+
+/*!
+ * \fn void requestAppsRebuild(const string &removedSeries)
+ * \brief Rebuild the series of the applications from today, in the background (appsRebuildJob).
+ *
+ * \param[in] removedSeries Series of a removed application to clear as well, empty if none. Ex: @Calendar
+ */
+void requestAppsRebuild(const string &removedSeries) {
+  boost::mutex::scoped_lock lock(appsRebuildMutex);
+  appsRebuild.day = boost::gregorian::to_iso_extended_string(boost::gregorian::day_clock::local_day());
+  if (!removedSeries.empty()) {
+    appsRebuild.removed.insert(removedSeries);
+  }
+  appsRebuild.requests++;
+  saveAppsRebuild(appsRebuild);
+}
+
+/*!
+ * \fn void stats_admin_apps(struct mg_connection *conn, const struct mg_request_info *ri)
+ * \brief List, create, change or remove the applications defined on the server.
+ *
+ * A change counts the visits read after it in the new applications, and the series of the applications are rebuilt
+ * from their modules in the background for the days already stored (appsRebuildJob).
+ * \param[in] conn Opaque connection handler.
+ * \param[in] request_info Information about HTTP request.
+ * \example http://localhost:9999/stats_admin_apps List
+ * \example http://localhost:9999/stats_admin_apps?app=Calendar&modules=cal_web/cal_ws Create or change
+ * \example http://localhost:9999/stats_admin_apps?app=Calendar&modules=del Remove
+ * \example http://localhost:9999/stats_admin_apps?rebuild=yes Rebuild the applications without change
+ */
+void stats_admin_apps(struct mg_connection *conn, const struct mg_request_info *ri) {
+  string strApplication; // Application name. Ex: Calendar
+  string strModules;     // Modules of the application. Ex: cal_web/cal_ws
+  string strRebuild;     // Rebuild of the applications requested. Ex: yes
+  
+  /// Get parameters in request.
+  RequestParams params;
+  params.parse(conn, ri);
+  
+  /// Change the applications if requested
+  AppGroups &appGroups = AppGroups::get();
+  if (params.get("app", strApplication)) {
+    if (!params.get("modules", strModules)) {
+      mg_printf(conn, "%s", standard_json_reply);
+      mg_printf(conn, "%s", "Missing parameter: modules");
+      return;
+    }
+    bool done;
+    string strRemoved;
+    if (strModules == "del") {
+      done = appGroups.removeApp(strApplication);
+      strRemoved = APP_SERIES_PREFIX + strApplication;
+    } else {
+      set<string> setModules;
+      boost::split(setModules, strModules, boost::is_any_of("/"));
+      done = appGroups.setApp(strApplication, setModules);
+    }
+    if (!done) {
+      mg_printf(conn, "%s", standard_json_reply);
+      mg_printf(conn, "%s", "Bad parameter: app");
+      return;
+    }
+    DEBUG_REQ_FUNC("Application " << strApplication << " set to: " << strModules);
+    if (!appGroups.save()) {
+      cerr << "Error saving applications." << endl;
+    }
+    /// The "apps=server" responses use the applications
+    ResponseCache::get().bumpAll();
+    
+    /// The days already stored are summed up again from the modules
+    requestAppsRebuild(strRemoved);
+  } else if (params.get("rebuild", strRebuild) && strRebuild == "yes") {
+    requestAppsRebuild("");
+  }
+  
+  /// Construct response
+  map<string, set<string> > apps;
+  appGroups.list(apps);
+  JsonWriter json(conn, jsonpCallback(ri));
+  json.raw("[", 1);
+  for (map<string, set<string> >::iterator it = apps.begin(); it != apps.end(); it++) {
+    if (it != apps.begin()) json.raw(", ", 2);
+    string strAppModules;
+    for (set<string>::iterator itMod = (it->second).begin(); itMod != (it->second).end(); itMod++) {
+      strAppModules += *itMod + "/";
+    }
+    json.raw("{\"app\": ", 8).quoted(it->first).raw(", \"modules\": ", 13).quoted(strAppModules).raw("}", 1);
+  }
+  json.raw("]", 1);
+  json.end();
+}
+
 /*!
  * \fn void get_error(struct mg_connection *conn, const struct mg_request_info *request_info)
  * \brief Build an HTTP error response.
@@ -1710,9 +1784,15 @@ const struct uri_config {
   {MG_NEW_REQUEST, "/stats_app_day", &stats_app_day},
   {MG_NEW_REQUEST, "/stats_app_week", &stats_app_week},
   {MG_NEW_REQUEST, "/stats_app_month", &stats_app_month},
+  {MG_NEW_REQUEST, "/stats_app_range", &stats_app_range},
+  {MG_NEW_REQUEST, "/stats_app_rt", &stats_app_rt},
   {MG_NEW_REQUEST, "/stats_modules_list", &stats_modules_list},
   {MG_NEW_REQUEST, "/stats_admin_do_mergemodules", &stats_admin_do_mergemodules},
   {MG_NEW_REQUEST, "/stats_admin_list_mergemodules", &stats_admin_list_mergemodules},
+  {MG_NEW_REQUEST, "/stats_admin_compaction", &stats_admin_compaction},
+  {MG_NEW_REQUEST, "/stats_admin_apps", &stats_admin_apps},
+  {MG_NEW_REQUEST, "/stats_admin_jobs", &stats_admin_jobs},
+  {MG_NEW_REQUEST, "/stats_admin_cache", &stats_admin_cache},
   {MG_NEW_REQUEST, "/", &get_error},
   {MG_HTTP_ERROR, "", &get_error}
 };
@@ -1728,6 +1808,15 @@ void *callback(enum mg_event event, struct mg_connection *conn) {
   const struct mg_request_info *request_info = mg_get_request_info(conn);
   int i;
 
+  /// Bodies too large are not read
+  const char *cl = (event == MG_NEW_REQUEST) ? mg_get_header(conn, "Content-Length") : NULL;
+  if (cl != NULL && strtoul(cl, NULL, 10) > MAX_REQUEST_BODY) {
+    mg_printf(conn, "HTTP/1.1 413 Request Entity Too Large\r\n"
+              "Connection: close\r\n\r\n");
+    mg_printf(conn, "Error: request body larger than %d bytes", MAX_REQUEST_BODY);
+    return (void*) "processed";
+  }
+
   for (i = 0; uri_config[i].uri != NULL; i++) {
     if (event == uri_config[i].event &&
         (event == MG_HTTP_ERROR ||
@@ -1790,361 +1879,823 @@ string constructMoyMed(const string strDurations) {
 }
 
 
-void loopModuleThread(const string module, map<string, set<string> > mapExt, const string strDay, const unsigned short maxTime) {
+/*!
+ * \fn void loopModuleThread(const string module, const map<string, set<string> > &mapExt, const string strDay, const set<unsigned short> minutes)
+ * \brief Calcul the response sizes and times of a module for the minutes of a day which received some (task of the work pool).
+ * The values lists are replaced by their calcul in one DB batch by group and type.
+ *
+ * \param[in] module Module to calculate.
+ * \param[in] mapExt Groups of pages (from config object).
+ * \param[in] strDay Day. Ex: 2011-04-24
+ * \param[in] minutes Minutes of the day to calculate (from the dirty index).
+ */
+void loopModuleThread(const string module, const map<string, set<string> > &mapExt, const string strDay, const set<unsigned short> minutes) {
   ostringstream oss;
   string val;
-  string strOss;
-  map<string, set<string> >::iterator itExtMap;
+  string strOss, strMinute;
+  RtSketch sketch;
+  DBBatch batch;
+  map<string, set<string> >::const_iterator itExtMap;
+  set<unsigned short>::const_iterator itMinute;
   
   /// Get DB accessor
-  DBAccessBerkeley &dbA = DBAccessBerkeley::get();
+  DBAccess &dbA = DBAccess::get();
 
-  cout << "Start thread #" << strDay << "-" << dbTimesMinutes[maxTime] << " for module: " << module << "..." << endl;
+  DEBUG_LOGS_FUNC("Start thread #" << strDay << " (" << minutes.size() << " minutes) for module: " << module << "...");
   
   for(itExtMap=mapExt.begin(); itExtMap!=mapExt.end(); itExtMap++) {
     for(int lineType = 1; lineType <= 2; lineType++) {
       oss << module << '/' << itExtMap->first << '/' << lineType << '/' << strDay << '/';
       strOss = oss.str();
-      if (lineType == 1) cout << module << "## " << strOss << endl;
       oss.str("");
       
-      for(unsigned short i=0;i<maxTime;i++) {
-        if (lineType != 2) {
-          // Search Sizes in DB
-          val = dbA.dbw_get(strOss+dbTimesMinutes[i]+"/sz/values");
+      for(itMinute=minutes.begin(); itMinute!=minutes.end(); itMinute++) {
+        strMinute = strOss+dbTimesMinutes[*itMinute];
+        
+        // Search Sizes in DB
+        dbA.dbw_read(strMinute+"/sz/values", val);
+        if (val.length() > 0) {
+          if(lineType == 1) DEBUG_LOGS_FUNC("C-sz-rt Found SZ values: " << strMinute << " =" << val << "#");
+          /// Delete the current Key in DB
+          batch.remove(strMinute+"/sz/values");
+          batch.put(strMinute+"/sz", constructMoyMed(val));
+        }
+                    
+        // Search Times in DB : sketch of the minute (lists of values are left by older versions)
+        dbA.dbw_read(strMinute+"/rt/sketch", val);
+        if (val.length() > 0 && sketch.parse(val)) {
+          if(lineType == 1) DEBUG_LOGS_FUNC("C-sz-rt Found RT sketch: " << strMinute << " =" << val << "#");
+          batch.put(strMinute+"/rt", boost::lexical_cast<std::string>(sketch.mean())+"/"+boost::lexical_cast<std::string>(sketch.quantile(0.5))
+                                     +"/"+boost::lexical_cast<std::string>(sketch.quantile(0.9)));
+        } else {
+          dbA.dbw_read(strMinute+"/rt/values", val);
           if (val.length() > 0) {
-            if(lineType == 1) DEBUG_LOGS_FUNC("C-sz-rt Found SZ values: " << strOss << '/' << dbTimesMinutes[i] << " =" << val << "#");
+            if(lineType == 1) DEBUG_LOGS_FUNC("C-sz-rt Found RT values: " << strMinute << " =" << val << "#");
             /// Delete the current Key in DB
-            dbA.dbw_remove(strOss+dbTimesMinutes[i]+"/sz/values");
-            dbA.dbw_add(strOss+dbTimesMinutes[i]+"/sz", constructMoyMed(val));
+            batch.remove(strMinute+"/rt/values");
+            batch.put(strMinute+"/rt", constructMoyMed(val));
           }
         }
-                    
-        // Search Times in DB
-        val = dbA.dbw_get(strOss+'/'+dbTimesMinutes[i]+"/rt/values");
-        if (val.length() > 0) {
-          if(lineType == 1) DEBUG_LOGS_FUNC("C-sz-rt Found RT values: " << strOss << '/' << dbTimesMinutes[i] << " =" << val << "#");
-          /// Delete the current Key in DB
-          dbA.dbw_remove(strOss+'/'+dbTimesMinutes[i]+"/rt/values");
-          dbA.dbw_add(strOss+'/'+dbTimesMinutes[i]+"/rt", constructMoyMed(val));
+      }
+      
+      /// Write the calculs of the group and type at once
+      if (!dbA.dbw_write(batch)) {
+        cerr << "DB error on RtSz calcul of " << strOss << endl;
+      }
+      batch.clear();
+    }
+  }
+  DEBUG_LOGS_FUNC(module << "## done.");
+}
+
+/*!
+ * \fn void retainModuleDay(const string module, const map<string, pair<int, int> > &groupStages, const set<int> &dropped, const string strDay)
+ * \brief Remove the tiers of a module for a day reached by the retention of each group of pages (task of the work pool).
+ * The removes are written in one DB batch by group and type.
+ *
+ * \param[in] module Module to compress.
+ * \param[in] groupStages RetentionStage of each group of pages before and after this run.
+ * \param[in] dropped RetentionStages already dropped at once by the storage engine.
+ * \param[in] strDay Day. Ex: 2011-04-24
+ */
+void retainModuleDay(const string module, const map<string, pair<int, int> > &groupStages, const set<int> &dropped,
+                     const string strDay) {
+  ostringstream oss;
+  string strOss;
+  DBBatch batch;
+  map<string, pair<int, int> >::const_iterator itGroup;
+  uint64_t i;
+  
+  /// Get DB accessor
+  DBAccess &dbA = DBAccess::get();
+  
+  for(itGroup=groupStages.begin(); itGroup!=groupStages.end(); itGroup++) {
+    /// Tiers reached by the retention of the group since the last run
+    bool remove[STAGE_DAYS_REMOVED + 1];
+    bool removeAny = false;
+    for(int stage = STAGE_MINUTES_REMOVED; stage <= STAGE_DAYS_REMOVED; stage++) {
+      remove[stage] = (itGroup->second).first < stage && stage <= (itGroup->second).second && dropped.find(stage) == dropped.end();
+      removeAny = removeAny || remove[stage];
+    }
+    if (!removeAny) {
+      continue;
+    }
+    for(int lineType = 1; lineType <= 2; lineType++) {
+      /// lineType=1 -> URL with return code "200"
+      /// lineType=2 -> URL with return code "302"
+      /// lineType=3 -> URL with return code "404"
+      oss << module << '/' << itGroup->first << '/' << lineType << '/' << strDay;
+      strOss = oss.str();
+      oss.str("");
+      
+      // Remove old minutes time stats
+      if (remove[STAGE_MINUTES_REMOVED]) {
+        for(i=0;i<DB_TIMES_MINUTES_SIZE;i++) {
+          batch.remove(strOss+'/'+dbTimesMinutes[i]);
+          batch.remove(strOss+'/'+dbTimesMinutes[i]+"/sz");
+          batch.remove(strOss+'/'+dbTimesMinutes[i]+"/rt");
+          batch.remove(strOss+'/'+dbTimesMinutes[i]+"/sz/values");
+          batch.remove(strOss+'/'+dbTimesMinutes[i]+"/rt/values");
+          batch.remove(strOss+'/'+dbTimesMinutes[i]+"/rt/sketch");
+        }
+      }
+      /// Remove old 10 minutes stats
+      if (remove[STAGE_DETAILS_REMOVED]) {
+        for(i=0;i<DB_TIMES_SIZE;i++) {
+          batch.remove(strOss+'/'+dbTimes[i]);
+          batch.remove(strOss+'/'+dbTimes[i]+"/sz");
+          batch.remove(strOss+'/'+dbTimes[i]+"/rt");
+        }
+      }
+      /// Remove old hours stats (days, weeks and months are summed up at ingest time)
+      if (remove[STAGE_HOURS_REMOVED]) {
+        for(i=0;i<DB_TIMES_HOURS_SIZE;i++) {
+          batch.remove(strOss+'/'+dbTimesHours[i]);
+          batch.remove(strOss+'/'+dbTimesHours[i]+"/sz");
+          batch.remove(strOss+'/'+dbTimesHours[i]+"/rt");
+          batch.remove(strOss+'/'+dbTimesHours[i]+"/rt/sketch");
+        }
+      }
+      /// Remove old day totals (weeks and months totals are kept)
+      if (remove[STAGE_DAYS_REMOVED]) {
+        batch.remove(strOss);
+        batch.remove(strOss+"/sz");
+        batch.remove(strOss+"/rt");
+        batch.remove(strOss+"/rt/sketch");
+      }
+      
+      if (!dbA.dbw_write(batch)) {
+        cerr << "DB error on retention of " << strOss << endl;
+      }
+      batch.clear();
+    }
+  }
+}
+
+/*!
+ * \fn void averageRtSzCalculJob(JobContext &ctx)
+ * \brief Calcul the average/median and 90th percentile of times and sizes responses stored in DB.
+ * Only the days and modules marked in the dirty index by the log readers are calculated.
+ *
+ * \param[in] ctx Context of the run : when it has to stop, the days left are kept for the next run.
+ */
+void averageRtSzCalculJob(JobContext &ctx) {
+  string strDay, strToday;
+  map<string, DirtyModules> dirtyDays;
+  map<string, DirtyModules>::iterator itDay;
+  DirtyModules::iterator it;
+  set<unsigned short>::iterator itMinute;
+  unsigned short maxTime;
+  
+  /// Get config object
+  Config &c = Config::get();
+  map<string, set<string> > mapExt = c.FILTER_EXTENSION;
+  
+  /// Get dirty index
+  DirtyIndex &dirtyIndex = DirtyIndex::get();
+  
+  boost::gregorian::date today(boost::gregorian::day_clock::universal_day());
+  boost::posix_time::ptime timeNow(boost::posix_time::second_clock::universal_time());
+  cout << "----- CALCUL RtSz RUNNING now (" << boost::posix_time::to_simple_string(timeNow) << ")-----" << endl;
+  
+  /// Minutes with response sizes and times written since the last calcul
+  dirtyIndex.takeRtSz(dirtyDays);
+  
+  /// Minutes of today still receiving lines are calculated by a next run
+  boost::posix_time::ptime end = timeNow - boost::posix_time::minutes(2);
+  maxTime = (end.date() < today) ? 0 : end.time_of_day().hours() * 60 + end.time_of_day().minutes();
+  cout << "CALCUL RtSz end:" << boost::posix_time::to_simple_string(end) << " (" << maxTime << ")" << endl;
+  
+  strToday = to_iso_extended_string(today);
+  for (itDay = dirtyDays.begin(); itDay != dirtyDays.end(); itDay++) {
+    strDay = itDay->first;
+    
+    /// Stop between two days if the run has to stop, the days left are kept for the next run
+    if (ctx.stopRequested()) {
+      for (; itDay != dirtyDays.end(); itDay++) {
+        dirtyIndex.markRtSz(itDay->first, itDay->second);
+      }
+      break;
+    }
+    cout << "C-sz-rt: " << strDay << endl;
+    
+    /// Today (or later) : put back the last minutes, they are calculated by a next run
+    if (strDay >= strToday) {
+      DirtyModules lastMinutes;
+      for(it=(itDay->second).begin(); it!=(itDay->second).end(); it++) {
+        itMinute = (it->second).lower_bound(maxTime);
+        if (itMinute != (it->second).end()) {
+          lastMinutes[it->first].insert(itMinute, (it->second).end());
+          (it->second).erase(itMinute, (it->second).end());
         }
       }
+      dirtyIndex.markRtSz(strDay, lastMinutes);
     }
+    
+    /// One task by module with its dirty minutes
+    for(it=(itDay->second).begin(); it!=(itDay->second).end(); it++) {
+      if ((it->second).empty()) continue;
+      string module = it->first;
+      set<unsigned short> minutes = it->second;
+      workPool->enqueue([module, &mapExt, strDay, minutes]
+      {
+        loopModuleThread(module, mapExt, strDay, minutes);
+      });
+    }
+  }
+  /// Wait for every module of every day
+  workPool->wait();
+  dirtyIndex.save();
+  
+  cout << "----- CALCUL RtSz END now -----" << endl;
+}
+
+/*!
+ * \fn int retentionStage(const RetentionDays &retention, const string &strDay, const boost::gregorian::date &today)
+ * \brief Give the RetentionStage a day has to reach with a retention.
+ *
+ * \param[in] retention Retention of a group of pages.
+ * \param[in] strDay Day. Ex: 2011-04-24
+ * \param[in] today Current day.
+ */
+int retentionStage(const RetentionDays &retention, const string &strDay, const boost::gregorian::date &today) {
+  int stage = STAGE_NEW;
+  if (retention.minutes > 0 && strDay <= to_iso_extended_string(today - boost::gregorian::date_duration(retention.minutes))) {
+    stage = STAGE_MINUTES_REMOVED;
+  }
+  if (retention.details > 0 && strDay <= to_iso_extended_string(today - boost::gregorian::date_duration(retention.details))) {
+    stage = STAGE_DETAILS_REMOVED;
+  }
+  if (retention.hours > 0 && strDay <= to_iso_extended_string(today - boost::gregorian::date_duration(retention.hours))) {
+    stage = STAGE_HOURS_REMOVED;
+  }
+  if (retention.days > 0 && strDay <= to_iso_extended_string(today - boost::gregorian::date_duration(retention.days))) {
+    stage = STAGE_DAYS_REMOVED;
+  }
+  return stage;
+}
+
+/*!
+ * \fn int retentionFinalStage(const RetentionDays &retention)
+ * \brief Give the last RetentionStage of a retention, the tiers above it are kept forever.
+ */
+int retentionFinalStage(const RetentionDays &retention) {
+  if (retention.days > 0) return STAGE_DAYS_REMOVED;
+  if (retention.hours > 0) return STAGE_HOURS_REMOVED;
+  if (retention.details > 0) return STAGE_DETAILS_REMOVED;
+  if (retention.minutes > 0) return STAGE_MINUTES_REMOVED;
+  return STAGE_NEW;
+}
+
+/*!
+ * \fn bool fitHotTier()
+ * \brief Close the hot tier when the minutes are kept longer than its ring (or forever) since the retention was read again :
+ * its minutes are written in DB, the ring is resized at the next start.
+ *
+ * \return false if the hot tier is closed.
+ */
+bool fitHotTier() {
+  Config &c = Config::get();
+  HotTier &hotTier = HotTier::get();
+  if (!hotTier.isEnabled()) {
+    return false;
+  }
+  if (!c.minutesKeptForever() && c.maxMinutesRetention() <= hotTier.days()) {
+    return true;
   }
-  cout << module << "## done." << endl;
+  cout << "Retention of the minutes longer than the hot tier, closing it." << endl;
+  return !hotTier.close();
 }
 
 /*!
- * \fn void averegeRtSzCalculThread()
- * \brief Calcul the average/median and 90th percentile of times and sizes responses stored in DB.
+ * \fn void compressionJob(JobContext &ctx)
+ * \brief Apply the retention of the minutes, 10 minutes, hours and days stats (once a day at a precise time).
+ * Only the days of the dirty index are visited, each one until the retention of every group of pages is done.
+ * The retention is read again from the configuration file at each run, so that it is changed without restart.
  *
+ * \param[in] ctx Context of the run : when it has to stop, the days left are retained by the next run.
  */
-void averageRtSzCalculThread() {
+void compressionJob(JobContext &ctx) {
+  uint64_t i;
   ostringstream oss;
-  string val, strDay, strEndTime;
+  string val;
   string strOss;
-  set<string> setModules;
+  set<string> setDeletedModules;
   set<string>::iterator it;
-  map<string, set<string> >::iterator itExtMap;
-  unsigned short maxTime;
+  map<string, DirtyDay> dirtyDays;
+  map<string, DirtyDay>::iterator itDay;
+  map<string, set<string> >::iterator itExt;
+  map<string, RetentionDays> groupRetention;
+  map<string, RetentionDays>::iterator itRetention;
+  struct tm * timeinfo;
+  time_t now;
+  char buffer[80];
   
   /// Get config object
   Config &c = Config::get();
   map<string, set<string> > mapExt = c.FILTER_EXTENSION;
   
-  /// At the first start do a compression from the first day of the year
-  boost::gregorian::date dateNow(boost::gregorian::day_clock::universal_day());
-  boost::gregorian::date dateLast(dateNow.year(), boost::gregorian::Jan, 1);
-  boost::gregorian::date dateStart(dateNow.year(), dateNow.month(), 1);
-  boost::posix_time::ptime start(dateStart);
-  boost::posix_time::time_iterator titr(start, boost::posix_time::minutes(1)); //increment by 1 minutes
-  boost::posix_time::ptime t = boost::posix_time::second_clock::universal_time() - boost::posix_time::seconds(10);
+  /// Get DB accessor
+  DBAccess &dbA = DBAccess::get();
   
-  try {
-    while(true) {
-      boost::gregorian::date today(boost::gregorian::day_clock::universal_day());
-      boost::posix_time::ptime timeNow(boost::posix_time::second_clock::universal_time());
-      cout << "CALCUL RtSz Objective:" << boost::posix_time::to_simple_string(t) << " & now:" << boost::posix_time::to_simple_string(timeNow) << endl;
-	  	
-    	/// New iteration check if current time > parsing date fixed
-      /// Compression to file atomically
-      if (timeNow >= t && appMutex.try_lock()) {
-        cout << "----- CALCUL RtSz RUNNING now (" << boost::posix_time::to_simple_string(timeNow) << ")-----" << endl;
-        
-        /// Prepare for the next parsing : add +10minutes to date fixed
-        t += boost::posix_time::minutes(10);
-        
-        /// Reconstruct list of modules
-        getDBModules(setModules, KEY_MODULES);
-        
-        boost::posix_time::ptime endLast, end = timeNow - boost::posix_time::minutes(2);
-        oss << setfill('0') << setw(2) << end.time_of_day().hours() << setw(2) << end.time_of_day().minutes();
-        strEndTime = oss.str();
-        oss.str("");
-        for(unsigned short i=0;i<DB_TIMES_MINUTES_SIZE;i++) {
-          if (dbTimesMinutes[i] == strEndTime) {
-            maxTime = i;
-            break;
-          }
-        }
-        cout << "CALCUL RtSz end:" << boost::posix_time::to_simple_string(end) << " is " << strEndTime << " (" << maxTime << ")" << endl;
-        
-        /// Reloop thru all minute slots since last parsing to j-x
-        boost::gregorian::day_iterator ditr(dateLast);
-        for (;ditr <= today; ++ditr) {
-          /// produces "C: 2013-11-04", "C: 2013-11-05", ...
-          strDay = to_iso_extended_string(*ditr);
-          cout << "C-sz-rt: " << strDay << endl;
-          
-          /// Set last time for day to use as max if the current parsing day is not the current day (aka today)
-          if (ditr < today) {
-            maxTime = DB_TIMES_MINUTES_SIZE;
-          }
-          
-          /// Check to see if this thread has been interrupted before going into each minutes of the current day
-          boost::this_thread::interruption_point();
-          
-          // create a thread pool of as many worker threads as there is logical cpus
-          //ThreadPool pool(boost::thread::hardware_concurrency());
-          ThreadPool pool(1);
- 
-          // queue a bunch of "work items"
-          /*for(int i = 0;i<16;++i) {
-            pool.enqueue([i]
-            {
-              cout << "hello " << i << endl;
-              boost::this_thread::sleep(boost::posix_time::milliseconds(20));
-              cout << "world " << i << endl;
-            });
-          }*/
-          for(it=setModules.begin(); it!=setModules.end(); it++) {
-            pool.enqueue([it, mapExt, strDay, maxTime]
-            {
-              loopModuleThread(*it, mapExt, strDay, maxTime);
-            });
+  /// Get dirty index
+  DirtyIndex &dirtyIndex = DirtyIndex::get();
+  
+  /// Retention of each group of pages, as configured now
+  c.reloadRetention();
+  for (itExt = mapExt.begin(); itExt != mapExt.end(); itExt++) {
+    groupRetention[itExt->first] = c.retentionOf(itExt->first);
+  }
+  fitHotTier();
+  boost::gregorian::date today(boost::gregorian::day_clock::universal_day());
+  boost::posix_time::ptime timeNow(boost::posix_time::second_clock::universal_time());
+  cout << "----- COMPRESSION RUNNING now (" << boost::posix_time::to_simple_string(timeNow) << ")-----" << endl;
+  for (itRetention = groupRetention.begin(); itRetention != groupRetention.end(); itRetention++) {
+    const RetentionDays &retention = itRetention->second;
+    cout << "Retention of " << itRetention->first << ": " << retention.minutes << "/" << retention.details << "/"
+         << retention.hours << "/" << retention.days << " days (minutes/10 minutes/hours/days, 0 kept forever)" << endl;
+  }
+  
+  /// Get current date
+  now = time(0);
+  timeinfo = localtime(&now);
+  strftime (buffer, 80, "%c", timeinfo);
+  cout << buffer << endl;
+  
+  /// Reconstruct list of deleted modules
+  getDBModules(setDeletedModules, KEY_DELETED_MODULES);
+  
+  /// Loop thru the days written since their last retention
+  dirtyIndex.retentionDays(dirtyDays);
+  for (itDay = dirtyDays.begin(); itDay != dirtyDays.end(); itDay++) {
+    const string &strDay = itDay->first;
+    DirtyDay &dirtyDay = itDay->second;
+    
+    /// Next stage of each group of pages, nothing to do if the retention of their next tier is not reached yet
+    map<string, pair<int, int> > groupStages;
+    map<string, int> newStages;
+    bool reached = false, done = true;
+    int minStage = STAGE_DAYS_REMOVED, minNewStage = STAGE_DAYS_REMOVED;
+    for (itRetention = groupRetention.begin(); itRetention != groupRetention.end(); itRetention++) {
+      int stage = dirtyDay.stageOf(itRetention->first);
+      int newStage = max(stage, retentionStage(itRetention->second, strDay, today));
+      groupStages[itRetention->first] = make_pair(stage, newStage);
+      newStages[itRetention->first] = newStage;
+      reached = reached || newStage > stage;
+      done = done && newStage >= retentionFinalStage(itRetention->second);
+      minStage = min(minStage, stage);
+      minNewStage = min(minNewStage, newStage);
+    }
+    if (!reached) {
+      /// Retention shortened to tiers already removed : the day is done
+      if (done) {
+        dirtyIndex.setStages(strDay, newStages, done);
+      }
+      continue;
+    }
+    
+    /// Check to see if the run has to stop before going into each modules of the current day
+    if (ctx.stopRequested()) {
+      cout << "COMPRESSION stopped before " << strDay << ", the days left are retained by the next run." << endl;
+      break;
+    }
+    
+    /// produces "C: 2011-11-04", "C: 2011-11-05", ...
+    cout << "C: " << strDay << " R" << minNewStage << "." << flush;
+    
+    /// Drop a tier of the day at once if the storage engine can and every group of pages reaches it,
+    /// else remove keys one by one below
+    set<int> dropped;
+    bool removeKeys = false;
+    for (int stage = STAGE_MINUTES_REMOVED; stage <= STAGE_DAYS_REMOVED; stage++) {
+      bool allGroups = true, anyGroup = false;
+      for (map<string, pair<int, int> >::iterator itGroup = groupStages.begin(); itGroup != groupStages.end(); itGroup++) {
+        allGroups = allGroups && (itGroup->second).second >= stage;
+        anyGroup = anyGroup || ((itGroup->second).first < stage && stage <= (itGroup->second).second);
+      }
+      if (!anyGroup) continue;
+      // RetentionStage n removes the DBTier n-1. Ex: STAGE_MINUTES_REMOVED -> TIER_MINUTES
+      if (allGroups && dbA.dbw_remove_day(strDay, static_cast<DBTier>(stage - 1))) {
+        dropped.insert(stage);
+      } else {
+        removeKeys = true;
+      }
+    }
+  
+    /// One task by module of the day, removes are batched by each worker
+    for(it=dirtyDay.modules.begin(); removeKeys && it!=dirtyDay.modules.end(); it++) {
+      string module = *it;
+      workPool->enqueue([module, &groupStages, &dropped, strDay]
+      {
+        retainModuleDay(module, groupStages, dropped, strDay);
+      });
+    }
+    
+    /// Loop thru modules to delete to remove stored stats
+    bool removeHours = (minStage < STAGE_HOURS_REMOVED && minNewStage >= STAGE_HOURS_REMOVED);
+    for(it=setDeletedModules.begin(); removeHours && it!=setDeletedModules.end(); it++) {
+      for(int lineType = 1; lineType <= 2; lineType++) {
+        /// lineType=1 -> URL with return code "200"
+        /// lineType=2 -> URL with return code "302"
+        /// lineType=3 -> URL with return code "404"
+        oss << *it << '/' << lineType << '/' << strDay;
+        strOss = oss.str();
+        for(i=0;i<DB_TIMES_HOURS_SIZE;i++) {
+          // Search Key in DB
+          dbA.dbw_read(strOss+'/'+dbTimesHours[i], val);
+          if (val.length() > 0) {
+            /// Delete the current Key in DB
+            dbA.dbw_remove(strOss+'/'+dbTimesHours[i]);
+            if(lineType == 1) DEBUG_LOGS_FUNC("C Full delete: " << strOss);
           }
         }
-        
-        cout << "----- CALCUL RtSz END now -----" << endl;
-        dateLast = today;
-        endLast = end;
+        oss.str("");
       }
-      
-      /// Sleep for 1 minute
-      boost::this_thread::sleep(boost::posix_time::seconds(20));
     }
-  } catch(boost::thread_interrupted &ex) {
+    
+    /// Wait for every module of the day before flushing
+    workPool->wait();
+    
+    /// Flush changes to DB
+    cout << " Flushing... ";
+    dbA.dbw_flush();
+    dirtyIndex.setStages(strDay, newStages, done);
+    dirtyIndex.save();
     cout << "done" << endl;
   }
+  dirtyIndex.save();
+  
+  /// Retention may have removed day totals read by the cached responses
+  ResponseCache::get().bumpAll();
+  
+  cout << "----- COMPRESSION END now -----" << endl;
 }
 
 /*!
- * \fn void compressionThread()
- * \brief Compress the stats DB at a precise time once a day until 7 day from today.
+ * \fn void loadCompactionPos()
+ * \brief Read the key where the last compaction pass stopped, so that a restart goes on from there.
  *
  */
-void compressionThread() {
-  uint64_t i, dayVisit;
-  int iVisit;
-  ostringstream oss;
-  string val;
-  string strOss;
-  set<string> setModules;
-  set<string> setDeletedModules;
-  set<string>::iterator it;
-  map<string, set<string> >::iterator itExtMap;
-  struct tm * timeinfo;
-  time_t now;
-  char buffer[80];
-  
+void loadCompactionPos() {
+  string data;
+  ifstream posFileIn (COMPACTION_POS_FILE.c_str());
+  if (posFileIn.is_open()) {
+    if (posFileIn.good()) {
+      getline (posFileIn, data);
+      boost::mutex::scoped_lock lock(compactMutex);
+      compactProgress.resumeKey = data;
+    }
+    posFileIn.close();
+  }
+}
+
+/*!
+ * \fn void compactionJob(JobContext &ctx)
+ * \brief Compact the DB by a small slice, the job is run again after a pause so that the other threads are not blocked.
+ * The key where the pass stopped is saved so that a restart goes on from there.
+ *
+ * \param[in] ctx Context of the run : a longer pause is asked after a full pass.
+ */
+void compactionJob(JobContext &ctx) {
   /// Get config object
   Config &c = Config::get();
-  map<string, set<string> > mapExt = c.FILTER_EXTENSION;
   
   /// Get DB accessor
-  DBAccessBerkeley &dbA = DBAccessBerkeley::get();
+  DBAccess &dbA = DBAccess::get();
   
-  /// At the first start do a compression from the first day of the year
-  boost::gregorian::date dateNow(boost::gregorian::day_clock::universal_day());
-  boost::gregorian::date dateLast(dateNow.year(), boost::gregorian::Jan, 1);
+  DBCompactProgress progress;
+  {
+    boost::mutex::scoped_lock lock(compactMutex);
+    progress = compactProgress;
+  }
+  unsigned long passes = progress.passes;
+  if (!dbA.dbw_compact_slice(progress, c.COMPACTION_PAGES)) {
+    return;
+  }
+  {
+    boost::mutex::scoped_lock lock(compactMutex);
+    compactProgress = progress;
+  }
   
-  /// Hold the delay for non compressed stats
-  boost::gregorian::date_duration dd_minutes(c.DAYS_FOR_MINUTES_DETAILS);
-  boost::gregorian::date_duration dd_details(c.DAYS_FOR_DETAILS);
-  boost::gregorian::date_duration dd_hours(c.DAYS_FOR_HOURS_DETAILS);
-  boost::gregorian::date_duration dd(1);
+  /// Save the key where the pass stopped
+  ofstream posFileOut (COMPACTION_POS_FILE.c_str());
+  if (posFileOut.is_open()) {
+    posFileOut << progress.resumeKey << "\n";
+    posFileOut.close();
+  }
+  
+  /// End of a full pass : wait before the next one
+  if (progress.passes != passes) {
+    cout << "DB compaction pass #" << progress.passes << " done: " << progress.pagesTruncated
+         << " pages reclaimed, fill factor " << progress.fillFactor << endl;
+    ctx.runAgainIn(boost::posix_time::minutes(c.COMPACTION_PASS_INTERVAL));
+  }
+}
+
+/*!
+ * \fn void hotTierCheckpointJob(JobContext &ctx)
+ * \brief Save the hot tier to disk (run at a regular interval), unless the retention of the minutes does not fit in it anymore.
+ *
+ */
+void hotTierCheckpointJob(JobContext &ctx) {
+  Config::get().reloadRetention();
+  if (fitHotTier()) {
+    HotTier::get().checkpoint();
+  }
+}
+
+/*!
+ * \fn void loadAppsRebuild()
+ * \brief Read the progress of the rebuild of the applications, so that a restart goes on from there.
+ *
+ */
+void loadAppsRebuild() {
+  string data;
+  ifstream rebuildFileIn (APPS_REBUILD_FILE.c_str());
+  if (rebuildFileIn.is_open()) {
+    boost::mutex::scoped_lock lock(appsRebuildMutex);
+    if (rebuildFileIn.good()) {
+      getline (rebuildFileIn, appsRebuild.day);
+    }
+    if (rebuildFileIn.good()) {
+      getline (rebuildFileIn, data);
+      if (!data.empty()) {
+        boost::split(appsRebuild.removed, data, boost::is_any_of("/"));
+      }
+    }
+    rebuildFileIn.close();
+  }
+}
 
-  /// Specify a fixed time in the day : 03h00 the next day for the next compression of DB
-  // FOR DEBUG purpose USE seconds + 10
-  //boost::posix_time::ptime t = boost::posix_time::second_clock::universal_time() + boost::posix_time::seconds(10);
-  boost::posix_time::ptime t(boost::gregorian::day_clock::universal_day() + dd, boost::posix_time::time_duration(3,0,0));
+/*!
+ * \fn static int rebuildAppsTotal(const string &strSeries, const vector<string> &members, const string &strPeriod, DBBatch &batch)
+ * \brief Replace a total of an application (day, ISO week or month) by the sum of the same total of its modules.
+ *
+ * \param[in] strSeries Series of the application. Ex: @Calendar/w/1
+ * \param[in] members Series of its modules. Ex: cal_web/w/1, cal_ws/w/1
+ * \param[in] strPeriod Period of the total. Ex: 2011-04-24, 2011-W16 or 2011-04
+ * \param[in, out] batch Batch the total is written in, only when it changes.
+ * \return 1 if the total is written, 0 if it is unchanged or removed, -1 on DB error.
+ */
+static int rebuildAppsTotal(const string &strSeries, const vector<string> &members, const string &strPeriod, DBBatch &batch) {
+  DBAccess &dbA = DBAccess::get();
+  string strVal;
+  unsigned int sum = 0, current = 0;
+  for (vector<string>::const_iterator it = members.begin(); it != members.end(); it++) {
+    int status = dbA.dbw_read(*it+'/'+strPeriod, strVal);
+    if (status == DBW_ERROR) return -1;
+    if (status == DBW_FOUND) sum += stringToInt(strVal);
+  }
+  int status = dbA.dbw_read(strSeries+'/'+strPeriod, strVal);
+  if (status == DBW_ERROR) return -1;
+  if (status == DBW_FOUND) current = stringToInt(strVal);
+  if (sum == current) {
+    return 0;
+  }
+  if (sum == 0) {
+    batch.remove(strSeries+'/'+strPeriod);
+    return 0;
+  }
+  strVal.clear();
+  intToString(strVal, sum);
+  batch.put(strSeries+'/'+strPeriod, strVal);
+  return 1;
+}
+
+/*!
+ * \fn static bool rebuildAppsDay(const map<string, vector<string> > &appModules, const string &strDay, map<string, DirtyModules> &dirtyDays)
+ * \brief Replace the minutes, 10 minutes, hours and total of a day of the applications by the sum of their modules.
+ * Only the counters that differ are written, the minutes covered by the hot tier are summed up in it.
+ *
+ * \param[in] appModules Modules of each series of application. Ex: @Calendar -> cal_web, cal_ws
+ * \param[in] strDay Day. Ex: 2011-04-24
+ * \param[in, out] dirtyDays Days and series of application written, for the retention.
+ * \return false on DB error.
+ */
+static bool rebuildAppsDay(const map<string, vector<string> > &appModules, const string &strDay, map<string, DirtyModules> &dirtyDays) {
+  static const DBTier tiers[] = {TIER_MINUTES, TIER_10MINUTES, TIER_HOURS};
+  vector<unsigned int> counters, sums, current;
+  vector<string> members;
+  string strVal;
+  DBBatch batch;
+  size_t slotSize;
   
-  try {
-    while(true) {
-      boost::gregorian::date today(boost::gregorian::day_clock::universal_day());
-      boost::gregorian::date dateToHoldMinutes(today - dd_minutes);
-      boost::gregorian::date dateToHold(today - dd_details);
-      boost::gregorian::date dateToHoldHours(today - dd_hours);
-      boost::posix_time::ptime timeNow(boost::posix_time::second_clock::universal_time());
-      cout << "COMPRESSION Objective:" << boost::posix_time::to_simple_string(t) << " & now:" << boost::posix_time::to_simple_string(timeNow) << endl;
-	  	
-    	/// New iteration check if current time > parsing date fixed (= 03h00)
-      /// Compression to file atomically
-      if (timeNow >= t && appMutex.try_lock()) {
-        cout << "----- COMPRESSION RUNNING now (" << boost::posix_time::to_simple_string(timeNow) << ")-----" << endl;
-		    
-        /// Prepare for the next parsing : add +1 day to date fixed
-        // FOR DEBUG
-        //t += boost::posix_time::minutes(2*c.LOGS_COMPRESSION_INTERVAL);
-        t += boost::posix_time::hours(24);
-        
-        /// Get current date
-        now = time(0);
-        timeinfo = localtime(&now);
-        strftime (buffer, 80, "%c", timeinfo);
-        cout << buffer << endl;
-        
-        /// Reconstruct list of modules
-        getDBModules(setModules, KEY_MODULES);
-        getDBModules(setDeletedModules, KEY_DELETED_MODULES);
-        
-        /// Reloop thru all days since last parsing to j-x in order to remove details and store days only
-        boost::gregorian::day_iterator ditr(dateLast);
-        for (;ditr <= today; ++ditr) {
-          /// produces "C: 2011-Nov-04", "C: 2011-Nov-05", ...
-          cout << "C: " << to_simple_string(*ditr) << flush;
-          if (ditr <= dateToHold) {
-            cout << " R.";
-          }
-          
-          /// Check to see if this thread has been interrupted before going into each modules of the current day
-          boost::this_thread::interruption_point();
+  /// Get DB accessor
+  DBAccess &dbA = DBAccess::get();
+  
+  map<string, set<string> > mapExt = Config::get().FILTER_EXTENSION;
+  for (map<string, vector<string> >::const_iterator itApp = appModules.begin(); itApp != appModules.end(); itApp++) {
+    bool written = false;
+    for (map<string, set<string> >::iterator itExt = mapExt.begin(); itExt != mapExt.end(); itExt++) {
+      for (int lineType = 1; lineType <= 2; lineType++) {
+        /// lineType=1 -> URL with return code "200"
+        /// lineType=2 -> URL with return code "302"
+        string strSuffix = '/' + itExt->first + '/' + (char)('0' + lineType);
+        string strSeries = itApp->first + strSuffix;
+        members.clear();
+        for (vector<string>::const_iterator itMod = (itApp->second).begin(); itMod != (itApp->second).end(); itMod++) {
+          members.push_back(*itMod + strSuffix);
+        }
         
-          /// Loop thru modules to compress stored stats
-          for(it=setModules.begin(); it!=setModules.end(); it++) {
-            for(itExtMap=mapExt.begin(); itExtMap!=mapExt.end(); itExtMap++) {
-              for(int lineType = 1; lineType <= 2; lineType++) {
-                /// lineType=1 -> URL with return code "200"
-                /// lineType=2 -> URL with return code "302"
-                /// lineType=3 -> URL with return code "404"
-                dayVisit = 0;
-                oss << *it << '/' << itExtMap->first << '/' << lineType << '/' << to_iso_extended_string(*ditr);
-                strOss = oss.str();
-								
-								// Remove old minutes time stats
-                if (ditr <= dateToHoldMinutes) {
-                  for(i=0;i<DB_TIMES_MINUTES_SIZE;i++) {
-                    dbA.dbw_remove(strOss+'/'+dbTimesMinutes[i]);
-                    dbA.dbw_remove(strOss+'/'+dbTimesMinutes[i]+"/sz");
-                    dbA.dbw_remove(strOss+'/'+dbTimesMinutes[i]+"/rt");
-                  }
-                }
-								/// Remove old 10 minutes stats
-                if (ditr <= dateToHold) {
-                  for(i=0;i<DB_TIMES_SIZE;i++) {
-                    dbA.dbw_remove(strOss+'/'+dbTimes[i]);
-                    dbA.dbw_remove(strOss+'/'+dbTimes[i]+"/sz");
-                    dbA.dbw_remove(strOss+'/'+dbTimes[i]+"/rt");
-                  }
-                }
-                /// Compress hours stats
-                for(i=0;i<DB_TIMES_HOURS_SIZE;i++) {
-                  // Search Key in DB
-                  val = dbA.dbw_get(strOss+'/'+dbTimesHours[i]);
-                  if (val.length() > 0) {
-                    if(lineType == 1) DEBUG_LOGS_FUNC("C Found -Hours-: " << strOss << '/' << dbTimesHours[i] << " =" << val << "#");
-                    /// Remove old hours stats
-                		if (ditr <= dateToHoldHours) {
-								      /// Delete the current Key in DB
-                      dbA.dbw_remove(strOss+'/'+dbTimesHours[i]);
-                      dbA.dbw_remove(strOss+'/'+dbTimesHours[i]+"/sz");
-                      dbA.dbw_remove(strOss+'/'+dbTimesHours[i]+"/rt");
-                    }
-                    /// SUM nb visit from hours to days
-                    sscanf(val.c_str(), "%d", &iVisit);
-                    dayVisit += iVisit;
-                  }
-                }
-          
-                if (dayVisit > 0) {
-                  /// Add nb day visits in DB
-                  if (dbA.dbw_add(strOss, boost::lexical_cast<string>(dayVisit))) {
-                    if(lineType == 1) DEBUG_LOGS_FUNC("C Added: " << strOss << " = " << dayVisit);
-                  }
-                }
-                oss.str("");
-              }
+        /// Minutes, 10 minutes and hours in DB
+        for (size_t t = 0; t < sizeof(tiers) / sizeof(tiers[0]); t++) {
+          size_t nbSlots = tierSlots(tiers[t], slotSize);
+          sums.assign(nbSlots, 0);
+          for (vector<string>::iterator itMember = members.begin(); itMember != members.end(); itMember++) {
+            if (dbA.dbw_read_counters(*itMember, strDay, tiers[t], counters) == DBW_ERROR) return false;
+            for (size_t i = 0; i < nbSlots && i < counters.size(); i++) {
+              sums[i] += counters[i];
             }
           }
-          
-          /// Loop thru modules to delete to remove stored stats
-          for(it=setDeletedModules.begin(); it!=setDeletedModules.end(); it++) {
-            for(int lineType = 1; lineType <= 2; lineType++) {
-              /// lineType=1 -> URL with return code "200"
-              /// lineType=2 -> URL with return code "302"
-              /// lineType=3 -> URL with return code "404"
-              dayVisit = 0;
-              oss << *it << '/' << lineType << '/' << ditr->year() << "-" << setfill('0') << setw(2) << ditr->month()
-                  << "-" << setfill('0') << setw(2) << ditr->day();
-              strOss = oss.str();
-              for(i=0;i<DB_TIMES_HOURS_SIZE;i++) {
-                // Search Key in DB
-                val = dbA.dbw_get(strOss+'/'+dbTimesHours[i]);
-                if (val.length() > 0) {
-                  if (ditr <= dateToHoldHours) {
-                    /// Delete the current Key in DB
-                    dbA.dbw_remove(strOss+'/'+dbTimesHours[i]);
-                    if(lineType == 1) DEBUG_LOGS_FUNC("C Full delete: " << strOss);
-                  }
-                }
-              }
-              oss.str("");
+          if (dbA.dbw_read_counters(strSeries, strDay, tiers[t], current) == DBW_ERROR) return false;
+          current.resize(nbSlots, 0);
+          const string *slots = (tiers[t] == TIER_MINUTES) ? dbTimesMinutes : (tiers[t] == TIER_10MINUTES) ? dbTimes : dbTimesHours;
+          for (size_t i = 0; i < nbSlots; i++) {
+            if (sums[i] == current[i]) continue;
+            if (sums[i] == 0) {
+              batch.remove(strSeries+'/'+strDay+'/'+slots[i]);
+            } else {
+              strVal.clear();
+              intToString(strVal, sums[i]);
+              batch.put(strSeries+'/'+strDay+'/'+slots[i], strVal);
+              written = true;
             }
           }
-          
-		      /// Flush changes to DB
-		      cout << " Flushing... ";
-          dbA.dbw_flush();
-          cout << "done" << endl;
         }
-      
-        /// DB compression
-        //cout << "DB compaction... " << flush;
-        //dbw_compact(db);
-        //cout << "done" << endl;
         
-        cout << "----- COMPRESSION END now -----" << endl;
-      
-        dateLast = dateToHold;
-        /// Release the mutex
-        appMutex.unlock();
+        /// Day total
+        int status = rebuildAppsTotal(strSeries, members, strDay, batch);
+        if (status < 0) return false;
+        written = written || status > 0;
+        
+        /// Minutes in the hot tier
+        HotTier::get().sumDay(strSeries, members, strDay);
       }
-      
-      /// Sleep for 20 minutes
-      boost::this_thread::sleep(boost::posix_time::minutes(20));
     }
-  } catch(boost::thread_interrupted &ex) {
-    cout << "done" << endl;
+    if (written) {
+      dirtyDays[strDay][itApp->first];
+    }
   }
+  return batch.empty() || dbA.dbw_write(batch);
 }
 
 /*!
- * \fn void readLogThread(const Config c, unsigned long readPos)
- * \brief Do a continuous read of a file and call the line analyser.
+ * \fn static bool rebuildAppsMonth(const map<string, vector<string> > &appModules, const boost::gregorian::date &month, bool &visits)
+ * \brief Replace the month and ISO weeks totals of the applications by the sum of their modules.
  *
- * \param[in] logFileNb Number of log file in configuration to be read (default: 1).
- * \param[in] readPos Position in file to read (default: 0).
+ * \param[in] appModules Modules of each series of application. Ex: @Calendar -> cal_web, cal_ws
+ * \param[in] month Any day of the month. The weeks of its days are rebuilt as well.
+ * \param[out] visits A module has visits in the month : a month total, or a day total for the stats stored before the totals.
+ * \return false on DB error.
+ */
+static bool rebuildAppsMonth(const map<string, vector<string> > &appModules, const boost::gregorian::date &month, bool &visits) {
+  vector<string> periods, members;
+  vector<unsigned int> counters;
+  string strVal;
+  DBBatch batch;
+  
+  /// Get DB accessor
+  DBAccess &dbA = DBAccess::get();
+  
+  /// Month and ISO weeks of its days. Ex: 2011-04, 2011-W13 ... 2011-W17
+  string strMonth = boost::gregorian::to_iso_extended_string(month).substr(0, 7);
+  periods.push_back(strMonth);
+  unsigned short nbDays = boost::gregorian::gregorian_calendar::end_of_month_day(month.year(), month.month());
+  for (unsigned short day = 1; day <= nbDays; day += 7) {
+    periods.push_back(isoWeek(month.year(), month.month(), day));
+  }
+  periods.push_back(isoWeek(month.year(), month.month(), nbDays));
+  
+  visits = false;
+  map<string, set<string> > mapExt = Config::get().FILTER_EXTENSION;
+  for (map<string, vector<string> >::const_iterator itApp = appModules.begin(); itApp != appModules.end(); itApp++) {
+    for (map<string, set<string> >::iterator itExt = mapExt.begin(); itExt != mapExt.end(); itExt++) {
+      for (int lineType = 1; lineType <= 2; lineType++) {
+        string strSuffix = '/' + itExt->first + '/' + (char)('0' + lineType);
+        members.clear();
+        for (vector<string>::const_iterator itMod = (itApp->second).begin(); itMod != (itApp->second).end(); itMod++) {
+          members.push_back(*itMod + strSuffix);
+          if (!visits) {
+            int status = dbA.dbw_read(members.back()+'/'+strMonth, strVal);
+            if (status == DBW_NOTFOUND) {
+              /// No month total in the stats stored before the totals : the days of the month tell
+              status = dbA.dbw_read_counters(members.back(), strMonth, TIER_DAYS, counters);
+            }
+            if (status == DBW_ERROR) return false;
+            visits = (status == DBW_FOUND);
+          }
+        }
+        for (vector<string>::iterator itPeriod = periods.begin(); itPeriod != periods.end(); itPeriod++) {
+          if (itPeriod->empty()) continue;
+          if (rebuildAppsTotal(itApp->first + strSuffix, members, *itPeriod, batch) < 0) return false;
+        }
+      }
+    }
+  }
+  return batch.empty() || dbA.dbw_write(batch);
+}
+
+/*!
+ * \fn void appsRebuildJob(JobContext &ctx)
+ * \brief Rebuild the series of the applications from the stats of their modules after a change of the applications,
+ * one day after the other from today back to the first month without visits of the modules.
+ * The log readers do not run meanwhile, the day where the run stopped is saved so that a restart goes on from there.
+ *
+ * \param[in] ctx Context of the run : when it has to stop, the days left are rebuilt by the next run.
+ */
+void appsRebuildJob(JobContext &ctx) {
+  AppsRebuild rebuild;
+  {
+    boost::mutex::scoped_lock lock(appsRebuildMutex);
+    rebuild = appsRebuild;
+  }
+  if (rebuild.day.empty()) {
+    return;
+  }
+  
+  /// Modules of each series of application, none for "@Others" without applications and for the removed applications
+  AppGroups &appGroups = AppGroups::get();
+  map<string, vector<string> > appModules;
+  map<string, set<string> > apps;
+  set<string> setModules;
+  appGroups.list(apps);
+  for (map<string, set<string> >::iterator it = apps.begin(); it != apps.end(); it++) {
+    appModules[APP_SERIES_PREFIX + it->first];
+    setModules.insert((it->second).begin(), (it->second).end());
+  }
+  appModules[string(1, APP_SERIES_PREFIX) + APP_OTHERS];
+  for (set<string>::iterator it = rebuild.removed.begin(); it != rebuild.removed.end(); it++) {
+    appModules[*it];
+  }
+  set<string> setDBModules;
+  getDBModules(setDBModules, KEY_MODULES);
+  setModules.insert(setDBModules.begin(), setDBModules.end());
+  for (set<string>::iterator it = setModules.begin(); it != setModules.end(); it++) {
+    string strAppSeries = it->empty() ? "" : appGroups.seriesOf(*it);
+    if (!strAppSeries.empty()) {
+      appModules[strAppSeries].push_back(*it);
+    }
+  }
+  
+  cout << "Applications rebuild from " << rebuild.day << "... " << flush;
+  boost::gregorian::date day(boost::gregorian::from_simple_string(rebuild.day));
+  map<string, DirtyModules> dirtyDays;
+  bool done = false;
+  while (!ctx.stopRequested()) {
+    if (!rebuildAppsDay(appModules, boost::gregorian::to_iso_extended_string(day), dirtyDays)) {
+      break;
+    }
+    /// First day of a month : month and weeks totals, the rebuild ends with the first month without visits
+    if (day.day() == 1) {
+      bool visits;
+      if (!rebuildAppsMonth(appModules, day, visits)) {
+        break;
+      }
+      if (!visits) {
+        done = true;
+        break;
+      }
+    }
+    day -= boost::gregorian::date_duration(1);
+  }
+  
+  /// The retention removes the stats of the applications with the ones of the modules
+  DBAccess::get().dbw_flush();
+  DirtyIndex &dirtyIndex = DirtyIndex::get();
+  dirtyIndex.mark(dirtyDays);
+  dirtyIndex.save();
+  ResponseCache::get().bumpAll();
+  
+  {
+    boost::mutex::scoped_lock lock(appsRebuildMutex);
+    /// A request during the run starts over from today
+    if (appsRebuild.requests == rebuild.requests) {
+      appsRebuild.day = done ? "" : boost::gregorian::to_iso_extended_string(day);
+      if (done) {
+        appsRebuild.removed.clear();
+      }
+      saveAppsRebuild(appsRebuild);
+    }
+  }
+  cout << (done ? "done" : "stopped at " + boost::gregorian::to_iso_extended_string(day)) << endl;
+  
+  /// Let the log readers run between two slices
+  if (!done) {
+    ctx.runAgainIn(boost::posix_time::seconds(APPS_REBUILD_PAUSE));
+  }
+}
+
+/*!
+ * \fn uint64_t loadLogPos(const unsigned short logFileNb)
+ * \brief Read the position in the log file where the last read stopped.
+ *
+ * \param[in] logFileNb Number of log file in configuration.
+ * \return The position, 0 if not saved.
  */
-void readLogThread(const unsigned short logFileNb, uint64_t readPos) {
+uint64_t loadLogPos(const unsigned short logFileNb) {
   string data;
-  struct tm * timeinfo;
-  time_t now;
-  char buffer[80];
-  ostringstream oss;
-  int wait_time = 5; // wait time of 5 seconds if first read from log file
+  uint64_t readPos = 0;
   string strPosFile = "bin/mwa.pos."+boost::lexical_cast<std::string>(logFileNb);
-  
-  /// Read pos file for line number to start in log file
   ifstream posFileIn (strPosFile.c_str());
   if (posFileIn.is_open()) {
     if (posFileIn.good()) {
@@ -2155,84 +2706,133 @@ void readLogThread(const unsigned short logFileNb, uint64_t readPos) {
   } else {
     cout << "Unable to open pos file for log file #" << logFileNb << endl;
   }
+  return readPos;
+}
+
+/*!
+ * \fn void readLogJob(JobContext &ctx, const unsigned short logFileNb, uint64_t *readPos)
+ * \brief Read the lines added to a log file since the last run and call the line analyser.
+ *
+ * \param[in] ctx Context of the run : the file is read again after 5 seconds while nothing has been read from it.
+ * \param[in] logFileNb Number of log file in configuration to be read (default: 1).
+ * \param[in, out] readPos Position in file to read from, updated to where the read stopped.
+ */
+void readLogJob(JobContext &ctx, const unsigned short logFileNb, uint64_t *readPos) {
+  struct tm * timeinfo;
+  time_t now;
+  char buffer[80];
+  ostringstream oss;
+  string strPosFile = "bin/mwa.pos."+boost::lexical_cast<std::string>(logFileNb);
   
   /// Get config object containing the path/name of file to read.
   Config &c = Config::get();
   
   /// Get DB accessor
-  DBAccessBerkeley &dbA = DBAccessBerkeley::get();
+  DBAccess &dbA = DBAccess::get();
   
-  /// Get config informations, if fail exit
+  /// Get config informations
   map<unsigned short, pair<string, string> >::const_iterator itLogFileConf = c.LOGS_FILES_CONFIG.find(logFileNb);
   if (itLogFileConf == c.LOGS_FILES_CONFIG.end()) {
-    cerr << "Configuration file is not properly initialized for log file #" << logFileNb << ". Exit." << endl;
     return;
   }
   pair<string, string> lfC = itLogFileConf->second;
   
-  try {
-    /// Loop
-    while(true) {
-      if (readPos != 0) {
-        wait_time = c.LOGS_READ_INTERVAL;
-      }
-      
-      boost::this_thread::sleep(boost::posix_time::seconds(wait_time)); // interruptible
-      
-      /// Write to file atomically
-      if (! appMutex.try_lock()) {
-        continue;
-      }
-      
-      oss << lfC.second;
-      now = time(0);
-      timeinfo = localtime(&now);
-      
-      /// File ext format date :
-      if (lfC.first == "timestamp") {
-        time_t midnight = now / 86400 * 86400; // seconds
-        oss << midnight;
-      } else if (lfC.first == "date") {
-        strftime (buffer, 11, "%Y-%m-%d", timeinfo);
-        oss << buffer;
-      }
-      //--strftime (buffer, 80, "%c", timeinfo);
-      //--cout << '\r' << setfill(' ') << setw(150) << '\r' << buffer << " - READ LOG (" << oss.str() << "): starting at " << readPos << flush;
-      
-      /// Reconstruct list of modules
-      set<string> setModules;
-      set<string>::iterator it, itLast;
-      getDBModules(setModules, KEY_MODULES);
+  oss << lfC.second;
+  now = time(0);
+  timeinfo = localtime(&now);
+  
+  /// File ext format date :
+  if (lfC.first == "timestamp") {
+    time_t midnight = now / 86400 * 86400; // seconds
+    oss << midnight;
+  } else if (lfC.first == "date") {
+    strftime (buffer, 11, "%Y-%m-%d", timeinfo);
+    oss << buffer;
+  }
+  
+  /// Reconstruct list of modules
+  set<string> setModules;
+  set<string>::iterator it, itLast;
+  getDBModules(setModules, KEY_MODULES);
+
+  *readPos = readLogFile(logFileNb, oss.str(), setModules, *readPos);
+  oss.str("");
+  
+  /// The minutes counted in the hot tier are saved before the position, as the other tiers are already in DB
+  HotTier::get().checkpoint();
+  
+  /// Save to pos file in case of error / server shutdown...
+  ofstream posFileOut (strPosFile.c_str());
+  if (posFileOut.is_open()) {
+    posFileOut << *readPos << "\n";
+    posFileOut.close();
+  } else cout << "Unable to save pos to file" << endl;
+  DirtyIndex::get().save();
+  
+  /// Update list of modules in DB (merged with modules added by other log readers in between)
+  {
+    boost::mutex::scoped_lock lock(modulesMutex);
+    set<string> setDBModules;
+    getDBModules(setDBModules, KEY_MODULES);
+    setModules.insert(setDBModules.begin(), setDBModules.end());
     
-      readPos = readLogFile(logFileNb, oss.str(), setModules, readPos);
-      //--cout << " until " << readPos << "." << flush;
-      oss.str("");
-      
-      /// Save to pos file in case of error / server shutdown...
-      ofstream posFileOut (strPosFile.c_str());
-      if (posFileOut.is_open()) {
-        posFileOut << readPos << "\n";
-        posFileOut.close();
-      } else cout << "Unable to save pos to file" << endl;
-      
-      /// Update list of modules in DB
-      string strModules = "";
-      itLast = --setModules.end();
-      for(it=setModules.begin(); it!=setModules.end(); it++) {
-        strModules += *it;
-        if (it != itLast) {// do not add ending slash to the last item
-          strModules += "/";
+    string strModules = "";
+    itLast = --setModules.end();
+    for(it=setModules.begin(); it!=setModules.end(); it++) {
+      strModules += *it;
+      if (it != itLast) {// do not add ending slash to the last item
+        strModules += "/";
+      }
+    }
+    dbA.dbw_remove(KEY_MODULES);
+    dbA.dbw_add(KEY_MODULES, strModules);
+  }
+  
+  /// Nothing read yet : wait of 5 seconds only
+  if (*readPos == 0) {
+    ctx.runAgainIn(boost::posix_time::seconds(5));
+  }
+}
+
+/*!
+ * \fn void warmupDBCache(const int nbDays)
+ * \brief Load in the DB cache the stats of every known module for the last days.
+ *
+ * \param[in] nbDays Number of days to load (today included).
+ */
+void warmupDBCache(const int nbDays) {
+  set<string> setModules;
+  set<string>::iterator it;
+  map<string, set<string> >::iterator itExtMap;
+  vector<string> prefixes;
+  ostringstream oss;
+  
+  /// Get config object
+  Config &c = Config::get();
+  
+  /// Get DB accessor
+  DBAccess &dbA = DBAccess::get();
+  
+  getDBModules(setModules, KEY_MODULES);
+  
+  /// Build the keys prefix of each module for each day. Ex: "application/w/1/2011-04-24"
+  boost::gregorian::date today(boost::gregorian::day_clock::universal_day());
+  boost::gregorian::day_iterator ditr(today - boost::gregorian::date_duration(nbDays - 1));
+  for (;ditr <= today; ++ditr) {
+    for(it=setModules.begin(); it!=setModules.end(); it++) {
+      for(itExtMap=c.FILTER_EXTENSION.begin(); itExtMap!=c.FILTER_EXTENSION.end(); itExtMap++) {
+        for(int lineType = 1; lineType <= 2; lineType++) {
+          oss << *it << '/' << itExtMap->first << '/' << lineType << '/' << to_iso_extended_string(*ditr);
+          prefixes.push_back(oss.str());
+          oss.str("");
         }
       }
-      dbA.dbw_remove(KEY_MODULES);
-      dbA.dbw_add(KEY_MODULES, strModules);
-      
-      /// Released the mutex
-      appMutex.unlock();
     }
-  } catch(boost::thread_interrupted &ex) {
-    cout << "done" << endl;
   }
+  
+  cout << "DB cache warm-up for " << nbDays << " days... " << flush;
+  unsigned long nbKeys = dbA.dbw_warmup(prefixes);
+  cout << nbKeys << " keys loaded." << endl;
 }
 
 /*!
@@ -2267,7 +2867,7 @@ int main(int argc, char* argv[]) {
   Config &c = Config::get();
   
   /// Get DB accessor
-  DBAccessBerkeley &dbA = DBAccessBerkeley::get();
+  DBAccess &dbA = DBAccess::get();
   
   /// Open database for each log file configured
   if (! dbA.dbw_open(c.DB_PATH, c.DB_NAME)) {
@@ -2275,30 +2875,169 @@ int main(int argc, char* argv[]) {
     return 1;
   }
   
-  /// Attach handler for SIGINT
-  signal(SIGINT, handler_function);
+  /// Applications defined on the server
+  AppGroups::get().load();
   
-  /// DB Compact task set-up
-  boost::thread cThread;
-  if (c.COMPRESSION) {
-    cout << "DB compression task start..." << endl;
-    cThread = boost::thread(compressionThread);
+  /// Days and modules changed since the last background jobs
+  string strDirtyFile = c.DB_PATH;
+  if (!strDirtyFile.empty() && strDirtyFile[strDirtyFile.size()-1] != '/') strDirtyFile += '/';
+  strDirtyFile += c.DB_NAME + ".dirty";
+  if (!DirtyIndex::get().open(strDirtyFile)) {
+    /// No index yet : the days stored before are not known, every day of the year is visited once by the retention
+    /// and every minute of the days still holding minutes stats by the RtSz job
+    set<string> setModules;
+    set<unsigned short> allMinutes;
+    map<string, DirtyModules> dayModules;
+    getDBModules(setModules, KEY_MODULES);
+    for (unsigned short i = 0; i < DB_TIMES_MINUTES_SIZE; i++) {
+      allMinutes.insert(i);
+    }
+    boost::gregorian::date today(boost::gregorian::day_clock::universal_day());
+    boost::gregorian::date dateToHoldMinutes(today - boost::gregorian::date_duration(c.maxMinutesRetention()));
+    boost::gregorian::day_iterator ditr(boost::gregorian::date(today.year(), boost::gregorian::Jan, 1));
+    for (;ditr <= today; ++ditr) {
+      for(set<string>::iterator it=setModules.begin(); it!=setModules.end(); it++) {
+        set<unsigned short> &minutes = dayModules[to_iso_extended_string(*ditr)][*it];
+        if (*ditr > dateToHoldMinutes) {
+          minutes = allMinutes;
+        }
+      }
+    }
+    DirtyIndex::get().mark(dayModules);
+    DirtyIndex::get().save();
+    cout << "Dirty index created for " << setModules.size() << " modules." << endl;
   }
   
-  /// DB Compact task set-up
-  boost::thread rtSzThread;
-  cout << "DB RtSz compression task start..." << endl;
-  rtSzThread = boost::thread(averageRtSzCalculThread);
+  /// Load the most recent stats in DB cache before serving requests
+  if (c.DB_WARMUP_DAYS > 0) {
+    warmupDBCache(c.DB_WARMUP_DAYS);
+  }
   
-  /// Start reading file for each one configured
-  uint64_t readPos = 0;
-  boost::thread rThread[c.LOGS_FILE_NB];
-  cout << "====== LOGS_FILE_NB = " << c.LOGS_FILE_NB << endl;
-  for(unsigned short i=0; i < c.LOGS_FILE_NB; i++) {
-    cout << "Read file task start... (" << i+1 << ")." << endl;
-    rThread[i] = boost::thread(readLogThread, i+1, readPos);
+  /// Keep the minute stats of the last days in memory
+  string strHotFile = c.DB_PATH;
+  if (!strHotFile.empty() && strHotFile[strHotFile.size()-1] != '/') strHotFile += '/';
+  strHotFile += c.DB_NAME + ".hot";
+  /// Minutes kept forever : they are all written in DB, the ring would drop them
+  bool hotTier = c.HOT_TIER && !c.minutesKeptForever();
+  if (c.HOT_TIER && !hotTier) {
+    cout << "Hot tier disabled: minutes stats kept forever." << endl;
+  }
+  if (hotTier ? !HotTier::get().open(strHotFile, c.maxMinutesRetention()) : !HotTier::get().flush(strHotFile)) {
+    /// The minutes of the checkpoint are not in DB : do not start without them
+    cout << "Hot tier checkpoint not loaded. Exit program." << endl;
+    dbA.dbw_close();
+    return 1;
   }
   
+  /// Pool of workers shared by the background jobs
+  ThreadPool pool(c.WORKER_THREADS);
+  workPool = &pool;
+  cout << "Work pool of " << pool.size() << " threads." << endl;
+  
+  /// Threads sharing the series of the large stats requests
+  ThreadPool queryThreads(c.QUERY_THREADS);
+  queryPool = &queryThreads;
+  cout << "Query pool of " << queryThreads.size() << " threads." << endl;
+  
+  /// Attach handler for SIGINT
+  signal(SIGINT, handler_function);
+  
+  /// Every periodic job is run by the scheduler
+  JobScheduler &scheduler = JobScheduler::get();
+  boost::posix_time::ptime timeNow(boost::posix_time::second_clock::universal_time());
+  set<string> setReadJobs;
+  
+  /// Log readers run together, but not during the background jobs that rewrite the stats
+  vector<uint64_t> readPositions(c.LOGS_FILE_NB + 1, 0);
+  cout << "====== LOGS_FILE_NB = " << c.LOGS_FILE_NB << endl;
+  for(unsigned short i=1; i <= c.LOGS_FILE_NB; i++) {
+    if (c.LOGS_FILES_CONFIG.find(i) == c.LOGS_FILES_CONFIG.end()) {
+      cerr << "Configuration file is not properly initialized for log file #" << i << "." << endl;
+      continue;
+    }
+    cout << "Read file task start... (" << i << ")." << endl;
+    readPositions[i] = loadLogPos(i);
+    JobSpec readJob;
+    readJob.name = "read-log-" + boost::lexical_cast<std::string>(i);
+    readJob.run = [i, &readPositions](JobContext &ctx)
+    {
+      readLogJob(ctx, i, &readPositions[i]);
+    };
+    readJob.lock = JOB_LOCK_SHARED;
+    readJob.priority = 30;
+    readJob.first = timeNow + boost::posix_time::seconds(readPositions[i] == 0 ? 5 : c.LOGS_READ_INTERVAL);
+    readJob.interval = boost::posix_time::seconds(c.LOGS_READ_INTERVAL);
+    scheduler.add(readJob);
+    setReadJobs.insert(readJob.name);
+  }
+  
+  /// Response sizes and times every 10 minutes, once the lines read have been flushed
+  cout << "DB RtSz compression task start..." << endl;
+  JobSpec rtSzJob;
+  rtSzJob.name = "rtsz";
+  rtSzJob.run = averageRtSzCalculJob;
+  rtSzJob.lock = JOB_LOCK_EXCLUSIVE;
+  rtSzJob.priority = 20;
+  rtSzJob.first = timeNow;
+  rtSzJob.interval = boost::posix_time::minutes(10);
+  rtSzJob.fixedRate = true;
+  rtSzJob.budget = boost::posix_time::minutes(9);
+  rtSzJob.after = setReadJobs;
+  scheduler.add(rtSzJob);
+  
+  /// Retention at 03h00 every day
+  if (c.COMPRESSION) {
+    cout << "DB compression task start..." << endl;
+    JobSpec compressionJobSpec;
+    compressionJobSpec.name = "compression";
+    compressionJobSpec.run = compressionJob;
+    compressionJobSpec.lock = JOB_LOCK_EXCLUSIVE;
+    compressionJobSpec.priority = 10;
+    compressionJobSpec.first = boost::posix_time::ptime(boost::gregorian::day_clock::universal_day() + boost::gregorian::date_duration(1), boost::posix_time::time_duration(3,0,0));
+    compressionJobSpec.interval = boost::posix_time::hours(24);
+    compressionJobSpec.fixedRate = true;
+    compressionJobSpec.budget = boost::posix_time::hours(3);
+    compressionJobSpec.after = setReadJobs;
+    scheduler.add(compressionJobSpec);
+  }
+  
+  /// DB background compaction by slices
+  if (c.COMPACTION) {
+    cout << "DB compaction task start..." << endl;
+    loadCompactionPos();
+    JobSpec compactJob;
+    compactJob.name = "compaction";
+    compactJob.run = compactionJob;
+    compactJob.first = timeNow + boost::posix_time::seconds(c.COMPACTION_SLICE_INTERVAL);
+    compactJob.interval = boost::posix_time::seconds(c.COMPACTION_SLICE_INTERVAL);
+    scheduler.add(compactJob);
+  }
+  
+  /// Rebuild of the applications after a change, by slices between the runs of the log readers
+  loadAppsRebuild();
+  JobSpec appsJob;
+  appsJob.name = "apps-rebuild";
+  appsJob.run = appsRebuildJob;
+  appsJob.lock = JOB_LOCK_EXCLUSIVE;
+  appsJob.priority = 15;
+  appsJob.first = timeNow + boost::posix_time::seconds(APPS_REBUILD_PAUSE);
+  appsJob.interval = boost::posix_time::minutes(1);
+  appsJob.budget = boost::posix_time::seconds(APPS_REBUILD_BUDGET);
+  scheduler.add(appsJob);
+  
+  /// Hot tier checkpoints
+  if (hotTier) {
+    cout << "Hot tier checkpoint task start..." << endl;
+    JobSpec hotJob;
+    hotJob.name = "hot-tier-checkpoint";
+    hotJob.run = hotTierCheckpointJob;
+    hotJob.priority = 40;
+    hotJob.first = timeNow + boost::posix_time::seconds(c.HOT_TIER_CHECKPOINT_INTERVAL);
+    hotJob.interval = boost::posix_time::seconds(c.HOT_TIER_CHECKPOINT_INTERVAL);
+    scheduler.add(hotJob);
+  }
+  scheduler.start();
+  
   /// Json web server set-up
   const char *soptions[] = {"listening_ports", c.LISTENING_PORT.c_str(), NULL};
   cout << "Server now listening on " << c.LISTENING_PORT << endl;
@@ -2318,21 +3057,16 @@ int main(int argc, char* argv[]) {
   cout << buffer << ". Stoping server... " << flush;
   mg_stop(ctx);
   cout << "done" << endl;
-  for(unsigned short i=0; i < c.LOGS_FILE_NB; i++) {
-    cout << "Stoping LOG Thread... (" << i+1 << ")." << flush;
-    rThread[i].interrupt();
-    rThread[i].join();
-  }
+  cout << "Stoping jobs... " << endl;
+  scheduler.stop();
   
-  if (c.COMPRESSION) {
-    cout << "Stoping Compression Thread... " << flush;
-    cThread.interrupt();
-    cThread.join();
+  if (HotTier::get().isEnabled()) {
+    cout << "Saving hot tier... " << flush;
+    HotTier::get().checkpoint();
+    cout << "done" << endl;
   }
-
-  cout << "Stoping RtSz Compression Thread... " << flush;
-  rtSzThread.interrupt();
-  rtSzThread.join();
+  
+  DirtyIndex::get().save();
   
   cout << "Closing DB... " << flush;
   /// DB Release
@@ -0,0 +1,160 @@
+/*!
+ * \file msgpack_writer.cpp
+ * \brief Writer of the MessagePack responses of the stats requests for mooWApp
+ * \author Xavier ETCHEBER
+ */
+
+#include <string>
+#include <string.h> // strlen
+#include <stdio.h> // snprintf
+
+// mooWApp
+#include "global.h"
+#include "msgpack_writer.h"
+
+using namespace std;
+
+/*!
+ * \fn string &MsgPackWriter::threadBuffer()
+ * \brief Give the buffer of the thread, emptied : its memory is kept from one request to the next.
+ */
+string &MsgPackWriter::threadBuffer() {
+  static thread_local string buffer;
+  buffer.clear();
+  return buffer;
+}
+
+/*!
+ * \fn MsgPackWriter::MsgPackWriter(struct mg_connection *conn)
+ * \brief Start the response of a request.
+ *
+ * \param[in] conn Opaque connection handler.
+ */
+MsgPackWriter::MsgPackWriter(struct mg_connection *conn) : conn(conn), buffer(threadBuffer()), ended(false) {
+}
+
+/*!
+ * \fn MsgPackWriter::~MsgPackWriter()
+ * \brief Send the response if end() was not called.
+ */
+MsgPackWriter::~MsgPackWriter() {
+  end();
+}
+
+/*!
+ * \fn void MsgPackWriter::etag(const string &tag)
+ * \brief Set the ETag of the response.
+ *
+ * \param[in] tag ETag. Ex: W/"5f3a9c2e10b47d61"
+ */
+void MsgPackWriter::etag(const string &tag) {
+  extraHeaders += "ETag: " + tag + "\r\n";
+}
+
+/*!
+ * \fn void MsgPackWriter::bigEndian(const uint64_t value, const int nbBytes)
+ * \brief Write the last bytes of a value, most significant first.
+ */
+void MsgPackWriter::bigEndian(const uint64_t value, const int nbBytes) {
+  for (int shift = (nbBytes - 1) * 8; shift >= 0; shift -= 8) {
+    buffer += static_cast<char>((value >> shift) & 0xff);
+  }
+}
+
+/*!
+ * \fn void MsgPackWriter::header(const unsigned char fix, const unsigned char fixMax, const unsigned char code16, const size_t size)
+ * \brief Write the header of an array, a map or a string : fix type for a small size, 16 or 32 bits size otherwise
+ * (the 32 bits code follows the 16 bits one).
+ */
+void MsgPackWriter::header(const unsigned char fix, const unsigned char fixMax, const unsigned char code16, const size_t size) {
+  if (size <= fixMax) {
+    buffer += static_cast<char>(fix | size);
+  } else if (size <= 0xffff) {
+    buffer += static_cast<char>(code16);
+    bigEndian(size, 2);
+  } else {
+    buffer += static_cast<char>(code16 + 1);
+    bigEndian(size, 4);
+  }
+}
+
+/*!
+ * \fn MsgPackWriter &MsgPackWriter::array(const size_t size)
+ * \brief Start an array, followed by its size elements.
+ */
+MsgPackWriter &MsgPackWriter::array(const size_t size) {
+  header(0x90, 15, 0xdc, size);
+  return *this;
+}
+
+/*!
+ * \fn MsgPackWriter &MsgPackWriter::map(const size_t size)
+ * \brief Start a map, followed by its size keys and values.
+ */
+MsgPackWriter &MsgPackWriter::map(const size_t size) {
+  header(0x80, 15, 0xde, size);
+  return *this;
+}
+
+/*!
+ * \fn MsgPackWriter &MsgPackWriter::number(const uint64_t value)
+ * \brief Write an unsigned integer in its smallest form.
+ */
+MsgPackWriter &MsgPackWriter::number(const uint64_t value) {
+  if (value < 0x80) {
+    buffer += static_cast<char>(value);
+  } else if (value <= 0xff) {
+    buffer += '\xcc';
+    bigEndian(value, 1);
+  } else if (value <= 0xffff) {
+    buffer += '\xcd';
+    bigEndian(value, 2);
+  } else if (value <= 0xffffffffULL) {
+    buffer += '\xce';
+    bigEndian(value, 4);
+  } else {
+    buffer += '\xcf';
+    bigEndian(value, 8);
+  }
+  return *this;
+}
+
+/*!
+ * \fn MsgPackWriter &MsgPackWriter::str(const string &value)
+ * \brief Write a string (UTF-8).
+ */
+MsgPackWriter &MsgPackWriter::str(const string &value) {
+  if (value.size() <= 31) {
+    buffer += static_cast<char>(0xa0 | value.size());
+  } else if (value.size() <= 0xff) {
+    buffer += '\xd9';
+    bigEndian(value.size(), 1);
+  } else if (value.size() <= 0xffff) {
+    buffer += '\xda';
+    bigEndian(value.size(), 2);
+  } else {
+    buffer += '\xdb';
+    bigEndian(value.size(), 4);
+  }
+  buffer += value;
+  return *this;
+}
+
+/*!
+ * \fn void MsgPackWriter::end()
+ * \brief Send the response with its headers in one write.
+ */
+void MsgPackWriter::end() {
+  if (ended) {
+    return;
+  }
+  ended = true;
+  char length[48];
+  int lengthSize = snprintf(length, sizeof(length), "Content-Length: %lu\r\n\r\n", static_cast<unsigned long>(buffer.size()));
+  size_t headersSize = strlen(standard_msgpack_reply) - 2;
+  buffer.insert(0, length, lengthSize);
+  buffer.insert(0, extraHeaders);
+  buffer.insert(0, standard_msgpack_reply, headersSize);
+  mg_write(conn, buffer.data(), buffer.size());
+  buffer.clear();
+}
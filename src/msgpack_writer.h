@@ -0,0 +1,50 @@
+/*!
+ * \file msgpack_writer.h
+ * \brief Writer of the MessagePack responses of the stats requests for mooWApp
+ * \author Xavier ETCHEBER
+ */
+
+#ifndef MOOWAPP_STATS_MSGPACK_WRITER_H_
+#define MOOWAPP_STATS_MSGPACK_WRITER_H_
+
+#include <string>
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+
+// mongoose web server
+#include "mongoose.h"
+
+/*!
+ * \class MsgPackWriter
+ * \brief Binary response of a request (MessagePack), written in a buffer reused by every request of the thread
+ * and sent with its headers in a single mg_write at end().
+ */
+class MsgPackWriter
+{
+public:
+  MsgPackWriter(struct mg_connection *conn);
+  ~MsgPackWriter();
+
+  void etag(const std::string &tag);
+  MsgPackWriter &array(const size_t size);
+  MsgPackWriter &map(const size_t size);
+  MsgPackWriter &number(const uint64_t value);
+  MsgPackWriter &str(const std::string &value);
+  void end();
+
+private:
+  struct mg_connection *conn; //!< Connection the response is sent to
+  std::string &buffer;        //!< Response
+  std::string extraHeaders;   //!< Headers of the request added to the standard ones. Ex: ETag
+  bool ended;                 //!< end() called
+
+  static std::string &threadBuffer();
+  void header(const unsigned char fix, const unsigned char fixMax, const unsigned char code16, const size_t size);
+  void bigEndian(const uint64_t value, const int nbBytes);
+
+  // Protection against copy -> Do not define these
+  MsgPackWriter(const MsgPackWriter&);
+  void operator=(const MsgPackWriter&);
+};
+
+#endif // MOOWAPP_STATS_MSGPACK_WRITER_H_
@@ -0,0 +1,377 @@
+/*!
+ * \file query_engine.cpp
+ * \brief Planner and executor of the time range queries of the stats requests for mooWApp
+ * \author Xavier ETCHEBER
+ */
+
+#include <string>
+#include <vector> // Series, scans, values
+#include <set> // Days kept
+#include <map> // Days scans by month
+#include <algorithm> // min, max, copy
+#include <stdio.h> // sscanf, snprintf
+#include <mutex> // End of the parts of a query
+#include <condition_variable>
+
+// Boost
+#include <boost/date_time/gregorian/gregorian.hpp> // Range of days
+
+// mooWApp
+#include "global.h"
+#include "configuration.h"
+#include "hot_tier.h"
+#include "thread_pool.h"
+#include "query_engine.h"
+
+using namespace std;
+
+ThreadPool *queryPool = NULL;
+
+/*!
+ * \fn static boost::gregorian::date mondayOf(const boost::gregorian::date &day)
+ * \brief Give the first day of the ISO week of a day.
+ */
+static boost::gregorian::date mondayOf(const boost::gregorian::date &day) {
+  return day - boost::gregorian::days((day.day_of_week().as_number() + 6) % 7);
+}
+
+/*!
+ * \fn static bool dayKept(const StatsQuery &query, const boost::gregorian::date &day)
+ * \brief Tell if the visits of a day are counted by a query.
+ */
+static bool dayKept(const StatsQuery &query, const boost::gregorian::date &day) {
+  return query.daysKept.empty() || query.daysKept.find(boost::gregorian::to_iso_extended_string(day)) != query.daysKept.end();
+}
+
+/*!
+ * \fn static DBTier resolutionTier(const QueryResolution resolution, unsigned int &width)
+ * \brief Give the tier stored at a resolution finer than a day, and its minutes by slot.
+ */
+static DBTier resolutionTier(const QueryResolution resolution, unsigned int &width) {
+  switch (resolution) {
+    case RES_MINUTES:
+      width = 1;
+      return TIER_MINUTES;
+    case RES_10MINUTES:
+      width = 10;
+      return TIER_10MINUTES;
+    default:
+      width = 60;
+      return TIER_HOURS;
+  }
+}
+
+/*!
+ * \fn size_t queryBuckets(const StatsQuery &query)
+ * \brief Give the number of buckets of a query.
+ *
+ * \param[in] query Query.
+ * \return Number of buckets, 0 if the range is not valid.
+ */
+size_t queryBuckets(const StatsQuery &query) {
+  if (query.first.is_special() || query.last.is_special() || query.last < query.first) {
+    return 0;
+  }
+  size_t nbDays = (query.last - query.first).days() + 1;
+  switch (query.resolution) {
+    case RES_MINUTES:
+      return nbDays * DB_TIMES_MINUTES_SIZE;
+    case RES_10MINUTES:
+      return nbDays * DB_TIMES_SIZE;
+    case RES_HOURS:
+      return nbDays * DB_TIMES_HOURS_SIZE;
+    case RES_DAYS:
+      return nbDays;
+    case RES_WEEKS:
+      return (mondayOf(query.last) - mondayOf(query.first)).days() / 7 + 1;
+    case RES_MONTHS:
+      return (query.last.year() - query.first.year()) * 12 + query.last.month() - query.first.month() + 1;
+  }
+  return 0;
+}
+
+/*!
+ * \fn int queryBucket(const StatsQuery &query, const boost::gregorian::date &day, const int slot)
+ * \brief Give the bucket of a day, or of a slot of a day, in the values of a query.
+ *
+ * \param[in] query Query.
+ * \param[in] day Day.
+ * \param[in] slot Slot in the day for the resolutions finer than a day. Ex: 15*60+3 for 15:03 in minutes
+ * \return Index of the bucket, -1 if the day is out of the range.
+ */
+int queryBucket(const StatsQuery &query, const boost::gregorian::date &day, const int slot/* = 0 */) {
+  if (day.is_special() || day < query.first || day > query.last) {
+    return -1;
+  }
+  int dayIndex = (day - query.first).days();
+  switch (query.resolution) {
+    case RES_MINUTES:
+      return dayIndex * DB_TIMES_MINUTES_SIZE + slot;
+    case RES_10MINUTES:
+      return dayIndex * DB_TIMES_SIZE + slot;
+    case RES_HOURS:
+      return dayIndex * DB_TIMES_HOURS_SIZE + slot;
+    case RES_DAYS:
+      return dayIndex;
+    case RES_WEEKS:
+      return (mondayOf(day) - mondayOf(query.first)).days() / 7;
+    case RES_MONTHS:
+      return (day.year() - query.first.year()) * 12 + day.month() - query.first.month();
+  }
+  return -1;
+}
+
+/*!
+ * \fn string queryBucketLabel(const StatsQuery &query, const size_t bucket)
+ * \brief Give the label of a bucket of a query, its first day or slot.
+ *
+ * \param[in] query Query.
+ * \param[in] bucket Index of the bucket.
+ * \return Label of the bucket. Ex: 2011-04-24 15:03, 2011-04-24 15:00, 2011-04-24, 2011-W16 or 2011-04
+ */
+string queryBucketLabel(const StatsQuery &query, const size_t bucket) {
+  size_t slotsByDay = 1, width = 0;
+  switch (query.resolution) {
+    case RES_MINUTES:
+      slotsByDay = DB_TIMES_MINUTES_SIZE;
+      width = 1;
+      break;
+    case RES_10MINUTES:
+      slotsByDay = DB_TIMES_SIZE;
+      width = 10;
+      break;
+    case RES_HOURS:
+      slotsByDay = DB_TIMES_HOURS_SIZE;
+      width = 60;
+      break;
+    case RES_DAYS:
+      break;
+    case RES_WEEKS: {
+      boost::gregorian::date monday = mondayOf(query.first) + boost::gregorian::days(7 * bucket);
+      return isoWeek(monday.year(), monday.month(), monday.day());
+    }
+    case RES_MONTHS: {
+      boost::gregorian::date month = boost::gregorian::date(query.first.year(), query.first.month(), 1) + boost::gregorian::months(bucket);
+      return boost::gregorian::to_iso_extended_string(month).substr(0, 7);
+    }
+  }
+  string label = boost::gregorian::to_iso_extended_string(query.first + boost::gregorian::days(bucket / slotsByDay));
+  if (width != 0) {
+    char time[8];
+    size_t minutes = (bucket % slotsByDay) * width;
+    snprintf(time, sizeof(time), " %02u:%02u", static_cast<unsigned int>(minutes / 60), static_cast<unsigned int>(minutes % 60));
+    label += time;
+  }
+  return label;
+}
+
+/*!
+ * \fn void planQuery(const StatsQuery &query, vector<QueryScan> &scans)
+ * \brief Choose the cheapest reads giving the buckets of a query.
+ *
+ * The resolutions finer than a day read the tier of the same size, one range by day.
+ * A week or month counted entirely is read with its total key (or its days when the key is not stored),
+ * the days counted of the other periods are read with one range of the days tier by month.
+ * \param[in] query Query.
+ * \param[out] scans Reads to do for each series.
+ */
+void planQuery(const StatsQuery &query, vector<QueryScan> &scans) {
+  scans.clear();
+  if (queryBuckets(query) == 0) {
+    return;
+  }
+
+  if (query.resolution == RES_MINUTES || query.resolution == RES_10MINUTES || query.resolution == RES_HOURS) {
+    unsigned int width;
+    size_t slotSize;
+    DBTier tier = resolutionTier(query.resolution, width);
+    size_t nbSlots = tierSlots(tier, slotSize);
+    for (boost::gregorian::day_iterator itDay(query.first); *itDay <= query.last; ++itDay) {
+      if (!dayKept(query, *itDay)) continue;
+      QueryScan scan;
+      scan.tier = tier;
+      scan.total = false;
+      scan.period = boost::gregorian::to_iso_extended_string(*itDay);
+      scan.buckets.resize(nbSlots);
+      for (size_t i = 0; i < nbSlots; i++) {
+        scan.buckets[i] = queryBucket(query, *itDay, i);
+      }
+      scans.push_back(scan);
+    }
+    return;
+  }
+
+  map<string, QueryScan> monthScans; // Days scans by month. Ex: 2011-04
+  boost::gregorian::date day = query.first;
+  while (day <= query.last) {
+    /// Period of the bucket of the day
+    boost::gregorian::date periodFirst = day, periodLast = day;
+    string strPeriod;
+    if (query.resolution == RES_WEEKS) {
+      periodFirst = mondayOf(day);
+      periodLast = periodFirst + boost::gregorian::days(6);
+      strPeriod = isoWeek(day.year(), day.month(), day.day());
+    } else if (query.resolution == RES_MONTHS) {
+      periodFirst = boost::gregorian::date(day.year(), day.month(), 1);
+      periodLast = day.end_of_month();
+      strPeriod = boost::gregorian::to_iso_extended_string(day).substr(0, 7);
+    }
+
+    if (!strPeriod.empty() && query.daysKept.empty() && periodFirst >= query.first && periodLast <= query.last) {
+      QueryScan scan;
+      scan.tier = TIER_DAYS;
+      scan.total = true;
+      scan.period = strPeriod;
+      scan.buckets.assign(1, queryBucket(query, day));
+      scan.first = periodFirst;
+      scan.last = periodLast;
+      scans.push_back(scan);
+    } else {
+      boost::gregorian::date from = max(periodFirst, query.first), to = min(periodLast, query.last);
+      for (boost::gregorian::day_iterator itDay(from); *itDay <= to; ++itDay) {
+        if (!dayKept(query, *itDay)) continue;
+        string strMonth = boost::gregorian::to_iso_extended_string(*itDay).substr(0, 7);
+        QueryScan &scan = monthScans[strMonth];
+        if (scan.buckets.empty()) {
+          scan.tier = TIER_DAYS;
+          scan.total = false;
+          scan.period = strMonth;
+          scan.buckets.assign(31, -1);
+        }
+        scan.buckets[itDay->day() - 1] = queryBucket(query, *itDay);
+      }
+    }
+    day = periodLast + boost::gregorian::days(1);
+  }
+  for (map<string, QueryScan>::iterator it = monthScans.begin(); it != monthScans.end(); it++) {
+    scans.push_back(it->second);
+  }
+}
+
+/*!
+ * \fn static void readScan(DBAccess &dbA, const string &series, const QueryScan &scan, vector<unsigned int> &counters)
+ * \brief Read the counters of a series for a step of a plan, the slots covered by the hot tier are not read in DB.
+ */
+static void readScan(DBAccess &dbA, const string &series, const QueryScan &scan, vector<unsigned int> &counters) {
+  if (scan.total) {
+    static thread_local string visit; // Buffer reused by every read of the thread
+    counters.assign(1, 0);
+    if (dbA.dbw_read(series + '/' + scan.period, visit) == DBW_FOUND) {
+      sscanf(visit.c_str(), "%u", &counters[0]);
+      return;
+    }
+    /// Total not stored (days counted before the totals were written) : sum of the days of the period, month by month
+    vector<unsigned int> days;
+    boost::gregorian::date month(scan.first.year(), scan.first.month(), 1);
+    for (; month <= scan.last; month += boost::gregorian::months(1)) {
+      if (dbA.dbw_read_counters(series, boost::gregorian::to_iso_extended_string(month).substr(0, 7), TIER_DAYS, days) != DBW_FOUND) {
+        continue;
+      }
+      boost::gregorian::date from = max(month, scan.first), to = min(month.end_of_month(), scan.last);
+      for (boost::gregorian::day_iterator itDay(from); *itDay <= to; ++itDay) {
+        if (static_cast<size_t>(itDay->day()) <= days.size()) {
+          counters[0] += days[itDay->day() - 1];
+        }
+      }
+    }
+    return;
+  }
+  if (scan.tier == TIER_DAYS) {
+    dbA.dbw_read_counters(series, scan.period, scan.tier, counters);
+    return;
+  }
+
+  unsigned int width = (scan.tier == TIER_MINUTES) ? 1 : (scan.tier == TIER_10MINUTES) ? 10 : 60;
+  int hotFirst = HotTier::get().readDay(series, scan.period, width, counters);
+  if (hotFirst < 0) {
+    dbA.dbw_read_counters(series, scan.period, scan.tier, counters);
+  } else if (hotFirst > 0) {
+    /// Beginning of the day older than the hot tier
+    vector<unsigned int> stored;
+    dbA.dbw_read_counters(series, scan.period, scan.tier, stored);
+    copy(stored.begin(), stored.begin() + min<size_t>(hotFirst, stored.size()), counters.begin());
+  }
+}
+
+/*!
+ * \fn static void sumSeries(DBAccess &dbA, const vector<QueryScan> &scans, vector<string>::const_iterator first, vector<string>::const_iterator last, vector<unsigned int> &values)
+ * \brief Read the plan of a query for a part of its series and add the counters to their buckets.
+ */
+static void sumSeries(DBAccess &dbA, const vector<QueryScan> &scans, vector<string>::const_iterator first,
+                      vector<string>::const_iterator last, vector<unsigned int> &values) {
+  vector<unsigned int> counters;
+  for (vector<string>::const_iterator itSeries = first; itSeries != last; itSeries++) {
+    for (vector<QueryScan>::const_iterator itScan = scans.begin(); itScan != scans.end(); itScan++) {
+      readScan(dbA, *itSeries, *itScan, counters);
+      for (size_t i = 0, maxI = min(counters.size(), (itScan->buckets).size()); i < maxI; i++) {
+        if ((itScan->buckets)[i] >= 0) {
+          values[(itScan->buckets)[i]] += counters[i];
+        }
+      }
+    }
+  }
+}
+
+/*!
+ * \fn void runQuery(DBAccess &dbA, const StatsQuery &query, vector<unsigned int> &values)
+ * \brief Run a query : the plan is read for each series and the counters are summed in their buckets.
+ *
+ * When the lookups (series x reads) reach QUERY_PARALLEL_THRESHOLD, the series are split in parts
+ * summed by the query threads and by the thread of the request. The partial sums are then merged.
+ * A request reading a snapshot of the DB is not split : a snapshot transaction is used by one thread at a time,
+ * and parts read in snapshots of their own would mix series read at different points in time.
+ * \param[in] dbA DB accessor, in the snapshot of the request.
+ * \param[in] query Query.
+ * \param[out] values Visits of each bucket (queryBucket()).
+ */
+void runQuery(DBAccess &dbA, const StatsQuery &query, vector<unsigned int> &values) {
+  values.assign(queryBuckets(query), 0);
+  vector<QueryScan> scans;
+  planQuery(query, scans);
+
+  /// Parts of the series, one by thread at most and one by threshold of lookups
+  size_t nbSeries = query.series.size();
+  size_t lookups = nbSeries * scans.size();
+  size_t threshold = Config::get().QUERY_PARALLEL_THRESHOLD;
+  size_t nbParts = 1;
+  if (queryPool != NULL && threshold > 0 && lookups >= threshold && !dbA.dbw_in_snapshot()) {
+    nbParts = min(min(queryPool->size() + 1, nbSeries), lookups / threshold + 1);
+  }
+  if (nbParts <= 1) {
+    sumSeries(dbA, scans, query.series.begin(), query.series.end(), values);
+    return;
+  }
+
+  /// Parts 1 to nbParts-1 on the query threads, part 0 on the thread of the request
+  vector<vector<unsigned int> > partials(nbParts);
+  size_t nbBuckets = values.size();
+  mutex doneMutex;
+  condition_variable done;
+  size_t running = nbParts - 1;
+  for (size_t part = 1; part < nbParts; part++) {
+    vector<string>::const_iterator first = query.series.begin() + nbSeries * part / nbParts;
+    vector<string>::const_iterator last = query.series.begin() + nbSeries * (part + 1) / nbParts;
+    vector<unsigned int> &partial = partials[part];
+    queryPool->enqueue([&dbA, &scans, first, last, &partial, nbBuckets, &doneMutex, &done, &running]
+    {
+      partial.assign(nbBuckets, 0);
+      sumSeries(dbA, scans, first, last, partial);
+      unique_lock<mutex> lock(doneMutex);
+      if (--running == 0) done.notify_one();
+    });
+  }
+  sumSeries(dbA, scans, query.series.begin(), query.series.begin() + nbSeries / nbParts, values);
+
+  /// Merge of the partial sums
+  {
+    unique_lock<mutex> lock(doneMutex);
+    while (running > 0) {
+      done.wait(lock);
+    }
+  }
+  for (size_t part = 1; part < nbParts; part++) {
+    for (size_t i = 0; i < nbBuckets; i++) {
+      values[i] += partials[part][i];
+    }
+  }
+}
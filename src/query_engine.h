@@ -0,0 +1,74 @@
+/*!
+ * \file query_engine.h
+ * \brief Planner and executor of the time range queries of the stats requests for mooWApp
+ * \author Xavier ETCHEBER
+ */
+
+#ifndef MOOWAPP_STATS_QUERY_ENGINE_H_
+#define MOOWAPP_STATS_QUERY_ENGINE_H_
+
+#include <string>
+#include <vector> // Series, scans, values
+#include <set> // Days kept
+
+// Boost
+#include <boost/date_time/gregorian/gregorian.hpp> // Range of days
+
+// mooWApp
+#include "db_access.h"
+
+class ThreadPool;
+
+/*!
+ * \def QUERY_MAX_BUCKETS
+ * \brief Max buckets of a query sent by a client. Ex: 69 days by minute
+ */
+#define QUERY_MAX_BUCKETS 100000
+
+/*!
+ * \enum QueryResolution
+ * \brief Size of the buckets of a query.
+ */
+enum QueryResolution {
+  RES_MINUTES,   //!< 1440 buckets a day
+  RES_10MINUTES, //!< 144 buckets a day
+  RES_HOURS,     //!< 24 buckets a day
+  RES_DAYS,      //!< A bucket a day
+  RES_WEEKS,     //!< A bucket by ISO week (Monday to Sunday)
+  RES_MONTHS     //!< A bucket by month
+};
+
+/*!
+ * \struct StatsQuery
+ * \brief Visits of a set of series summed by bucket, from the period of the first day to the period of the last day.
+ */
+struct StatsQuery {
+  std::vector<std::string> series;  //!< Series summed. Ex: module_test_1/w/1
+  boost::gregorian::date first;     //!< First day of the range
+  boost::gregorian::date last;      //!< Last day of the range
+  QueryResolution resolution;       //!< Size of the buckets
+  std::set<std::string> daysKept;   //!< Days counted (Ex: 2011-04-24), empty to count every day
+};
+
+/*!
+ * \struct QueryScan
+ * \brief Step of the plan of a query : one read by series of the counters of a stored tier, added to buckets.
+ */
+struct QueryScan {
+  DBTier tier;              //!< Tier read
+  bool total;               //!< Week or month total key read instead of the tier
+  std::string period;       //!< Day (Ex: 2011-04-24), month (Ex: 2011-04), or period of the total (Ex: 2011-W16)
+  std::vector<int> buckets; //!< Bucket of each counter read, -1 if it is not counted
+  boost::gregorian::date first; //!< First day of the period of a total, its days are read if the total key is not stored
+  boost::gregorian::date last;  //!< Last day of the period of a total
+};
+
+extern ThreadPool *queryPool; //!< Pool of threads sharing the series of the large queries, NULL to run every query on its own thread
+
+size_t queryBuckets(const StatsQuery &query);
+int queryBucket(const StatsQuery &query, const boost::gregorian::date &day, const int slot = 0);
+std::string queryBucketLabel(const StatsQuery &query, const size_t bucket);
+void planQuery(const StatsQuery &query, std::vector<QueryScan> &scans);
+void runQuery(DBAccess &dbA, const StatsQuery &query, std::vector<unsigned int> &values);
+
+#endif // MOOWAPP_STATS_QUERY_ENGINE_H_
@@ -0,0 +1,268 @@
+/*!
+ * \file request_params.cpp
+ * \brief Parameters of the HTTP requests for mooWApp
+ * \author Xavier ETCHEBER
+ */
+
+#include <string>
+#include <vector> // Parameters
+#include <algorithm> // stable_sort, lower_bound, min
+#include <string.h> // strcmp, memchr
+#include <stdlib.h> // strtoul
+
+// mooWApp
+#include "request_params.h"
+
+// mongoose web server
+#include "mongoose.h"
+
+using namespace std;
+
+/*!
+ * \fn static bool paramLess(const RequestParams::Param &a, const RequestParams::Param &b)
+ * \brief Order of the parameters : base name, indexes, then suffix.
+ */
+static bool paramLess(const RequestParams::Param &a, const RequestParams::Param &b) {
+  if (a.base != b.base) return a.base < b.base;
+  if (a.index[0] != b.index[0]) return a.index[0] < b.index[0];
+  if (a.index[1] != b.index[1]) return a.index[1] < b.index[1];
+  return a.suffix < b.suffix;
+}
+
+/*!
+ * \fn static bool isDigit(const char c)
+ * \brief Tell if a character is a decimal digit.
+ */
+static inline bool isDigit(const char c) {
+  return c >= '0' && c <= '9';
+}
+
+/*!
+ * \fn static int hexValue(const char c)
+ * \brief Give the value of an hexadecimal digit, -1 if it is not one.
+ */
+static inline int hexValue(const char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+/*!
+ * \fn size_t RequestParams::decode(char *data, const size_t size)
+ * \brief URL-decode a name or a value in place : + is a space, %XX a byte.
+ *
+ * \return Size of the decoded data.
+ */
+size_t RequestParams::decode(char *data, const size_t size) {
+  size_t to = 0;
+  for (size_t from = 0; from < size; from++, to++) {
+    if (data[from] == '+') {
+      data[to] = ' ';
+    } else if (data[from] == '%' && from + 2 < size && hexValue(data[from+1]) >= 0 && hexValue(data[from+2]) >= 0) {
+      data[to] = static_cast<char>(hexValue(data[from+1]) * 16 + hexValue(data[from+2]));
+      from += 2;
+    } else {
+      data[to] = data[from];
+    }
+  }
+  return to;
+}
+
+/*!
+ * \fn void RequestParams::splitName(const View &name, Param &param)
+ * \brief Split the indexes of a name : the base ends at the first _ followed by a digit, then up to two indexes
+ * and an optional suffix after a _. A name not matching this form is not indexed. Ex: m_3x
+ */
+void RequestParams::splitName(const View &name, Param &param) {
+  param.name = param.base = name;
+  param.index[0] = param.index[1] = -1;
+  param.suffix = View();
+
+  size_t start = View::npos;
+  for (size_t k = 0; k + 1 < name.size(); k++) {
+    if (name[k] == '_' && isDigit(name[k+1])) {
+      start = k;
+      break;
+    }
+  }
+  if (start == View::npos) {
+    return;
+  }
+  int index[2] = {-1, -1};
+  size_t pos = start;
+  for (int nb = 0; nb < 2 && pos + 1 < name.size() && name[pos] == '_' && isDigit(name[pos+1]); nb++) {
+    int value = 0;
+    for (pos++; pos < name.size() && isDigit(name[pos]); pos++) {
+      if (value < 100000000) value = value * 10 + (name[pos] - '0');
+    }
+    index[nb] = value;
+  }
+  if (pos < name.size() && (name[pos] != '_' || pos + 1 == name.size())) {
+    return; // Not indexed
+  }
+  param.base = name.substr(0, start);
+  param.index[0] = index[0];
+  param.index[1] = index[1];
+  if (pos < name.size()) {
+    param.suffix = name.substr(pos + 1);
+  }
+}
+
+/*!
+ * \fn bool RequestParams::readBody(struct mg_connection *conn, const struct mg_request_info *ri, string &body)
+ * \brief Read the body of a POST or PUT request with a length.
+ * The buffer grows with the data received, not with the Content-Length announced.
+ *
+ * \param[in] conn Opaque connection handler.
+ * \param[in] ri Information about HTTP request.
+ * \param[out] body Body read, empty if the request has none.
+ * \return false if the request has no body (not a POST or PUT, or no Content-Length) or if it is larger than MAX_REQUEST_BODY.
+ */
+bool RequestParams::readBody(struct mg_connection *conn, const struct mg_request_info *ri, string &body) {
+  body.clear();
+  const char *cl = mg_get_header(conn, "Content-Length");
+  if ((strcmp(ri->request_method, "POST") && strcmp(ri->request_method, "PUT")) || cl == NULL) {
+    return false;
+  }
+  unsigned long length = strtoul(cl, NULL, 10);
+  if (length > MAX_REQUEST_BODY) {
+    return false;
+  }
+  char chunk[4096];
+  while (body.size() < length) {
+    int nbRead = mg_read(conn, chunk, min(sizeof(chunk), static_cast<size_t>(length - body.size())));
+    if (nbRead <= 0) break;
+    body.append(chunk, nbRead);
+  }
+  return true;
+}
+
+/*!
+ * \fn void RequestParams::parse(struct mg_connection *conn, const struct mg_request_info *ri)
+ * \brief Read the parameters of a request : its body for a POST or PUT with a length, its query string otherwise.
+ *
+ * \param[in] conn Opaque connection handler.
+ * \param[in] ri Information about HTTP request.
+ */
+void RequestParams::parse(struct mg_connection *conn, const struct mg_request_info *ri) {
+  buffer.clear();
+  owned.clear();
+  params.clear();
+
+  /// Single copy of the request
+  if (!readBody(conn, ri, buffer) && ri->query_string != NULL) {
+    buffer = ri->query_string;
+  }
+
+  /// Split sequences separated by & then = ; Ex var1=val1&var2=val2
+  char *data = buffer.empty() ? NULL : &buffer[0];
+  size_t pos = 0;
+  while (pos < buffer.size()) {
+    char *end = static_cast<char*>(memchr(data + pos, '&', buffer.size() - pos));
+    size_t next = (end != NULL) ? end - data : buffer.size();
+    char *equal = static_cast<char*>(memchr(data + pos, '=', next - pos));
+    if (equal != NULL) {
+      size_t nameSize = decode(data + pos, equal - data - pos);
+      size_t valueSize = decode(equal + 1, data + next - equal - 1);
+      Param param;
+      splitName(View(data + pos, nameSize), param);
+      param.value = View(equal + 1, valueSize);
+      params.push_back(param);
+    }
+    pos = next + 1;
+  }
+  stable_sort(params.begin(), params.end(), paramLess);
+}
+
+/*!
+ * \fn void RequestParams::set(const string &name, const string &value)
+ * \brief Set a parameter, its value is replaced if it exists. Ex: applications of apps=server
+ */
+void RequestParams::set(const string &name, const string &value) {
+  owned.push_back(name);
+  owned.push_back(value);
+  Param param;
+  splitName(View(owned[owned.size()-2]), param);
+  param.value = View(owned.back());
+  vector<Param>::iterator it = lower_bound(params.begin(), params.end(), param, paramLess);
+  if (it != params.end() && !paramLess(param, *it)) {
+    it->value = param.value;
+  } else {
+    params.insert(it, param);
+  }
+}
+
+/*!
+ * \fn const RequestParams::Param *RequestParams::lookup(const View &base, const int i, const int j, const View &suffix) const
+ * \brief Find a parameter by its base name, indexes (-1 if absent) and suffix.
+ */
+const RequestParams::Param *RequestParams::lookup(const View &base, const int i, const int j, const View &suffix) const {
+  Param probe;
+  probe.base = base;
+  probe.index[0] = i;
+  probe.index[1] = j;
+  probe.suffix = suffix;
+  vector<Param>::const_iterator it = lower_bound(params.begin(), params.end(), probe, paramLess);
+  if (it == params.end() || paramLess(probe, *it)) {
+    return NULL;
+  }
+  return &(*it);
+}
+
+/*!
+ * \fn bool RequestParams::find(const View &base, View &value) const
+ * \brief Find a parameter not indexed. Ex: mode
+ */
+bool RequestParams::find(const View &base, View &value) const {
+  const Param *param = lookup(base, -1, -1, View());
+  if (param == NULL) return false;
+  value = param->value;
+  return true;
+}
+
+/*!
+ * \fn bool RequestParams::find(const View &base, const int i, View &value) const
+ * \brief Find a parameter with one index. Ex: m_3
+ */
+bool RequestParams::find(const View &base, const int i, View &value) const {
+  const Param *param = lookup(base, i, -1, View());
+  if (param == NULL) return false;
+  value = param->value;
+  return true;
+}
+
+/*!
+ * \fn bool RequestParams::find(const View &base, const int i, const int j, View &value) const
+ * \brief Find a parameter with two indexes. Ex: m_3_12
+ */
+bool RequestParams::find(const View &base, const int i, const int j, View &value) const {
+  const Param *param = lookup(base, i, j, View());
+  if (param == NULL) return false;
+  value = param->value;
+  return true;
+}
+
+/*!
+ * \fn bool RequestParams::find(const View &base, const int i, const View &suffix, View &value) const
+ * \brief Find a parameter with one index and a suffix. Ex: p_0_d
+ */
+bool RequestParams::find(const View &base, const int i, const View &suffix, View &value) const {
+  const Param *param = lookup(base, i, -1, suffix);
+  if (param == NULL) return false;
+  value = param->value;
+  return true;
+}
+
+/*!
+ * \fn bool RequestParams::get(const View &base, string &value) const
+ * \brief Copy the value of a parameter not indexed.
+ *
+ * \return false if the parameter is missing, value is not changed.
+ */
+bool RequestParams::get(const View &base, string &value) const {
+  View view;
+  if (!find(base, view)) return false;
+  value.assign(view.data(), view.size());
+  return true;
+}
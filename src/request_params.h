@@ -0,0 +1,87 @@
+/*!
+ * \file request_params.h
+ * \brief Parameters of the HTTP requests for mooWApp
+ * \author Xavier ETCHEBER
+ */
+
+#ifndef MOOWAPP_STATS_REQUEST_PARAMS_H_
+#define MOOWAPP_STATS_REQUEST_PARAMS_H_
+
+#include <string>
+#include <vector> // Parameters
+#include <deque> // Parameters set by the server
+
+// Boost
+#include <boost/utility/string_ref.hpp> // Views in the request
+
+struct mg_connection;
+struct mg_request_info;
+
+/*!
+ * \def MAX_REQUEST_BODY
+ * \brief Max size in bytes of the body of a POST or PUT request, larger requests are rejected.
+ */
+#define MAX_REQUEST_BODY (1024 * 1024)
+
+/*!
+ * \class RequestParams
+ * \brief Parameters of a request, read from the query string (or the body of a POST or PUT) in one pass.
+ *
+ * The names and values are URL-decoded in place in a single copy of the request, the parameters are views on it.
+ * The indexed names are split from their indexes, so that the array parameters are found without building their name.
+ * Ex: m_3_12 is found with find("m", 3, 12), p_0_d with find("p", 0, "d")
+ * When a name is given twice, its first value is kept.
+ */
+class RequestParams
+{
+public:
+  typedef boost::string_ref View;
+
+  /*!
+   * \struct Param
+   * \brief A parameter of a request.
+   */
+  struct Param {
+    View name;     //!< Whole name. Ex: m_3_12
+    View base;     //!< Name without its indexes. Ex: m
+    int index[2];  //!< Indexes of the name, -1 if absent. Ex: 3 and 12
+    View suffix;   //!< End of the name after its indexes. Ex: d for p_0_d
+    View value;    //!< Decoded value
+  };
+
+  static bool readBody(struct mg_connection *conn, const struct mg_request_info *ri, std::string &body);
+  void parse(struct mg_connection *conn, const struct mg_request_info *ri);
+  void set(const std::string &name, const std::string &value);
+
+  bool find(const View &base, View &value) const;
+  bool find(const View &base, const int i, View &value) const;
+  bool find(const View &base, const int i, const int j, View &value) const;
+  bool find(const View &base, const int i, const View &suffix, View &value) const;
+  bool get(const View &base, std::string &value) const;
+
+  /*!
+   * \fn size_t size() const
+   * \brief Give the number of parameters.
+   */
+  size_t size() const {
+    return params.size();
+  }
+  /*!
+   * \fn const Param &operator[](const size_t k) const
+   * \brief Give a parameter, sorted by base name, indexes then suffix.
+   */
+  const Param &operator[](const size_t k) const {
+    return params[k];
+  }
+
+private:
+  std::string buffer;           //!< Copy of the query string or of the body, decoded in place
+  std::deque<std::string> owned; //!< Names and values set by the server (a deque keeps them in place)
+  std::vector<Param> params;    //!< Parameters, sorted
+
+  static void splitName(const View &name, Param &param);
+  static size_t decode(char *data, const size_t size);
+  const Param *lookup(const View &base, const int i, const int j, const View &suffix) const;
+};
+
+#endif // MOOWAPP_STATS_REQUEST_PARAMS_H_
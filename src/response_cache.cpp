@@ -0,0 +1,270 @@
+/*!
+ * \file response_cache.cpp
+ * \brief Cache of the responses of the stats requests for mooWApp
+ * \author Xavier ETCHEBER
+ */
+
+#include <string>
+#include <map> // Entries, epochs
+#include <set> // Days
+#include <list> // Least recently used order
+#include <stdio.h> // snprintf
+#include <time.h> // time
+
+// mooWApp
+#include "configuration.h"
+#include "response_cache.h"
+
+using namespace std;
+
+/*!
+ * \fn ResponseCache::ResponseCache()
+ * \brief Constructor
+ */
+ResponseCache::ResponseCache() : globalEpoch(1), instance(time(NULL)) {
+  counters.hits = counters.misses = counters.stale = counters.evictions = counters.entries = counters.capacity = 0;
+  counters.bytes = 0;
+}
+
+/*!
+ * \fn static void appendEscaped(string &strKey, const RequestParams::View &value)
+ * \brief Append a decoded name or value to a key, with its '%', '&' and '=' encoded again so that the key
+ * of a request can not be the one of an other. Ex: a&b -> a%26b
+ */
+static void appendEscaped(string &strKey, const RequestParams::View &value) {
+  for (size_t i = 0; i < value.size(); i++) {
+    switch (value[i]) {
+      case '%': strKey += "%25"; break;
+      case '&': strKey += "%26"; break;
+      case '=': strKey += "%3D"; break;
+      default: strKey += value[i];
+    }
+  }
+}
+
+/*!
+ * \fn string ResponseCache::key(const string &uri, const RequestParams &params)
+ * \brief Give the key of a request : its context and its parameters in their order.
+ *
+ * \param[in] uri Context of the request. Ex: /stats_app_month
+ * \param[in] params Parameters of the request.
+ * \return Ex: /stats_app_month?dates=31&mode=app&...
+ */
+string ResponseCache::key(const string &uri, const RequestParams &params) {
+  string strKey = uri + '?';
+  for (size_t k = 0; k < params.size(); k++) {
+    const RequestParams::Param &param = params[k];
+    /// JSONP callback and anti-cache parameter of the browsers do not change the data
+    if (param.name == "callback" || param.name == "_") continue;
+    appendEscaped(strKey, param.name);
+    strKey += '=';
+    appendEscaped(strKey, param.value);
+    strKey += '&';
+  }
+  return strKey;
+}
+
+/*!
+ * \fn bool ResponseCache::find(const string &key, string &body, string *gzipped)
+ * \brief Get the response of a request if it is still valid.
+ *
+ * \param[in] key Key of the request (key()).
+ * \param[out] body Response without the JSONP wrapping.
+ * \param[out] gzipped Response compressed with gzip, empty if not compressed yet. NULL if not needed.
+ * \return false if the request has to be built.
+ */
+bool ResponseCache::find(const string &key, string &body, string *gzipped/* = NULL */) {
+  boost::mutex::scoped_lock lock(mutex);
+  map<string, Entry>::iterator it = entries.find(key);
+  if (it == entries.end()) {
+    counters.misses++;
+    return false;
+  }
+  if (!valid(it->second)) {
+    counters.stale++;
+    erase(it);
+    return false;
+  }
+  /// Most recently used
+  lru.splice(lru.begin(), lru, (it->second).lru);
+  body = (it->second).body;
+  if (gzipped != NULL) {
+    *gzipped = (it->second).gzipped;
+  }
+  counters.hits++;
+  return true;
+}
+
+/*!
+ * \fn void ResponseCache::epochsOf(const set<string> &days, CacheEpochs &epochs)
+ * \brief Get the current epochs of the days a response is going to be built from (before reading them).
+ *
+ * \param[in] days Days read by the request. Ex: 2011-04-24
+ * \param[out] epochs Epochs to store with the response.
+ */
+void ResponseCache::epochsOf(const set<string> &days, CacheEpochs &epochs) {
+  boost::mutex::scoped_lock lock(mutex);
+  epochs.global = globalEpoch;
+  epochs.days.clear();
+  for (set<string>::const_iterator it = days.begin(); it != days.end(); it++) {
+    map<string, uint64_t>::const_iterator itEpoch = dayEpochs.find(*it);
+    epochs.days[*it] = (itEpoch != dayEpochs.end()) ? itEpoch->second : 0;
+  }
+}
+
+/*!
+ * \fn void ResponseCache::epochsOfRange(const string &first, const string &last, CacheEpochs &epochs)
+ * \brief Get the current epochs of the days of a range : only the days written since the start are listed,
+ * the others are at 0. Ex: range of years
+ *
+ * \param[in] first First day of the range. Ex: 2011-04-01
+ * \param[in] last Last day of the range. Ex: 2011-04-30
+ * \param[out] epochs Epochs of the days of the range.
+ */
+void ResponseCache::epochsOfRange(const string &first, const string &last, CacheEpochs &epochs) {
+  boost::mutex::scoped_lock lock(mutex);
+  epochs.global = globalEpoch;
+  epochs.days.clear();
+  map<string, uint64_t>::const_iterator itEnd = dayEpochs.upper_bound(last);
+  for (map<string, uint64_t>::const_iterator it = dayEpochs.lower_bound(first); it != itEnd; it++) {
+    epochs.days.insert(*it);
+  }
+}
+
+/*!
+ * \fn string ResponseCache::etag(const string &key, const CacheEpochs &epochs) const
+ * \brief Give the ETag of a response : hash of the request and of the epochs of its data (FNV-1a).
+ * It is weak, the gzip and plain forms of a response have the same one.
+ *
+ * \param[in] key Key of the request (key()), with what changes the bytes of the response. Ex: JSONP callback
+ * \param[in] epochs Epochs got before the response is built (epochsOf() or epochsOfRange()).
+ * \return Ex: W/"5f3a9c2e10b47d61"
+ */
+string ResponseCache::etag(const string &key, const CacheEpochs &epochs) const {
+  uint64_t hash = 14695981039346656037ULL;
+  char number[48];
+  string data = key;
+  data.append(number, snprintf(number, sizeof(number), "#%llu#%llu", static_cast<unsigned long long>(instance),
+                                                                     static_cast<unsigned long long>(epochs.global)));
+  for (map<string, uint64_t>::const_iterator it = epochs.days.begin(); it != epochs.days.end(); it++) {
+    if (it->second == 0) continue; // Same tag for a day not written, listed or not
+    data += it->first;
+    data.append(number, snprintf(number, sizeof(number), "=%llu;", static_cast<unsigned long long>(it->second)));
+  }
+  for (size_t i = 0; i < data.size(); i++) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 1099511628211ULL;
+  }
+  snprintf(number, sizeof(number), "%016llx", static_cast<unsigned long long>(hash));
+  return string("W/\"") + number + '"';
+}
+
+/*!
+ * \fn void ResponseCache::store(const string &key, const string &body, const CacheEpochs &epochs, const string &gzipped)
+ * \brief Keep the response of a request, the least recently used one is removed if the cache is full.
+ *
+ * \param[in] key Key of the request (key()).
+ * \param[in] body Response without the JSONP wrapping.
+ * \param[in] epochs Epochs got before the response was built (epochsOf()).
+ * \param[in] gzipped Response compressed with gzip, empty if it was not compressed.
+ */
+void ResponseCache::store(const string &key, const string &body, const CacheEpochs &epochs, const string &gzipped/* = string() */) {
+  unsigned long capacity = Config::get().RESPONSE_CACHE_ENTRIES;
+  if (capacity == 0) {
+    return;
+  }
+  boost::mutex::scoped_lock lock(mutex);
+  counters.capacity = capacity;
+  map<string, Entry>::iterator it = entries.find(key);
+  if (it != entries.end()) {
+    erase(it);
+  }
+  while (entries.size() >= capacity && !lru.empty()) {
+    erase(entries.find(lru.back()));
+    counters.evictions++;
+  }
+  lru.push_front(key);
+  Entry &entry = entries[key];
+  entry.body = body;
+  entry.gzipped = gzipped;
+  entry.epochs = epochs;
+  entry.lru = lru.begin();
+  counters.bytes += key.size() + body.size() + gzipped.size();
+}
+
+/*!
+ * \fn void ResponseCache::storeGzipped(const string &key, const string &gzipped)
+ * \brief Keep the gzip form of a response found in the cache without it.
+ *
+ * \param[in] key Key of the request (key()).
+ * \param[in] gzipped Response compressed with gzip.
+ */
+void ResponseCache::storeGzipped(const string &key, const string &gzipped) {
+  boost::mutex::scoped_lock lock(mutex);
+  map<string, Entry>::iterator it = entries.find(key);
+  if (it == entries.end() || !(it->second).gzipped.empty()) {
+    return; // Removed or compressed by another request meanwhile
+  }
+  (it->second).gzipped = gzipped;
+  counters.bytes += gzipped.size();
+}
+
+/*!
+ * \fn void ResponseCache::bumpDay(const string &day)
+ * \brief Invalidate the responses built from a day, its visits have changed.
+ *
+ * \param[in] day Day. Ex: 2011-04-24
+ */
+void ResponseCache::bumpDay(const string &day) {
+  boost::mutex::scoped_lock lock(mutex);
+  dayEpochs[day]++;
+}
+
+/*!
+ * \fn void ResponseCache::bumpAll()
+ * \brief Invalidate every response. Ex: module merged or application changed
+ */
+void ResponseCache::bumpAll() {
+  boost::mutex::scoped_lock lock(mutex);
+  globalEpoch++;
+}
+
+/*!
+ * \fn void ResponseCache::metrics(CacheMetrics &metrics)
+ * \brief Get the counters of the cache.
+ */
+void ResponseCache::metrics(CacheMetrics &metrics) {
+  boost::mutex::scoped_lock lock(mutex);
+  counters.entries = entries.size();
+  counters.capacity = Config::get().RESPONSE_CACHE_ENTRIES;
+  metrics = counters;
+}
+
+/*!
+ * \fn bool ResponseCache::valid(const Entry &entry) const
+ * \brief Tell if none of the days a response was built from has changed since.
+ */
+bool ResponseCache::valid(const Entry &entry) const {
+  if (entry.epochs.global != globalEpoch) {
+    return false;
+  }
+  for (map<string, uint64_t>::const_iterator it = entry.epochs.days.begin(); it != entry.epochs.days.end(); it++) {
+    map<string, uint64_t>::const_iterator itEpoch = dayEpochs.find(it->first);
+    if (((itEpoch != dayEpochs.end()) ? itEpoch->second : 0) != it->second) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*!
+ * \fn void ResponseCache::erase(map<string, Entry>::iterator it)
+ * \brief Remove a response.
+ */
+void ResponseCache::erase(map<string, Entry>::iterator it) {
+  counters.bytes -= (it->first).size() + (it->second).body.size() + (it->second).gzipped.size();
+  lru.erase((it->second).lru);
+  entries.erase(it);
+}
+
+ResponseCache ResponseCache::singleton;
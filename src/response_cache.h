@@ -0,0 +1,114 @@
+/*!
+ * \file response_cache.h
+ * \brief Cache of the responses of the stats requests for mooWApp
+ * \author Xavier ETCHEBER
+ */
+
+#ifndef MOOWAPP_STATS_RESPONSE_CACHE_H_
+#define MOOWAPP_STATS_RESPONSE_CACHE_H_
+
+#include <string>
+#include <map> // Entries, epochs
+#include <set> // Days
+#include <list> // Least recently used order
+#include <stdint.h> // uint64_t
+
+// Boost
+#include <boost/thread/mutex.hpp> // Mutex
+
+// mooWApp
+#include "request_params.h"
+
+/*!
+ * \struct CacheEpochs
+ * \brief Epochs of the data a response was built from, the response is valid while none of them changes.
+ */
+struct CacheEpochs {
+  uint64_t global;                    //!< Epoch of the whole data (modules, applications, retention)
+  std::map<std::string, uint64_t> days; //!< Epoch of each day read. Ex: 2011-04-24 -> 3
+
+  CacheEpochs() : global(0) {}
+};
+
+/*!
+ * \struct CacheMetrics
+ * \brief Counters of the cache since the start of the server.
+ */
+struct CacheMetrics {
+  unsigned long hits;      //!< Responses found and valid
+  unsigned long misses;    //!< Responses not found
+  unsigned long stale;     //!< Responses found but built from days changed since
+  unsigned long evictions; //!< Least recently used responses removed for a new one
+  unsigned long entries;   //!< Responses in the cache
+  uint64_t bytes;          //!< Size of the responses in the cache, compressed forms included
+  unsigned long capacity;  //!< Max responses in the cache (RESPONSE_CACHE_ENTRIES)
+};
+
+/*!
+ * \class ResponseCache
+ * \brief Least recently used cache of the responses, keyed by the context and the parameters of the request
+ * (callback and _ excepted, they only change the JSONP wrapping and the browser cache).
+ *
+ * Each day has an epoch, bumped by the log readers when they write visits of the day. A response keeps the epochs
+ * of the days it was built from : responses of past months stay valid until evicted, the ones of today until
+ * the next batch of log lines is written. The global epoch is bumped by the changes of the modules, of the
+ * applications and by the retention.
+ * The gzip form of a response is kept with it, so that it is compressed only once.
+ * The same epochs give the ETag of the responses : a client having a response of days not changed since
+ * gets a 304 without any read in DB.
+ */
+class ResponseCache
+{
+public:
+  static std::string key(const std::string &uri, const RequestParams &params);
+  bool find(const std::string &key, std::string &body, std::string *gzipped = NULL);
+  void epochsOf(const std::set<std::string> &days, CacheEpochs &epochs);
+  void epochsOfRange(const std::string &first, const std::string &last, CacheEpochs &epochs);
+  std::string etag(const std::string &key, const CacheEpochs &epochs) const;
+  void store(const std::string &key, const std::string &body, const CacheEpochs &epochs, const std::string &gzipped = std::string());
+  void storeGzipped(const std::string &key, const std::string &gzipped);
+  void bumpDay(const std::string &day);
+  void bumpAll();
+  void metrics(CacheMetrics &metrics);
+
+  // Getter of singleton
+  static ResponseCache &get() throw() {
+    return singleton;
+  }
+
+private:
+  /*!
+   * \struct Entry
+   * \brief A response with the epochs it was built from.
+   */
+  struct Entry {
+    std::string body;
+    std::string gzipped; //!< Body compressed with gzip, empty until a client accepting it asks for the response
+    CacheEpochs epochs;
+    std::list<std::string>::iterator lru; //!< Position in the least recently used order
+  };
+
+  static ResponseCache singleton;
+  std::map<std::string, Entry> entries;   //!< Responses by key
+  std::list<std::string> lru;             //!< Keys, most recently used first
+  std::map<std::string, uint64_t> dayEpochs; //!< Epoch of each day written since the start (0 if not written)
+  uint64_t globalEpoch;                   //!< Epoch of the whole data
+  uint64_t instance;                      //!< Start time of the server, in the ETags : the epochs restart from 0
+  CacheMetrics counters;                  //!< Metrics
+  boost::mutex mutex;                     //!< Mutex for the entries and the epochs
+
+  bool valid(const Entry &entry) const;
+  void erase(std::map<std::string, Entry>::iterator it);
+
+  /*!
+   * \fn ResponseCache()
+   * \brief Constructor
+   */
+  ResponseCache();
+
+  // Protection against copy -> Do not define these
+  ResponseCache(const ResponseCache&);
+  void operator=(const ResponseCache&);
+};
+
+#endif // MOOWAPP_STATS_RESPONSE_CACHE_H_
@@ -0,0 +1,155 @@
+/*!
+ * \file rt_sketch.cpp
+ * \brief Mergeable histogram of response times for mooWApp
+ * \author Xavier ETCHEBER
+ */
+
+#include <string>
+#include <map> // Buckets
+#include <sstream> // ostringstream
+#include <stdlib.h> // strtoull
+
+// mooWApp
+#include "db_access.h"
+#include "rt_sketch.h"
+
+using namespace std;
+
+static const bool mergeRegistered = registerMergeFunc("rt_sketch", RtSketch::mergeValue); //!< Replay of the sketches merged by the segments engine
+
+/*!
+ * \fn uint16_t RtSketch::bucketOf(const uint32_t value)
+ * \brief Give the bucket of a value.
+ */
+uint16_t RtSketch::bucketOf(const uint32_t value) {
+  const uint32_t subBuckets = 1 << RT_SKETCH_SUB_BITS;
+  if (value < subBuckets) {
+    return value;
+  }
+  /// Power of two of the value, then its linear bucket inside the power of two
+  unsigned int shift = (31 - __builtin_clz(value)) - RT_SKETCH_SUB_BITS;
+  return subBuckets + shift * subBuckets + ((value >> shift) & (subBuckets - 1));
+}
+
+/*!
+ * \fn uint32_t RtSketch::bucketMiddle(const uint16_t bucket)
+ * \brief Give the value in the middle of a bucket.
+ */
+uint32_t RtSketch::bucketMiddle(const uint16_t bucket) {
+  const uint32_t subBuckets = 1 << RT_SKETCH_SUB_BITS;
+  if (bucket < subBuckets) {
+    return bucket;
+  }
+  unsigned int shift = (bucket - subBuckets) / subBuckets;
+  uint64_t low = (uint64_t) (subBuckets + (bucket - subBuckets) % subBuckets) << shift;
+  return low + (((uint64_t) 1 << shift) - 1) / 2;
+}
+
+/*!
+ * \fn void RtSketch::add(const uint32_t value, const uint32_t count)
+ * \brief Add a value to the sketch.
+ *
+ * \param[in] value Response time.
+ * \param[in] count Number of times the value is added.
+ */
+void RtSketch::add(const uint32_t value, const uint32_t count/* = 1 */) {
+  buckets[bucketOf(value)] += count;
+  total += count;
+  sum += (uint64_t) value * count;
+}
+
+/*!
+ * \fn void RtSketch::merge(const RtSketch &other)
+ * \brief Add the values of an other sketch.
+ */
+void RtSketch::merge(const RtSketch &other) {
+  for (map<uint16_t, uint64_t>::const_iterator it = other.buckets.begin(); it != other.buckets.end(); it++) {
+    buckets[it->first] += it->second;
+  }
+  total += other.total;
+  sum += other.sum;
+}
+
+/*!
+ * \fn uint32_t RtSketch::quantile(const double q) const
+ * \brief Give a percentile of the values (within the precision of a bucket).
+ *
+ * \param[in] q Quantile between 0 and 1. Ex: 0.99
+ * \return The value, 0 if the sketch is empty.
+ */
+uint32_t RtSketch::quantile(const double q) const {
+  if (total == 0) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t) (q * total + 0.5);
+  if (rank < 1) rank = 1;
+  if (rank > total) rank = total;
+  uint64_t seen = 0;
+  for (map<uint16_t, uint64_t>::const_iterator it = buckets.begin(); it != buckets.end(); it++) {
+    seen += it->second;
+    if (seen >= rank) {
+      return bucketMiddle(it->first);
+    }
+  }
+  return bucketMiddle(buckets.rbegin()->first);
+}
+
+/*!
+ * \fn bool RtSketch::parse(const string &str)
+ * \brief Read a sketch stored as "count/sum/bucket:count,bucket:count".
+ *
+ * \return false if the string is not a sketch (the sketch is left empty).
+ */
+bool RtSketch::parse(const string &str) {
+  buckets.clear();
+  total = sum = 0;
+  const char *p = str.c_str();
+  char *end;
+  uint64_t iTotal = strtoull(p, &end, 10);
+  if (end == p || *end != '/') return false;
+  p = end + 1;
+  uint64_t iSum = strtoull(p, &end, 10);
+  if (end == p || *end != '/') return false;
+  p = end + 1;
+  uint64_t counted = 0;
+  while (*p != '\0') {
+    uint64_t bucket = strtoull(p, &end, 10);
+    if (end == p || *end != ':' || bucket > bucketOf(UINT32_MAX)) break; // Bucket of no value : corrupt sketch
+    p = end + 1;
+    uint64_t count = strtoull(p, &end, 10);
+    if (end == p) break;
+    buckets[bucket] += count;
+    counted += count;
+    p = (*end == ',') ? end + 1 : end;
+  }
+  if (*p != '\0' || counted != iTotal) {
+    buckets.clear();
+    return false;
+  }
+  total = iTotal;
+  sum = iSum;
+  return true;
+}
+
+/*!
+ * \fn string RtSketch::toString() const
+ * \brief Give the sketch as stored in DB.
+ */
+string RtSketch::toString() const {
+  ostringstream oss;
+  oss << total << '/' << sum << '/';
+  for (map<uint16_t, uint64_t>::const_iterator it = buckets.begin(); it != buckets.end(); it++) {
+    if (it != buckets.begin()) oss << ',';
+    oss << it->first << ':' << it->second;
+  }
+  return oss.str();
+}
+
+void RtSketch::mergeValue(string &value, const string &delta) {
+  RtSketch stored, added;
+  stored.parse(value); // A value which is not a sketch is replaced
+  if (added.parse(delta)) {
+    stored.merge(added);
+  }
+  value = stored.toString();
+}
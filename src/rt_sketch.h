@@ -0,0 +1,53 @@
+/*!
+ * \file rt_sketch.h
+ * \brief Mergeable histogram of response times for mooWApp
+ * \author Xavier ETCHEBER
+ */
+
+#ifndef MOOWAPP_STATS_RT_SKETCH_H_
+#define MOOWAPP_STATS_RT_SKETCH_H_
+
+#include <string>
+#include <map> // Buckets
+#include <stdint.h> // uint32_t, uint64_t
+
+#define RT_SKETCH_SUB_BITS 4 //!< Each power of two is split in 2^RT_SKETCH_SUB_BITS buckets (max relative error 1/16)
+
+/*!
+ * \class RtSketch
+ * \brief Log-linear histogram of response times : values below 2^RT_SKETCH_SUB_BITS have their own bucket, above
+ * each power of two is split in 2^RT_SKETCH_SUB_BITS linear buckets.
+ *
+ * Two sketches are merged by adding their buckets, so that minute sketches roll up into hour, day and month sketches
+ * and give percentiles at any resolution without keeping the samples.
+ * Stored as "count/sum/bucket:count,bucket:count". Ex: 3/412/5:1,70:2
+ */
+class RtSketch
+{
+public:
+  RtSketch() : total(0), sum(0) {}
+
+  void add(const uint32_t value, const uint32_t count = 1);
+  void merge(const RtSketch &other);
+  bool parse(const std::string &str);
+  std::string toString() const;
+  uint64_t count() const { return total; }
+  uint32_t mean() const { return total > 0 ? sum / total : 0; }
+  uint32_t quantile(const double q) const;
+
+  /*!
+   * \fn static void mergeValue(std::string &value, const std::string &delta)
+   * \brief Merge a stored sketch with a sketch to add (DBMergeFunc of dbw_merge).
+   */
+  static void mergeValue(std::string &value, const std::string &delta);
+
+private:
+  std::map<uint16_t, uint64_t> buckets; //!< Count of each non empty bucket
+  uint64_t total;                       //!< Number of values
+  uint64_t sum;                         //!< Sum of the values (for the mean)
+
+  static uint16_t bucketOf(const uint32_t value);
+  static uint32_t bucketMiddle(const uint16_t bucket);
+};
+
+#endif // MOOWAPP_STATS_RT_SKETCH_H_
@@ -28,24 +28,44 @@ void Worker::operator()() {
       // get the task from the queue
       task = pool.tasks.front();
       pool.tasks.pop_front();
+      pool.active++;
  
      }// release lock
  
      // execute the task
      task();
+ 
+     {   // wake up the waiting thread when the pool is idle
+      std::unique_lock<std::mutex>
+      lock(pool.queue_mutex);
+      pool.active--;
+      if(pool.tasks.empty() && pool.active == 0)
+        pool.finished.notify_all();
+     }
   }
 }
 
 // the constructor just launches some amount of workers
-ThreadPool::ThreadPool(size_t threads) : stop(false) {
+ThreadPool::ThreadPool(size_t threads) : active(0), stop(false) {
   for(size_t i = 0;i<threads;++i)
     workers.push_back(std::thread(Worker(*this)));
 }
  
+// wait until every task queued is done (barrier)
+void ThreadPool::wait() {
+  std::unique_lock<std::mutex> lock(queue_mutex);
+  while(!tasks.empty() || active > 0) {
+    finished.wait(lock);
+  }
+}
+
 // the destructor joins all threads
 ThreadPool::~ThreadPool() {
   // stop all threads
-  stop = true;
+  {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    stop = true;
+  }
   condition.notify_all();
  
   // join them
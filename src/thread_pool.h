@@ -10,6 +10,9 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
 
 // Boost
 #include <boost/thread/thread.hpp> // Thread system
@@ -41,6 +44,8 @@ public:
    ThreadPool(size_t);
    template<class F>
    void enqueue(F f);
+   void wait();
+   size_t size() const { return workers.size(); }
    ~ThreadPool();
 private:
    friend class Worker;
@@ -54,7 +59,23 @@ private:
    // synchronization
    std::mutex queue_mutex;
    std::condition_variable condition;
+   std::condition_variable finished; // notified when the last running task ends
+   size_t active; // tasks running
    bool stop;
 };
 
+// add new work item to the pool
+template<class F>
+void ThreadPool::enqueue(F f) {
+  { // acquire lock
+    std::unique_lock<std::mutex> lock(queue_mutex);
+ 
+    // add the task
+    tasks.push_back(std::function<void()>(f));
+  } // release lock
+ 
+  // wake up one thread
+  condition.notify_one();
+}
+
 #endif // MOOWAPP_STATS_THREAD_POOL_H_
\ No newline at end of file
@@ -0,0 +1,571 @@
+/*!
+ * \file db_access_test.cpp
+ * \brief Tests of the storage engines on a real environment (BerkeleyDB opened with DB_THREAD), and of the query planner,
+ * request parameters, response time sketches and JSON writer on a fake connection
+ * \author Xavier ETCHEBER
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map> // Headers of the fake connection
+#include <stdlib.h> // mkdtemp, system, strtoul
+#include <stdio.h> // snprintf
+#include <string.h> // strcmp
+#include <stdint.h> // UINT32_MAX
+#include <sys/stat.h> // stat
+
+// zlib
+#include <zlib.h> // gzip responses
+
+// mooWApp
+#include "global.h"
+#include "configuration.h"
+#include "db_access_berkeleydb.h"
+#include "db_access_segments.h"
+#include "query_engine.h"
+#include "request_params.h"
+#include "rt_sketch.h"
+#include "json_writer.h"
+
+using namespace std;
+
+static int failures = 0; //!< Checks failed
+
+/*!
+ * \def CHECK(cond)
+ * \brief Report a check failed, with its line.
+ */
+#define CHECK(cond) do { if (!(cond)) { cerr << __FILE__ << ':' << __LINE__ << ": check failed: " #cond << endl; failures++; } } while (false)
+
+/*!
+ * \fn static void testReadCounters(DBAccessBerkeley &dbA)
+ * \brief Scan of the counters of a series : slots of the tier, keys of the finer tiers and suffixes skipped,
+ * value too large for a counter skipped without failing the range.
+ */
+static void testReadCounters(DBAccessBerkeley &dbA) {
+  CHECK(dbA.dbw_add("mod/w/1/2011-04-24", "10"));
+  CHECK(dbA.dbw_add("mod/w/1/2011-04-25", "5"));
+  CHECK(dbA.dbw_add("mod/w/1/2011-04-24/15", "7"));
+  CHECK(dbA.dbw_add("mod/w/1/2011-04-24/15/sz", "1,2,3"));
+  CHECK(dbA.dbw_add("mod/w/1/2011-04-24/150", "4"));
+  CHECK(dbA.dbw_add("mod/w/1/2011-04-24/1503", "2"));
+  CHECK(dbA.dbw_add("mod/w/1/2011-04-24/16", "3"));
+  CHECK(dbA.dbw_add("mod/w/1/2011-04-24/17", string(VAL_MAX_VALUE_SIZE * 2, '9')));
+  CHECK(dbA.dbw_add("mod/w/1/2011-04-24/18", "6"));
+  CHECK(dbA.dbw_add("mod/w/10/2011-04-24/15", "100")); // Other series with the same beginning
+  
+  vector<unsigned int> counters;
+  CHECK(dbA.dbw_read_counters("mod/w/1", "2011-04-24", TIER_HOURS, counters) == DBW_FOUND);
+  CHECK(counters.size() == DB_TIMES_HOURS_SIZE);
+  CHECK(counters[15] == 7);
+  CHECK(counters[16] == 3);
+  CHECK(counters[17] == 0);
+  CHECK(counters[18] == 6);
+  
+  CHECK(dbA.dbw_read_counters("mod/w/1", "2011-04-24", TIER_10MINUTES, counters) == DBW_FOUND);
+  CHECK(counters[15*6] == 4);
+  
+  CHECK(dbA.dbw_read_counters("mod/w/1", "2011-04-24", TIER_MINUTES, counters) == DBW_FOUND);
+  CHECK(counters[15*60+3] == 2);
+  
+  CHECK(dbA.dbw_read_counters("mod/w/1", "2011-04", TIER_DAYS, counters) == DBW_FOUND);
+  CHECK(counters.size() == 31);
+  CHECK(counters[23] == 10);
+  CHECK(counters[24] == 5);
+  
+  CHECK(dbA.dbw_read_counters("mod/w/1", "2011-05-01", TIER_HOURS, counters) == DBW_NOTFOUND);
+  
+  /// Same reads in a snapshot
+  {
+    DBSnapshot snapshot(dbA);
+    CHECK(dbA.dbw_read_counters("mod/w/1", "2011-04-24", TIER_HOURS, counters) == DBW_FOUND);
+    CHECK(counters[15] == 7);
+    CHECK(counters[18] == 6);
+  }
+}
+
+/*!
+ * \fn static void testWarmup(DBAccessBerkeley &dbA)
+ * \brief Warm-up of the keys of some prefixes : every key of the prefixes is read.
+ */
+static void testWarmup(DBAccessBerkeley &dbA) {
+  vector<string> prefixes;
+  prefixes.push_back("mod/w/1/2011-04-24");
+  prefixes.push_back("mod/w/1/2011-04-25");
+  prefixes.push_back("nomod/w/1/2011-04-24");
+  CHECK(dbA.dbw_warmup(prefixes) == 9);
+}
+
+/*!
+ * \fn static void testPartitionsMigration(DBAccessBerkeley &dbA, const string &baseDir)
+ * \brief Db reopened with the partitions : the minutes stats written before are moved to the partitions,
+ * read from there and removed with their day.
+ */
+static void testPartitionsMigration(DBAccessBerkeley &dbA, const string &baseDir) {
+  dbA.dbw_close();
+  Config::get().DB_PARTITIONS = true;
+  CHECK(dbA.dbw_open(baseDir, "test.db"));
+  
+  vector<unsigned int> counters;
+  CHECK(dbA.dbw_read_counters("mod/w/1", "2011-04-24", TIER_MINUTES, counters) == DBW_FOUND);
+  CHECK(counters[15*60+3] == 2);
+  CHECK(dbA.dbw_read_counters("mod/w/1", "2011-04-24", TIER_10MINUTES, counters) == DBW_FOUND);
+  CHECK(counters[15*6] == 4);
+  
+  /// Moved once : the main db keeps no minutes stats
+  CHECK(dbA.dbw_remove_day("2011-04-24", TIER_MINUTES));
+  CHECK(dbA.dbw_read_counters("mod/w/1", "2011-04-24", TIER_MINUTES, counters) == DBW_NOTFOUND);
+  dbA.dbw_close();
+  CHECK(dbA.dbw_open(baseDir, "test.db"));
+  CHECK(dbA.dbw_read_counters("mod/w/1", "2011-04-24", TIER_MINUTES, counters) == DBW_NOTFOUND);
+  CHECK(dbA.dbw_read_counters("mod/w/1", "2011-04-24", TIER_HOURS, counters) == DBW_FOUND);
+  CHECK(counters[15] == 7);
+}
+
+/*!
+ * \fn static void concatMerge(string &value, const string &delta)
+ * \brief Merge function of the tests : the deltas are concatenated after a '+'.
+ */
+static void concatMerge(string &value, const string &delta) {
+  value += '+';
+  value += delta;
+}
+
+static const bool concatRegistered = registerMergeFunc("test_concat", concatMerge); //!< Replay of the merges of the tests
+
+/*!
+ * \fn static void testSegments(const string &baseDir)
+ * \brief Segments engine : appends and merges logged as deltas replayed at open, also after a compaction by slices
+ * with changes between the slices, missing segment, drop.
+ */
+static void testSegments(const string &baseDir) {
+  DBAccessSegments &dbS = DBAccessSegments::get();
+  CHECK(dbS.dbw_open(baseDir, "test"));
+  CHECK(dbS.dbw_append("mod/w/1/2011-04-24/1503/sz/values", "10"));
+  CHECK(dbS.dbw_append("mod/w/1/2011-04-24/1503/sz/values", "20"));
+  CHECK(dbS.dbw_merge("mod/w/1/2011-04-24/15/rt/sketch", "a", concatMerge));
+  CHECK(dbS.dbw_merge("mod/w/1/2011-04-24/15/rt/sketch", "b", concatMerge));
+  
+  /// Segment missing, then created
+  string value;
+  CHECK(dbS.dbw_read("mod/w/1/2011-04-23/15", value) == DBW_NOTFOUND);
+  CHECK(dbS.dbw_read("mod/w/1/2011-04-23/15", value) == DBW_NOTFOUND);
+  CHECK(dbS.dbw_increment("mod/w/1/2011-04-23/15", 3) == 3);
+  CHECK(dbS.dbw_read("mod/w/1/2011-04-23/15", value) == DBW_FOUND && stringToInt(value) == 3);
+  
+  dbS.dbw_close();
+  CHECK(dbS.dbw_open(baseDir, "test"));
+  CHECK(dbS.dbw_read("mod/w/1/2011-04-24/1503/sz/values", value) == DBW_FOUND && value == "10,20");
+  CHECK(dbS.dbw_read("mod/w/1/2011-04-24/15/rt/sketch", value) == DBW_FOUND && value == "+a+b");
+  
+  /// Compaction by slices of 16 keys, keys changed between the slices
+  char key[16];
+  for (int i = 0; i < 40; i++) {
+    snprintf(key, sizeof(key), "key/%02d", i);
+    CHECK(dbS.dbw_add(key, "v"));
+  }
+  DBCompactProgress progress;
+  CHECK(dbS.dbw_compact_slice(progress, 1));
+  CHECK(progress.passes == 0);
+  CHECK(dbS.dbw_append("key/00", "w")); // Already copied
+  CHECK(dbS.dbw_append("key/39", "w")); // Not copied yet
+  dbS.dbw_remove("key/01");
+  CHECK(dbS.dbw_merge("mod/w/1/2011-04-24/15/rt/sketch", "c", concatMerge));
+  while (progress.passes == 0 && dbS.dbw_compact_slice(progress, 1)) {}
+  CHECK(progress.passes == 1);
+  CHECK(progress.slices > 2);
+  
+  dbS.dbw_close();
+  CHECK(dbS.dbw_open(baseDir, "test"));
+  CHECK(dbS.dbw_read("key/00", value) == DBW_FOUND && value == "v,w");
+  CHECK(dbS.dbw_read("key/01", value) == DBW_NOTFOUND);
+  CHECK(dbS.dbw_read("key/20", value) == DBW_FOUND && value == "v");
+  CHECK(dbS.dbw_read("key/39", value) == DBW_FOUND && value == "v,w");
+  CHECK(dbS.dbw_read("mod/w/1/2011-04-24/1503/sz/values", value) == DBW_FOUND && value == "10,20");
+  CHECK(dbS.dbw_read("mod/w/1/2011-04-24/15/rt/sketch", value) == DBW_FOUND && value == "+a+b+c");
+  
+  dbS.dbw_drop(NULL);
+  struct stat st;
+  CHECK(stat((baseDir + "test.segments").c_str(), &st) != 0);
+}
+
+/*!
+ * \struct mg_connection
+ * \brief Fake connection of the tests : headers and body of the request, response written.
+ */
+struct mg_connection {
+  std::map<std::string, std::string> headers; //!< Headers of the request
+  std::string body;                           //!< Body of the request
+  size_t bodyRead;                            //!< Bytes of the body already read
+  std::string written;                        //!< Response
+
+  mg_connection() : bodyRead(0) {}
+};
+
+const char *mg_get_header(const struct mg_connection *conn, const char *name) {
+  std::map<std::string, std::string>::const_iterator it = conn->headers.find(name);
+  return it != conn->headers.end() ? (it->second).c_str() : NULL;
+}
+
+int mg_read(struct mg_connection *conn, void *buf, size_t len) {
+  size_t size = min(len, conn->body.size() - conn->bodyRead);
+  memcpy(buf, conn->body.data() + conn->bodyRead, size);
+  conn->bodyRead += size;
+  return size;
+}
+
+int mg_write(struct mg_connection *conn, const void *buf, size_t len) {
+  conn->written.append(static_cast<const char *>(buf), len);
+  return len;
+}
+
+/*!
+ * \fn static void testQueryPlan()
+ * \brief Buckets, labels and plans of the queries : ISO weeks across the end of a year, partial months, days kept.
+ */
+static void testQueryPlan() {
+  StatsQuery query;
+  vector<QueryScan> scans;
+  
+  /// Week 53 of 2009 ends in 2010 : read with its total
+  query.first = boost::gregorian::date(2009, 12, 28);
+  query.last = boost::gregorian::date(2010, 1, 10);
+  query.resolution = RES_WEEKS;
+  CHECK(queryBuckets(query) == 2);
+  CHECK(queryBucket(query, boost::gregorian::date(2010, 1, 1)) == 0);
+  CHECK(queryBucket(query, boost::gregorian::date(2010, 1, 4)) == 1);
+  CHECK(queryBucketLabel(query, 0) == "2009-W53");
+  CHECK(queryBucketLabel(query, 1) == "2010-W01");
+  planQuery(query, scans);
+  CHECK(scans.size() == 2);
+  CHECK(scans[0].total && scans[0].period == "2009-W53" && scans[0].buckets.size() == 1 && scans[0].buckets[0] == 0);
+  CHECK(scans[0].first == query.first && scans[0].last == boost::gregorian::date(2010, 1, 3));
+  CHECK(scans[1].total && scans[1].period == "2010-W01" && scans[1].buckets[0] == 1);
+  
+  /// Week of 2011-W52 cut by the range : its days, in the months of 2011 and 2012
+  query.first = boost::gregorian::date(2011, 12, 30);
+  query.last = boost::gregorian::date(2012, 1, 1);
+  CHECK(queryBuckets(query) == 1);
+  CHECK(queryBucketLabel(query, 0) == "2011-W52");
+  planQuery(query, scans);
+  CHECK(scans.size() == 2);
+  CHECK(!scans[0].total && scans[0].tier == TIER_DAYS && scans[0].period == "2011-12");
+  CHECK(scans[0].buckets.size() == 31 && scans[0].buckets[29] == 0 && scans[0].buckets[30] == 0 && scans[0].buckets[28] == -1);
+  CHECK(!scans[1].total && scans[1].period == "2012-01" && scans[1].buckets[0] == 0 && scans[1].buckets[1] == -1);
+  
+  /// Partial months read by day, full month by its total
+  query.first = boost::gregorian::date(2011, 4, 15);
+  query.last = boost::gregorian::date(2011, 6, 10);
+  query.resolution = RES_MONTHS;
+  CHECK(queryBuckets(query) == 3);
+  CHECK(queryBucketLabel(query, 0) == "2011-04");
+  CHECK(queryBucketLabel(query, 2) == "2011-06");
+  CHECK(queryBucket(query, boost::gregorian::date(2011, 4, 14)) == -1);
+  CHECK(queryBucket(query, boost::gregorian::date(2011, 6, 10)) == 2);
+  planQuery(query, scans);
+  CHECK(scans.size() == 3);
+  CHECK(scans[0].total && scans[0].period == "2011-05" && scans[0].buckets[0] == 1);
+  CHECK(!scans[1].total && scans[1].period == "2011-04" && scans[1].buckets[13] == -1 && scans[1].buckets[14] == 0
+        && scans[1].buckets[29] == 0 && scans[1].buckets[30] == -1);
+  CHECK(!scans[2].total && scans[2].period == "2011-06" && scans[2].buckets[9] == 2 && scans[2].buckets[10] == -1);
+  
+  /// Days kept : no total, only their days
+  query.first = boost::gregorian::date(2011, 4, 1);
+  query.last = boost::gregorian::date(2011, 4, 30);
+  query.daysKept.insert("2011-04-24");
+  planQuery(query, scans);
+  CHECK(scans.size() == 1);
+  CHECK(!scans[0].total && scans[0].buckets[23] == 0 && scans[0].buckets[22] == -1 && scans[0].buckets[24] == -1);
+  
+  /// Resolutions finer than a day : a scan by day kept
+  query.first = boost::gregorian::date(2011, 4, 24);
+  query.last = boost::gregorian::date(2011, 4, 25);
+  query.resolution = RES_10MINUTES;
+  query.daysKept.clear();
+  query.daysKept.insert("2011-04-25");
+  CHECK(queryBuckets(query) == 2 * DB_TIMES_SIZE);
+  CHECK(queryBucket(query, boost::gregorian::date(2011, 4, 25), 91) == DB_TIMES_SIZE + 91);
+  CHECK(queryBucketLabel(query, DB_TIMES_SIZE + 91) == "2011-04-25 15:10");
+  planQuery(query, scans);
+  CHECK(scans.size() == 1);
+  CHECK(scans[0].tier == TIER_10MINUTES && scans[0].period == "2011-04-25" && scans[0].buckets.size() == DB_TIMES_SIZE);
+  CHECK(scans[0].buckets[0] == DB_TIMES_SIZE);
+  
+  query.resolution = RES_MINUTES;
+  CHECK(queryBucketLabel(query, 15*60+3) == "2011-04-24 15:03");
+  
+  /// Range not valid
+  query.last = boost::gregorian::date(2011, 4, 23);
+  CHECK(queryBuckets(query) == 0);
+  planQuery(query, scans);
+  CHECK(scans.empty());
+}
+
+/*!
+ * \fn static void testRequestParams()
+ * \brief Parameters of a query string and of a POST body : decoding, indexed names, first value kept, body too large.
+ */
+static void testRequestParams() {
+  struct mg_connection conn;
+  struct mg_request_info ri;
+  memset(&ri, 0, sizeof(ri));
+  char get[] = "GET", post[] = "POST";
+  char query[] = "mode=all&m_3_12=a%26b&p_0_d=x+y&m_3=one&m_3=two&m_3x=z&name%3D=v&flag&m_=w";
+  ri.request_method = get;
+  ri.query_string = query;
+  
+  RequestParams params;
+  RequestParams::View value;
+  string strValue;
+  params.parse(&conn, &ri);
+  CHECK(params.get("mode", strValue) && strValue == "all");
+  CHECK(params.find("m", 3, 12, value) && value == "a&b");
+  CHECK(params.find("p", 0, "d", value) && value == "x y");
+  CHECK(params.find("m", 3, value) && value == "one");
+  CHECK(params.find("m_3x", value) && value == "z"); // Not indexed
+  CHECK(!params.find("m", 3, value) || value != "z");
+  CHECK(params.find("name=", value) && value == "v");
+  CHECK(params.find("m_", value) && value == "w");
+  CHECK(!params.find("flag", value)); // No value
+  CHECK(!params.find("m", 4, value));
+  CHECK(!params.find("p", 0, value));
+  
+  params.set("mode", "grouped");
+  CHECK(params.get("mode", strValue) && strValue == "grouped");
+  params.set("apps", "server");
+  CHECK(params.get("apps", strValue) && strValue == "server");
+  
+  /// POST body read instead of the query string
+  ri.request_method = post;
+  conn.headers["Content-Length"] = "19";
+  conn.body = "m_0=cal_web&dates=3";
+  params.parse(&conn, &ri);
+  CHECK(params.find("m", 0, value) && value == "cal_web");
+  CHECK(params.get("dates", strValue) && strValue == "3");
+  CHECK(!params.get("mode", strValue));
+  
+  /// Body larger than MAX_REQUEST_BODY : not read
+  char length[32];
+  snprintf(length, sizeof(length), "%lu", static_cast<unsigned long>(MAX_REQUEST_BODY + 1));
+  conn.headers["Content-Length"] = length;
+  conn.bodyRead = 0;
+  string body;
+  CHECK(!RequestParams::readBody(&conn, &ri, body));
+  CHECK(body.empty());
+}
+
+/*!
+ * \fn static void testRtSketch()
+ * \brief Sketches of response times : percentiles within a bucket, round trip of the stored string, merge,
+ * corrupt sketches rejected.
+ */
+static void testRtSketch() {
+  RtSketch sketch, parsed, other;
+  sketch.add(5);
+  sketch.add(70, 2);
+  sketch.add(1000000);
+  CHECK(sketch.count() == 4);
+  CHECK(sketch.mean() == (5 + 140 + 1000000) / 4);
+  CHECK(sketch.quantile(0) == 5);
+  CHECK(sketch.quantile(0.5) >= 66 && sketch.quantile(0.5) <= 74); // Within 1/16 of the value
+  CHECK(sketch.quantile(1) >= 1000000 - 1000000 / 16 && sketch.quantile(1) <= 1000000 + 1000000 / 16);
+  
+  CHECK(parsed.parse(sketch.toString()));
+  CHECK(parsed.toString() == sketch.toString());
+  CHECK(parsed.count() == 4 && parsed.mean() == sketch.mean());
+  
+  other.add(5, 3);
+  parsed.merge(other);
+  CHECK(parsed.count() == 7);
+  CHECK(parsed.quantile(0.4) == 5);
+  string value = sketch.toString();
+  RtSketch::mergeValue(value, other.toString());
+  CHECK(value == parsed.toString());
+  
+  /// Largest value in the last bucket, above it the sketch is corrupt
+  RtSketch largest;
+  largest.add(UINT32_MAX);
+  CHECK(parsed.parse(largest.toString()));
+  CHECK(parsed.quantile(1) >= UINT32_MAX - UINT32_MAX / 16);
+  CHECK(parsed.parse("1/5/463:1"));
+  CHECK(!parsed.parse("1/5/464:1"));
+  CHECK(parsed.count() == 0);
+  CHECK(!parsed.parse("1/5/70000:1"));
+  CHECK(!parsed.parse("2/10/5:1")); // Count of the buckets not the total
+  CHECK(!parsed.parse("1/5/5:1,x"));
+  CHECK(!parsed.parse(""));
+}
+
+/*!
+ * \fn static bool splitResponse(const string &response, string &headers, string &body)
+ * \brief Split a response written on the fake connection, its chunks joined.
+ *
+ * \return false if the response is not well formed.
+ */
+static bool splitResponse(const string &response, string &headers, string &body) {
+  size_t end = response.find("\r\n\r\n");
+  if (end == string::npos) return false;
+  headers = response.substr(0, end + 2);
+  body.clear();
+  if (headers.find("Transfer-Encoding: chunked\r\n") == string::npos) {
+    body = response.substr(end + 4);
+    return true;
+  }
+  size_t pos = end + 4;
+  while (pos < response.size()) {
+    char *sizeEnd;
+    unsigned long size = strtoul(response.c_str() + pos, &sizeEnd, 16);
+    pos = sizeEnd - response.c_str();
+    if (response.compare(pos, 2, "\r\n") != 0) return false;
+    pos += 2;
+    if (size == 0) return response.compare(pos, 2, "\r\n") == 0 && pos + 2 == response.size();
+    body.append(response, pos, size);
+    pos += size;
+    if (response.compare(pos, 2, "\r\n") != 0) return false;
+    pos += 2;
+  }
+  return false;
+}
+
+/*!
+ * \fn static string gunzip(const string &gzipped)
+ * \brief Uncompress a gzip response, empty if it is not valid.
+ */
+static string gunzip(const string &gzipped) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit2(&stream, 15 + 16) != Z_OK) return "";
+  string result;
+  char out[16 * 1024];
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(gzipped.data()));
+  stream.avail_in = gzipped.size();
+  int ret;
+  do {
+    stream.next_out = reinterpret_cast<Bytef*>(out);
+    stream.avail_out = sizeof(out);
+    ret = inflate(&stream, Z_NO_FLUSH);
+    result.append(out, sizeof(out) - stream.avail_out);
+  } while (ret == Z_OK);
+  inflateEnd(&stream);
+  return ret == Z_STREAM_END ? result : "";
+}
+
+/*!
+ * \fn static string writeJson(struct mg_connection &conn, const string &callback, const size_t nbItems, string *copy, string *gzipCopy)
+ * \brief Write a JSON array of numbers and strings to escape, give the JSON expected.
+ */
+static string writeJson(struct mg_connection &conn, const string &callback, const size_t nbItems, string *copy, string *gzipCopy) {
+  string expected = "[";
+  JsonWriter json(&conn, callback, copy, gzipCopy);
+  json.raw("[", 1);
+  for (size_t i = 0; i < nbItems; i++) {
+    if (i != 0) {
+      json.raw(",", 1);
+      expected += ",";
+    }
+    json.number(static_cast<int64_t>(i) - 5).raw(",", 1).quoted("a\"b\\c\n");
+    char number[24];
+    snprintf(number, sizeof(number), "%ld", static_cast<long>(i) - 5);
+    expected += string(number) + ",\"a\\\"b\\\\c\\u000a\"";
+  }
+  json.raw("]", 1);
+  json.end();
+  return expected + "]";
+}
+
+/*!
+ * \fn static void testJsonWriter()
+ * \brief JSON responses : small one with its length, large one in chunks, JSONP wrapping, gzip whole or by chunks.
+ */
+static void testJsonWriter() {
+  string headers, body, copy, gzipCopy, expected;
+  Config::get().HTTP_GZIP = true;
+  Config::get().HTTP_GZIP_MIN_SIZE = 2048;
+  
+  /// Small response : headers with its length, not compressed under HTTP_GZIP_MIN_SIZE
+  {
+    struct mg_connection conn;
+    conn.headers["Accept-Encoding"] = "gzip, deflate";
+    expected = writeJson(conn, "", 3, &copy, &gzipCopy);
+    CHECK(splitResponse(conn.written, headers, body));
+    CHECK(body == expected && copy == expected && gzipCopy.empty());
+    CHECK(headers.find("Content-Length: " + boost::lexical_cast<string>(expected.size()) + "\r\n") != string::npos);
+    CHECK(headers.find("Content-Encoding") == string::npos);
+  }
+  
+  /// JSONP : wrapped, the copy is not
+  {
+    struct mg_connection conn;
+    expected = writeJson(conn, "cb", 3, &copy, NULL);
+    CHECK(splitResponse(conn.written, headers, body));
+    CHECK(body == "cb(" + expected + ")" && copy == expected);
+  }
+  
+  /// Large response without gzip : chunks of JSON_CHUNK_SIZE
+  {
+    struct mg_connection conn;
+    expected = writeJson(conn, "", 20000, &copy, &gzipCopy);
+    CHECK(expected.size() > 3 * JSON_CHUNK_SIZE);
+    CHECK(splitResponse(conn.written, headers, body));
+    CHECK(headers.find("Transfer-Encoding: chunked") != string::npos && headers.find("Content-Length") == string::npos);
+    CHECK(body == expected && copy == expected && gzipCopy.empty());
+  }
+  
+  /// Compressed whole, and by chunks
+  {
+    struct mg_connection conn;
+    conn.headers["Accept-Encoding"] = "gzip";
+    expected = writeJson(conn, "", 200, &copy, &gzipCopy);
+    CHECK(expected.size() > 2048 && expected.size() < JSON_CHUNK_SIZE);
+    CHECK(splitResponse(conn.written, headers, body));
+    CHECK(headers.find("Content-Encoding: gzip\r\n") != string::npos && headers.find("Content-Length") != string::npos);
+    CHECK(gunzip(body) == expected && gzipCopy == body);
+  }
+  {
+    struct mg_connection conn;
+    conn.headers["Accept-Encoding"] = "gzip";
+    expected = writeJson(conn, "", 20000, &copy, &gzipCopy);
+    CHECK(splitResponse(conn.written, headers, body));
+    CHECK(headers.find("Content-Encoding: gzip\r\n") != string::npos && headers.find("Transfer-Encoding: chunked") != string::npos);
+    CHECK(gunzip(body) == expected && gzipCopy == body);
+  }
+  
+  /// Response already compressed sent as is
+  {
+    struct mg_connection conn;
+    conn.headers["Accept-Encoding"] = "gzip";
+    JsonWriter json(&conn, "");
+    CHECK(json.sendGzipped(gzipCopy));
+    json.end();
+    CHECK(splitResponse(conn.written, headers, body));
+    CHECK(body == gzipCopy);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  testQueryPlan();
+  testRequestParams();
+  testRtSketch();
+  testJsonWriter();
+  
+  char baseDir[] = "/tmp/moowapp_test_XXXXXX";
+  if (mkdtemp(baseDir) == NULL) {
+    cerr << "Error creating the test folder." << endl;
+    return 1;
+  }
+  DBAccessBerkeley &dbA = DBAccessBerkeley::get();
+  if (!dbA.dbw_open(string(baseDir) + '/', "test.db")) {
+    return 1;
+  }
+  
+  testReadCounters(dbA);
+  testWarmup(dbA);
+  testPartitionsMigration(dbA, string(baseDir) + '/');
+  testSegments(string(baseDir) + '/');
+  
+  dbA.dbw_close();
+  system((string("rm -rf ") + baseDir).c_str());
+  cout << (failures == 0 ? "All tests passed." : "Tests failed.") << endl;
+  return failures == 0 ? 0 : 1;
+}